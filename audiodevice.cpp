@@ -0,0 +1,289 @@
+#include "audiodevice.h"
+
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+
+const int ADAPTIVE_MIN_FRAMES = 256;
+const int ADAPTIVE_START_FRAMES = 512;
+const int ADAPTIVE_MAX_FRAMES = 8192;
+const Uint32 ADAPTIVE_GROW_HOLDOFF_MS = 1000;   // Let a new buffer size settle before growing again
+const Uint32 ADAPTIVE_SHRINK_AFTER_MS = 30000;  // Underrun free time before trying a smaller buffer
+
+// Conversions into the device format share it, reopening the device needs
+// it exclusively. Unlike std::shared_mutex it lets a waiting reopen go
+// first: once one is waiting, new conversions block until it is done, so a
+// steady stream of decodes can not hold it off.
+static std::mutex formatMutex;
+static std::condition_variable formatChanged;
+static int formatReaders = 0;
+static bool formatWanted = false; // A reopen holds the format or waits for it
+static void (*onFormatFree)() = nullptr;
+
+bool parseLatencyProfile(const std::string &name, LatencyProfile &profile)
+{
+    for (int i = LATENCY_SAFE; i <= LATENCY_ADAPTIVE; i++)
+    {
+        if (name == latencyProfileName((LatencyProfile)i))
+        {
+            profile = (LatencyProfile)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *latencyProfileName(LatencyProfile profile)
+{
+    switch (profile)
+    {
+    case LATENCY_SAFE:
+        return "safe";
+    case LATENCY_BALANCED:
+        return "balanced";
+    case LATENCY_LOW:
+        return "low";
+    case LATENCY_ADAPTIVE:
+        return "adaptive";
+    }
+    return "unknown";
+}
+
+static int profileBufferFrames(LatencyProfile profile)
+{
+    switch (profile)
+    {
+    case LATENCY_SAFE:
+        return 4096;
+    case LATENCY_LOW:
+        return 256;
+    case LATENCY_ADAPTIVE:
+        return ADAPTIVE_START_FRAMES;
+    default:
+        return 2048;
+    }
+}
+
+bool AudioDevice::open(LatencyProfile profile, int bufferFrames, Uint16 format, const std::string &deviceName)
+{
+    latencyProfile = profile;
+    this->deviceName = deviceName;
+    if (bufferFrames <= 0)
+    {
+        bufferFrames = profileBufferFrames(profile);
+    }
+
+    // Same flexibility Mix_OpenAudio allows, the buffer size is kept as
+    // requested. The format is never changed, so all processing stays in it.
+    if (!openMixer(44100, format, 2, bufferFrames, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_CHANNELS_CHANGE))
+    {
+        return false;
+    }
+
+    lastUnderruns = 0;
+    pendingFrames = 0;
+    lastChangeTicks = SDL_GetTicks();
+    lastUnderrunTicks = lastChangeTicks;
+    return true;
+}
+
+void AudioDevice::close()
+{
+    if (isOpen)
+    {
+        Mix_CloseAudio();
+        isOpen = false;
+    }
+}
+
+bool AudioDevice::tryLockFormat(void (*onFree)())
+{
+    std::lock_guard<std::mutex> lock(formatMutex);
+    formatWanted = true;
+    onFormatFree = formatReaders > 0 ? onFree : nullptr;
+    return formatReaders == 0;
+}
+
+void AudioDevice::cancelLockFormat()
+{
+    std::lock_guard<std::mutex> lock(formatMutex);
+    if (formatWanted)
+    {
+        formatWanted = false;
+        onFormatFree = nullptr;
+        formatChanged.notify_all();
+    }
+}
+
+void AudioDevice::unlockFormat()
+{
+    std::lock_guard<std::mutex> lock(formatMutex);
+    formatWanted = false;
+    onFormatFree = nullptr;
+    formatChanged.notify_all();
+}
+
+bool AudioDevice::reopen(int bufferFrames)
+{
+    if (!isOpen)
+    {
+        return false;
+    }
+
+    AudioDeviceSpec previous = deviceSpec;
+    Mix_CloseAudio();
+    isOpen = false;
+
+    // Insist on the previous format so decoded tracks can still be played
+    bool opened = openMixer(previous.frequency, previous.format, previous.channels, bufferFrames, 0);
+    if (!opened)
+    {
+        std::cout << "Falling back to a buffer of " << previous.bufferFrames << " frames" << std::endl;
+        if (!openMixer(previous.frequency, previous.format, previous.channels, previous.bufferFrames, 0))
+        {
+            std::cout << "Lost the audio device" << std::endl;
+        }
+    }
+
+    reopenCount++;
+    lastChangeTicks = SDL_GetTicks();
+    if (bufferFrames == pendingFrames)
+    {
+        pendingFrames = 0;
+    }
+    return opened;
+}
+
+bool AudioDevice::setFrequency(int frequency)
+{
+    if (!isOpen)
+    {
+        return false;
+    }
+    if (frequency == deviceSpec.frequency)
+    {
+        return true;
+    }
+
+    AudioDeviceSpec previous = deviceSpec;
+    Mix_CloseAudio();
+    isOpen = false;
+
+    bool opened = openMixer(frequency, previous.format, previous.channels, previous.bufferFrames, 0);
+    if (!opened)
+    {
+        std::cout << "Falling back to " << previous.frequency << " Hz" << std::endl;
+        if (!openMixer(previous.frequency, previous.format, previous.channels, previous.bufferFrames, 0))
+        {
+            std::cout << "Lost the audio device" << std::endl;
+        }
+    }
+
+    reopenCount++;
+    lastChangeTicks = SDL_GetTicks();
+    return opened;
+}
+
+// Quiet, the caller retries until it works. The format stays, the engine
+// is started over for a new rate or channel count anyway.
+bool AudioDevice::recover()
+{
+    if (isOpen)
+    {
+        return true;
+    }
+    const char *device = deviceName.empty() ? nullptr : deviceName.c_str();
+    if (Mix_OpenAudioDevice(deviceSpec.frequency, deviceSpec.format, deviceSpec.channels, deviceSpec.bufferFrames, device,
+                            SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_CHANNELS_CHANGE) < 0)
+    {
+        return false;
+    }
+    Mix_QuerySpec(&deviceSpec.frequency, &deviceSpec.format, &deviceSpec.channels);
+    isOpen = true;
+    reopenCount++;
+    lastChangeTicks = SDL_GetTicks();
+    return true;
+}
+
+int AudioDevice::adapt(Uint64 underruns)
+{
+    if (latencyProfile != LATENCY_ADAPTIVE || !isOpen)
+    {
+        lastUnderruns = underruns;
+        return 0;
+    }
+
+    Uint32 now = SDL_GetTicks();
+    int frames = deviceSpec.bufferFrames;
+
+    // A size that could not be applied yet stays pending until reopen()
+    // manages to, so underruns during long decodes are not forgotten
+    if (underruns != lastUnderruns)
+    {
+        lastUnderruns = underruns;
+        lastUnderrunTicks = now;
+        if (pendingFrames != 0 && pendingFrames < frames)
+        {
+            pendingFrames = 0; // Not the time to shrink after all
+        }
+        if (pendingFrames == 0 && now - lastChangeTicks >= ADAPTIVE_GROW_HOLDOFF_MS && frames < ADAPTIVE_MAX_FRAMES)
+        {
+            pendingFrames = frames * 2;
+        }
+    }
+    else if (pendingFrames == 0 && now - lastChangeTicks >= ADAPTIVE_SHRINK_AFTER_MS &&
+             now - lastUnderrunTicks >= ADAPTIVE_SHRINK_AFTER_MS && frames > ADAPTIVE_MIN_FRAMES)
+    {
+        pendingFrames = frames / 2;
+    }
+    return pendingFrames;
+}
+
+double AudioDevice::latencyMs(int extraFrames) const
+{
+    if (deviceSpec.frequency == 0)
+    {
+        return 0.0;
+    }
+    return (deviceSpec.bufferFrames + extraFrames) * 1000.0 / deviceSpec.frequency;
+}
+
+bool AudioDevice::openMixer(int frequency, Uint16 format, int channels, int bufferFrames, int allowedChanges)
+{
+    const char *device = deviceName.empty() ? nullptr : deviceName.c_str();
+    if (Mix_OpenAudioDevice(frequency, format, channels, bufferFrames, device, allowedChanges) < 0)
+    {
+        std::cout << "SDL2_mixer could not open the audio device: " << Mix_GetError() << std::endl;
+        return false;
+    }
+
+    deviceSpec.bufferFrames = bufferFrames;
+    Mix_QuerySpec(&deviceSpec.frequency, &deviceSpec.format, &deviceSpec.channels);
+    isOpen = true;
+    return true;
+}
+
+AudioFormatLock::AudioFormatLock()
+{
+    std::unique_lock<std::mutex> lock(formatMutex);
+    formatChanged.wait(lock, [] { return !formatWanted; });
+    formatReaders++;
+}
+
+AudioFormatLock::~AudioFormatLock()
+{
+    void (*onFree)() = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(formatMutex);
+        formatReaders--;
+        if (formatReaders == 0)
+        {
+            onFree = onFormatFree;
+            onFormatFree = nullptr;
+        }
+    }
+    if (onFree != nullptr)
+    {
+        onFree();
+    }
+}
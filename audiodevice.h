@@ -0,0 +1,112 @@
+#ifndef AUDIODEVICE_H
+#define AUDIODEVICE_H
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_mixer.h>
+#include <string>
+
+enum LatencyProfile
+{
+    LATENCY_SAFE,     // 4096 frames, for heavily loaded machines
+    LATENCY_BALANCED, // 2048 frames, what the player always used
+    LATENCY_LOW,      // 256 frames
+    LATENCY_ADAPTIVE  // Starts low, grows after underruns and shrinks when stable
+};
+
+bool parseLatencyProfile(const std::string &name, LatencyProfile &profile);
+const char *latencyProfileName(LatencyProfile profile);
+
+struct AudioDeviceSpec
+{
+    int frequency;
+    Uint16 format;
+    int channels;
+    int bufferFrames;
+};
+
+// Opens the mixer with Mix_OpenAudioDevice using the buffer size of a
+// latency profile and remembers the negotiated spec, so the device can be
+// reopened with a different buffer size without changing the sample format
+// (decoded tracks stay valid), or at another rate for native-rate playback.
+// Everything here runs on the UI thread.
+class AudioDevice
+{
+public:
+    // bufferFrames overrides the profile's buffer size if it is not 0.
+    // format is what the player renders in (AUDIO_S16SYS or AUDIO_F32SYS);
+    // SDL converts it to whatever the hardware takes, once, at the very end.
+    // deviceName may be empty for the default device.
+    bool open(LatencyProfile profile, int bufferFrames, Uint16 format, const std::string &deviceName);
+    void close();
+
+    // Reopening needs the sample format to itself, see AudioFormatLock.
+    // Returns false while tracks are being converted into it; onFree is then
+    // called from the thread of the last one when it is done, and
+    // conversions that start meanwhile wait, so trying again succeeds.
+    static bool tryLockFormat(void (*onFree)());
+    // Lets conversions waiting after a failed tryLockFormat() go on, once
+    // the reopen is no longer wanted
+    static void cancelLockFormat();
+    static void unlockFormat();
+
+    // With the format locked. Returns false if the device could not be
+    // opened with the new buffer size and fell back to the old one, or if
+    // that failed too and the device is closed, see opened().
+    bool reopen(int bufferFrames);
+
+    // With the format locked. Reopens the device at another sample rate,
+    // keeping the sample format and buffer size. Falls back to the old rate;
+    // if even that fails the device is left closed.
+    bool setFrequency(int frequency);
+
+    // False after a reopen that could not get the device back, until
+    // recover() does
+    bool opened() const { return isOpen; }
+    // With the format locked. Opens the closed device again with the spec
+    // it last had, or whatever rate and channels it offers now.
+    bool recover();
+
+    // Adaptive profile: feed it the total underrun count every pass of the
+    // main loop. Returns the buffer size the device should be reopened with,
+    // or 0; the same size again until reopen() was done with it.
+    int adapt(Uint64 underruns);
+
+    const AudioDeviceSpec &spec() const { return deviceSpec; }
+    LatencyProfile profile() const { return latencyProfile; }
+    const std::string &name() const { return deviceName; }
+    // The device buffer plus extraFrames of delay in front of it, such as
+    // AudioEngine::outputLatencyFrames()
+    double latencyMs(int extraFrames = 0) const;
+    Uint32 reopens() const { return reopenCount; }
+
+private:
+    bool openMixer(int frequency, Uint16 format, int channels, int bufferFrames, int allowedChanges);
+
+    LatencyProfile latencyProfile = LATENCY_BALANCED;
+    std::string deviceName;
+    AudioDeviceSpec deviceSpec = {};
+    bool isOpen = false;
+    Uint32 reopenCount = 0;
+
+    // Adaptive state
+    Uint64 lastUnderruns = 0;
+    Uint32 lastChangeTicks = 0;
+    Uint32 lastUnderrunTicks = 0;
+    int pendingFrames = 0; // Buffer size waiting for the device to be reopened
+};
+
+// Held while audio is converted into the device format (the last step of
+// loading a track), so the device is never reopened underneath it. Any
+// number of conversions can hold it at the same time. Blocks while a reopen
+// is waiting for the ones already running.
+class AudioFormatLock
+{
+public:
+    AudioFormatLock();
+    ~AudioFormatLock();
+
+    AudioFormatLock(const AudioFormatLock &) = delete;
+    AudioFormatLock &operator=(const AudioFormatLock &) = delete;
+};
+
+#endif
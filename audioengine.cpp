@@ -0,0 +1,980 @@
+#include "audioengine.h"
+#include "realtime.h"
+#include "trackstream.h"
+
+#include <iostream>
+#include <vector>
+
+// The stream holds silence, so the track is simply copied in. Float has
+// headroom: the gain is neither clamped nor rounded to SDL's volume steps.
+static void copyScaledF32(float *__restrict dst, const float *__restrict src, float gain, int samples)
+{
+    for (int i = 0; i < samples; i++)
+    {
+        dst[i] = src[i] * gain;
+    }
+}
+
+// 16 bits have none, a ReplayGain boost saturates like the crossfade does
+static void copyScaledS16(Sint16 *__restrict dst, const Sint16 *__restrict src, float gain, int samples)
+{
+    for (int i = 0; i < samples; i++)
+    {
+        float value = (float)src[i] * gain;
+        value = value > 32767.0f ? 32767.0f : value;
+        value = value < -32768.0f ? -32768.0f : value;
+        dst[i] = (Sint16)value;
+    }
+}
+
+bool AudioEngine::start(void (*onEvent)(), int ringMilliseconds)
+{
+    int channels;
+    if (Mix_QuerySpec(&deviceFrequency, &deviceFormat, &channels) == 0)
+    {
+        std::cout << "Failed to start audio engine: " << Mix_GetError() << std::endl;
+        return false;
+    }
+
+    deviceChannels = channels;
+    frameSize = SDL_AUDIO_BITSIZE(deviceFormat) / 8 * channels;
+    this->onEvent = onEvent;
+
+    if (onEvent != nullptr)
+    {
+        // onEvent may lock and allocate (SDL_PushEvent does), so the
+        // rendering threads only post a semaphore and this thread calls it
+        stopNotifier = false;
+        uiWakeup = SDL_CreateSemaphore(0);
+        notifierThread = uiWakeup != nullptr ? SDL_CreateThread(notifierMain, "AudioNotify", this) : nullptr;
+        if (notifierThread == nullptr)
+        {
+            std::cout << "Failed to create notifier thread: " << SDL_GetError() << std::endl;
+            stop();
+            return false;
+        }
+    }
+
+    if (ringMilliseconds > 0)
+    {
+        Uint32 ringBytes = (Uint32)((Sint64)ringMilliseconds * deviceFrequency / 1000) * frameSize;
+        // Render in blocks of a quarter ring, at most 1024 frames
+        renderBlockBytes = SDL_min((int)(ringBytes / 4 / frameSize), 1024) * frameSize;
+        renderBlockBytes = SDL_max(renderBlockBytes, frameSize);
+        renderBlock = static_cast<Uint8 *>(SDL_malloc(renderBlockBytes));
+        ringSpace = SDL_CreateSemaphore(0);
+        if (renderBlock == nullptr || ringSpace == nullptr || !ring.init(ringBytes))
+        {
+            std::cout << "Failed to set up the decoder thread: " << SDL_GetError() << std::endl;
+            stop();
+            return false;
+        }
+
+        stopDecoder = false;
+        decoderThread = SDL_CreateThread(decoderMain, "AudioDecoder", this);
+        if (decoderThread == nullptr)
+        {
+            std::cout << "Failed to create decoder thread: " << SDL_GetError() << std::endl;
+            stop();
+            return false;
+        }
+    }
+
+    streamFrame = 0;
+    renderFrame = 0;
+    clock.reset(deviceFrequency);
+    gain.init(deviceFrequency, deviceFormat, deviceChannels);
+    equalizer.init(deviceFrequency, deviceFormat, deviceChannels);
+    dynamics.init(deviceFrequency, deviceFormat, deviceChannels, limiterLookaheadMs);
+    clock.setExtraLatency(dynamics.latencyFrames());
+    canStretch = deviceFormat == AUDIO_F32SYS && stretch.init(deviceFrequency, deviceChannels);
+
+    running = true;
+    if (!offline)
+    {
+        Mix_HookMusic(mixCallback, this);
+        Mix_SetPostMix(postMixCallback, this);
+    }
+    return true;
+}
+
+bool AudioEngine::startOffline()
+{
+    offline = true;
+    return start(nullptr, 0);
+}
+
+void AudioEngine::renderOffline(Uint8 *stream, int len)
+{
+    // What the mixer does around the music hook and the post-mix hook. There
+    // is no device deadline, so nothing counts as late.
+    lastCallbackCounter = 0;
+    SDL_memset(stream, 0, len);
+    mix(stream, len);
+    postMix(stream, len);
+}
+
+void AudioEngine::stop()
+{
+    if (running && !offline)
+    {
+        // Mix_HookMusic takes the audio lock, so the callback is not running afterwards
+        Mix_HookMusic(nullptr, nullptr);
+        Mix_SetPostMix(nullptr, nullptr);
+    }
+    running = false;
+    offline = false;
+
+    if (decoderThread != nullptr)
+    {
+        stopDecoder = true;
+        SDL_SemPost(ringSpace);
+        SDL_WaitThread(decoderThread, nullptr);
+        decoderThread = nullptr;
+    }
+    if (ringSpace != nullptr)
+    {
+        SDL_DestroySemaphore(ringSpace);
+        ringSpace = nullptr;
+    }
+    SDL_free(renderBlock);
+    renderBlock = nullptr;
+    ring.destroy();
+
+    if (notifierThread != nullptr)
+    {
+        stopNotifier = true;
+        SDL_SemPost(uiWakeup);
+        SDL_WaitThread(notifierThread, nullptr);
+        notifierThread = nullptr;
+    }
+    if (uiWakeup != nullptr)
+    {
+        SDL_DestroySemaphore(uiWakeup);
+        uiWakeup = nullptr;
+    }
+
+    Command command;
+    while (commands.pop(command))
+    {
+        if (command.type == COMMAND_PLAY || command.type == COMMAND_SET_NEXT)
+        {
+            freeTrack(command.track);
+        }
+    }
+
+    EngineEvent event;
+    while (pollEvent(event))
+    {
+        if (event.type == ENGINE_TRACK_RELEASED)
+        {
+            freeTrack(event.track);
+        }
+    }
+
+    freeTrack(current);
+    freeTrack(incoming);
+    freeTrack(next);
+    current = nullptr;
+    incoming = nullptr;
+    next = nullptr;
+}
+
+void AudioEngine::detach()
+{
+    if (running && !offline)
+    {
+        Mix_HookMusic(nullptr, nullptr);
+        Mix_SetPostMix(nullptr, nullptr);
+    }
+}
+
+void AudioEngine::attach()
+{
+    if (running && !offline)
+    {
+        lastCallbackCounter = 0; // The gap while reopening is not an underrun
+        clock.restartRate();
+        Mix_HookMusic(mixCallback, this);
+        Mix_SetPostMix(postMixCallback, this);
+    }
+}
+
+void AudioEngine::play(Track *track, float gain)
+{
+    if (!commands.push({COMMAND_PLAY, track, gain, 0}))
+    {
+        std::cout << "Failed to play music: engine command queue is full" << std::endl;
+        freeTrack(track);
+    }
+}
+
+void AudioEngine::setNext(Track *track, float gain)
+{
+    if (!commands.push({COMMAND_SET_NEXT, track, gain, 0}))
+    {
+        std::cout << "Failed to queue music: engine command queue is full" << std::endl;
+        freeTrack(track);
+    }
+}
+
+void AudioEngine::setGain(Track *track, float gain)
+{
+    if (!commands.push({COMMAND_SET_GAIN, track, gain, 0}))
+    {
+        std::cout << "Failed to change track gain: engine command queue is full" << std::endl;
+    }
+}
+
+void AudioEngine::seek(Track *track, Uint64 frame)
+{
+    if (!commands.push({COMMAND_SEEK, track, 1.0f, frame}))
+    {
+        std::cout << "Failed to seek: engine command queue is full" << std::endl;
+    }
+}
+
+void AudioEngine::setPaused(bool paused)
+{
+    this->paused.store(paused);
+    gain.setMuted(paused);
+}
+
+void AudioEngine::setVolumeDb(double db)
+{
+    gain.setGainDb(db);
+}
+
+bool AudioEngine::setEqualizer(const EqualizerSettings &settings)
+{
+    return equalizer.setSettings(settings);
+}
+
+void AudioEngine::setCrossfade(int milliseconds, CrossfadeCurve curve)
+{
+    crossfadeMs.store(SDL_clamp(milliseconds, 0, CROSSFADE_MAX_SECONDS * 1000));
+    crossfadeCurve.store(curve);
+}
+
+bool AudioEngine::setTimeStretch(float speed, float semitones, StretchMode mode)
+{
+    if (!canStretch)
+    {
+        return false;
+    }
+    stretchSpeed.store(speed);
+    stretchSemitones.store(semitones);
+    stretchMode.store(mode);
+    return true;
+}
+
+// Releases are taken before the queue is drained. Every event about a
+// released track was queued before its release, so the UI sees them all
+// before the track is freed.
+bool AudioEngine::pollEvent(EngineEvent &event)
+{
+    if (!polling)
+    {
+        polling = true;
+        releasing = released.exchange(nullptr, std::memory_order_acquire);
+    }
+    if (events.pop(event))
+    {
+        return true;
+    }
+    if (releasing != nullptr)
+    {
+        event = {ENGINE_TRACK_RELEASED, releasing, 0, 0, 0, 1.0f};
+        releasing = releasing->releasedNext;
+        return true;
+    }
+    polling = false;
+    return false;
+}
+
+void SDLCALL AudioEngine::mixCallback(void *udata, Uint8 *stream, int len)
+{
+    prepareAudioThread();
+    RealtimeScope scope;
+    static_cast<AudioEngine *>(udata)->mix(stream, len);
+}
+
+void SDLCALL AudioEngine::postMixCallback(void *udata, Uint8 *stream, int len)
+{
+    RealtimeScope scope;
+    static_cast<AudioEngine *>(udata)->postMix(stream, len);
+}
+
+void AudioEngine::mix(Uint8 *stream, int len)
+{
+    // A callback arriving more than two buffer periods after the previous one
+    // means the device ran dry in between
+    Uint64 now = SDL_GetPerformanceCounter();
+    int frames = len / frameSize;
+    Uint64 period = (Uint64)frames * SDL_GetPerformanceFrequency() / deviceFrequency;
+    bool late = false;
+    if (lastCallbackCounter != 0)
+    {
+        Uint64 interval = now - lastCallbackCounter;
+        late = interval > 2 * period;
+        Uint64 deviation = interval > period ? interval - period : period - interval;
+        telemetry.jitter.record(deviation * 1e6 / SDL_GetPerformanceFrequency());
+    }
+    lastCallbackCounter = now;
+    callbackPeriod = period;
+    lastCallbackFrames.store(frames, std::memory_order_relaxed);
+    if (late)
+    {
+        lateCallbacks++;
+    }
+
+    // SDL_mixer has already filled the stream with silence
+    if (decoderThread != nullptr)
+    {
+        // Only copy out of the ring here, the decoder thread does the rest
+        bool underrun = false;
+        Uint32 read = 0;
+        if (!holding())
+        {
+            telemetry.ringFill.record(100.0 * ring.fill() / ring.capacity());
+            read = ring.read(stream, len);
+            underrun = read < (Uint32)len;
+            SDL_SemPost(ringSpace);
+        }
+        deliveredFrames = read / frameSize;
+        deliveredFrame = ring.readOffset() / frameSize - deliveredFrames;
+        if (late || underrun)
+        {
+            wake();
+        }
+        return;
+    }
+
+    if (late)
+    {
+        wakeUi = true;
+    }
+    applyCommands();
+    deliveredFrame = streamFrame;
+    deliveredFrames = 0;
+    if (!holding())
+    {
+        render(stream, len);
+        deliveredFrames = frames;
+    }
+    notifyUi();
+}
+
+void AudioEngine::postMix(Uint8 *stream, int len)
+{
+    // Runs after everything was mixed, right before SDL hands the buffer to the device
+    Uint64 start = SDL_GetPerformanceCounter();
+    gain.process(stream, len);
+    equalizer.process(stream, len);
+    dynamics.process(stream, len);
+    clock.advance(deliveredFrame, deliveredFrames, len / frameSize);
+
+    // The whole callback ran from the music hook up to here
+    Uint64 end = SDL_GetPerformanceCounter();
+    if (callbackPeriod > 0)
+    {
+        telemetry.postMixLoad.record(100.0 * (end - start) / callbackPeriod);
+        telemetry.load.record(100.0 * (end - lastCallbackCounter) / callbackPeriod);
+    }
+}
+
+void AudioEngine::wake()
+{
+    if (uiWakeup != nullptr)
+    {
+        SDL_SemPost(uiWakeup);
+    }
+}
+
+int SDLCALL AudioEngine::notifierMain(void *data)
+{
+    static_cast<AudioEngine *>(data)->runNotifier();
+    return 0;
+}
+
+void AudioEngine::runNotifier()
+{
+    while (SDL_SemWait(uiWakeup) == 0 && !stopNotifier.load())
+    {
+        // One call covers every wake-up that piled up meanwhile
+        while (SDL_SemTryWait(uiWakeup) == 0)
+        {
+        }
+        onEvent();
+    }
+}
+
+int SDLCALL AudioEngine::decoderMain(void *data)
+{
+    static_cast<AudioEngine *>(data)->runDecoder();
+    return 0;
+}
+
+void AudioEngine::runDecoder()
+{
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH);
+
+    while (!stopDecoder.load())
+    {
+        if (ring.space() < (Uint32)renderBlockBytes)
+        {
+            // Nothing drains the ring while paused, but a seek must still
+            // show up right away and not play what was buffered before it
+            applyCommands();
+            notifyUi();
+            if (flushPending)
+            {
+                flushPending = false;
+                ring.flush();
+            }
+            else
+            {
+                SDL_SemWaitTimeout(ringSpace, 10);
+            }
+            continue;
+        }
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        SDL_memset(renderBlock, deviceFormat == AUDIO_U8 ? 0x80 : 0, renderBlockBytes);
+        applyCommands();
+        render(renderBlock, renderBlockBytes);
+        telemetry.decoderTime.record((SDL_GetPerformanceCounter() - start) * 1e6 / SDL_GetPerformanceFrequency());
+
+        if (flushPending)
+        {
+            // A newly started track must not wait behind what is already buffered
+            flushPending = false;
+            ring.flush();
+        }
+        ring.write(renderBlock, renderBlockBytes);
+        notifyUi();
+    }
+}
+
+void AudioEngine::applyCommands()
+{
+    Command command;
+    while (commands.pop(command))
+    {
+        applyCommand(command);
+    }
+}
+
+void AudioEngine::render(Uint8 *stream, int len)
+{
+    Uint64 blockStart = streamFrame;
+    renderFrame = blockStart;
+    updateStretch();
+    int offset = 0;
+    while (offset < len && current != nullptr)
+    {
+        renderFrame = blockStart + offset / frameSize;
+        if (incoming != nullptr)
+        {
+            offset += mixCrossfade(stream + offset, len - offset);
+            continue;
+        }
+
+        if (stretch.active())
+        {
+            int frames = (len - offset) / frameSize;
+            Uint64 resumed = (Uint64)stretch.mediaFrame();
+            int written = stretch.render(readTrack, current, current->frames, (float *)(stream + offset), frames, currentGain);
+            if (stalled && written > 0)
+            {
+                // Like the copy below, tell the UI where the track resumes
+                stalled = false;
+                pushEvent({ENGINE_TRACK_SEEKED, current, 0, resumed, 0, stretch.currentSpeed()});
+            }
+            offset += written * frameSize;
+            if (stretch.starving())
+            {
+                // The stream has not decoded what the next hop needs; the
+                // rest of the buffer stays silent and the track waits
+                stalled = true;
+                position = SDL_min((Uint64)stretch.mediaFrame(), current->frames);
+                break;
+            }
+            position = written < frames ? current->frames : SDL_min((Uint64)stretch.mediaFrame(), current->frames);
+        }
+        else
+        {
+            // Stop copying where the fade into the next track has to begin
+            Uint64 remaining = current->frames - position;
+            Uint32 planned = plannedFadeFrames();
+            if (planned > 0 && remaining <= planned)
+            {
+                if (remaining > 0)
+                {
+                    beginCrossfade((Uint32)remaining);
+                    continue;
+                }
+                planned = 0; // Not even a frame left to fade, just play it out
+            }
+
+            Uint32 count = (Uint32)SDL_min(remaining - planned, (Uint64)((len - offset) / frameSize));
+            if (count > 0)
+            {
+                const Uint8 *pcm = current->pcm(position, count);
+                if (count == 0)
+                {
+                    // A streamed track not decoded this far yet, e.g. right
+                    // after a seek. The rest of the buffer stays silent.
+                    stalled = true;
+                    break;
+                }
+                if (stalled)
+                {
+                    // The output went on without the track; tell the UI
+                    // where the track resumes so its clock does not run ahead
+                    stalled = false;
+                    pushEvent({ENGINE_TRACK_SEEKED, current, 0, position, 0, 1.0f});
+                }
+                if (deviceFormat == AUDIO_F32SYS)
+                {
+                    copyScaledF32((float *)(stream + offset), (const float *)pcm, currentGain, count * deviceChannels);
+                }
+                else if (deviceFormat == AUDIO_S16SYS)
+                {
+                    copyScaledS16((Sint16 *)(stream + offset), (const Sint16 *)pcm, currentGain, count * deviceChannels);
+                }
+                else
+                {
+                    SDL_MixAudioFormat(stream + offset, pcm, deviceFormat, count * frameSize, trackVolume(currentGain));
+                }
+                position += count;
+                offset += count * frameSize;
+            }
+        }
+        renderFrame = blockStart + offset / frameSize;
+
+        if (position >= current->frames)
+        {
+            // Splice the next track in right where this one ended
+            release(current);
+            current = nullptr;
+            if (next != nullptr)
+            {
+                Track *track = next;
+                next = nullptr;
+                transitionCount++;
+                startTrack(track, nextGain, 0);
+            }
+            else
+            {
+                waitingForNext = true;
+                gapFrames = 0;
+                pushEvent({ENGINE_DRAINED, nullptr, 0, 0, 0, 1.0f});
+            }
+        }
+    }
+
+    if (current == nullptr && waitingForNext)
+    {
+        gapFrames += (len - offset) / frameSize;
+    }
+
+    streamFrame = blockStart + len / frameSize;
+    renderFrame = streamFrame;
+}
+
+// Picks up speed and pitch changes. The current track carries on from
+// where it is, and the UI learns the new speed like it learns of a seek.
+void AudioEngine::updateStretch()
+{
+    if (!canStretch || incoming != nullptr)
+    {
+        return; // Changes during a crossfade wait until it is over
+    }
+    float speed = stretchSpeed.load(std::memory_order_relaxed);
+    float semitones = stretchSemitones.load(std::memory_order_relaxed);
+    StretchMode mode = (StretchMode)stretchMode.load(std::memory_order_relaxed);
+    if (speed == stretch.currentSpeed() && semitones == stretch.currentSemitones() && mode == stretch.currentMode())
+    {
+        return;
+    }
+
+    bool wasActive = stretch.active();
+    bool modeChanged = mode != stretch.currentMode();
+    Uint64 trackFrame = wasActive ? (Uint64)stretch.mediaFrame() : position;
+    stretch.setParameters(speed, semitones, mode);
+    if (current == nullptr)
+    {
+        return; // The next track starts with the new settings
+    }
+
+    trackFrame = SDL_min(trackFrame, current->frames);
+    if (stretch.active() && (!wasActive || modeChanged))
+    {
+        stretch.reset(trackFrame);
+    }
+    else if (!stretch.active())
+    {
+        position = trackFrame;
+    }
+    pushEvent({ENGINE_TRACK_SEEKED, current, 0, trackFrame, 0, stretch.active() ? stretch.currentSpeed() : 1.0f});
+}
+
+void AudioEngine::notifyUi()
+{
+    if (wakeUi)
+    {
+        wakeUi = false;
+        wake();
+    }
+}
+
+void AudioEngine::applyCommand(const Command &command)
+{
+    // Rendering offline runs as fast as the stream decodes, not ahead of it
+    if (offline && command.track != nullptr && command.track->stream != nullptr)
+    {
+        command.track->stream->setBlocking(true);
+    }
+
+    switch (command.type)
+    {
+    case COMMAND_PLAY:
+        if (current != nullptr)
+        {
+            release(current);
+        }
+        if (incoming != nullptr)
+        {
+            release(incoming);
+            incoming = nullptr;
+        }
+        waitingForNext = false;
+        flushPending = true;
+        startTrack(command.track, command.gain, ENGINE_EXPLICIT_START);
+        break;
+
+    case COMMAND_SET_NEXT:
+        if (next != nullptr)
+        {
+            release(next);
+            next = nullptr;
+        }
+
+        if (current != nullptr)
+        {
+            next = command.track;
+            nextGain = command.gain;
+        }
+        else if (waitingForNext)
+        {
+            // The previous track already ended, so the silence so far is the gap
+            waitingForNext = false;
+            transitionCount++;
+            startTrack(command.track, command.gain, gapFrames);
+        }
+        else
+        {
+            startTrack(command.track, command.gain, ENGINE_EXPLICIT_START);
+        }
+        break;
+
+    case COMMAND_SET_GAIN:
+        // Changing the gain of an audible track would be a jump in level
+        if (command.track != nullptr && command.track == next)
+        {
+            nextGain = command.gain;
+        }
+        break;
+
+    case COMMAND_SEEK:
+        // Ignore seeks into a track that ended or is fading out by now
+        if (command.track == nullptr || command.track != (incoming != nullptr ? incoming : current))
+        {
+            break;
+        }
+        if (incoming != nullptr)
+        {
+            // Seeking in the track that is fading in cuts the fade short
+            release(current);
+            current = incoming;
+            currentGain = incomingGain;
+            incoming = nullptr;
+        }
+
+        // A decoded track is an offset away from any frame, a streamed one
+        // starts decoding there and stays silent until it has
+        position = SDL_min(command.frame, current->frames);
+        flushPending = true;
+        if (stretch.active())
+        {
+            stretch.reset((double)position);
+        }
+        pushEvent({ENGINE_TRACK_SEEKED, current, 0, position, 0, currentSpeed()});
+        break;
+    }
+}
+
+void AudioEngine::startTrack(Track *track, float gain, Sint64 gapFrames)
+{
+    current = track;
+    currentGain = gain;
+    position = 0;
+    stalled = false;
+    if (stretch.active())
+    {
+        stretch.reset(0.0);
+    }
+    if (gapFrames > maxGap)
+    {
+        maxGap = gapFrames;
+    }
+    pushEvent({ENGINE_TRACK_STARTED, track, gapFrames, 0, 0, currentSpeed()});
+}
+
+Uint32 AudioEngine::plannedFadeFrames() const
+{
+    int milliseconds = crossfadeMs.load(std::memory_order_relaxed);
+    if (milliseconds <= 0 || next == nullptr || stretch.active() || (deviceFormat != AUDIO_S16SYS && deviceFormat != AUDIO_F32SYS) ||
+        deviceChannels > CROSSFADE_MAX_CHANNELS)
+    {
+        return 0;
+    }
+
+    // A fade can not be longer than the track fading in
+    Uint32 frames = (Uint32)((Sint64)milliseconds * deviceFrequency / 1000);
+    return (Uint32)SDL_min((Uint64)frames, next->frames);
+}
+
+void AudioEngine::beginCrossfade(Uint32 frames)
+{
+    incoming = next;
+    incomingGain = nextGain;
+    next = nullptr;
+    incomingPosition = 0;
+    fadeFrames = frames;
+    fadePosition = 0;
+    fadeCurve = (CrossfadeCurve)crossfadeCurve.load(std::memory_order_relaxed);
+
+    transitionCount++;
+    if ((Sint64)frames > maxOverlap)
+    {
+        maxOverlap = frames;
+    }
+    pushEvent({ENGINE_TRACK_STARTED, incoming, -(Sint64)frames, 0, 0, 1.0f});
+}
+
+int AudioEngine::mixCrossfade(Uint8 *stream, int len)
+{
+    // Gains for one block live on the stack, nothing is allocated here
+    float gainOut[CROSSFADE_BLOCK_FRAMES * CROSSFADE_MAX_CHANNELS];
+    float gainIn[CROSSFADE_BLOCK_FRAMES * CROSSFADE_MAX_CHANNELS];
+
+    int written = 0;
+    while (fadePosition < fadeFrames)
+    {
+        int frames = SDL_min((len - written) / frameSize, CROSSFADE_BLOCK_FRAMES);
+        frames = (int)SDL_min((Uint32)frames, fadeFrames - fadePosition);
+        Uint32 outgoingFrames = (Uint32)frames;
+        Uint32 incomingFrames = (Uint32)frames;
+        const Uint8 *outgoing = frames > 0 ? current->pcm(position, outgoingFrames) : nullptr;
+        const Uint8 *fadingIn = frames > 0 ? incoming->pcm(incomingPosition, incomingFrames) : nullptr;
+        frames = (int)SDL_min(outgoingFrames, incomingFrames);
+        if (frames == 0)
+        {
+            break;
+        }
+
+        crossfadeGains(fadeCurve, fadePosition, frames, fadeFrames, deviceChannels, currentGain, incomingGain, gainOut, gainIn);
+        if (deviceFormat == AUDIO_F32SYS)
+        {
+            crossfadeMixF32((float *)(stream + written), (const float *)outgoing, (const float *)fadingIn, gainOut, gainIn,
+                            frames * deviceChannels);
+        }
+        else
+        {
+            crossfadeMixS16((Sint16 *)(stream + written), (const Sint16 *)outgoing, (const Sint16 *)fadingIn, gainOut, gainIn,
+                            frames * deviceChannels);
+        }
+
+        position += frames;
+        incomingPosition += frames;
+        fadePosition += frames;
+        written += frames * frameSize;
+    }
+
+    if (fadePosition >= fadeFrames)
+    {
+        // The outgoing track ends exactly where the fade does
+        release(current);
+        current = incoming;
+        currentGain = incomingGain;
+        position = incomingPosition;
+        incoming = nullptr;
+    }
+    else if (written == 0)
+    {
+        written = len; // Less than a frame left in this buffer or a streamed track ran dry, leave it silent
+    }
+    return written;
+}
+
+// Other formats go through SDL_MixAudioFormat, which only attenuates, so
+// the gain is clamped to unity there
+int AudioEngine::trackVolume(float gain) const
+{
+    return SDL_clamp((int)(MIX_MAX_VOLUME * gain + 0.5f), 0, MIX_MAX_VOLUME);
+}
+
+float AudioEngine::currentSpeed() const
+{
+    return stretch.active() ? stretch.currentSpeed() : 1.0f;
+}
+
+// Paused and the ramp down has reached silence, stop consuming audio
+bool AudioEngine::holding() const
+{
+    return paused.load(std::memory_order_relaxed) && gain.isSilent();
+}
+
+void AudioEngine::release(Track *track)
+{
+    // Freeing happens on the UI thread, never in the callback
+    track->releasedNext = released.load(std::memory_order_relaxed);
+    while (!released.compare_exchange_weak(track->releasedNext, track, std::memory_order_release, std::memory_order_relaxed))
+    {
+    }
+    wakeUi = true;
+}
+
+// Track reader of the time stretcher, which only runs on float output
+const float *AudioEngine::readTrack(void *context, Uint64 frame, Uint32 &count)
+{
+    return (const float *)static_cast<Track *>(context)->pcm(frame, count);
+}
+
+void AudioEngine::pushEvent(const EngineEvent &event)
+{
+    EngineEvent stamped = event;
+    stamped.streamFrame = renderFrame;
+    if (!events.push(stamped))
+    {
+        droppedEventCount.fetch_add(1, std::memory_order_relaxed);
+        return; // The UI is not draining events
+    }
+    wakeUi = true;
+}
+
+void benchmarkSampleFormats()
+{
+    const int frequency = 48000;
+    const int channels = 2;
+    const int bufferFrames = 1024;
+    const int seconds = 20;
+    const float trackGain = 0.8f;
+
+    std::vector<float> noise((size_t)frequency * seconds * channels);
+    Uint32 seed = 12345;
+    for (float &sample : noise)
+    {
+        seed = seed * 1664525 + 1013904223;
+        sample = (float)(Sint16)(seed >> 16) / 131072.0f; // -12 dB
+    }
+
+    for (int format = 0; format < 2; format++)
+    {
+        Uint16 sampleFormat = format == 0 ? AUDIO_S16SYS : AUDIO_F32SYS;
+        int sampleBytes = SDL_AUDIO_BITSIZE(sampleFormat) / 8;
+        std::vector<Uint8> track(noise.size() * sampleBytes);
+        for (size_t i = 0; i < noise.size(); i++)
+        {
+            if (sampleFormat == AUDIO_S16SYS)
+            {
+                ((Sint16 *)track.data())[i] = (Sint16)(noise[i] * 32768.0f);
+            }
+            else
+            {
+                ((float *)track.data())[i] = noise[i];
+            }
+        }
+
+        int bufferBytes = bufferFrames * channels * sampleBytes;
+        std::vector<Uint8> buffer(bufferBytes);
+        GainStage gain;
+        gain.init(frequency, sampleFormat, channels);
+        gain.setGainDb(-6.0);
+        Equalizer equalizer;
+        equalizer.init(frequency, sampleFormat, channels);
+        equalizer.setSettings(equalizerPreset(EQ_PRESET_LOUDNESS));
+        Dynamics dynamics;
+        dynamics.init(frequency, sampleFormat, channels, LIMITER_DEFAULT_LOOKAHEAD_MS);
+        dynamics.setCeilingDb(LIMITER_DEFAULT_CEILING_DB);
+        // Let the parameters settle before timing
+        for (int i = 0; i < 100; i++)
+        {
+            gain.process(buffer.data(), bufferBytes);
+            equalizer.process(buffer.data(), bufferBytes);
+            dynamics.process(buffer.data(), bufferBytes);
+        }
+
+        double nsPerFrame[2];
+        for (int crossfading = 0; crossfading < 2; crossfading++)
+        {
+            float gainOut[CROSSFADE_BLOCK_FRAMES * CROSSFADE_MAX_CHANNELS];
+            float gainIn[CROSSFADE_BLOCK_FRAMES * CROSSFADE_MAX_CHANNELS];
+            Uint32 length = (Uint32)(track.size() / (channels * sampleBytes));
+            Uint32 fadePosition = 0;
+
+            Uint64 begin = SDL_GetPerformanceCounter();
+            for (size_t offset = 0; offset + bufferBytes <= track.size(); offset += bufferBytes)
+            {
+                const Uint8 *source = track.data() + offset;
+                // The crossfade mixes the track with itself played backwards
+                const Uint8 *other = track.data() + track.size() - offset - bufferBytes;
+                SDL_memset(buffer.data(), 0, bufferBytes);
+                if (!crossfading)
+                {
+                    if (sampleFormat == AUDIO_F32SYS)
+                    {
+                        copyScaledF32((float *)buffer.data(), (const float *)source, trackGain, bufferBytes / sizeof(float));
+                    }
+                    else
+                    {
+                        copyScaledS16((Sint16 *)buffer.data(), (const Sint16 *)source, trackGain, bufferBytes / sizeof(Sint16));
+                    }
+                }
+                else
+                {
+                    for (int frame = 0; frame < bufferFrames; frame += CROSSFADE_BLOCK_FRAMES)
+                    {
+                        int count = SDL_min(bufferFrames - frame, CROSSFADE_BLOCK_FRAMES);
+                        int sample = frame * channels;
+                        crossfadeGains(CROSSFADE_EQUAL_POWER, fadePosition, count, length, channels, trackGain, trackGain, gainOut, gainIn);
+                        if (sampleFormat == AUDIO_F32SYS)
+                        {
+                            crossfadeMixF32((float *)buffer.data() + sample, (const float *)source + sample,
+                                            (const float *)other + sample, gainOut, gainIn, count * channels);
+                        }
+                        else
+                        {
+                            crossfadeMixS16((Sint16 *)buffer.data() + sample, (const Sint16 *)source + sample,
+                                            (const Sint16 *)other + sample, gainOut, gainIn, count * channels);
+                        }
+                        fadePosition += count;
+                    }
+                }
+                gain.process(buffer.data(), bufferBytes);
+                equalizer.process(buffer.data(), bufferBytes);
+                dynamics.process(buffer.data(), bufferBytes);
+            }
+            double elapsed = (double)(SDL_GetPerformanceCounter() - begin) / SDL_GetPerformanceFrequency();
+            nsPerFrame[crossfading] = elapsed * 1e9 / ((double)frequency * seconds);
+        }
+
+        std::cout << "Output chain (" << (sampleFormat == AUDIO_S16SYS ? "S16" : "F32") << ", " << channels << " channels, "
+                  << equalizer.activeBands() << " EQ bands): " << nsPerFrame[0] << " ns per frame playing, " << nsPerFrame[1]
+                  << " ns per frame crossfading, " << nsPerFrame[1] * frequency / 1e9 * 100.0 << "% of one core at " << frequency
+                  << " Hz, " << (double)frequency * 60 * channels * sampleBytes / (1024 * 1024) << " MiB per decoded minute"
+                  << std::endl;
+    }
+}
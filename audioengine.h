@@ -0,0 +1,262 @@
+#ifndef AUDIOENGINE_H
+#define AUDIOENGINE_H
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_mixer.h>
+#include <atomic>
+#include "crossfade.h"
+#include "dynamics.h"
+#include "equalizer.h"
+#include "gainstage.h"
+#include "pcmring.h"
+#include "playbackclock.h"
+#include "spscqueue.h"
+#include "telemetry.h"
+#include "timestretch.h"
+#include "track.h"
+
+enum EngineEventType
+{
+    ENGINE_TRACK_STARTED,  // track is now audible
+    ENGINE_TRACK_RELEASED, // track is no longer used by the engine and must be freed, streamFrame is not set
+    ENGINE_TRACK_SEEKED,   // track continues from trackFrame
+    ENGINE_DRAINED         // the current track ended and nothing was queued behind it
+};
+
+struct EngineEvent
+{
+    EngineEventType type;
+    Track *track;
+    // For ENGINE_TRACK_STARTED: silent frames between the end of the previous
+    // track and this one, negative for the overlap of a crossfade, or
+    // ENGINE_EXPLICIT_START if the track did not follow another one
+    Sint64 gapFrames;
+    // For ENGINE_TRACK_SEEKED: frame of the track that plays at streamFrame
+    Uint64 trackFrame;
+    // Output stream frame at which the event takes effect, comparable with
+    // AudioEngine::playbackFrame()
+    Uint64 streamFrame;
+    // For ENGINE_TRACK_STARTED and ENGINE_TRACK_SEEKED: track frames played
+    // per output frame from streamFrame on
+    float speed;
+};
+
+const Sint64 ENGINE_EXPLICIT_START = SDL_MIN_SINT64;
+
+// Plays decoded tracks from an SDL_mixer music hook. The UI thread hands
+// tracks over through a lock-free command queue and the audio callback
+// reports back through an event queue, so the callback never blocks,
+// allocates or frees. When the current track ends, the next one is spliced
+// in within the same callback buffer, which makes transitions gapless as
+// long as the next track was set before the current one ran out. With
+// crossfading enabled, the next track instead starts early and both are
+// mixed sample by sample until the current one ends.
+//
+// By default the tracks are rendered directly inside the callback. With a
+// ring depth set, a dedicated decoder thread renders ahead into a lock-free
+// PCM ring and the callback only copies out of it, so the real-time path is
+// isolated from everything the rendering does.
+//
+// Neither the callback nor the decoder thread call onEvent themselves: they
+// post a semaphore and a small notifier thread makes the call, since waking
+// the UI means locking SDL's event queue.
+class AudioEngine
+{
+public:
+    // Must be called after the audio device was opened. ringMilliseconds > 0
+    // selects the decoder thread mode with a ring of that depth.
+    bool start(void (*onEvent)(), int ringMilliseconds);
+    // Unhooks the callback and frees every track still owned by the engine
+    void stop();
+    // Runs without an audio device: nothing is hooked into the mixer and
+    // the caller pulls the output with renderOffline(), as fast as it likes.
+    // The mixer must still be open, tracks are decoded for its spec. Events
+    // are only delivered through pollEvent().
+    bool startOffline();
+    // Renders the next len bytes exactly like one device callback would
+    void renderOffline(Uint8 *stream, int len);
+    // Temporarily unhook from the mixer while the device is reopened; the
+    // sample format must not change in between
+    void detach();
+    void attach();
+
+    // gain is the track's own linear gain (e.g. ReplayGain), on top of the volume
+    void play(Track *track, float gain = 1.0f);
+    void setNext(Track *track, float gain = 1.0f);
+    // Only changes the gain of a track that was set as next and has not started
+    void setGain(Track *track, float gain);
+    // Ignored unless track is still playing when the command is applied
+    void seek(Track *track, Uint64 frame);
+    // Pausing ramps the output down before the engine stops, resuming ramps it up
+    void setPaused(bool paused);
+    void setVolumeDb(double db); // GAIN_MIN_DB or below is silence
+    // Returns false if the audio thread has not picked up earlier settings yet
+    bool setEqualizer(const EqualizerSettings &settings);
+    // 0 disables crossfading, longer fades are clamped to CROSSFADE_MAX_SECONDS
+    void setCrossfade(int milliseconds, CrossfadeCurve curve);
+    // Playback speed without a change in pitch and pitch shift without a
+    // change in speed, see TimeStretch. Returns false if the sample format is
+    // not float. Tracks do not crossfade while stretched.
+    bool setTimeStretch(float speed, float semitones, StretchMode mode);
+    // Look-ahead of the output limiter, 0 turns it off. Takes effect at the
+    // next start(); the playback clock accounts for the added latency.
+    void setLimiterLookahead(int milliseconds) { limiterLookaheadMs = milliseconds; }
+    void setLimiterCeiling(double db) { dynamics.setCeilingDb(db); }
+    void setCompressor(bool enabled) { dynamics.setCompressor(enabled); }
+    // Gain reduction meters and statistics, see Dynamics
+    Dynamics &outputDynamics() { return dynamics; }
+
+    // Every ENGINE_TRACK_RELEASED arrives, after the other events about that
+    // track; other events are dropped while the UI does not keep up
+    bool pollEvent(EngineEvent &event);
+    Uint64 droppedEvents() const { return droppedEventCount.load(std::memory_order_relaxed); }
+
+    Uint64 transitions() const { return transitionCount; }
+    Sint64 maxGapFrames() const { return maxGap; }
+    Sint64 longestOverlapFrames() const { return maxOverlap; }
+    int frequency() const { return deviceFrequency; }
+    bool usesDecoderThread() const { return decoderThread != nullptr; }
+    PcmRingStats ringStats() const { return ring.stats(); }
+    int frameBytes() const { return frameSize; }
+    // Callbacks that came more than two buffers late plus reads that found the ring short
+    Uint64 underruns() const { return lateCallbacks + ring.underruns(); }
+    int callbackFrames() const { return lastCallbackFrames; }
+    // Frames the post-mix processing delays the output by
+    int outputLatencyFrames() const { return dynamics.latencyFrames(); }
+    // Timing histograms, readable from any thread while playing
+    const EngineTelemetry &stats() const { return telemetry; }
+
+    // Output stream frame that is audible right now, interpolated between
+    // callbacks and compensated for the device buffer. Cheap, lock-free.
+    double playbackFrame() const { return clock.audibleFrame(); }
+    double measuredDeviceRate() const { return clock.measuredRate(); }
+
+private:
+    enum CommandType
+    {
+        COMMAND_PLAY,
+        COMMAND_SET_NEXT,
+        COMMAND_SET_GAIN,
+        COMMAND_SEEK
+    };
+
+    struct Command
+    {
+        CommandType type;
+        Track *track;
+        float gain;
+        Uint64 frame; // COMMAND_SEEK only
+    };
+
+    static void SDLCALL mixCallback(void *udata, Uint8 *stream, int len);
+    static void SDLCALL postMixCallback(void *udata, Uint8 *stream, int len);
+    static int SDLCALL decoderMain(void *data);
+    static int SDLCALL notifierMain(void *data);
+    void mix(Uint8 *stream, int len);
+    void postMix(Uint8 *stream, int len);
+    void runDecoder();
+    void runNotifier();
+    void wake();
+    void applyCommands();
+    void applyCommand(const Command &command);
+    void render(Uint8 *stream, int len);
+    void notifyUi();
+    void updateStretch();
+    void startTrack(Track *track, float gain, Sint64 gapFrames);
+    int trackVolume(float gain) const;
+    bool holding() const;
+    float currentSpeed() const;
+    Uint32 plannedFadeFrames() const;
+    void beginCrossfade(Uint32 frames);
+    int mixCrossfade(Uint8 *stream, int len);
+    void release(Track *track);
+    static const float *readTrack(void *context, Uint64 frame, Uint32 &count);
+    void pushEvent(const EngineEvent &event);
+
+    int deviceFrequency = 0;
+    Uint16 deviceFormat = 0;
+    int deviceChannels = 0;
+    int frameSize = 0;
+    void (*onEvent)() = nullptr;
+    bool running = false;
+    bool offline = false; // Pulled by renderOffline() instead of the mixer
+    SDL_Thread *notifierThread = nullptr;
+    SDL_sem *uiWakeup = nullptr;
+    std::atomic<bool> stopNotifier{false};
+
+    // Decoder thread mode
+    SDL_Thread *decoderThread = nullptr;
+    SDL_sem *ringSpace = nullptr; // Posted by the callback after every read
+    std::atomic<bool> stopDecoder{false};
+    PcmRing ring;
+    Uint8 *renderBlock = nullptr;
+    int renderBlockBytes = 0;
+    bool flushPending = false; // A PLAY was applied, drop what is in the ring
+
+    SpscQueue<Command, 64> commands;
+    SpscQueue<EngineEvent, 256> events;
+    std::atomic<Uint64> droppedEventCount{0};
+    // Released tracks, pushed by the rendering thread and taken whole by
+    // pollEvent(), linked through Track::releasedNext. Unlike a queue it can
+    // not fill up, so a release is never lost and no track leaks.
+    std::atomic<Track *> released{nullptr};
+    Track *releasing = nullptr; // Taken from released, not handed out yet
+    bool polling = false;       // Between the first pollEvent() of a round and the one returning false
+    std::atomic<bool> paused{false};
+    std::atomic<int> crossfadeMs{0};
+    std::atomic<int> crossfadeCurve{CROSSFADE_EQUAL_POWER};
+    std::atomic<float> stretchSpeed{1.0f};
+    std::atomic<float> stretchSemitones{0.0f};
+    std::atomic<int> stretchMode{STRETCH_MUSIC};
+    bool canStretch = false;
+
+    // Owned by the rendering thread (callback or decoder) while running
+    Track *current = nullptr;
+    Track *next = nullptr;
+    float currentGain = 1.0f;
+    float nextGain = 1.0f;
+    Uint64 position = 0;       // Frame of current
+    bool stalled = false;      // Output of current stopped at position, its stream was not decoded that far
+    bool waitingForNext = false; // The previous track ended without a successor
+    Sint64 gapFrames = 0;
+    Track *incoming = nullptr;   // Fading in while current fades out
+    Uint64 incomingPosition = 0; // Frame of incoming
+    float incomingGain = 1.0f;
+    Uint32 fadeFrames = 0;
+    Uint32 fadePosition = 0;
+    CrossfadeCurve fadeCurve = CROSSFADE_EQUAL_POWER;
+    TimeStretch stretch; // Reads current instead of copying it when active
+    bool wakeUi = false;
+    Uint64 streamFrame = 0; // Frames rendered into the output stream so far
+    Uint64 renderFrame = 0; // Stream frame of the render cursor, stamped on events
+
+    // Written by the audio thread, read by the UI after stop() or as a statistic
+    std::atomic<Uint64> transitionCount{0};
+    std::atomic<Sint64> maxGap{0};
+    std::atomic<Sint64> maxOverlap{0};
+
+    // Callback timing, only touched by the callback apart from the statistics
+    Uint64 lastCallbackCounter = 0;
+    Uint64 callbackPeriod = 0; // Performance counter ticks of the last buffer
+    std::atomic<Uint64> lateCallbacks{0};
+    std::atomic<int> lastCallbackFrames{0};
+
+    // What the last callback delivered, published by the post-mix hook
+    Uint64 deliveredFrame = 0;
+    int deliveredFrames = 0;
+    PlaybackClock clock;
+    // Post-mix processing, in this order
+    GainStage gain; // Volume and pause ramps
+    Equalizer equalizer;
+    Dynamics dynamics; // Compressor and true-peak limiter
+    int limiterLookaheadMs = LIMITER_DEFAULT_LOOKAHEAD_MS;
+
+    EngineTelemetry telemetry;
+};
+
+// Runs the output chain (track copy or crossfade, volume, equalizer,
+// limiter) over generated audio in S16 and F32 and prints the cost per
+// frame of each
+void benchmarkSampleFormats();
+
+#endif
@@ -0,0 +1,1532 @@
+#include "audiofile.h"
+#include "bitwriter.h"
+#include "codecreader.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+const int FLAC_BLOCK_FRAMES = 4096;
+const int FLAC_MAX_ORDER = 4;           // Highest fixed predictor
+const int FLAC_MAX_PARTITION_ORDER = 4; // Up to 16 Rice partitions per subframe
+const int MAX_CHANNELS = 8;
+
+static bool hasExtension(const std::string &path, const char *extension)
+{
+    size_t length = SDL_strlen(extension);
+    return path.size() >= length && SDL_strcasecmp(path.c_str() + path.size() - length, extension) == 0;
+}
+
+bool AudioFileWriter::open(const std::string &path, int frequency, Uint16 format, int channels)
+{
+    close();
+    if (format != AUDIO_S16SYS && format != AUDIO_F32SYS)
+    {
+        std::cout << "Can not write " << path << ": unsupported sample format" << std::endl;
+        return false;
+    }
+    if (channels <= 0 || channels > MAX_CHANNELS)
+    {
+        std::cout << "Can not write " << path << ": unsupported channel count" << std::endl;
+        return false;
+    }
+    if (hasExtension(path, ".flac"))
+    {
+        flac = true;
+    }
+    else if (hasExtension(path, ".wav"))
+    {
+        flac = false;
+    }
+    else
+    {
+        std::cout << "Can not write " << path << ": use a .wav or .flac file name" << std::endl;
+        return false;
+    }
+
+    file = SDL_RWFromFile(path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        std::cout << "Failed to create " << path << ": " << SDL_GetError() << std::endl;
+        return false;
+    }
+    this->frequency = frequency;
+    this->format = format;
+    this->channels = channels;
+    failed = false;
+    frameCount = 0;
+    if (flac)
+    {
+        bitsPerSample = format == AUDIO_S16SYS ? 16 : 24;
+        block.assign((size_t)FLAC_BLOCK_FRAMES * channels, 0);
+        blockFrames = 0;
+        flacFrameNumber = 0;
+        channelSamples.assign(FLAC_BLOCK_FRAMES, 0);
+        residual.assign(FLAC_BLOCK_FRAMES, 0);
+        return writeFlacHeader();
+    }
+    bitsPerSample = SDL_AUDIO_BITSIZE(format);
+    return writeWavHeader();
+}
+
+bool AudioFileWriter::write(const Uint8 *pcm, int bytes)
+{
+    if (file == nullptr || failed)
+    {
+        return false;
+    }
+    int sampleBytes = SDL_AUDIO_BITSIZE(format) / 8;
+    int frames = bytes / (sampleBytes * channels);
+    frameCount += frames;
+
+    if (!flac)
+    {
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+        // WAV is little endian; swap a copy, the caller's buffer stays as it is
+        std::vector<Uint8> swapped(pcm, pcm + frames * sampleBytes * channels);
+        for (size_t i = 0; i < swapped.size(); i += sampleBytes)
+        {
+            std::reverse(swapped.begin() + i, swapped.begin() + i + sampleBytes);
+        }
+        pcm = swapped.data();
+#endif
+        size_t length = (size_t)frames * sampleBytes * channels;
+        failed = SDL_RWwrite(file, pcm, 1, length) != length;
+        return !failed;
+    }
+
+    int samples = frames * channels;
+    for (int i = 0; i < samples;)
+    {
+        int count = SDL_min(samples - i, (FLAC_BLOCK_FRAMES - blockFrames) * channels);
+        Sint32 *target = block.data() + (size_t)blockFrames * channels;
+        if (format == AUDIO_S16SYS)
+        {
+            const Sint16 *source = (const Sint16 *)pcm + i;
+            for (int j = 0; j < count; j++)
+            {
+                target[j] = source[j];
+            }
+        }
+        else
+        {
+            const float *source = (const float *)pcm + i;
+            for (int j = 0; j < count; j++)
+            {
+                float scaled = source[j] * 8388608.0f;
+                scaled = scaled > 8388607.0f ? 8388607.0f : scaled;
+                scaled = scaled < -8388608.0f ? -8388608.0f : scaled;
+                target[j] = (Sint32)std::lrint(scaled);
+            }
+        }
+        i += count;
+        blockFrames += count / channels;
+        if (blockFrames == FLAC_BLOCK_FRAMES && !encodeFlacBlock(blockFrames))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool AudioFileWriter::close()
+{
+    if (file == nullptr)
+    {
+        return false;
+    }
+    if (flac && blockFrames > 0)
+    {
+        encodeFlacBlock(blockFrames);
+    }
+    // Now that the length is known, write the headers again
+    if (!failed && SDL_RWseek(file, 0, RW_SEEK_SET) == 0)
+    {
+        if (flac)
+        {
+            writeFlacHeader();
+        }
+        else
+        {
+            writeWavHeader();
+        }
+    }
+    failed = SDL_RWclose(file) != 0 || failed;
+    file = nullptr;
+    return !failed;
+}
+
+bool AudioFileWriter::writeWavHeader()
+{
+    // Sizes saturate for files over 4 GiB, which readers then treat as unknown
+    bool isFloat = format == AUDIO_F32SYS;
+    int frameBytes = bitsPerSample / 8 * channels;
+    Uint64 dataBytes = frameCount * frameBytes;
+    Uint32 dataSize = (Uint32)SDL_min(dataBytes, (Uint64)0xFFFFFFFF - 64);
+    Uint32 formatSize = isFloat ? 18 : 16;
+    Uint32 factSize = isFloat ? 12 : 0;
+
+    bool written = SDL_RWwrite(file, "RIFF", 1, 4) == 4;
+    written &= SDL_WriteLE32(file, 4 + 8 + formatSize + factSize + 8 + dataSize) == 1;
+    written &= SDL_RWwrite(file, "WAVEfmt ", 1, 8) == 8;
+    written &= SDL_WriteLE32(file, formatSize) == 1;
+    written &= SDL_WriteLE16(file, isFloat ? 3 : 1) == 1; // WAVE_FORMAT_IEEE_FLOAT or WAVE_FORMAT_PCM
+    written &= SDL_WriteLE16(file, channels) == 1;
+    written &= SDL_WriteLE32(file, frequency) == 1;
+    written &= SDL_WriteLE32(file, frequency * frameBytes) == 1;
+    written &= SDL_WriteLE16(file, frameBytes) == 1;
+    written &= SDL_WriteLE16(file, bitsPerSample) == 1;
+    if (isFloat)
+    {
+        // Formats other than PCM carry an extension size and a frame count
+        written &= SDL_WriteLE16(file, 0) == 1;
+        written &= SDL_RWwrite(file, "fact", 1, 4) == 4;
+        written &= SDL_WriteLE32(file, 4) == 1;
+        written &= SDL_WriteLE32(file, (Uint32)SDL_min(frameCount, (Uint64)0xFFFFFFFF)) == 1;
+    }
+    written &= SDL_RWwrite(file, "data", 1, 4) == 4;
+    written &= SDL_WriteLE32(file, dataSize) == 1;
+    failed = failed || !written;
+    return written;
+}
+
+bool AudioFileWriter::writeFlacHeader()
+{
+    std::vector<Uint8> header;
+    BitWriter writer(header);
+    header.insert(header.end(), {'f', 'L', 'a', 'C'});
+    writer.put(1, 1);  // Last metadata block
+    writer.put(0, 7);  // STREAMINFO
+    writer.put(34, 24); // Its length
+    writer.put(FLAC_BLOCK_FRAMES, 16);
+    writer.put(FLAC_BLOCK_FRAMES, 16);
+    writer.put(0, 24); // Smallest and largest frame size unknown
+    writer.put(0, 24);
+    writer.put(frequency, 20);
+    writer.put(channels - 1, 3);
+    writer.put(bitsPerSample - 1, 5);
+    writer.put((Uint32)(frameCount >> 32) & 0xF, 4);
+    writer.put((Uint32)frameCount, 32);
+    for (int i = 0; i < 4; i++)
+    {
+        writer.put(0, 32); // No MD5 signature
+    }
+
+    bool written = SDL_RWwrite(file, header.data(), 1, header.size()) == header.size();
+    failed = failed || !written;
+    return written;
+}
+
+static Uint8 crc8(const Uint8 *data, size_t length)
+{
+    Uint8 crc = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (Uint8)(crc & 0x80 ? crc << 1 ^ 0x07 : crc << 1);
+        }
+    }
+    return crc;
+}
+
+static std::vector<Uint16> crc16Table()
+{
+    std::vector<Uint16> table(256);
+    for (int i = 0; i < 256; i++)
+    {
+        Uint16 crc = (Uint16)(i << 8);
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (Uint16)(crc & 0x8000 ? crc << 1 ^ 0x8005 : crc << 1);
+        }
+        table[i] = crc;
+    }
+    return table;
+}
+
+// Table driven: the reader checks every frame it decodes
+static Uint16 crc16(const Uint8 *data, size_t length)
+{
+    static const std::vector<Uint16> table = crc16Table();
+    Uint16 crc = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc = (Uint16)(crc << 8 ^ table[(crc >> 8) ^ data[i]]);
+    }
+    return crc;
+}
+
+static Uint32 zigzag(Sint32 value)
+{
+    return (Uint32)value << 1 ^ (Uint32)(value >> 31);
+}
+
+// Residual of FLAC's fixed predictor of the given order at sample i >= order
+static Sint64 fixedResidual(const Sint32 *x, int i, int order)
+{
+    switch (order)
+    {
+    case 0:
+        return x[i];
+    case 1:
+        return (Sint64)x[i] - x[i - 1];
+    case 2:
+        return (Sint64)x[i] - 2 * (Sint64)x[i - 1] + x[i - 2];
+    case 3:
+        return (Sint64)x[i] - 3 * (Sint64)x[i - 1] + 3 * (Sint64)x[i - 2] - x[i - 3];
+    default:
+        return (Sint64)x[i] - 4 * (Sint64)x[i - 1] + 6 * (Sint64)x[i - 2] - 4 * (Sint64)x[i - 3] + x[i - 4];
+    }
+}
+
+// Rice parameter with the fewest bits for count values summing to sum,
+// estimated as count * (k + 1) + sum / 2^k
+static int riceParameter(Uint64 sum, int count, int maxParameter, Uint64 &bits)
+{
+    int best = 0;
+    bits = ~(Uint64)0;
+    for (int k = 0; k <= maxParameter; k++)
+    {
+        Uint64 estimate = (Uint64)count * (k + 1) + (sum >> k);
+        if (estimate < bits)
+        {
+            bits = estimate;
+            best = k;
+        }
+    }
+    return best;
+}
+
+static void putSigned(BitWriter &writer, Sint32 value, int bits)
+{
+    writer.put((Uint32)value & (Uint32)((1ull << bits) - 1), bits);
+}
+
+static void putRice(BitWriter &writer, Uint32 value, int k)
+{
+    Uint32 quotient = value >> k;
+    while (quotient >= 31)
+    {
+        writer.put(0, 31);
+        quotient -= 31;
+    }
+    writer.put(1, quotient + 1); // quotient zeros and the stop bit
+    if (k > 0)
+    {
+        writer.put(value & ((1u << k) - 1), k);
+    }
+}
+
+bool AudioFileWriter::encodeFlacBlock(int frames)
+{
+    encoded.clear();
+    BitWriter writer(encoded);
+
+    // Frame header
+    bool standardSize = frames == FLAC_BLOCK_FRAMES;
+    writer.put(0xFFF8, 16);               // Sync code, fixed block size
+    writer.put(standardSize ? 12 : 7, 4); // 4096 frames, or a 16-bit size at the end of the header
+    writer.put(0, 4);                     // Sample rate from STREAMINFO
+    writer.put(channels - 1, 4);          // Independent channels
+    writer.put(bitsPerSample == 16 ? 4 : 6, 3);
+    writer.put(0, 1);
+    // Frame number in FLAC's UTF-8 style variable length code
+    Uint32 number = flacFrameNumber++;
+    if (number < 0x80)
+    {
+        writer.put(number, 8);
+    }
+    else
+    {
+        int continuation = number < 0x800 ? 1 : number < 0x10000 ? 2 : number < 0x200000 ? 3 : number < 0x4000000 ? 4 : 5;
+        writer.put(((0xFF00u >> (continuation + 1)) & 0xFF) | number >> (6 * continuation), 8);
+        for (int i = continuation - 1; i >= 0; i--)
+        {
+            writer.put(0x80 | (number >> (6 * i) & 0x3F), 8);
+        }
+    }
+    if (!standardSize)
+    {
+        writer.put(frames - 1, 16);
+    }
+    writer.put(crc8(encoded.data(), encoded.size()), 8);
+
+    Sint32 *samples = channelSamples.data();
+    for (int channel = 0; channel < channels; channel++)
+    {
+        for (int i = 0; i < frames; i++)
+        {
+            samples[i] = block[(size_t)i * channels + channel];
+        }
+
+        bool constant = true;
+        for (int i = 1; i < frames && constant; i++)
+        {
+            constant = samples[i] == samples[0];
+        }
+        if (constant)
+        {
+            writer.put(0, 8); // CONSTANT subframe: silence and gaps
+            putSigned(writer, samples[0], bitsPerSample);
+            continue;
+        }
+
+        // The fixed predictor with the smallest residuals
+        int order = 0;
+        Uint64 smallest = ~(Uint64)0;
+        for (int candidate = 0; candidate <= SDL_min(FLAC_MAX_ORDER, frames - 1); candidate++)
+        {
+            Uint64 sum = 0;
+            for (int i = FLAC_MAX_ORDER; i < frames; i++)
+            {
+                Sint64 value = fixedResidual(samples, i, candidate);
+                sum += (Uint64)(value < 0 ? -value : value);
+            }
+            if (sum < smallest)
+            {
+                smallest = sum;
+                order = candidate;
+            }
+        }
+        for (int i = order; i < frames; i++)
+        {
+            // A 24-bit residual of the fourth order fits in 29 bits
+            residual[i] = (Sint32)fixedResidual(samples, i, order);
+        }
+
+        // Partition order and parameters with the fewest estimated bits.
+        // RICE2 allows parameters above 14, which 24-bit noise can need.
+        int maxParameter = bitsPerSample > 16 ? 30 : 14;
+        int partitionOrder = 0;
+        Uint64 bestBits = ~(Uint64)0;
+        int parameters[1 << FLAC_MAX_PARTITION_ORDER];
+        for (int candidate = 0; candidate <= FLAC_MAX_PARTITION_ORDER; candidate++)
+        {
+            int partitions = 1 << candidate;
+            if (frames % partitions != 0 || frames / partitions <= order)
+            {
+                break;
+            }
+            Uint64 total = 0;
+            int candidateParameters[1 << FLAC_MAX_PARTITION_ORDER];
+            for (int partition = 0; partition < partitions; partition++)
+            {
+                int begin = partition == 0 ? order : partition * (frames / partitions);
+                int end = (partition + 1) * (frames / partitions);
+                Uint64 sum = 0;
+                for (int i = begin; i < end; i++)
+                {
+                    sum += zigzag(residual[i]);
+                }
+                Uint64 bits;
+                candidateParameters[partition] = riceParameter(sum, end - begin, maxParameter, bits);
+                total += bits + (bitsPerSample > 16 ? 5 : 4);
+            }
+            if (total < bestBits)
+            {
+                bestBits = total;
+                partitionOrder = candidate;
+                SDL_memcpy(parameters, candidateParameters, sizeof(int) * partitions);
+            }
+        }
+
+        if (bestBits + (Uint64)order * bitsPerSample >= (Uint64)frames * bitsPerSample)
+        {
+            writer.put(2, 8); // VERBATIM subframe, for noise that does not compress
+            for (int i = 0; i < frames; i++)
+            {
+                putSigned(writer, samples[i], bitsPerSample);
+            }
+            continue;
+        }
+
+        writer.put((0x08 | order) << 1, 8); // FIXED subframe of this order
+        for (int i = 0; i < order; i++)
+        {
+            putSigned(writer, samples[i], bitsPerSample);
+        }
+        bool rice2 = false;
+        int partitions = 1 << partitionOrder;
+        for (int partition = 0; partition < partitions; partition++)
+        {
+            rice2 = rice2 || parameters[partition] > 14;
+        }
+        writer.put(rice2 ? 1 : 0, 2);
+        writer.put(partitionOrder, 4);
+        for (int partition = 0; partition < partitions; partition++)
+        {
+            int begin = partition == 0 ? order : partition * (frames / partitions);
+            int end = (partition + 1) * (frames / partitions);
+            writer.put(parameters[partition], rice2 ? 5 : 4);
+            for (int i = begin; i < end; i++)
+            {
+                putRice(writer, zigzag(residual[i]), parameters[partition]);
+            }
+        }
+    }
+
+    writer.flush();
+    writer.put(crc16(encoded.data(), encoded.size()), 16);
+    blockFrames = 0;
+    bool written = SDL_RWwrite(file, encoded.data(), 1, encoded.size()) == encoded.size();
+    failed = failed || !written;
+    return written;
+}
+
+// Reading
+
+const size_t FLAC_BUFFER_BYTES = 1 << 20;
+const size_t FLAC_MAX_FRAME_BYTES = 1 << 26; // Frames claiming more are treated as broken
+const int FLAC_MAX_BITS = 24;                 // Deeper files are left to SDL_mixer
+
+static int countLeadingZeros(Uint64 value)
+{
+#ifdef __GNUC__
+    return value == 0 ? 64 : __builtin_clzll(value);
+#else
+    int zeros = 0;
+    while (zeros < 64 && (value >> (63 - zeros) & 1) == 0)
+    {
+        zeros++;
+    }
+    return zeros;
+#endif
+}
+
+// Reads FLAC's bit fields, most significant bit first. Past the end it
+// reads zero bits and remembers that it did.
+class FlacBitReader
+{
+public:
+    FlacBitReader(const Uint8 *data, size_t size) : data(data), size(size) {}
+
+    // Up to 32 bits
+    Uint32 get(int bits)
+    {
+        if (bits == 0)
+        {
+            return 0;
+        }
+        while (count < bits)
+        {
+            accumulator = accumulator << 8 | (position < size ? data[position] : 0);
+            position++;
+            count += 8;
+        }
+        count -= bits;
+        return (Uint32)(accumulator >> count) & (Uint32)((1ull << bits) - 1);
+    }
+
+    // Two's complement, up to 32 bits
+    Sint32 getSigned(int bits)
+    {
+        if (bits == 0)
+        {
+            return 0;
+        }
+        Uint32 value = get(bits);
+        return bits == 32 ? (Sint32)value : (Sint32)(value << (32 - bits)) >> (32 - bits);
+    }
+
+    // Counts clear bits up to a set one, which is consumed
+    Uint32 zeros()
+    {
+        Uint32 total = 0;
+        while (!overrun())
+        {
+            if (count == 0)
+            {
+                accumulator = position < size ? data[position] : 0;
+                position++;
+                count = 8;
+            }
+            Uint64 unread = accumulator & ((1ull << count) - 1);
+            if (unread == 0)
+            {
+                total += count;
+                count = 0;
+                continue;
+            }
+            int leading = countLeadingZeros(unread) - (64 - count);
+            total += leading;
+            count -= leading + 1;
+            return total;
+        }
+        return total;
+    }
+
+    // Skips the rest of a partly read byte
+    void align() { count -= count % 8; }
+    // Bytes consumed so far, once aligned
+    size_t offset() const { return position - count / 8; }
+    bool overrun() const { return position * 8 - count > size * 8; }
+
+private:
+    const Uint8 *data;
+    size_t size;
+    size_t position = 0;
+    Uint64 accumulator = 0;
+    int count = 0;
+};
+
+static Uint16 readLE16(const Uint8 *bytes)
+{
+    return (Uint16)(bytes[0] | bytes[1] << 8);
+}
+
+static Uint32 readLE32(const Uint8 *bytes)
+{
+    return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (Uint32)bytes[3] << 24;
+}
+
+static Uint64 readLE64(const Uint8 *bytes)
+{
+    return readLE32(bytes) | (Uint64)readLE32(bytes + 4) << 32;
+}
+
+static Uint64 readBE(const Uint8 *bytes, int count)
+{
+    Uint64 value = 0;
+    for (int i = 0; i < count; i++)
+    {
+        value = value << 8 | bytes[i];
+    }
+    return value;
+}
+
+bool AudioFileReader::open(const std::string &path, const SeekTable *stored)
+{
+    close();
+    file = SDL_RWFromFile(path.c_str(), "rb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    fileSize = SDL_RWsize(file);
+
+    Uint8 header[12];
+    bool opened = false;
+    if (SDL_RWread(file, header, 1, sizeof(header)) == sizeof(header))
+    {
+        if ((memcmp(header, "RIFF", 4) == 0 || memcmp(header, "RF64", 4) == 0) && memcmp(header + 8, "WAVE", 4) == 0)
+        {
+            opened = openWav();
+        }
+        else
+        {
+            // FLAC, maybe behind an ID3v2 tag whose size is stored in 7 bit bytes
+            Sint64 offset = 0;
+            Uint8 tag[10];
+            if (memcmp(header, "ID3", 3) == 0 && SDL_RWseek(file, 0, RW_SEEK_SET) == 0 && SDL_RWread(file, tag, 1, 10) == 10)
+            {
+                offset = 10 + ((tag[6] & 0x7F) << 21 | (tag[7] & 0x7F) << 14 | (tag[8] & 0x7F) << 7 | (tag[9] & 0x7F));
+                offset += tag[5] & 0x10 ? 10 : 0; // Footer
+            }
+            Uint8 magic[4];
+            if (SDL_RWseek(file, offset, RW_SEEK_SET) == offset && SDL_RWread(file, magic, 1, 4) == 4 &&
+                memcmp(magic, "fLaC", 4) == 0)
+            {
+                opened = openFlac();
+            }
+        }
+    }
+    if (opened && flac && stored != nullptr)
+    {
+        addSeekPoints(stored->points);
+    }
+    if (!opened)
+    {
+        close();
+        codec = new CodecReader;
+        opened = codec->open(path, stored);
+        if (opened)
+        {
+            rate = codec->frequency();
+            channels = codec->channelCount();
+            totalFrames = codec->length();
+            titleTag = codec->title();
+            artistTag = codec->artist();
+            albumTag = codec->album();
+        }
+    }
+    if (!opened)
+    {
+        close();
+    }
+    return opened;
+}
+
+void takeVorbisCommentTag(const std::string &comment, std::string &title, std::string &artist, std::string &album)
+{
+    size_t equals = comment.find('=');
+    if (equals == std::string::npos)
+    {
+        return;
+    }
+    std::string key = comment.substr(0, equals);
+    std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return (char)toupper(c); });
+    std::string *tag = key == "TITLE" ? &title : key == "ARTIST" ? &artist : key == "ALBUM" ? &album : nullptr;
+    if (tag != nullptr && tag->empty())
+    {
+        *tag = comment.substr(equals + 1);
+    }
+}
+
+void AudioFileReader::close()
+{
+    if (file != nullptr)
+    {
+        SDL_RWclose(file);
+        file = nullptr;
+    }
+    delete codec;
+    codec = nullptr;
+    titleTag.clear();
+    artistTag.clear();
+    albumTag.clear();
+    flac = false;
+    rate = 0;
+    channels = 0;
+    totalFrames = 0;
+    position = 0;
+    points.clear();
+    decodedFrames = 0;
+}
+
+bool AudioFileReader::openWav()
+{
+    // RF64 keeps the sizes that do not fit 32 bits in a ds64 chunk
+    Uint64 dataSize64 = 0;
+    bool haveFormat = false;
+    Uint64 dataSize = 0;
+    dataOffset = 0;
+    Sint64 offset = 12;
+    // The tags may follow the data
+    while (offset + 8 <= fileSize)
+    {
+        Uint8 chunk[8];
+        if (SDL_RWseek(file, offset, RW_SEEK_SET) != offset || SDL_RWread(file, chunk, 1, 8) != 8)
+        {
+            break;
+        }
+        Uint64 size = readLE32(chunk + 4);
+        Uint8 body[40] = {};
+        size_t bodyBytes = (size_t)SDL_min(size, (Uint64)sizeof(body));
+        if (memcmp(chunk, "ds64", 4) == 0 || memcmp(chunk, "fmt ", 4) == 0)
+        {
+            if (SDL_RWread(file, body, 1, bodyBytes) != bodyBytes)
+            {
+                return false;
+            }
+        }
+
+        if (memcmp(chunk, "ds64", 4) == 0 && size >= 16)
+        {
+            dataSize64 = readLE64(body + 8);
+        }
+        else if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16)
+        {
+            int tag = readLE16(body);
+            channels = readLE16(body + 2);
+            rate = (int)readLE32(body + 4);
+            blockAlign = readLE16(body + 12);
+            bitsPerSample = readLE16(body + 14);
+            if (tag == 0xFFFE && size >= 40)
+            {
+                tag = readLE16(body + 24); // WAVE_FORMAT_EXTENSIBLE names the real format in its GUID
+            }
+            isFloat = tag == 3;
+            bool supported = (tag == 1 && (bitsPerSample == 8 || bitsPerSample == 16 || bitsPerSample == 24 || bitsPerSample == 32)) ||
+                             (tag == 3 && (bitsPerSample == 32 || bitsPerSample == 64));
+            if (!supported || channels <= 0 || channels > MAX_CHANNELS || rate <= 0 || blockAlign != bitsPerSample / 8 * channels)
+            {
+                return false;
+            }
+            haveFormat = true;
+        }
+        else if (memcmp(chunk, "data", 4) == 0)
+        {
+            dataOffset = offset + 8;
+            dataSize = size == 0xFFFFFFFF && dataSize64 > 0 ? dataSize64 : size;
+            // Writers that could not go back to fill in the size leave it
+            // saturated or zero; the data then runs to the end of the file
+            if (dataSize > (Uint64)(fileSize - dataOffset) || dataSize == 0 || dataSize >= 0xFFFFFFFF - 64)
+            {
+                dataSize = fileSize - dataOffset;
+            }
+            size = dataSize;
+        }
+        else if (memcmp(chunk, "LIST", 4) == 0)
+        {
+            readInfoTags(offset + 8, size);
+        }
+        offset += 8 + size + (size & 1);
+    }
+    if (!haveFormat || dataOffset == 0)
+    {
+        return false;
+    }
+
+    flac = false;
+    totalFrames = dataSize / blockAlign;
+    position = 0;
+    return SDL_RWseek(file, dataOffset, RW_SEEK_SET) == dataOffset;
+}
+
+bool AudioFileReader::openFlac()
+{
+    bool haveInfo = false;
+    bool last = false;
+    while (!last)
+    {
+        Uint8 block[4];
+        if (SDL_RWread(file, block, 1, 4) != 4)
+        {
+            return false;
+        }
+        last = (block[0] & 0x80) != 0;
+        int type = block[0] & 0x7F;
+        size_t length = (size_t)readBE(block + 1, 3);
+        std::vector<Uint8> body(length);
+        if (length > 0 && SDL_RWread(file, body.data(), 1, length) != length)
+        {
+            return false;
+        }
+
+        if (type == 0 && length >= 34)
+        {
+            // STREAMINFO
+            minBlockSize = (int)readBE(&body[0], 2);
+            maxBlockSize = (int)readBE(&body[2], 2);
+            maxFrameBytes = (size_t)readBE(&body[7], 3);
+            Uint64 packed = readBE(&body[10], 8);
+            rate = (int)(packed >> 44);
+            channels = (int)(packed >> 41 & 7) + 1;
+            bitsPerSample = (int)(packed >> 36 & 31) + 1;
+            totalFrames = packed & 0xFFFFFFFFFull;
+            haveInfo = true;
+        }
+        else if (type == 4)
+        {
+            readVorbisComment(body);
+        }
+        else if (type == 3)
+        {
+            // SEEKTABLE: sample, offset from the first frame and its length, placeholders all ones
+            for (size_t i = 0; i + 18 <= length; i += 18)
+            {
+                Uint64 frame = readBE(&body[i], 8);
+                if (frame != ~(Uint64)0)
+                {
+                    points.push_back({frame, readBE(&body[i + 8], 8)});
+                }
+            }
+        }
+    }
+    if (!haveInfo || rate <= 0 || bitsPerSample < 4 || bitsPerSample > FLAC_MAX_BITS || maxBlockSize < 16 ||
+        minBlockSize > maxBlockSize)
+    {
+        return false;
+    }
+
+    firstFrameOffset = (Uint64)SDL_RWtell(file);
+    for (SeekPoint &point : points)
+    {
+        point.offset += firstFrameOffset;
+    }
+    std::vector<SeekPoint> table;
+    table.swap(points);
+    addSeekPoints(table);
+
+    // Never less than a verbatim frame, whatever STREAMINFO claims
+    size_t verbatimBytes = (size_t)maxBlockSize * channels * (bitsPerSample + 1) / 8 + 64;
+    maxFrameBytes = SDL_max(maxFrameBytes, verbatimBytes);
+    buffer.assign(SDL_max(FLAC_BUFFER_BYTES, 2 * maxFrameBytes), 0);
+    decoded.assign((size_t)maxBlockSize * channels, 0);
+    residual.assign(maxBlockSize, 0);
+    flac = true;
+    restartAt(0, firstFrameOffset);
+    return true;
+}
+
+// A LIST chunk of type INFO: name, artist and product, which is the album
+void AudioFileReader::readInfoTags(Sint64 offset, Uint64 size)
+{
+    std::vector<Uint8> list((size_t)SDL_min(size, (Uint64)65536));
+    if (list.size() < 4 || SDL_RWseek(file, offset, RW_SEEK_SET) != offset ||
+        SDL_RWread(file, list.data(), 1, list.size()) != list.size() || memcmp(list.data(), "INFO", 4) != 0)
+    {
+        return;
+    }
+    for (size_t at = 4; at + 8 <= list.size();)
+    {
+        size_t length = SDL_min((size_t)readLE32(&list[at + 4]), list.size() - at - 8);
+        const char *text = (const char *)&list[at + 8];
+        std::string *tag = memcmp(&list[at], "INAM", 4) == 0   ? &titleTag
+                           : memcmp(&list[at], "IART", 4) == 0 ? &artistTag
+                           : memcmp(&list[at], "IPRD", 4) == 0 ? &albumTag
+                                                               : nullptr;
+        if (tag != nullptr)
+        {
+            *tag = std::string(text, strnlen(text, length));
+        }
+        at += 8 + length + (length & 1);
+    }
+}
+
+// VORBIS_COMMENT, the one part of FLAC that is little-endian
+void AudioFileReader::readVorbisComment(const std::vector<Uint8> &body)
+{
+    size_t at = 0;
+    auto length = [&]() -> size_t {
+        size_t value = at + 4 <= body.size() ? readLE32(&body[at]) : body.size();
+        at += 4;
+        return value;
+    };
+    size_t vendor = length();
+    at += vendor;
+    size_t count = at + 4 <= body.size() ? length() : 0;
+    for (size_t i = 0; i < count && at + 4 <= body.size(); i++)
+    {
+        size_t size = length();
+        if (size > body.size() - at)
+        {
+            break;
+        }
+        takeVorbisCommentTag(std::string((const char *)&body[at], size), titleTag, artistTag, albumTag);
+        at += size;
+    }
+}
+
+Uint32 AudioFileReader::read(float *output, Uint32 frames)
+{
+    if (codec != nullptr)
+    {
+        Uint32 got = codec->read(output, frames);
+        position += got;
+        return got;
+    }
+    if (file == nullptr)
+    {
+        return 0;
+    }
+    if (totalFrames > 0)
+    {
+        frames = (Uint32)SDL_min((Uint64)frames, totalFrames - SDL_min(position, totalFrames));
+    }
+    if (!flac)
+    {
+        return readWav(output, frames);
+    }
+
+    float scale = 1.0f / (float)(1 << (bitsPerSample - 1));
+    Uint32 written = 0;
+    while (written < frames)
+    {
+        if (position >= decodedFrame + decodedFrames)
+        {
+            if (!decodeFrame())
+            {
+                break;
+            }
+            continue;
+        }
+        // After frames were lost to damage, keep the timing with silence
+        if (position < decodedFrame)
+        {
+            Uint32 gap = (Uint32)SDL_min(decodedFrame - position, (Uint64)(frames - written));
+            SDL_memset(output + (size_t)written * channels, 0, (size_t)gap * channels * sizeof(float));
+            written += gap;
+            position += gap;
+            continue;
+        }
+
+        int first = (int)(position - decodedFrame);
+        int count = (int)SDL_min((Uint32)(decodedFrames - first), frames - written);
+        float *target = output + (size_t)written * channels;
+        for (int channel = 0; channel < channels; channel++)
+        {
+            const Sint32 *source = &decoded[(size_t)channel * maxBlockSize + first];
+            for (int i = 0; i < count; i++)
+            {
+                target[(size_t)i * channels + channel] = source[i] * scale;
+            }
+        }
+        written += count;
+        position += count;
+    }
+    return written;
+}
+
+Uint32 AudioFileReader::readWav(float *output, Uint32 frames)
+{
+    bytes.resize((size_t)frames * blockAlign);
+    size_t got = SDL_RWread(file, bytes.data(), 1, bytes.size());
+    Uint32 count = (Uint32)(got / blockAlign);
+    size_t samples = (size_t)count * channels;
+    const Uint8 *in = bytes.data();
+    for (size_t i = 0; i < samples; i++)
+    {
+        switch (bitsPerSample)
+        {
+        case 8:
+            output[i] = ((int)in[i] - 128) * (1.0f / 128.0f);
+            break;
+        case 16:
+            output[i] = (Sint16)readLE16(in + 2 * i) * (1.0f / 32768.0f);
+            break;
+        case 24:
+            output[i] = (Sint32)((Uint32)in[3 * i] << 8 | (Uint32)in[3 * i + 1] << 16 | (Uint32)in[3 * i + 2] << 24) *
+                        (1.0f / 2147483648.0f);
+            break;
+        case 32:
+            if (isFloat)
+            {
+                Uint32 bits = readLE32(in + 4 * i);
+                SDL_memcpy(&output[i], &bits, sizeof(float));
+            }
+            else
+            {
+                output[i] = (Sint32)readLE32(in + 4 * i) * (1.0f / 2147483648.0f);
+            }
+            break;
+        default:
+        {
+            Uint64 bits = readLE64(in + 8 * i);
+            double value;
+            SDL_memcpy(&value, &bits, sizeof(double));
+            output[i] = (float)value;
+            break;
+        }
+        }
+    }
+    position += count;
+    return count;
+}
+
+bool AudioFileReader::seek(Uint64 frame)
+{
+    if (codec != nullptr)
+    {
+        if (!codec->seek(frame))
+        {
+            return false;
+        }
+        position = SDL_min(frame, totalFrames);
+        return true;
+    }
+    if (file == nullptr)
+    {
+        return false;
+    }
+    if (totalFrames > 0)
+    {
+        frame = SDL_min(frame, totalFrames);
+    }
+    if (flac)
+    {
+        return seekFlac(frame);
+    }
+    Sint64 offset = dataOffset + (Sint64)(frame * blockAlign);
+    if (SDL_RWseek(file, offset, RW_SEEK_SET) != offset)
+    {
+        return false;
+    }
+    position = frame;
+    return true;
+}
+
+SeekTable AudioFileReader::seekTable() const
+{
+    if (codec != nullptr)
+    {
+        return codec->seekTable();
+    }
+    SeekTable table;
+    table.frames = totalFrames;
+    table.points = points;
+    return table;
+}
+
+void AudioFileReader::addSeekPoints(const std::vector<SeekPoint> &more)
+{
+    if (codec != nullptr)
+    {
+        codec->addSeekPoints(more);
+        return;
+    }
+    for (const SeekPoint &point : more)
+    {
+        addSeekPoint(point.frame, point.offset);
+    }
+}
+
+// Keeps the points about SEEK_POINT_SECONDS apart, more would not make
+// seeking any faster
+void AudioFileReader::addSeekPoint(Uint64 frame, Uint64 offset)
+{
+    if (offset < firstFrameOffset || (totalFrames > 0 && frame >= totalFrames))
+    {
+        return;
+    }
+    Uint64 spacing = (Uint64)rate * SEEK_POINT_SECONDS;
+    auto after = std::upper_bound(points.begin(), points.end(), frame,
+                                  [](Uint64 value, const SeekPoint &point) { return value < point.frame; });
+    if ((after != points.end() && after->frame - frame < spacing) || (after != points.begin() && frame - (after - 1)->frame < spacing))
+    {
+        return;
+    }
+    points.insert(after, {frame, offset});
+}
+
+// Makes the bytes of the next frame, up to the given count, available from cursor on
+bool AudioFileReader::fill(size_t count)
+{
+    if (bufferFill - cursor >= count)
+    {
+        return true;
+    }
+    SDL_memmove(buffer.data(), buffer.data() + cursor, bufferFill - cursor);
+    bufferOffset += cursor;
+    bufferFill -= cursor;
+    cursor = 0;
+    if (buffer.size() < count)
+    {
+        buffer.resize(count);
+    }
+    while (bufferFill < buffer.size())
+    {
+        size_t got = SDL_RWread(file, buffer.data() + bufferFill, 1, buffer.size() - bufferFill);
+        if (got == 0)
+        {
+            break;
+        }
+        bufferFill += got;
+    }
+    return bufferFill >= count;
+}
+
+void AudioFileReader::restartAt(Uint64 frame, Uint64 offset)
+{
+    SDL_RWseek(file, (Sint64)offset, RW_SEEK_SET);
+    bufferOffset = offset;
+    bufferFill = 0;
+    cursor = 0;
+    decodedFrame = frame;
+    decodedFrames = 0;
+    position = frame;
+}
+
+bool AudioFileReader::parseFrameHeader(const Uint8 *data, size_t available, FrameHeader &header) const
+{
+    if (available < 6 || data[0] != 0xFF || (data[1] & 0xFE) != 0xF8 || (data[3] & 1) != 0)
+    {
+        return false;
+    }
+    bool variable = (data[1] & 1) != 0;
+    int sizeCode = data[2] >> 4;
+    int rateCode = data[2] & 15;
+    int assignment = data[3] >> 4;
+    int depthCode = data[3] >> 1 & 7;
+    if (sizeCode == 0 || rateCode == 15 || assignment > 10 || depthCode == 3)
+    {
+        return false;
+    }
+
+    // Frame or sample number in FLAC's UTF-8 style variable length code
+    size_t p = 4;
+    int extra = data[p] < 0x80 ? 0 : data[p] >= 0xC0 && data[p] < 0xFF ? countLeadingZeros((Uint64)(Uint8)~data[p] << 56) - 1 : -1;
+    if (extra < 0 || extra > (variable ? 6 : 5) || available < p + extra + 6)
+    {
+        return false;
+    }
+    Uint64 number = data[p] & (extra == 0 ? 0x7F : (1 << (6 - extra)) - 1);
+    for (int i = 1; i <= extra; i++)
+    {
+        if ((data[p + i] & 0xC0) != 0x80)
+        {
+            return false;
+        }
+        number = number << 6 | (data[p + i] & 0x3F);
+    }
+    p += extra + 1;
+
+    int blockSize;
+    if (sizeCode == 1)
+    {
+        blockSize = 192;
+    }
+    else if (sizeCode <= 5)
+    {
+        blockSize = 576 << (sizeCode - 2);
+    }
+    else if (sizeCode == 6)
+    {
+        blockSize = data[p++] + 1;
+    }
+    else if (sizeCode == 7)
+    {
+        blockSize = (int)readBE(data + p, 2) + 1;
+        p += 2;
+    }
+    else
+    {
+        blockSize = 256 << (sizeCode - 8);
+    }
+
+    static const int rates[12] = {0, 88200, 176400, 192000, 8000, 16000, 22050, 24000, 32000, 44100, 48000, 96000};
+    int frameRate = rateCode < 12 ? rates[rateCode] : 0;
+    if (rateCode == 12)
+    {
+        frameRate = data[p++] * 1000;
+    }
+    else if (rateCode >= 13)
+    {
+        frameRate = (int)readBE(data + p, 2) * (rateCode == 14 ? 10 : 1);
+        p += 2;
+    }
+
+    static const int depths[8] = {0, 8, 12, 0, 16, 20, 24, 32};
+    int depth = depthCode == 0 ? bitsPerSample : depths[depthCode];
+    int frameChannels = assignment < 8 ? assignment + 1 : 2;
+    if (p >= available || crc8(data, p) != data[p] || (rateCode != 0 && frameRate != rate) || depth != bitsPerSample ||
+        frameChannels != channels || blockSize > maxBlockSize)
+    {
+        return false;
+    }
+
+    header.firstFrame = variable ? number : number * maxBlockSize;
+    header.blockSize = blockSize;
+    header.channelAssignment = assignment;
+    header.bitsPerSample = depth;
+    header.headerBytes = p + 1;
+    return true;
+}
+
+// Residual of a fixed or LPC subframe of the given predictor order
+static bool decodeResidual(FlacBitReader &reader, int blockSize, int order, Sint32 *residual)
+{
+    int method = (int)reader.get(2);
+    if (method > 1)
+    {
+        return false;
+    }
+    int parameterBits = method == 0 ? 4 : 5;
+    Uint32 escape = method == 0 ? 15 : 31;
+    int partitionOrder = (int)reader.get(4);
+    int partitionSize = blockSize >> partitionOrder;
+    if (partitionSize << partitionOrder != blockSize || partitionSize < order)
+    {
+        return false;
+    }
+
+    int i = order;
+    for (int partition = 0; partition < 1 << partitionOrder; partition++)
+    {
+        int end = (partition + 1) * partitionSize;
+        Uint32 parameter = reader.get(parameterBits);
+        if (parameter == escape)
+        {
+            int bits = (int)reader.get(5);
+            for (; i < end; i++)
+            {
+                residual[i] = reader.getSigned(bits);
+            }
+            continue;
+        }
+        for (; i < end; i++)
+        {
+            Uint32 value = reader.zeros() << parameter | reader.get((int)parameter);
+            residual[i] = (Sint32)(value >> 1) ^ -(Sint32)(value & 1);
+        }
+        if (reader.overrun())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool decodeSubframe(FlacBitReader &reader, int blockSize, int bits, Sint32 *out, Sint32 *residual)
+{
+    if (reader.get(1) != 0)
+    {
+        return false;
+    }
+    int type = (int)reader.get(6);
+    int wasted = 0;
+    if (reader.get(1) != 0)
+    {
+        wasted = (int)reader.zeros() + 1;
+        bits -= wasted;
+        if (bits <= 0)
+        {
+            return false;
+        }
+    }
+
+    if (type == 0)
+    {
+        Sint32 value = reader.getSigned(bits);
+        std::fill(out, out + blockSize, value);
+    }
+    else if (type == 1)
+    {
+        for (int i = 0; i < blockSize; i++)
+        {
+            out[i] = reader.getSigned(bits);
+        }
+    }
+    else if (type >= 8 && type <= 12)
+    {
+        int order = type - 8;
+        if (order > blockSize)
+        {
+            return false;
+        }
+        for (int i = 0; i < order; i++)
+        {
+            out[i] = reader.getSigned(bits);
+        }
+        if (!decodeResidual(reader, blockSize, order, residual))
+        {
+            return false;
+        }
+        for (int i = order; i < blockSize; i++)
+        {
+            Sint32 prediction = order == 0   ? 0
+                                : order == 1 ? out[i - 1]
+                                : order == 2 ? 2 * out[i - 1] - out[i - 2]
+                                : order == 3 ? 3 * out[i - 1] - 3 * out[i - 2] + out[i - 3]
+                                             : 4 * out[i - 1] - 6 * out[i - 2] + 4 * out[i - 3] - out[i - 4];
+            out[i] = prediction + residual[i];
+        }
+    }
+    else if (type >= 32)
+    {
+        int order = type - 31;
+        if (order > blockSize)
+        {
+            return false;
+        }
+        for (int i = 0; i < order; i++)
+        {
+            out[i] = reader.getSigned(bits);
+        }
+        int precision = (int)reader.get(4) + 1;
+        int shift = reader.getSigned(5);
+        if (precision == 16 || shift < 0)
+        {
+            return false;
+        }
+        Sint32 coefficients[32];
+        for (int i = 0; i < order; i++)
+        {
+            coefficients[i] = reader.getSigned(precision);
+        }
+        if (!decodeResidual(reader, blockSize, order, residual))
+        {
+            return false;
+        }
+        for (int i = order; i < blockSize; i++)
+        {
+            Sint64 sum = 0;
+            for (int j = 0; j < order; j++)
+            {
+                sum += (Sint64)coefficients[j] * out[i - 1 - j];
+            }
+            out[i] = (Sint32)(sum >> shift) + residual[i];
+        }
+    }
+    else
+    {
+        return false;
+    }
+
+    if (wasted > 0)
+    {
+        for (int i = 0; i < blockSize; i++)
+        {
+            out[i] = (Sint32)((Uint32)out[i] << wasted);
+        }
+    }
+    return !reader.overrun();
+}
+
+bool AudioFileReader::decodeFrame()
+{
+    for (;;)
+    {
+        fill(maxFrameBytes);
+        size_t available = bufferFill - cursor;
+        const Uint8 *data = buffer.data() + cursor;
+        FrameHeader header;
+        if (available == 0)
+        {
+            return false;
+        }
+        if (!parseFrameHeader(data, available, header))
+        {
+            // Lost sync, skip ahead to the next byte pair that can start a frame
+            size_t next = 1;
+            while (next + 1 < available && !(data[next] == 0xFF && (data[next + 1] & 0xFE) == 0xF8))
+            {
+                next++;
+            }
+            cursor += next + 1 < available ? next : available;
+            continue;
+        }
+
+        FlacBitReader reader(data + header.headerBytes, available - header.headerBytes);
+        bool valid = true;
+        for (int channel = 0; channel < channels && valid; channel++)
+        {
+            // The side channel needs a bit more
+            int assignment = header.channelAssignment;
+            bool side = (assignment == 8 && channel == 1) || (assignment == 9 && channel == 0) || (assignment == 10 && channel == 1);
+            valid = decodeSubframe(reader, header.blockSize, header.bitsPerSample + (side ? 1 : 0),
+                                   &decoded[(size_t)channel * maxBlockSize], residual.data());
+        }
+        reader.align();
+        size_t frameBytes = header.headerBytes + reader.offset() + 2;
+        if (reader.overrun() || frameBytes > available)
+        {
+            // Either the frame is bigger than allowed for, or the file ends in it
+            if (available >= maxFrameBytes && maxFrameBytes < FLAC_MAX_FRAME_BYTES)
+            {
+                maxFrameBytes *= 2;
+                continue;
+            }
+            if (available < maxFrameBytes)
+            {
+                return false;
+            }
+            valid = false;
+        }
+        else
+        {
+            valid = valid && crc16(data, frameBytes - 2) == readBE(data + frameBytes - 2, 2);
+        }
+
+        decodedFrame = header.firstFrame;
+        decodedFrames = header.blockSize;
+        if (!valid)
+        {
+            // Silence in its place, decoding picks up at the next frame header
+            std::fill(decoded.begin(), decoded.end(), 0);
+            cursor += 2;
+            return true;
+        }
+        addSeekPoint(header.firstFrame, bufferOffset + cursor);
+        cursor += frameBytes;
+
+        Sint32 *left = decoded.data();
+        Sint32 *right = decoded.data() + maxBlockSize;
+        int count = header.blockSize;
+        switch (header.channelAssignment)
+        {
+        case 8: // Left and side
+            for (int i = 0; i < count; i++)
+            {
+                right[i] = left[i] - right[i];
+            }
+            break;
+        case 9: // Side and right
+            for (int i = 0; i < count; i++)
+            {
+                left[i] += right[i];
+            }
+            break;
+        case 10: // Mid and side
+            for (int i = 0; i < count; i++)
+            {
+                Sint32 side = right[i];
+                Sint32 mid = (Sint32)((Uint32)left[i] << 1) | (side & 1);
+                left[i] = (mid + side) >> 1;
+                right[i] = (mid - side) >> 1;
+            }
+            break;
+        }
+        return true;
+    }
+}
+
+// First valid frame header in file bytes [from, limit)
+bool AudioFileReader::findFrame(Uint64 from, Uint64 limit, SeekPoint &found)
+{
+    std::vector<Uint8> window((size_t)SDL_min(limit - from + 16, (Uint64)maxFrameBytes * 2 + 16));
+    if (SDL_RWseek(file, (Sint64)from, RW_SEEK_SET) != (Sint64)from)
+    {
+        return false;
+    }
+    size_t got = SDL_RWread(file, window.data(), 1, window.size());
+    FrameHeader header;
+    for (size_t i = 0; i + 1 < got && from + i < limit; i++)
+    {
+        if (window[i] == 0xFF && (window[i + 1] & 0xFE) == 0xF8 && parseFrameHeader(&window[i], got - i, header) &&
+            (totalFrames == 0 || header.firstFrame < totalFrames))
+        {
+            found = {header.firstFrame, from + i};
+            return true;
+        }
+    }
+    return false;
+}
+
+bool AudioFileReader::seekFlac(Uint64 frame)
+{
+    // Close ahead of what is decoded, reading on gets there fastest
+    if (decodedFrames > 0 && frame >= decodedFrame && frame < decodedFrame + decodedFrames + (Uint64)rate)
+    {
+        position = frame;
+        return true;
+    }
+
+    SeekPoint low = {0, firstFrameOffset};
+    SeekPoint high = {totalFrames, (Uint64)fileSize};
+    for (const SeekPoint &point : points)
+    {
+        if (point.frame <= frame)
+        {
+            low = point;
+        }
+        else
+        {
+            high = point;
+            break;
+        }
+    }
+
+    // Too far from a known point: bisect, guessing the offset from the
+    // average bitrate between the two ends
+    Uint64 close = (Uint64)rate * SEEK_POINT_SECONDS;
+    for (int step = 0; step < 32 && frame - low.frame > close && high.frame > low.frame && high.offset - low.offset > 2 * maxFrameBytes;
+         step++)
+    {
+        double fraction = (double)(frame - low.frame) / (double)(high.frame - low.frame);
+        Uint64 guess = low.offset + (Uint64)(fraction * (double)(high.offset - low.offset));
+        guess = SDL_clamp(guess, low.offset + 1, high.offset - 1);
+        SeekPoint found;
+        if (!findFrame(guess, high.offset, found) || found.frame <= low.frame || found.frame >= high.frame)
+        {
+            high.offset = guess;
+            continue;
+        }
+        addSeekPoint(found.frame, found.offset);
+        if (found.frame <= frame)
+        {
+            low = found;
+        }
+        else
+        {
+            high = found;
+        }
+    }
+
+    restartAt(low.frame, low.offset);
+    position = frame;
+    return true;
+}
@@ -0,0 +1,184 @@
+#ifndef AUDIOFILE_H
+#define AUDIOFILE_H
+
+#include <SDL2/SDL.h>
+#include <string>
+#include <vector>
+
+class CodecReader;
+
+// Where decoding can resume: the first frame of a FLAC block or of an MPEG
+// frame, before the encoder delay is cut, or a Vorbis position, at a byte
+// offset counted from the start of the file
+struct SeekPoint
+{
+    Uint64 frame;
+    Uint64 offset;
+};
+
+// What a reader learned about seeking in a file, kept between runs for
+// streamed files. Only MP3 has to take the length from it.
+struct SeekTable
+{
+    Uint64 frames = 0;
+    std::vector<SeekPoint> points;
+};
+
+// Writes rendered audio to a WAV or FLAC file, picked by the extension of
+// the path. WAV keeps the samples exactly as rendered: 16-bit PCM for
+// AUDIO_S16SYS, 32-bit IEEE float for AUDIO_F32SYS. FLAC stores 16-bit
+// audio as it is and float rounded to 24 bits, clamped to full scale.
+//
+// The FLAC encoder is deliberately small: fixed blocks of 4096 frames,
+// channels coded independently, each with the best of FLAC's fixed
+// predictors (order 0 to 4) and Rice coded residuals in up to 16
+// partitions. The MD5 signature is left empty, which decoders accept.
+class AudioFileWriter
+{
+public:
+    ~AudioFileWriter() { close(); }
+
+    // Prints the error and returns false if the file can not be created or
+    // the extension is neither .wav nor .flac
+    bool open(const std::string &path, int frequency, Uint16 format, int channels);
+    // Interleaved frames in the format given to open()
+    bool write(const Uint8 *pcm, int bytes);
+    // Finishes the headers; returns false if anything failed to be written
+    bool close();
+
+    Uint64 frames() const { return frameCount; }
+
+private:
+    bool writeWavHeader();
+    bool writeFlacHeader();
+    bool encodeFlacBlock(int frames);
+
+    SDL_RWops *file = nullptr;
+    bool flac = false;
+    bool failed = false;
+    int frequency = 0;
+    Uint16 format = 0;
+    int channels = 0;
+    int bitsPerSample = 0;
+    Uint64 frameCount = 0;
+
+    // FLAC
+    std::vector<Sint32> block; // Interleaved, up to one block waiting to be encoded
+    int blockFrames = 0;
+    Uint32 flacFrameNumber = 0;
+    std::vector<Uint8> encoded;
+    std::vector<Sint32> channelSamples;
+    std::vector<Sint32> residual;
+};
+
+// Decodes WAV (also RF64 and WAVE_FORMAT_EXTENSIBLE) and FLAC files a
+// piece at a time, as interleaved float at the file's own rate, and MP3 and
+// Ogg Vorbis through a CodecReader. Used where SDL_mixer would decode the
+// whole file into memory, which does not fit for very long files, and
+// converts it to the device format on the way. Everything else is left to
+// SDL_mixer.
+//
+// A WAV file seeks by arithmetic. A FLAC frame can only be found by
+// decoding or by searching for its header, so the reader keeps seek points:
+// those of the file's SEEKTABLE, one every SEEK_POINT_SECONDS of what it
+// decodes, and any given with addSeekPoints(). A seek starts from the
+// closest point before the target and bisects the file for a frame header
+// if that is still far away.
+class AudioFileReader
+{
+public:
+    static const int SEEK_POINT_SECONDS = 10;
+
+    ~AudioFileReader() { close(); }
+
+    // Quiet on failure: returns false for anything that is not a file this
+    // reader can decode. A table kept from an earlier run of the same file
+    // saves an MP3 the read through on opening.
+    bool open(const std::string &path, const SeekTable *stored = nullptr);
+    void close();
+
+    // Up to frames frames from the current position on, fewer at the end.
+    // A FLAC frame that fails its checksum plays as silence.
+    Uint32 read(float *output, Uint32 frames);
+    bool seek(Uint64 frame);
+
+    int frequency() const { return rate; }
+    int channelCount() const { return channels; }
+    // 0 if the file does not say
+    Uint64 length() const { return totalFrames; }
+    Uint64 tell() const { return position; }
+    // Whether seekTable() has anything worth keeping: WAV seeks by arithmetic
+    bool hasSeekTable() const { return flac || codec != nullptr; }
+
+    // Points sorted by frame
+    SeekTable seekTable() const;
+    void addSeekPoints(const std::vector<SeekPoint> &more);
+
+    // Empty if the file has no such tag
+    const std::string &title() const { return titleTag; }
+    const std::string &artist() const { return artistTag; }
+    const std::string &album() const { return albumTag; }
+
+private:
+    struct FrameHeader
+    {
+        Uint64 firstFrame;
+        int blockSize;
+        int channelAssignment;
+        int bitsPerSample;
+        size_t headerBytes;
+    };
+
+    bool openWav();
+    bool openFlac();
+    void readInfoTags(Sint64 offset, Uint64 size);
+    void readVorbisComment(const std::vector<Uint8> &body);
+    Uint32 readWav(float *output, Uint32 frames);
+    bool fill(size_t bytes);
+    bool seekFlac(Uint64 frame);
+    void restartAt(Uint64 frame, Uint64 offset);
+    bool parseFrameHeader(const Uint8 *data, size_t available, FrameHeader &header) const;
+    bool decodeFrame();
+    bool findFrame(Uint64 from, Uint64 limit, SeekPoint &found);
+    void addSeekPoint(Uint64 frame, Uint64 offset);
+
+    SDL_RWops *file = nullptr;
+    CodecReader *codec = nullptr; // MP3 and Ogg Vorbis, file is closed then
+    bool flac = false;
+    int rate = 0;
+    int channels = 0;
+    int bitsPerSample = 0;
+    Uint64 totalFrames = 0;
+    Uint64 position = 0; // Next frame read() returns
+    Sint64 fileSize = 0;
+    std::string titleTag;
+    std::string artistTag;
+    std::string albumTag;
+
+    // WAV
+    Sint64 dataOffset = 0;
+    int blockAlign = 0;
+    bool isFloat = false;
+    std::vector<Uint8> bytes;
+
+    // FLAC: file bytes [bufferOffset, bufferOffset + bufferFill) are buffered
+    Uint64 firstFrameOffset = 0;
+    int minBlockSize = 0;
+    int maxBlockSize = 0;
+    size_t maxFrameBytes = 0;
+    std::vector<Uint8> buffer;
+    Uint64 bufferOffset = 0;
+    size_t bufferFill = 0;
+    size_t cursor = 0; // Start of the next frame in buffer
+    std::vector<Sint32> decoded; // Planar, maxBlockSize per channel
+    std::vector<Sint32> residual;
+    Uint64 decodedFrame = 0; // Stream frame of decoded[0]
+    int decodedFrames = 0;
+    std::vector<SeekPoint> points;
+};
+
+// Takes the title, artist or album from a Vorbis comment like "TITLE=Song",
+// as FLAC and Ogg files keep their tags. The first of each wins.
+void takeVorbisCommentTag(const std::string &comment, std::string &title, std::string &artist, std::string &album);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef BITWRITER_H
+#define BITWRITER_H
+
+#include <SDL2/SDL.h>
+#include <vector>
+
+// Appends bit fields to a byte vector, most significant bit first, as both
+// the track cache's packed PCM and FLAC lay them out
+class BitWriter
+{
+public:
+    explicit BitWriter(std::vector<Uint8> &out) : out(out) {}
+
+    // Up to 32 bits at a time; value must fit in them
+    void put(Uint32 value, int bits)
+    {
+        accumulator = accumulator << bits | value;
+        count += bits;
+        while (count >= 8)
+        {
+            count -= 8;
+            out.push_back((Uint8)(accumulator >> count));
+        }
+    }
+
+    // Pads the last byte with zero bits
+    void flush()
+    {
+        if (count > 0)
+        {
+            out.push_back((Uint8)(accumulator << (8 - count)));
+            count = 0;
+        }
+    }
+
+private:
+    std::vector<Uint8> &out;
+    Uint64 accumulator = 0;
+    int count = 0;
+};
+
+#endif
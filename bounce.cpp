@@ -0,0 +1,97 @@
+#include "bounce.h"
+
+#include <iostream>
+
+const int BOUNCE_BLOCK_FRAMES = 1024; // Rendered per engine call, like a device buffer
+
+// The next track of paths that loads, nullptr when none is left
+static Track *loadNextTrack(const std::vector<std::string> &paths, size_t &index, BounceStats &stats)
+{
+    while (index < paths.size())
+    {
+        Uint64 begin = SDL_GetPerformanceCounter();
+        Track *track = loadTrack(paths[index++]);
+        stats.decodeSeconds += (double)(SDL_GetPerformanceCounter() - begin) / SDL_GetPerformanceFrequency();
+        if (track != nullptr)
+        {
+            return track;
+        }
+        stats.failed++;
+    }
+    return nullptr;
+}
+
+bool bounceTracks(AudioEngine &engine, const std::vector<std::string> &paths, float (*gainOf)(const Track *),
+                  AudioFileWriter &writer, BounceStats &stats)
+{
+    Uint64 begin = SDL_GetPerformanceCounter();
+    size_t index = 0;
+    Track *first = loadNextTrack(paths, index, stats);
+    if (first == nullptr)
+    {
+        std::cout << "Nothing to bounce: no track could be loaded" << std::endl;
+        return false;
+    }
+    engine.play(first, gainOf != nullptr ? gainOf(first) : 1.0f);
+    Track *pending = loadNextTrack(paths, index, stats);
+    if (pending != nullptr)
+    {
+        engine.setNext(pending, gainOf != nullptr ? gainOf(pending) : 1.0f);
+    }
+
+    // Output frames [skip, end) of the rendered stream go to the file
+    int frameBytes = engine.frameBytes();
+    std::vector<Uint8> buffer((size_t)BOUNCE_BLOCK_FRAMES * frameBytes);
+    Uint64 skip = engine.outputLatencyFrames();
+    Uint64 end = SDL_MAX_UINT64;
+    Uint64 rendered = 0;
+    bool written = true;
+    while (rendered < end && written)
+    {
+        engine.renderOffline(buffer.data(), (int)buffer.size());
+        EngineEvent event;
+        while (engine.pollEvent(event))
+        {
+            if (event.type == ENGINE_TRACK_STARTED)
+            {
+                stats.tracks++;
+                if (event.track == pending)
+                {
+                    // Preload the one after it while it plays
+                    pending = loadNextTrack(paths, index, stats);
+                    if (pending != nullptr)
+                    {
+                        engine.setNext(pending, gainOf != nullptr ? gainOf(pending) : 1.0f);
+                    }
+                }
+            }
+            else if (event.type == ENGINE_TRACK_RELEASED)
+            {
+                freeTrack(event.track);
+            }
+            else if (event.type == ENGINE_DRAINED && pending == nullptr)
+            {
+                // Let the last frames out of the post-mix delay too
+                end = event.streamFrame + skip;
+            }
+        }
+
+        // Only now is it known whether the audio ended inside this block
+        Uint64 from = SDL_max(rendered, skip);
+        Uint64 to = SDL_min(rendered + BOUNCE_BLOCK_FRAMES, end);
+        if (to > from)
+        {
+            written = writer.write(buffer.data() + (from - rendered) * frameBytes, (int)((to - from) * frameBytes));
+            stats.frames += to - from;
+        }
+        rendered += BOUNCE_BLOCK_FRAMES;
+    }
+
+    stats.wallSeconds = (double)(SDL_GetPerformanceCounter() - begin) / SDL_GetPerformanceFrequency();
+    stats.audioSeconds = (double)stats.frames / engine.frequency();
+    if (!written)
+    {
+        std::cout << "Failed to write the bounced audio" << std::endl;
+    }
+    return written;
+}
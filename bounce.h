@@ -0,0 +1,35 @@
+#ifndef BOUNCE_H
+#define BOUNCE_H
+
+#include <SDL2/SDL.h>
+#include <string>
+#include <vector>
+#include "audioengine.h"
+#include "audiofile.h"
+
+struct BounceStats
+{
+    Uint32 tracks = 0; // Started
+    Uint32 failed = 0; // Could not be loaded
+    Uint64 frames = 0; // Written to the file
+    double audioSeconds = 0.0;
+    double wallSeconds = 0.0;
+    double decodeSeconds = 0.0; // Part of the wall time spent loading tracks
+
+    double realtimeFactor() const { return wallSeconds > 0.0 ? audioSeconds / wallSeconds : 0.0; }
+};
+
+// Plays paths back to back through an engine started with startOffline()
+// and writes everything it renders to writer, as fast as the CPU allows.
+// Tracks are loaded on this thread while the engine waits, the next one as
+// soon as the previous one started, exactly as the player preloads them, so
+// transitions and crossfades come out as they would sound. gainOf supplies
+// each track's own gain (e.g. ReplayGain) and may be nullptr. The delay of
+// the post-mix processing is trimmed, so the file starts with the first
+// track and ends with the last one. The same input and settings always
+// give the same file, which makes it a regression test for the playback
+// path. Returns false if nothing could be played or written.
+bool bounceTracks(AudioEngine &engine, const std::vector<std::string> &paths, float (*gainOf)(const Track *),
+                  AudioFileWriter &writer, BounceStats &stats);
+
+#endif
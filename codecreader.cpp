@@ -0,0 +1,692 @@
+#include "codecreader.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+#if defined(_WIN32)
+static const char *MPG123_LIBRARY = "libmpg123-0.dll";
+static const char *VORBISFILE_LIBRARY = "libvorbisfile-3.dll";
+#elif defined(__APPLE__)
+static const char *MPG123_LIBRARY = "libmpg123.0.dylib";
+static const char *VORBISFILE_LIBRARY = "libvorbisfile.3.dylib";
+#else
+static const char *MPG123_LIBRARY = "libmpg123.so.0";
+static const char *VORBISFILE_LIBRARY = "libvorbisfile.so.3";
+#endif
+
+const Uint32 DECODE_FRAMES = 4096; // Per call into the library
+const int MAX_CHANNELS = 8;
+const long MPG123_INDEX_ENTRIES = 4096; // A step of 9 s in a 10 hour file
+
+// The parts of mpg123.h used here
+const int MPG123_OK = 0;
+const int MPG123_NEW_FORMAT = -11;
+const int MPG123_ADD_FLAGS = 2;
+const int MPG123_INDEX_SIZE = 15;
+const long MPG123_QUIET = 0x20;
+const long MPG123_GAPLESS = 0x40;
+const int MPG123_MONO = 1;
+const int MPG123_STEREO = 2;
+const int MPG123_ENC_FLOAT_32 = 0x200;
+const int MPG123_ID3 = 0x3;
+
+struct Mpg123String
+{
+    char *p;
+    size_t size;
+    size_t fill; // Including the terminating zero
+};
+
+struct Mpg123Id3v1
+{
+    char tag[3];
+    char title[30];
+    char artist[30];
+    char album[30];
+    char year[4];
+    char comment[30];
+    unsigned char genre;
+};
+
+struct Mpg123Id3v2
+{
+    unsigned char version;
+    Mpg123String *title;
+    Mpg123String *artist;
+    Mpg123String *album;
+    // More follows that is not used here
+};
+
+// Sample and byte offsets are off_t in mpg123 1.31 and before. Those are
+// taken in the _64 variants where the library has them, as 64-bit Linux
+// and Windows builds with large file support do, else as a long. 1.32 has
+// int64_t versions that are preferred.
+struct Mpg123
+{
+    bool loaded = false;
+    int (*init)();
+    void *(*create)(const char *decoder, int *error);
+    void (*destroy)(void *handle);
+    int (*param)(void *handle, int type, long value, double floatValue);
+    int (*formatNone)(void *handle);
+    int (*format)(void *handle, long rate, int channels, int encodings);
+    int (*open)(void *handle, const char *path);
+    int (*close)(void *handle);
+    int (*getFormat)(void *handle, long *rate, int *channels, int *encoding);
+    int (*read)(void *handle, void *output, size_t bytes, size_t *done);
+    int (*scan)(void *handle);
+    int (*samplesPerFrame)(void *handle);
+    int (*metaCheck)(void *handle);
+    int (*id3)(void *handle, Mpg123Id3v1 **v1, Mpg123Id3v2 **v2);
+
+    Sint64 (*seek64)(void *handle, Sint64 frame, int whence);
+    Sint64 (*length64)(void *handle);
+    int (*index64)(void *handle, Sint64 **offsets, Sint64 *step, size_t *fill);
+    int (*setIndex64)(void *handle, Sint64 *offsets, Sint64 step, size_t fill);
+    long (*seekLong)(void *handle, long frame, int whence);
+    long (*lengthLong)(void *handle);
+    int (*indexLong)(void *handle, long **offsets, long *step, size_t *fill);
+    int (*setIndexLong)(void *handle, long *offsets, long step, size_t fill);
+};
+
+// The parts of vorbisfile.h used here. An OggVorbis_File is allocated by
+// the caller; it is well under VORBIS_FILE_BYTES with every ABI.
+const size_t VORBIS_FILE_BYTES = 4096;
+const long OV_HOLE = -3;
+
+struct VorbisCallbacks
+{
+    size_t (*read)(void *buffer, size_t size, size_t count, void *source);
+    int (*seek)(void *source, Sint64 offset, int whence);
+    int (*close)(void *source);
+    long (*tell)(void *source);
+};
+
+struct VorbisInfo
+{
+    int version;
+    int channels;
+    long rate;
+    // More follows that is not used here
+};
+
+struct VorbisComment
+{
+    char **userComments;
+    int *commentLengths;
+    int comments;
+    char *vendor;
+};
+
+struct Vorbisfile
+{
+    bool loaded = false;
+    int (*openCallbacks)(void *source, void *file, const char *initial, long initialBytes, VorbisCallbacks callbacks);
+    int (*clear)(void *file);
+    long (*streams)(void *file);
+    VorbisInfo *(*info)(void *file, int link);
+    VorbisComment *(*comment)(void *file, int link);
+    Sint64 (*pcmTotal)(void *file, int link);
+    long (*readFloat)(void *file, float ***pcm, int frames, int *link);
+    int (*pcmSeek)(void *file, Sint64 frame);
+    Sint64 (*pcmTell)(void *file);
+    int (*rawSeek)(void *file, Sint64 offset);
+    Sint64 (*rawTell)(void *file);
+};
+
+template <typename Function>
+static bool resolve(void *library, Function &function, const char *name)
+{
+    function = library != nullptr ? (Function)SDL_LoadFunction(library, name) : nullptr;
+    return function != nullptr;
+}
+
+// Loaded once and kept until the program ends
+static const Mpg123 *mpg123Library()
+{
+    static Mpg123 library = []() {
+        Mpg123 mpg123;
+        void *object = SDL_LoadObject(MPG123_LIBRARY);
+        bool found = resolve(object, mpg123.init, "mpg123_init") && resolve(object, mpg123.create, "mpg123_new") &&
+                     resolve(object, mpg123.destroy, "mpg123_delete") && resolve(object, mpg123.param, "mpg123_param") &&
+                     resolve(object, mpg123.formatNone, "mpg123_format_none") &&
+                     resolve(object, mpg123.format, "mpg123_format") && resolve(object, mpg123.close, "mpg123_close") &&
+                     resolve(object, mpg123.getFormat, "mpg123_getformat") && resolve(object, mpg123.read, "mpg123_read") &&
+                     resolve(object, mpg123.scan, "mpg123_scan") && resolve(object, mpg123.samplesPerFrame, "mpg123_spf") &&
+                     resolve(object, mpg123.metaCheck, "mpg123_meta_check") && resolve(object, mpg123.id3, "mpg123_id3");
+        if (found && resolve(object, mpg123.seek64, "mpg123_seek64") && resolve(object, mpg123.length64, "mpg123_length64") &&
+            resolve(object, mpg123.index64, "mpg123_index64") && resolve(object, mpg123.setIndex64, "mpg123_set_index64"))
+        {
+            found = resolve(object, mpg123.open, "mpg123_open");
+        }
+        else if (found && resolve(object, mpg123.seek64, "mpg123_seek_64") &&
+                 resolve(object, mpg123.length64, "mpg123_length_64") && resolve(object, mpg123.index64, "mpg123_index_64") &&
+                 resolve(object, mpg123.setIndex64, "mpg123_set_index_64"))
+        {
+            found = resolve(object, mpg123.open, "mpg123_open_64");
+        }
+        else
+        {
+            mpg123.seek64 = nullptr;
+            found = found && resolve(object, mpg123.seekLong, "mpg123_seek") &&
+                    resolve(object, mpg123.lengthLong, "mpg123_length") && resolve(object, mpg123.indexLong, "mpg123_index") &&
+                    resolve(object, mpg123.setIndexLong, "mpg123_set_index") && resolve(object, mpg123.open, "mpg123_open");
+        }
+        mpg123.loaded = found && mpg123.init() == MPG123_OK;
+        return mpg123;
+    }();
+    return library.loaded ? &library : nullptr;
+}
+
+static const Vorbisfile *vorbisfileLibrary()
+{
+    static Vorbisfile library = []() {
+        Vorbisfile vorbisfile;
+        void *object = SDL_LoadObject(VORBISFILE_LIBRARY);
+        vorbisfile.loaded =
+            resolve(object, vorbisfile.openCallbacks, "ov_open_callbacks") && resolve(object, vorbisfile.clear, "ov_clear") &&
+            resolve(object, vorbisfile.streams, "ov_streams") && resolve(object, vorbisfile.info, "ov_info") &&
+            resolve(object, vorbisfile.comment, "ov_comment") && resolve(object, vorbisfile.pcmTotal, "ov_pcm_total") &&
+            resolve(object, vorbisfile.readFloat, "ov_read_float") && resolve(object, vorbisfile.pcmSeek, "ov_pcm_seek") &&
+            resolve(object, vorbisfile.pcmTell, "ov_pcm_tell") && resolve(object, vorbisfile.rawSeek, "ov_raw_seek") &&
+            resolve(object, vorbisfile.rawTell, "ov_raw_tell");
+        return vorbisfile;
+    }();
+    return library.loaded ? &library : nullptr;
+}
+
+static Sint64 mpg123Seek(const Mpg123 *mpg123, void *handle, Uint64 frame)
+{
+    return mpg123->seek64 != nullptr ? mpg123->seek64(handle, (Sint64)frame, RW_SEEK_SET)
+                                     : mpg123->seekLong(handle, (long)frame, RW_SEEK_SET);
+}
+
+static Sint64 mpg123Length(const Mpg123 *mpg123, void *handle)
+{
+    return mpg123->seek64 != nullptr ? mpg123->length64(handle) : mpg123->lengthLong(handle);
+}
+
+static size_t vorbisRead(void *buffer, size_t size, size_t count, void *source)
+{
+    return SDL_RWread(static_cast<SDL_RWops *>(source), buffer, size, count);
+}
+
+static int vorbisSeek(void *source, Sint64 offset, int whence)
+{
+    return SDL_RWseek(static_cast<SDL_RWops *>(source), offset, whence) < 0 ? -1 : 0;
+}
+
+static long vorbisTell(void *source)
+{
+    return (long)SDL_RWtell(static_cast<SDL_RWops *>(source));
+}
+
+// Vorbis orders the center before the right channel and the LFE last,
+// WAV and FLAC the other way round. Indexed by the Vorbis channel.
+static const int VORBIS_TO_WAV[MAX_CHANNELS + 1][MAX_CHANNELS] = {
+    {},
+    {0},
+    {0, 1},
+    {0, 2, 1},
+    {0, 1, 2, 3},
+    {0, 2, 1, 3, 4},
+    {0, 2, 1, 4, 5, 3},
+    {0, 2, 1, 5, 6, 4, 3},
+    {0, 2, 1, 6, 7, 4, 5, 3},
+};
+
+static bool hasExtension(const std::string &path, const char *extension)
+{
+    size_t length = strlen(extension);
+    if (path.size() < length)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++)
+    {
+        if (tolower((unsigned char)path[path.size() - length + i]) != extension[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// ID3v1 is Latin-1, everything else here is UTF-8
+static std::string fromLatin1(const char *text, size_t size)
+{
+    std::string result;
+    for (size_t i = 0; i < size && text[i] != '\0'; i++)
+    {
+        unsigned char c = (unsigned char)text[i];
+        if (c < 0x80)
+        {
+            result += (char)c;
+        }
+        else
+        {
+            result += (char)(0xC0 | c >> 6);
+            result += (char)(0x80 | (c & 0x3F));
+        }
+    }
+    while (!result.empty() && result.back() == ' ')
+    {
+        result.pop_back();
+    }
+    return result;
+}
+
+static std::string fromMpg123(const Mpg123String *text)
+{
+    return text != nullptr && text->p != nullptr && text->fill > 1 ? std::string(text->p, text->fill - 1) : std::string();
+}
+
+bool CodecReader::open(const std::string &path, const SeekTable *stored)
+{
+    close();
+    SDL_RWops *probe = SDL_RWFromFile(path.c_str(), "rb");
+    if (probe == nullptr)
+    {
+        return false;
+    }
+    Uint8 header[64] = {};
+    size_t size = SDL_RWread(probe, header, 1, sizeof(header));
+    SDL_RWclose(probe);
+
+    // mpg123 takes anything as MP3 after searching it for a frame, so only
+    // files that look like one are handed to it
+    bool opened = false;
+    if (size >= 28 && memcmp(header, "OggS", 4) == 0)
+    {
+        size_t packet = 27 + header[26];
+        if (packet + 7 <= size && memcmp(header + packet, "\x01vorbis", 7) == 0)
+        {
+            opened = openVorbis(path);
+        }
+    }
+    else if ((size >= 3 && memcmp(header, "ID3", 3) == 0) || (size >= 2 && header[0] == 0xFF && (header[1] & 0xE0) == 0xE0) ||
+             hasExtension(path, ".mp3"))
+    {
+        opened = openMp3(path, stored);
+    }
+    if (!opened)
+    {
+        close();
+    }
+    return opened;
+}
+
+void CodecReader::close()
+{
+    if (mpg123 != nullptr)
+    {
+        const Mpg123 *library = mpg123Library();
+        library->close(mpg123);
+        library->destroy(mpg123);
+        mpg123 = nullptr;
+    }
+    if (!vorbis.empty())
+    {
+        vorbisfileLibrary()->clear(vorbis.data());
+        vorbis.clear();
+    }
+    if (file != nullptr)
+    {
+        SDL_RWclose(file);
+        file = nullptr;
+    }
+    rate = 0;
+    channels = 0;
+    totalFrames = 0;
+    position = 0;
+    points.clear();
+    titleTag.clear();
+    artistTag.clear();
+    albumTag.clear();
+}
+
+bool CodecReader::openMp3(const std::string &path, const SeekTable *stored)
+{
+    const Mpg123 *library = mpg123Library();
+    int error = 0;
+    mpg123 = library != nullptr ? library->create(nullptr, &error) : nullptr;
+    if (mpg123 == nullptr)
+    {
+        return false;
+    }
+
+    // Float at the file's own rate and channel count, encoder delay and padding cut
+    static const long rates[] = {8000, 11025, 12000, 16000, 22050, 24000, 32000, 44100, 48000};
+    library->param(mpg123, MPG123_ADD_FLAGS, MPG123_QUIET | MPG123_GAPLESS, 0.0);
+    library->param(mpg123, MPG123_INDEX_SIZE, MPG123_INDEX_ENTRIES, 0.0);
+    library->formatNone(mpg123);
+    for (long fileRate : rates)
+    {
+        library->format(mpg123, fileRate, MPG123_MONO | MPG123_STEREO, MPG123_ENC_FLOAT_32);
+    }
+    long fileRate = 0;
+    int encoding = 0;
+    if (library->open(mpg123, path.c_str()) != MPG123_OK ||
+        library->getFormat(mpg123, &fileRate, &channels, &encoding) != MPG123_OK || encoding != MPG123_ENC_FLOAT_32)
+    {
+        return false;
+    }
+    rate = (int)fileRate;
+
+    // The length in the headers is an estimate unless the encoder wrote a
+    // LAME tag, and seeking to a frame that is not indexed yet reads every
+    // frame before it. A scan settles both.
+    if (stored == nullptr || !restoreIndex(*stored))
+    {
+        if (library->scan(mpg123) != MPG123_OK)
+        {
+            return false;
+        }
+        Sint64 length = mpg123Length(library, mpg123);
+        totalFrames = length > 0 ? (Uint64)length : 0;
+    }
+    if (totalFrames == 0 || mpg123Seek(library, mpg123, 0) != 0)
+    {
+        return false;
+    }
+
+    Mpg123Id3v1 *v1 = nullptr;
+    Mpg123Id3v2 *v2 = nullptr;
+    if ((library->metaCheck(mpg123) & MPG123_ID3) != 0 && library->id3(mpg123, &v1, &v2) == MPG123_OK)
+    {
+        if (v2 != nullptr)
+        {
+            titleTag = fromMpg123(v2->title);
+            artistTag = fromMpg123(v2->artist);
+            albumTag = fromMpg123(v2->album);
+        }
+        if (v1 != nullptr && memcmp(v1->tag, "TAG", 3) == 0)
+        {
+            titleTag = titleTag.empty() ? fromLatin1(v1->title, sizeof(v1->title)) : titleTag;
+            artistTag = artistTag.empty() ? fromLatin1(v1->artist, sizeof(v1->artist)) : artistTag;
+            albumTag = albumTag.empty() ? fromLatin1(v1->album, sizeof(v1->album)) : albumTag;
+        }
+    }
+    return true;
+}
+
+// Hands a frame index from seekTable() back to mpg123, which takes it as is
+bool CodecReader::restoreIndex(const SeekTable &stored)
+{
+    const Mpg123 *library = mpg123Library();
+    Uint64 samplesPerFrame = (Uint64)library->samplesPerFrame(mpg123);
+    if (stored.frames == 0 || stored.points.empty() || samplesPerFrame == 0 || stored.points[0].frame != 0)
+    {
+        return false;
+    }
+    Uint64 step = stored.points.size() > 1 ? stored.points[1].frame / samplesPerFrame : 1;
+    std::vector<Sint64> offsets(stored.points.size());
+    for (size_t i = 0; i < stored.points.size(); i++)
+    {
+        if (step == 0 || stored.points[i].frame != i * step * samplesPerFrame)
+        {
+            return false;
+        }
+        offsets[i] = (Sint64)stored.points[i].offset;
+    }
+    int result;
+    if (library->seek64 != nullptr)
+    {
+        result = library->setIndex64(mpg123, offsets.data(), (Sint64)step, offsets.size());
+    }
+    else
+    {
+        std::vector<long> narrow(offsets.begin(), offsets.end());
+        result = library->setIndexLong(mpg123, narrow.data(), (long)step, narrow.size());
+    }
+    if (result != MPG123_OK)
+    {
+        return false;
+    }
+    totalFrames = stored.frames;
+    return true;
+}
+
+bool CodecReader::openVorbis(const std::string &path)
+{
+    const Vorbisfile *library = vorbisfileLibrary();
+    file = library != nullptr ? SDL_RWFromFile(path.c_str(), "rb") : nullptr;
+    if (file == nullptr)
+    {
+        return false;
+    }
+    // The file is closed here, not by the library
+    VorbisCallbacks callbacks = {vorbisRead, vorbisSeek, nullptr, vorbisTell};
+    std::vector<Uint64> storage(VORBIS_FILE_BYTES / sizeof(Uint64), 0);
+    if (library->openCallbacks(file, storage.data(), nullptr, 0, callbacks) != 0)
+    {
+        return false;
+    }
+    vorbis.swap(storage);
+
+    // Chained files that change the format are left to SDL_mixer
+    VorbisInfo *info = library->info(vorbis.data(), 0);
+    if (info == nullptr || info->channels < 1 || info->channels > MAX_CHANNELS || info->rate <= 0)
+    {
+        return false;
+    }
+    for (long link = 1; link < library->streams(vorbis.data()); link++)
+    {
+        VorbisInfo *other = library->info(vorbis.data(), (int)link);
+        if (other == nullptr || other->channels != info->channels || other->rate != info->rate)
+        {
+            return false;
+        }
+    }
+    rate = (int)info->rate;
+    channels = info->channels;
+    Sint64 length = library->pcmTotal(vorbis.data(), -1);
+    totalFrames = length > 0 ? (Uint64)length : 0;
+
+    VorbisComment *comment = library->comment(vorbis.data(), 0);
+    for (int i = 0; comment != nullptr && i < comment->comments; i++)
+    {
+        std::string entry(comment->userComments[i], comment->commentLengths[i]);
+        takeVorbisCommentTag(entry, titleTag, artistTag, albumTag);
+    }
+    return totalFrames > 0;
+}
+
+Uint32 CodecReader::read(float *output, Uint32 frames)
+{
+    frames = (Uint32)SDL_min((Uint64)frames, totalFrames - SDL_min(position, totalFrames));
+    Uint32 got = mpg123 != nullptr ? readMp3(output, frames) : !vorbis.empty() ? readVorbis(output, frames) : 0;
+    position += got;
+    return got;
+}
+
+Uint32 CodecReader::readMp3(float *output, Uint32 frames)
+{
+    const Mpg123 *library = mpg123Library();
+    size_t frameBytes = (size_t)channels * sizeof(float);
+    size_t wanted = (size_t)frames * frameBytes;
+    size_t filled = 0;
+    while (filled < wanted)
+    {
+        size_t done = 0;
+        int result = library->read(mpg123, (Uint8 *)output + filled, wanted - filled, &done);
+        filled += done;
+        if (result == MPG123_NEW_FORMAT)
+        {
+            // A file that switches between mono and stereo stops there
+            long fileRate;
+            int fileChannels;
+            int encoding;
+            library->getFormat(mpg123, &fileRate, &fileChannels, &encoding);
+            if (fileRate != rate || fileChannels != channels)
+            {
+                break;
+            }
+        }
+        else if (result != MPG123_OK || done == 0)
+        {
+            break; // The end, or damage mpg123 could not get past
+        }
+    }
+    return (Uint32)(filled / frameBytes);
+}
+
+Uint32 CodecReader::readVorbis(float *output, Uint32 frames)
+{
+    const Vorbisfile *library = vorbisfileLibrary();
+    const int *order = VORBIS_TO_WAV[channels];
+    Uint32 written = 0;
+    while (written < frames)
+    {
+        float **pcm = nullptr;
+        int link = 0;
+        long got = library->readFloat(vorbis.data(), &pcm, (int)SDL_min(frames - written, DECODE_FRAMES), &link);
+        if (got == OV_HOLE)
+        {
+            continue; // Pages went missing, decoding picks up behind them
+        }
+        if (got <= 0)
+        {
+            break;
+        }
+        float *target = output + (size_t)written * channels;
+        for (int channel = 0; channel < channels; channel++)
+        {
+            const float *source = pcm[channel];
+            int index = order[channel];
+            for (long i = 0; i < got; i++)
+            {
+                target[(size_t)i * channels + index] = source[i];
+            }
+        }
+        written += (Uint32)got;
+    }
+
+    // Everything up to the page the decoder is in plays out before a raw
+    // seek to it comes back, so the frame is never past where that lands
+    Sint64 frame = library->pcmTell(vorbis.data());
+    Sint64 offset = library->rawTell(vorbis.data());
+    if (frame > 0 && offset > 0)
+    {
+        addSeekPoint((Uint64)frame, (Uint64)offset);
+    }
+    return written;
+}
+
+bool CodecReader::seek(Uint64 frame)
+{
+    frame = SDL_min(frame, totalFrames);
+    if (mpg123 != nullptr)
+    {
+        if (mpg123Seek(mpg123Library(), mpg123, frame) != (Sint64)frame)
+        {
+            return false;
+        }
+    }
+    else if (vorbis.empty() || !seekVorbis(frame))
+    {
+        return false;
+    }
+    position = frame;
+    return true;
+}
+
+// From the closest point before the frame if that is near, decoding what
+// lies between; else vorbisfile bisects the file for the page
+bool CodecReader::seekVorbis(Uint64 frame)
+{
+    const Vorbisfile *library = vorbisfileLibrary();
+    Uint64 spacing = (Uint64)rate * AudioFileReader::SEEK_POINT_SECONDS;
+    auto after = std::upper_bound(points.begin(), points.end(), frame,
+                                  [](Uint64 value, const SeekPoint &point) { return value < point.frame; });
+    if (after != points.begin() && frame - (after - 1)->frame < 2 * spacing &&
+        library->rawSeek(vorbis.data(), (Sint64)(after - 1)->offset) == 0)
+    {
+        Sint64 at = library->pcmTell(vorbis.data());
+        while (at >= 0 && (Uint64)at < frame)
+        {
+            float **pcm;
+            int link;
+            long got = library->readFloat(vorbis.data(), &pcm, (int)SDL_min(frame - (Uint64)at, (Uint64)DECODE_FRAMES), &link);
+            if (got <= 0 && got != OV_HOLE)
+            {
+                break;
+            }
+            at = library->pcmTell(vorbis.data());
+        }
+        if (at >= 0 && (Uint64)at == frame)
+        {
+            return true;
+        }
+    }
+    return library->pcmSeek(vorbis.data(), (Sint64)frame) == 0;
+}
+
+SeekTable CodecReader::seekTable() const
+{
+    SeekTable table;
+    table.frames = totalFrames;
+    if (mpg123 == nullptr)
+    {
+        table.points = points;
+        return table;
+    }
+
+    const Mpg123 *library = mpg123Library();
+    Uint64 samplesPerFrame = (Uint64)library->samplesPerFrame(mpg123);
+    size_t fill = 0;
+    if (library->seek64 != nullptr)
+    {
+        Sint64 *offsets = nullptr;
+        Sint64 step = 0;
+        if (library->index64(mpg123, &offsets, &step, &fill) == MPG123_OK)
+        {
+            for (size_t i = 0; i < fill; i++)
+            {
+                table.points.push_back({i * (Uint64)step * samplesPerFrame, (Uint64)offsets[i]});
+            }
+        }
+    }
+    else
+    {
+        long *offsets = nullptr;
+        long step = 0;
+        if (library->indexLong(mpg123, &offsets, &step, &fill) == MPG123_OK)
+        {
+            for (size_t i = 0; i < fill; i++)
+            {
+                table.points.push_back({i * (Uint64)step * samplesPerFrame, (Uint64)offsets[i]});
+            }
+        }
+    }
+    return table;
+}
+
+void CodecReader::addSeekPoints(const std::vector<SeekPoint> &more)
+{
+    if (!vorbis.empty())
+    {
+        for (const SeekPoint &point : more)
+        {
+            addSeekPoint(point.frame, point.offset);
+        }
+    }
+}
+
+// Keeps the points about SEEK_POINT_SECONDS apart, like AudioFileReader
+void CodecReader::addSeekPoint(Uint64 frame, Uint64 offset)
+{
+    if (frame >= totalFrames)
+    {
+        return;
+    }
+    Uint64 spacing = (Uint64)rate * AudioFileReader::SEEK_POINT_SECONDS;
+    auto after = std::upper_bound(points.begin(), points.end(), frame,
+                                  [](Uint64 value, const SeekPoint &point) { return value < point.frame; });
+    if ((after != points.end() && after->frame - frame < spacing) || (after != points.begin() && frame - (after - 1)->frame < spacing))
+    {
+        return;
+    }
+    points.insert(after, {frame, offset});
+}
@@ -0,0 +1,66 @@
+#ifndef CODECREADER_H
+#define CODECREADER_H
+
+#include <SDL2/SDL.h>
+#include <string>
+#include <vector>
+#include "audiofile.h"
+
+// Decodes MP3 and Ogg Vorbis files a piece at a time for AudioFileReader,
+// with libmpg123 and libvorbisfile, the decoders SDL_mixer itself can be
+// built with. Both are loaded the first time a file needs them, like avrt,
+// so the build does not depend on them; without them those files are left
+// to SDL_mixer, which decodes them whole.
+//
+// An MP3 file has no reliable length or frame table in its headers, so it
+// is read through once when it is opened, unless a seek table kept from
+// that run is given: mpg123's frame index, the offset of every step-th
+// MPEG frame, which takes a seek straight to the frame it needs. Vorbis
+// bisects the file for a seek; it also keeps a point every
+// SEEK_POINT_SECONDS of what it decodes and starts from there when it can.
+class CodecReader
+{
+public:
+    ~CodecReader() { close(); }
+
+    // Quiet on failure, like AudioFileReader::open()
+    bool open(const std::string &path, const SeekTable *stored);
+    void close();
+
+    // Interleaved, channels in WAV order
+    Uint32 read(float *output, Uint32 frames);
+    bool seek(Uint64 frame);
+
+    int frequency() const { return rate; }
+    int channelCount() const { return channels; }
+    Uint64 length() const { return totalFrames; }
+    SeekTable seekTable() const;
+    void addSeekPoints(const std::vector<SeekPoint> &more);
+
+    const std::string &title() const { return titleTag; }
+    const std::string &artist() const { return artistTag; }
+    const std::string &album() const { return albumTag; }
+
+private:
+    bool openMp3(const std::string &path, const SeekTable *stored);
+    bool openVorbis(const std::string &path);
+    bool restoreIndex(const SeekTable &stored);
+    Uint32 readMp3(float *output, Uint32 frames);
+    Uint32 readVorbis(float *output, Uint32 frames);
+    bool seekVorbis(Uint64 frame);
+    void addSeekPoint(Uint64 frame, Uint64 offset);
+
+    void *mpg123 = nullptr;       // mpg123_handle
+    std::vector<Uint64> vorbis;   // Storage for an OggVorbis_File, empty when none is open
+    SDL_RWops *file = nullptr;    // Vorbis reads through it
+    int rate = 0;
+    int channels = 0;
+    Uint64 totalFrames = 0;
+    Uint64 position = 0;
+    std::vector<SeekPoint> points; // Vorbis
+    std::string titleTag;
+    std::string artistTag;
+    std::string albumTag;
+};
+
+#endif
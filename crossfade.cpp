@@ -0,0 +1,55 @@
+#include "crossfade.h"
+
+#include <cmath>
+
+const float HALF_PI = 1.57079632679f;
+
+void crossfadeGains(CrossfadeCurve curve, Uint32 start, int count, Uint32 length, int channels, float scaleOut, float scaleIn,
+                    float *gainOut, float *gainIn)
+{
+    float step = 1.0f / (float)length;
+    for (int frame = 0; frame < count; frame++)
+    {
+        float t = (float)(start + frame) * step;
+        float out;
+        float in;
+        if (curve == CROSSFADE_EQUAL_POWER)
+        {
+            // Keeps the summed power constant for uncorrelated material
+            out = cosf(t * HALF_PI);
+            in = sinf(t * HALF_PI);
+        }
+        else
+        {
+            out = 1.0f - t;
+            in = t;
+        }
+
+        for (int channel = 0; channel < channels; channel++)
+        {
+            gainOut[frame * channels + channel] = out * scaleOut;
+            gainIn[frame * channels + channel] = in * scaleIn;
+        }
+    }
+}
+
+void crossfadeMixS16(Sint16 *__restrict dst, const Sint16 *__restrict a, const Sint16 *__restrict b,
+                     const float *__restrict gainOut, const float *__restrict gainIn, int samples)
+{
+    for (int i = 0; i < samples; i++)
+    {
+        float value = (float)a[i] * gainOut[i] + (float)b[i] * gainIn[i];
+        value = value > 32767.0f ? 32767.0f : value;
+        value = value < -32768.0f ? -32768.0f : value;
+        dst[i] = (Sint16)value;
+    }
+}
+
+void crossfadeMixF32(float *__restrict dst, const float *__restrict a, const float *__restrict b,
+                     const float *__restrict gainOut, const float *__restrict gainIn, int samples)
+{
+    for (int i = 0; i < samples; i++)
+    {
+        dst[i] = a[i] * gainOut[i] + b[i] * gainIn[i];
+    }
+}
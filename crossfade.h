@@ -0,0 +1,33 @@
+#ifndef CROSSFADE_H
+#define CROSSFADE_H
+
+#include <SDL2/SDL.h>
+
+enum CrossfadeCurve
+{
+    CROSSFADE_LINEAR,
+    CROSSFADE_EQUAL_POWER
+};
+
+const int CROSSFADE_MAX_SECONDS = 12;
+
+// Frames processed per kernel call, so gain buffers can live on the stack
+const int CROSSFADE_BLOCK_FRAMES = 256;
+const int CROSSFADE_MAX_CHANNELS = 8;
+
+// Computes the gains of the outgoing and incoming track for `count` frames
+// starting at frame `start` of a fade that lasts `length` frames. Gains are
+// written once per sample (repeated for every channel) and scaled by
+// `scaleOut` and `scaleIn` (the tracks' own gains).
+void crossfadeGains(CrossfadeCurve curve, Uint32 start, int count, Uint32 length, int channels, float scaleOut, float scaleIn,
+                    float *gainOut, float *gainIn);
+
+// dst[i] = a[i] * gainOut[i] + b[i] * gainIn[i], saturated to 16 bits.
+// Written as a flat loop over samples so the compiler can vectorize it.
+void crossfadeMixS16(Sint16 *__restrict dst, const Sint16 *__restrict a, const Sint16 *__restrict b,
+                     const float *__restrict gainOut, const float *__restrict gainIn, int samples);
+// Same for float samples, which keep their headroom and are not clamped
+void crossfadeMixF32(float *__restrict dst, const float *__restrict a, const float *__restrict b,
+                     const float *__restrict gainOut, const float *__restrict gainIn, int samples);
+
+#endif
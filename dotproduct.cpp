@@ -0,0 +1,115 @@
+#include "dotproduct.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DOTPRODUCT_AVX2
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// The portable kernel keeps eight partial sums so the compiler can
+// vectorize it without reassociating
+static float dotPortable(const float *__restrict a, const float *__restrict b, int count)
+{
+    float sums[8] = {};
+    for (int i = 0; i < count; i += 8)
+    {
+        for (int j = 0; j < 8; j++)
+        {
+            sums[j] += a[i + j] * b[i + j];
+        }
+    }
+    return ((sums[0] + sums[4]) + (sums[1] + sums[5])) + ((sums[2] + sums[6]) + (sums[3] + sums[7]));
+}
+
+#ifdef DOTPRODUCT_AVX2
+__attribute__((target("avx2,fma"))) static float dotAvx2(const float *a, const float *b, int count)
+{
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), sum0);
+        sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), sum1);
+    }
+    if (i < count)
+    {
+        sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), sum0);
+    }
+    __m256 sum = _mm256_add_ps(sum0, sum1);
+    __m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+    half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+    half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+    return _mm_cvtss_f32(half);
+}
+#endif
+
+#ifdef __ARM_NEON
+static float dotNeon(const float *a, const float *b, int count)
+{
+    float32x4_t sum0 = vdupq_n_f32(0.0f);
+    float32x4_t sum1 = vdupq_n_f32(0.0f);
+    for (int i = 0; i < count; i += 8)
+    {
+#ifdef __aarch64__
+        sum0 = vfmaq_f32(sum0, vld1q_f32(a + i), vld1q_f32(b + i));
+        sum1 = vfmaq_f32(sum1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+#else
+        sum0 = vmlaq_f32(sum0, vld1q_f32(a + i), vld1q_f32(b + i));
+        sum1 = vmlaq_f32(sum1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+#endif
+    }
+    float32x4_t sum = vaddq_f32(sum0, sum1);
+#ifdef __aarch64__
+    return vaddvq_f32(sum);
+#else
+    float32x2_t pair = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+    return vget_lane_f32(vpadd_f32(pair, pair), 0);
+#endif
+}
+#endif
+
+#ifdef DOTPRODUCT_AVX2
+// The AVX2 kernel uses FMA, which is a separate CPUID flag (leaf 1, ECX bit
+// 12); some CPUs and hypervisors report AVX2 without it
+static bool hasFma()
+{
+    unsigned int eax, ebx, ecx, edx;
+    return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_FMA) != 0;
+}
+#endif
+
+static DotProduct selectKernel(const char **name)
+{
+#ifdef DOTPRODUCT_AVX2
+    if (SDL_HasAVX2() && hasFma())
+    {
+        *name = "AVX2";
+        return dotAvx2;
+    }
+#endif
+#ifdef __ARM_NEON
+    *name = "NEON";
+    return dotNeon;
+#else
+    *name = "portable";
+    return dotPortable;
+#endif
+}
+
+static const char *kernelName = nullptr;
+
+DotProduct dotProductKernel()
+{
+    static const DotProduct selected = selectKernel(&kernelName);
+    return selected;
+}
+
+const char *dotProductKernelName()
+{
+    dotProductKernel();
+    return kernelName;
+}
@@ -0,0 +1,15 @@
+#ifndef DOTPRODUCT_H
+#define DOTPRODUCT_H
+
+#include <SDL2/SDL.h>
+
+// Dot product of two float arrays whose length is a multiple of 8, the
+// inner loop of the resampler and of the time stretcher's similarity search
+typedef float (*DotProduct)(const float *a, const float *b, int count);
+
+// The kernel for the widest instruction set the CPU has (AVX2 with FMA, NEON or
+// portable C++), picked once at runtime
+DotProduct dotProductKernel();
+const char *dotProductKernelName();
+
+#endif
@@ -0,0 +1,284 @@
+#include "dynamics.h"
+
+#include <cmath>
+
+const float COMPRESSOR_THRESHOLD_DB = -20.0f;
+const float COMPRESSOR_RATIO = 2.5f;
+const float COMPRESSOR_KNEE_DB = 6.0f;
+const float COMPRESSOR_MAKEUP_DB = 6.0f;
+const float COMPRESSOR_ATTACK = 0.020f; // Seconds
+const float COMPRESSOR_RELEASE = 0.250f;
+const float LIMITER_RELEASE = 0.060f;
+const float SETTLED_DB = 0.001f;
+
+bool Dynamics::init(int frequency, Uint16 format, int channels, int lookaheadMs)
+{
+    this->format = format;
+    this->channels = channels;
+    if (channels <= 0 || channels > MAX_CHANNELS)
+    {
+        window = 0;
+        latency = 0;
+        return false;
+    }
+
+    attackCoefficient = 1.0f - std::exp(-1.0f / (COMPRESSOR_ATTACK * frequency));
+    releaseCoefficient = 1.0f - std::exp(-1.0f / (COMPRESSOR_RELEASE * frequency));
+    limiterRelease = 1.0f - std::exp(-1.0f / (LIMITER_RELEASE * frequency));
+    compressorGainDb = 0.0f;
+
+    lookaheadMs = SDL_clamp(lookaheadMs, 0, LIMITER_MAX_LOOKAHEAD_MS);
+    window = lookaheadMs > 0 ? SDL_max(lookaheadMs * frequency / 1000, 1) : 0;
+    // The gain for a frame is final window - 1 frames after its peak was
+    // seen, and the peak is seen DETECTOR_DELAY frames after the frame came in
+    latency = window > 0 ? window - 1 + DETECTOR_DELAY : 0;
+
+    // Windowed sinc for the points 1/4, 2/4 and 3/4 of the way from the
+    // middle tap to the next, each normalized to unity gain
+    for (int phase = 0; phase < PHASES; phase++)
+    {
+        double fraction = (phase + 1.0) / (PHASES + 1);
+        double sum = 0.0;
+        for (int tap = 0; tap < TAPS; tap++)
+        {
+            double x = tap - (DETECTOR_DELAY - 1) - fraction;
+            double sinc = std::sin(M_PI * x) / (M_PI * x);
+            double hann = 0.5 + 0.5 * std::cos(M_PI * x / (DETECTOR_DELAY + 0.5));
+            interpolator[phase][tap] = (float)(sinc * hann);
+            sum += sinc * hann;
+        }
+        for (int tap = 0; tap < TAPS; tap++)
+        {
+            interpolator[phase][tap] = (float)(interpolator[phase][tap] / sum);
+        }
+    }
+
+    history.assign((size_t)channels * TAPS * 2, 0.0f);
+    historyPosition = 0;
+    minimumValue.assign(window + 1, 1.0f);
+    minimumIndex.assign(window + 1, 0);
+    minimumHead = 0;
+    minimumCount = 0;
+    gainIndex = 0;
+    released = 1.0f;
+    average.assign(SDL_max(window, 1), 1.0f);
+    averageSum = window;
+    averagePosition = 0;
+    delay.assign((size_t)SDL_max(latency, 1) * channels, 0.0f);
+    delayPosition = 0;
+    return true;
+}
+
+void Dynamics::setCeilingDb(double db)
+{
+    ceiling.store((float)std::pow(10.0, SDL_min(db, 0.0) / 20.0), std::memory_order_relaxed);
+}
+
+void Dynamics::raiseMeter(std::atomic<float> &meter, float db)
+{
+    // Readers reset the meter, so this has to be a read-modify-write
+    float seen = meter.load(std::memory_order_relaxed);
+    while (db > seen && !meter.compare_exchange_weak(seen, db, std::memory_order_relaxed))
+    {
+    }
+}
+
+void Dynamics::process(Uint8 *stream, int len)
+{
+    if ((format != AUDIO_S16SYS && format != AUDIO_F32SYS) || channels <= 0 || channels > MAX_CHANNELS)
+    {
+        return;
+    }
+
+    bool compressing = compressorOn.load(std::memory_order_relaxed) || std::fabs(compressorGainDb) > SETTLED_DB;
+    if (!compressing && window == 0)
+    {
+        return;
+    }
+
+    int sampleBytes = SDL_AUDIO_BITSIZE(format) / 8;
+    int frames = len / (sampleBytes * channels);
+    float block[BLOCK_FRAMES * MAX_CHANNELS];
+    for (int frame = 0; frame < frames; frame += BLOCK_FRAMES)
+    {
+        int count = SDL_min(frames - frame, BLOCK_FRAMES);
+        int offset = frame * channels;
+        float *samples = format == AUDIO_F32SYS ? (float *)stream + offset : block;
+        if (format == AUDIO_S16SYS)
+        {
+            for (int i = 0; i < count * channels; i++)
+            {
+                block[i] = ((Sint16 *)stream)[offset + i] * (1.0f / 32768.0f);
+            }
+        }
+
+        if (compressing)
+        {
+            compress(samples, count);
+        }
+        if (window > 0)
+        {
+            limit(samples, count);
+        }
+
+        if (format == AUDIO_S16SYS)
+        {
+            for (int i = 0; i < count * channels; i++)
+            {
+                float value = block[i] * 32768.0f;
+                value = value > 32767.0f ? 32767.0f : value;
+                value = value < -32768.0f ? -32768.0f : value;
+                ((Sint16 *)stream)[offset + i] = (Sint16)value;
+            }
+        }
+    }
+    frameCount.store(frameCount.load(std::memory_order_relaxed) + frames, std::memory_order_relaxed);
+}
+
+void Dynamics::compress(float *samples, int frames)
+{
+    bool enabled = compressorOn.load(std::memory_order_relaxed);
+    float halfKnee = COMPRESSOR_KNEE_DB * 0.5f;
+    float slope = 1.0f / COMPRESSOR_RATIO - 1.0f;
+    for (int i = 0; i < frames; i++)
+    {
+        float *frame = samples + i * channels;
+        float target = 0.0f;
+        if (enabled)
+        {
+            // Linked: the loudest channel sets the gain for all of them
+            float peak = 1e-6f;
+            for (int channel = 0; channel < channels; channel++)
+            {
+                peak = SDL_max(peak, std::fabs(frame[channel]));
+            }
+            float over = 20.0f * std::log10(peak) - COMPRESSOR_THRESHOLD_DB;
+            float reduction = 0.0f;
+            if (over >= halfKnee)
+            {
+                reduction = slope * over;
+            }
+            else if (over > -halfKnee)
+            {
+                reduction = slope * (over + halfKnee) * (over + halfKnee) / (2.0f * COMPRESSOR_KNEE_DB);
+            }
+            target = reduction + COMPRESSOR_MAKEUP_DB;
+        }
+
+        float coefficient = target < compressorGainDb ? attackCoefficient : releaseCoefficient;
+        compressorGainDb += (target - compressorGainDb) * coefficient;
+        float gain = std::pow(10.0f, compressorGainDb * 0.05f);
+        for (int channel = 0; channel < channels; channel++)
+        {
+            frame[channel] *= gain;
+        }
+    }
+    if (!enabled && std::fabs(compressorGainDb) <= SETTLED_DB)
+    {
+        compressorGainDb = 0.0f;
+    }
+    if (enabled)
+    {
+        raiseMeter(compressorMeter, COMPRESSOR_MAKEUP_DB - compressorGainDb);
+    }
+}
+
+float Dynamics::requiredGain()
+{
+    float limit = ceiling.load(std::memory_order_relaxed);
+    float peak = 0.0f;
+    for (int channel = 0; channel < channels; channel++)
+    {
+        // Oldest first: tap DETECTOR_DELAY - 1 is the frame being judged
+        const float *taps = history.data() + (size_t)channel * TAPS * 2 + historyPosition;
+        peak = SDL_max(peak, std::fabs(taps[DETECTOR_DELAY - 1]));
+        for (int phase = 0; phase < PHASES; phase++)
+        {
+            float value = 0.0f;
+            for (int tap = 0; tap < TAPS; tap++)
+            {
+                value += taps[tap] * interpolator[phase][tap];
+            }
+            peak = SDL_max(peak, std::fabs(value));
+        }
+    }
+    return peak > limit ? limit / peak : 1.0f;
+}
+
+float Dynamics::slidingMinimum(float gain)
+{
+    // Monotonic deque: values increase from head to tail, so the head is the
+    // minimum of the last window gains
+    int capacity = window + 1;
+    while (minimumCount > 0 && minimumValue[(minimumHead + minimumCount - 1) % capacity] >= gain)
+    {
+        minimumCount--;
+    }
+    int tail = (minimumHead + minimumCount) % capacity;
+    minimumValue[tail] = gain;
+    minimumIndex[tail] = gainIndex;
+    minimumCount++;
+    if (minimumIndex[minimumHead] <= gainIndex - window)
+    {
+        minimumHead = (minimumHead + 1) % capacity;
+        minimumCount--;
+    }
+    gainIndex++;
+    return minimumValue[minimumHead];
+}
+
+void Dynamics::limit(float *samples, int frames)
+{
+    float limit = ceiling.load(std::memory_order_relaxed);
+    float smallestGain = 1.0f;
+    Uint64 limited = 0;
+    for (int i = 0; i < frames; i++)
+    {
+        float *frame = samples + i * channels;
+
+        // Newest frame into the detector history, written twice so the last
+        // TAPS frames always sit contiguously from historyPosition on
+        for (int channel = 0; channel < channels; channel++)
+        {
+            float *ring = history.data() + (size_t)channel * TAPS * 2;
+            ring[historyPosition] = frame[channel];
+            ring[historyPosition + TAPS] = frame[channel];
+        }
+        historyPosition = historyPosition + 1 == TAPS ? 0 : historyPosition + 1;
+
+        float held = slidingMinimum(requiredGain());
+        released = held < released ? held : released + (held - released) * limiterRelease;
+
+        averageSum += released - average[averagePosition];
+        average[averagePosition] = released;
+        averagePosition = averagePosition + 1 == window ? 0 : averagePosition + 1;
+        float gain = (float)SDL_min(averageSum / window, 1.0);
+
+        // Swap the frame with the one leaving the delay line and apply the gain
+        float *delayed = delay.data() + (size_t)delayPosition * channels;
+        for (int channel = 0; channel < channels; channel++)
+        {
+            float value = delayed[channel] * gain;
+            delayed[channel] = frame[channel];
+            // The interpolator only estimates the true peak, so clamp what it missed
+            value = value > limit ? limit : value;
+            value = value < -limit ? -limit : value;
+            frame[channel] = value;
+        }
+        delayPosition = delayPosition + 1 == latency ? 0 : delayPosition + 1;
+
+        smallestGain = SDL_min(smallestGain, gain);
+        limited += gain < 0.9999f ? 1 : 0;
+    }
+
+    if (smallestGain < 1.0f)
+    {
+        float reduction = -20.0f * std::log10(smallestGain);
+        raiseMeter(limiterMeter, reduction);
+        if (reduction > limiterPeak.load(std::memory_order_relaxed))
+        {
+            limiterPeak.store(reduction, std::memory_order_relaxed);
+        }
+        limitedCount.store(limitedCount.load(std::memory_order_relaxed) + limited, std::memory_order_relaxed);
+    }
+}
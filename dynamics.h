@@ -0,0 +1,105 @@
+#ifndef DYNAMICS_H
+#define DYNAMICS_H
+
+#include <SDL2/SDL.h>
+#include <atomic>
+#include <vector>
+
+const int LIMITER_DEFAULT_LOOKAHEAD_MS = 5;
+const int LIMITER_MAX_LOOKAHEAD_MS = 50;
+const double LIMITER_DEFAULT_CEILING_DB = -1.0;
+
+// Last stage of the post-mix chain: an optional program compressor followed
+// by a look-ahead true-peak limiter.
+//
+// The compressor is a stereo-linked feed-forward design with a soft knee
+// (-20 dB threshold, 2.5:1, 20 ms attack, 250 ms release) and a fixed 6 dB
+// makeup gain. It glides in and out when toggled.
+//
+// The limiter keeps inter-sample peaks below the ceiling. Every frame's
+// peak is estimated at four times the sample rate with a short windowed
+// sinc interpolator, and the gain it needs is spread over the look-ahead
+// window: a sliding minimum holds it for the whole window, a one-pole
+// release lets it recover, and a moving average of the same length smooths
+// the attack, so the gain has reached its target by the time the peak
+// leaves the delay line. Like a BS.1770 meter, the four times oversampled
+// estimate can read a fraction of a dB low for content near Nyquist. The
+// audio is delayed by the look-ahead plus the interpolator's half length;
+// latencyFrames() tells the playback clock.
+class Dynamics
+{
+public:
+    // Allocates everything; must not run concurrently with process().
+    // lookaheadMs 0 turns the limiter off, which also removes its latency.
+    bool init(int frequency, Uint16 format, int channels, int lookaheadMs);
+    int latencyFrames() const { return latency; }
+    bool limiterEnabled() const { return window > 0; }
+
+    // Any thread
+    void setCeilingDb(double db);
+    void setCompressor(bool enabled) { compressorOn.store(enabled, std::memory_order_relaxed); }
+    bool compressorEnabled() const { return compressorOn.load(std::memory_order_relaxed); }
+
+    // Audio thread. Supports AUDIO_S16SYS and AUDIO_F32SYS.
+    void process(Uint8 *stream, int len);
+
+    // Any thread. Largest gain reduction in dB since the previous call, for
+    // meters; 0 when nothing was reduced.
+    float takeLimiterReductionDb() { return limiterMeter.exchange(0.0f, std::memory_order_relaxed); }
+    float takeCompressorReductionDb() { return compressorMeter.exchange(0.0f, std::memory_order_relaxed); }
+
+    // Session statistics
+    float maxLimiterReductionDb() const { return limiterPeak.load(std::memory_order_relaxed); }
+    Uint64 processedFrames() const { return frameCount.load(std::memory_order_relaxed); }
+    Uint64 limitedFrames() const { return limitedCount.load(std::memory_order_relaxed); }
+
+private:
+    static const int BLOCK_FRAMES = 256;
+    static const int MAX_CHANNELS = 8;
+    static const int TAPS = 12;        // Interpolator length
+    static const int PHASES = 3;       // Interpolated points between two samples
+    static const int DETECTOR_DELAY = TAPS / 2;
+
+    void compress(float *samples, int frames);
+    void limit(float *samples, int frames);
+    float requiredGain();
+    float slidingMinimum(float gain);
+    static void raiseMeter(std::atomic<float> &meter, float db);
+
+    Uint16 format = 0;
+    int channels = 0;
+    int window = 0;  // Look-ahead in frames
+    int latency = 0; // Audio delay in frames
+
+    float attackCoefficient = 0.0f;
+    float releaseCoefficient = 0.0f;
+    float limiterRelease = 0.0f;
+    float interpolator[PHASES][TAPS];
+
+    std::atomic<float> ceiling{1.0f};
+    std::atomic<bool> compressorOn{false};
+
+    // Audio thread only
+    float compressorGainDb = 0.0f;
+    std::vector<float> history; // Last TAPS input frames per channel, twice over so a window never wraps
+    int historyPosition = 0;
+    std::vector<float> minimumValue; // Sliding minimum, a monotonic deque in a ring
+    std::vector<Sint64> minimumIndex;
+    int minimumHead = 0;
+    int minimumCount = 0;
+    Sint64 gainIndex = 0;
+    float released = 1.0f;
+    std::vector<float> average; // Moving average ring over window gains
+    double averageSum = 0.0;
+    int averagePosition = 0;
+    std::vector<float> delay; // Audio delay line, latency frames
+    int delayPosition = 0;
+
+    std::atomic<float> limiterMeter{0.0f};
+    std::atomic<float> compressorMeter{0.0f};
+    std::atomic<float> limiterPeak{0.0f};
+    std::atomic<Uint64> frameCount{0};
+    std::atomic<Uint64> limitedCount{0};
+};
+
+#endif
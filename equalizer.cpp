@@ -0,0 +1,383 @@
+#include "equalizer.h"
+
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+const double PI = 3.14159265358979323846;
+const float GLIDE = 0.05f; // Share of the remaining distance covered per block, about 13 ms at 48 kHz
+const float BAND_FREQUENCIES[EQUALIZER_BANDS] = {31.25f, 62.5f, 125.0f, 250.0f, 500.0f, 1000.0f, 2000.0f, 4000.0f, 8000.0f, 16000.0f};
+const float PRESET_GAINS[EQ_PRESET_COUNT][EQUALIZER_BANDS] = {
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0},     // Flat
+    {6, 5, 4, 2, 0, 0, 0, 0, 0, 0},     // Bass
+    {0, 0, 0, 0, 0, 0, 2, 4, 5, 6},     // Treble
+    {-2, -2, -1, 0, 2, 3, 3, 2, 0, -1}, // Vocal
+    {5, 4, 2, 0, -1, 0, 0, 2, 4, 5}     // Loudness
+};
+
+EqualizerSettings equalizerPreset(EqualizerPreset preset)
+{
+    EqualizerSettings settings;
+    float maxGain = 0.0f;
+    for (int i = 0; i < EQUALIZER_BANDS; i++)
+    {
+        settings.bands[i] = {EQ_PEAKING, BAND_FREQUENCIES[i], PRESET_GAINS[preset][i], 1.41f};
+        maxGain = SDL_max(maxGain, PRESET_GAINS[preset][i]);
+    }
+    settings.preampDb = -maxGain;
+    return settings;
+}
+
+bool parseEqualizerPreset(const std::string &name, EqualizerPreset &preset)
+{
+    for (int i = 0; i < EQ_PRESET_COUNT; i++)
+    {
+        if (name == equalizerPresetName((EqualizerPreset)i))
+        {
+            preset = (EqualizerPreset)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *equalizerPresetName(EqualizerPreset preset)
+{
+    switch (preset)
+    {
+    case EQ_PRESET_FLAT:
+        return "flat";
+    case EQ_PRESET_BASS:
+        return "bass";
+    case EQ_PRESET_TREBLE:
+        return "treble";
+    case EQ_PRESET_VOCAL:
+        return "vocal";
+    case EQ_PRESET_LOUDNESS:
+        return "loudness";
+    default:
+        return "unknown";
+    }
+}
+
+// Moves value towards target and snaps once it is within tolerance.
+// Returns true if the value changed.
+static bool approach(float &value, float target, float tolerance)
+{
+    if (value == target)
+    {
+        return false;
+    }
+    value += (target - value) * GLIDE;
+    if (std::fabs(target - value) < tolerance)
+    {
+        value = target;
+    }
+    return true;
+}
+
+void Equalizer::init(int frequency, Uint16 format, int channels)
+{
+    this->frequency = frequency;
+    this->format = format;
+    this->channels = channels;
+
+    EqualizerSettings settings;
+    while (updates.pop(settings))
+    {
+    }
+    target = equalizerPreset(EQ_PRESET_FLAT);
+    current = target;
+    for (int band = 0; band < EQUALIZER_BANDS; band++)
+    {
+        updateCoefficients(band);
+        SDL_zero(biquads[band].z1);
+        SDL_zero(biquads[band].z2);
+    }
+    active = 0;
+    preamp = 1.0f;
+    gliding = false;
+}
+
+bool Equalizer::setSettings(const EqualizerSettings &settings)
+{
+    return updates.push(settings);
+}
+
+void Equalizer::process(Uint8 *stream, int len)
+{
+    EqualizerSettings settings;
+    while (updates.pop(settings))
+    {
+        target = settings;
+        gliding = true;
+    }
+
+    if ((!gliding && active == 0 && preamp == 1.0f) || (format != AUDIO_S16SYS && format != AUDIO_F32SYS) || channels <= 0 ||
+        channels > MAX_LANES)
+    {
+        return;
+    }
+
+    // One block of frames, padded to the lane count, lives on the stack
+    float block[BLOCK_FRAMES * MAX_LANES];
+    int lanes = channels <= 2 ? 2 : (channels <= 4 ? 4 : MAX_LANES);
+    int frames = len / (SDL_AUDIO_BITSIZE(format) / 8 * channels);
+
+    for (int frame = 0; frame < frames; frame += BLOCK_FRAMES)
+    {
+        if (gliding)
+        {
+            glide();
+        }
+
+        int count = SDL_min(frames - frame, BLOCK_FRAMES);
+        int offset = frame * channels;
+        SDL_memset(block, 0, sizeof(block));
+        for (int i = 0; i < count; i++)
+        {
+            for (int channel = 0; channel < channels; channel++)
+            {
+                block[i * lanes + channel] = format == AUDIO_S16SYS ? ((Sint16 *)stream)[offset + i * channels + channel] * (1.0f / 32768.0f)
+                                                                    : ((float *)stream)[offset + i * channels + channel];
+            }
+        }
+
+        if (lanes == 2)
+        {
+            processBlock<2>(block, count);
+        }
+        else if (lanes == 4)
+        {
+            processBlock<4>(block, count);
+        }
+        else
+        {
+            processBlock<MAX_LANES>(block, count);
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            for (int channel = 0; channel < channels; channel++)
+            {
+                float value = block[i * lanes + channel];
+                if (format == AUDIO_S16SYS)
+                {
+                    value *= 32768.0f;
+                    value = value > 32767.0f ? 32767.0f : value;
+                    value = value < -32768.0f ? -32768.0f : value;
+                    ((Sint16 *)stream)[offset + i * channels + channel] = (Sint16)value;
+                }
+                else
+                {
+                    ((float *)stream)[offset + i * channels + channel] = value;
+                }
+            }
+        }
+    }
+
+    // Let decayed filter states reach zero instead of lingering as slow denormals
+    for (int i = 0; i < active; i++)
+    {
+        Biquad &biquad = biquads[bandOrder[i]];
+        for (int lane = 0; lane < MAX_LANES; lane++)
+        {
+            biquad.z1[lane] = std::fabs(biquad.z1[lane]) < 1e-20f ? 0.0f : biquad.z1[lane];
+            biquad.z2[lane] = std::fabs(biquad.z2[lane]) < 1e-20f ? 0.0f : biquad.z2[lane];
+        }
+    }
+}
+
+template <int Lanes>
+void Equalizer::processBlock(float *samples, int frames)
+{
+    for (int frame = 0; frame < frames; frame++)
+    {
+        float x[Lanes];
+        for (int lane = 0; lane < Lanes; lane++)
+        {
+            x[lane] = samples[frame * Lanes + lane] * preamp;
+        }
+
+        // Each statement works on all lanes at once
+        for (int i = 0; i < active; i++)
+        {
+            Biquad &biquad = biquads[bandOrder[i]];
+            for (int lane = 0; lane < Lanes; lane++)
+            {
+                float y = biquad.b0 * x[lane] + biquad.z1[lane];
+                biquad.z1[lane] = biquad.b1 * x[lane] - biquad.a1 * y + biquad.z2[lane];
+                biquad.z2[lane] = biquad.b2 * x[lane] - biquad.a2 * y;
+                x[lane] = y;
+            }
+        }
+
+        for (int lane = 0; lane < Lanes; lane++)
+        {
+            samples[frame * Lanes + lane] = x[lane];
+        }
+    }
+}
+
+void Equalizer::glide()
+{
+    bool moving = false;
+    active = 0;
+    for (int band = 0; band < EQUALIZER_BANDS; band++)
+    {
+        EqualizerBand &from = current.bands[band];
+        const EqualizerBand &to = target.bands[band];
+
+        bool changed = from.type != to.type;
+        from.type = to.type;
+        changed |= approach(from.gainDb, to.gainDb, 0.01f);
+        changed |= approach(from.q, to.q, 0.001f);
+        // Frequencies glide on a log scale, so sweeps sound even
+        if (from.frequency != to.frequency)
+        {
+            from.frequency *= std::pow(to.frequency / from.frequency, GLIDE);
+            if (std::fabs(std::log2(to.frequency / from.frequency)) < 0.001f)
+            {
+                from.frequency = to.frequency;
+            }
+            changed = true;
+        }
+
+        if (changed)
+        {
+            updateCoefficients(band);
+            moving = true;
+        }
+
+        if (from.gainDb != 0.0f || to.gainDb != 0.0f)
+        {
+            bandOrder[active++] = band;
+        }
+        else if (changed)
+        {
+            // The band dropped out, start from rest if it comes back
+            SDL_zero(biquads[band].z1);
+            SDL_zero(biquads[band].z2);
+        }
+    }
+
+    if (approach(current.preampDb, target.preampDb, 0.01f))
+    {
+        moving = true;
+    }
+    preamp = std::pow(10.0f, current.preampDb / 20.0f);
+    gliding = moving;
+}
+
+// Audio EQ Cookbook (R. Bristow-Johnson) peaking and shelving filters
+void Equalizer::updateCoefficients(int band)
+{
+    const EqualizerBand &parameters = current.bands[band];
+    double f0 = SDL_min((double)parameters.frequency, 0.45 * frequency);
+    double a = std::pow(10.0, parameters.gainDb / 40.0);
+    double w0 = 2.0 * PI * f0 / frequency;
+    double cosine = std::cos(w0);
+    double alpha = std::sin(w0) / (2.0 * SDL_max((double)parameters.q, 0.1));
+    double shelf = 2.0 * std::sqrt(a) * alpha;
+
+    double b0, b1, b2, a0, a1, a2;
+    switch (parameters.type)
+    {
+    case EQ_LOW_SHELF:
+        b0 = a * ((a + 1) - (a - 1) * cosine + shelf);
+        b1 = 2 * a * ((a - 1) - (a + 1) * cosine);
+        b2 = a * ((a + 1) - (a - 1) * cosine - shelf);
+        a0 = (a + 1) + (a - 1) * cosine + shelf;
+        a1 = -2 * ((a - 1) + (a + 1) * cosine);
+        a2 = (a + 1) + (a - 1) * cosine - shelf;
+        break;
+    case EQ_HIGH_SHELF:
+        b0 = a * ((a + 1) + (a - 1) * cosine + shelf);
+        b1 = -2 * a * ((a - 1) + (a + 1) * cosine);
+        b2 = a * ((a + 1) + (a - 1) * cosine - shelf);
+        a0 = (a + 1) - (a - 1) * cosine + shelf;
+        a1 = 2 * ((a - 1) - (a + 1) * cosine);
+        a2 = (a + 1) - (a - 1) * cosine - shelf;
+        break;
+    default:
+        b0 = 1 + alpha * a;
+        b1 = -2 * cosine;
+        b2 = 1 - alpha * a;
+        a0 = 1 + alpha / a;
+        a1 = -2 * cosine;
+        a2 = 1 - alpha / a;
+        break;
+    }
+
+    Biquad &biquad = biquads[band];
+    biquad.b0 = (float)(b0 / a0);
+    biquad.b1 = (float)(b1 / a0);
+    biquad.b2 = (float)(b2 / a0);
+    biquad.a1 = (float)(a1 / a0);
+    biquad.a2 = (float)(a2 / a0);
+}
+
+void benchmarkEqualizer()
+{
+    const int frequency = 48000;
+    const int channels = 2;
+    const int bufferFrames = 1024;
+    const int seconds = 20;
+
+    // Every band boosted or cut, so none of them is skipped
+    EqualizerSettings settings = equalizerPreset(EQ_PRESET_FLAT);
+    for (int band = 0; band < EQUALIZER_BANDS; band++)
+    {
+        settings.bands[band].gainDb = band % 2 == 0 ? 3.0f : -3.0f;
+    }
+    settings.preampDb = -3.0f;
+
+    std::vector<Sint16> noise((size_t)frequency * seconds * channels);
+    Uint32 seed = 12345;
+    for (Sint16 &sample : noise)
+    {
+        seed = seed * 1664525 + 1013904223;
+        sample = (Sint16)((seed >> 16) / 4);
+    }
+
+    for (int format = 0; format < 2; format++)
+    {
+        Uint16 sampleFormat = format == 0 ? AUDIO_S16SYS : AUDIO_F32SYS;
+        std::vector<Uint8> buffer;
+        if (sampleFormat == AUDIO_S16SYS)
+        {
+            buffer.assign((Uint8 *)noise.data(), (Uint8 *)(noise.data() + noise.size()));
+        }
+        else
+        {
+            buffer.resize(noise.size() * sizeof(float));
+            for (size_t i = 0; i < noise.size(); i++)
+            {
+                ((float *)buffer.data())[i] = noise[i] / 32768.0f;
+            }
+        }
+
+        Equalizer equalizer;
+        equalizer.init(frequency, sampleFormat, channels);
+        equalizer.setSettings(settings);
+        int bufferBytes = bufferFrames * channels * SDL_AUDIO_BITSIZE(sampleFormat) / 8;
+        // Let the parameters settle before timing
+        for (int i = 0; i < 100; i++)
+        {
+            equalizer.process(buffer.data(), bufferBytes);
+        }
+
+        Uint64 begin = SDL_GetPerformanceCounter();
+        for (size_t offset = 0; offset + bufferBytes <= buffer.size(); offset += bufferBytes)
+        {
+            equalizer.process(buffer.data() + offset, bufferBytes);
+        }
+        double elapsed = (double)(SDL_GetPerformanceCounter() - begin) / SDL_GetPerformanceFrequency();
+
+        double frames = (double)frequency * seconds;
+        double nsPerFrame = elapsed * 1e9 / frames;
+        std::cout << "Equalizer (" << (sampleFormat == AUDIO_S16SYS ? "S16" : "F32") << ", " << channels << " channels, "
+                  << equalizer.activeBands() << " bands): " << nsPerFrame / equalizer.activeBands() << " ns per frame and band, "
+                  << nsPerFrame * frequency / 1e9 * 100.0 << "% of one core at " << frequency << " Hz" << std::endl;
+    }
+}
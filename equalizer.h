@@ -0,0 +1,103 @@
+#ifndef EQUALIZER_H
+#define EQUALIZER_H
+
+#include <SDL2/SDL.h>
+#include <string>
+#include "spscqueue.h"
+
+const int EQUALIZER_BANDS = 10;
+
+enum EqualizerBandType
+{
+    EQ_PEAKING,
+    EQ_LOW_SHELF,
+    EQ_HIGH_SHELF
+};
+
+struct EqualizerBand
+{
+    EqualizerBandType type;
+    float frequency; // Hz
+    float gainDb;
+    float q;
+};
+
+struct EqualizerSettings
+{
+    EqualizerBand bands[EQUALIZER_BANDS];
+    float preampDb; // Headroom for boosts, so they do not clip
+};
+
+enum EqualizerPreset
+{
+    EQ_PRESET_FLAT,
+    EQ_PRESET_BASS,
+    EQ_PRESET_TREBLE,
+    EQ_PRESET_VOCAL,
+    EQ_PRESET_LOUDNESS,
+    EQ_PRESET_COUNT
+};
+
+// Octave spaced peaking bands from 31 Hz to 16 kHz, preamp set to the largest boost
+EqualizerSettings equalizerPreset(EqualizerPreset preset);
+bool parseEqualizerPreset(const std::string &name, EqualizerPreset &preset);
+const char *equalizerPresetName(EqualizerPreset preset);
+
+// Ten band parametric equalizer for the post-mix path. Each band is a
+// biquad in transposed direct form II. The channels of a frame sit side by
+// side in a small fixed-width array, so every biquad step is one operation
+// across all channels and the compiler maps it onto SIMD lanes. New settings
+// travel from the UI through a lock-free queue; the audio thread then glides
+// each band's frequency, gain and Q towards them and recomputes the
+// coefficients every few frames, so changes never click. Flat bands are
+// skipped and a flat equalizer costs nothing.
+class Equalizer
+{
+public:
+    // Must be called before process(), not concurrently with it
+    void init(int frequency, Uint16 format, int channels);
+
+    // Any single thread. Returns false if the audio thread is not keeping up.
+    bool setSettings(const EqualizerSettings &settings);
+
+    // Audio thread. Supports AUDIO_S16SYS and AUDIO_F32SYS.
+    void process(Uint8 *stream, int len);
+
+    int activeBands() const { return active; }
+
+private:
+    static const int MAX_LANES = 8;
+    static const int BLOCK_FRAMES = 32; // Parameters glide once per block
+
+    struct Biquad
+    {
+        float b0, b1, b2, a1, a2;
+        float z1[MAX_LANES];
+        float z2[MAX_LANES];
+    };
+
+    template <int Lanes>
+    void processBlock(float *samples, int frames);
+    void glide();
+    void updateCoefficients(int band);
+
+    int frequency = 0;
+    Uint16 format = 0;
+    int channels = 0;
+
+    SpscQueue<EqualizerSettings, 8> updates;
+
+    // Audio thread only
+    EqualizerSettings target = {};
+    EqualizerSettings current = {};
+    Biquad biquads[EQUALIZER_BANDS] = {};
+    int bandOrder[EQUALIZER_BANDS] = {}; // Indices of the bands that are not flat
+    int active = 0;
+    float preamp = 1.0f;
+    bool gliding = false;
+};
+
+// Runs the equalizer over generated audio and prints the cost per frame and band
+void benchmarkEqualizer();
+
+#endif
@@ -0,0 +1,121 @@
+#include "gainstage.h"
+
+#include <cmath>
+
+const float VOLUME_TIME_CONSTANT = 0.010f; // Seconds
+const float MUTE_TIME_CONSTANT = 0.002f;
+const float SETTLED = 1e-4f; // -80 dB, close enough to snap to the target
+
+// The gains never exceed 1, so the products always fit without saturating.
+// Flat loops over samples, the compiler vectorizes them.
+static void applyGainsS16(Sint16 *__restrict samples, const float *__restrict gains, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        samples[i] = (Sint16)((float)samples[i] * gains[i]);
+    }
+}
+
+static void applyGainsF32(float *__restrict samples, const float *__restrict gains, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        samples[i] *= gains[i];
+    }
+}
+
+static void applyGainS16(Sint16 *samples, float gain, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        samples[i] = (Sint16)((float)samples[i] * gain);
+    }
+}
+
+static void applyGainF32(float *samples, float gain, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        samples[i] *= gain;
+    }
+}
+
+void GainStage::init(int frequency, Uint16 format, int channels)
+{
+    this->format = format;
+    this->channels = channels;
+    volumeCoefficient = 1.0f - std::exp(-1.0f / (VOLUME_TIME_CONSTANT * frequency));
+    muteCoefficient = 1.0f - std::exp(-1.0f / (MUTE_TIME_CONSTANT * frequency));
+}
+
+void GainStage::setGainDb(double db)
+{
+    float gain = db <= GAIN_MIN_DB ? 0.0f : (float)std::pow(10.0, SDL_min(db, 0.0) / 20.0);
+    targetVolume.store(gain, std::memory_order_relaxed);
+}
+
+void GainStage::process(Uint8 *stream, int len)
+{
+    if ((format != AUDIO_S16SYS && format != AUDIO_F32SYS) || channels <= 0 || channels > MAX_CHANNELS)
+    {
+        return;
+    }
+
+    int sampleBytes = SDL_AUDIO_BITSIZE(format) / 8;
+    int frames = len / (sampleBytes * channels);
+    float target = targetVolume.load(std::memory_order_relaxed);
+    float muteTarget = muted.load(std::memory_order_relaxed) ? 0.0f : 1.0f;
+
+    // Gains for one block live on the stack, nothing is allocated here
+    float gains[BLOCK_FRAMES * MAX_CHANNELS];
+    int frame = 0;
+    while (frame < frames)
+    {
+        int offset = frame * channels;
+        if (std::fabs(volume - target) < SETTLED && std::fabs(mute - muteTarget) < SETTLED)
+        {
+            // Nothing is moving, one gain for the rest of the buffer
+            volume = target;
+            mute = muteTarget;
+            float gain = volume * mute;
+            int count = (frames - frame) * channels;
+            if (gain == 1.0f)
+            {
+                break;
+            }
+            if (format == AUDIO_S16SYS)
+            {
+                applyGainS16((Sint16 *)stream + offset, gain, count);
+            }
+            else
+            {
+                applyGainF32((float *)stream + offset, gain, count);
+            }
+            break;
+        }
+
+        int count = SDL_min(frames - frame, BLOCK_FRAMES);
+        for (int i = 0; i < count; i++)
+        {
+            volume += (target - volume) * volumeCoefficient;
+            mute += (muteTarget - mute) * muteCoefficient;
+            float gain = volume * mute;
+            for (int channel = 0; channel < channels; channel++)
+            {
+                gains[i * channels + channel] = gain;
+            }
+        }
+
+        if (format == AUDIO_S16SYS)
+        {
+            applyGainsS16((Sint16 *)stream + offset, gains, count * channels);
+        }
+        else
+        {
+            applyGainsF32((float *)stream + offset, gains, count * channels);
+        }
+        frame += count;
+    }
+
+    silent = muteTarget == 0.0f && mute < SETTLED;
+}
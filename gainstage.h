@@ -0,0 +1,47 @@
+#ifndef GAINSTAGE_H
+#define GAINSTAGE_H
+
+#include <SDL2/SDL.h>
+#include <atomic>
+
+// Volume below this is silence; the slider's left end
+const double GAIN_MIN_DB = -60.0;
+
+// Final volume stage, run on the mixed output from the post-mix hook. The
+// UI sets a target in dB and a mute flag from any thread; the audio thread
+// glides towards them with one-pole exponential ramps evaluated per sample,
+// so neither volume changes nor pause and resume click. Volume glides with
+// a 10 ms time constant, muting with 2 ms.
+class GainStage
+{
+public:
+    void init(int frequency, Uint16 format, int channels);
+
+    // Any thread. Anything at or below GAIN_MIN_DB is silence.
+    void setGainDb(double db);
+    void setMuted(bool muted) { this->muted.store(muted, std::memory_order_relaxed); }
+
+    // Audio thread. Supports AUDIO_S16SYS and AUDIO_F32SYS.
+    void process(Uint8 *stream, int len);
+    // True once a mute ramp has reached silence
+    bool isSilent() const { return silent; }
+
+private:
+    static const int BLOCK_FRAMES = 256;
+    static const int MAX_CHANNELS = 8;
+
+    Uint16 format = 0;
+    int channels = 0;
+    float volumeCoefficient = 0.0f; // Share of the remaining distance covered per frame
+    float muteCoefficient = 0.0f;
+
+    std::atomic<float> targetVolume{1.0f};
+    std::atomic<bool> muted{false};
+
+    // Audio thread only
+    float volume = 1.0f;
+    float mute = 1.0f;
+    bool silent = false;
+};
+
+#endif
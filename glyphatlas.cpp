@@ -0,0 +1,240 @@
+#include "glyphatlas.h"
+
+#include <iostream>
+
+const int ATLAS_WIDTH = 1024;
+const int ATLAS_PADDING = 1;
+
+static bool isPrintableLatin1(int ch)
+{
+    return (ch >= 32 && ch < 127) || ch >= 160;
+}
+
+GlyphAtlas::GlyphAtlas(SDL_Renderer *renderer, TextCache &fallback)
+    : renderer(renderer), fallback(fallback)
+{
+}
+
+GlyphAtlas::~GlyphAtlas()
+{
+    destroy();
+}
+
+bool GlyphAtlas::build(TTF_Font *font)
+{
+    destroy();
+    this->font = font;
+    height = TTF_FontHeight(font);
+
+    // Rasterize every glyph in white so the vertex color can tint it
+    SDL_Color white = {255, 255, 255, 255};
+    SDL_Surface *rendered[256] = {};
+    int penX = 0;
+    int penY = 0;
+    int rowHeight = 0;
+    for (int ch = 0; ch < 256; ch++)
+    {
+        if (!isPrintableLatin1(ch))
+        {
+            continue;
+        }
+
+        int minx, maxx, miny, maxy, advance;
+        if (TTF_GlyphMetrics32(font, ch, &minx, &maxx, &miny, &maxy, &advance) < 0)
+        {
+            continue;
+        }
+        glyphs[ch].advance = advance;
+        // Matches the pen offset TTF_RenderText applies to glyphs with a negative bearing
+        glyphs[ch].xOffset = minx < 0 ? minx : 0;
+
+        rendered[ch] = TTF_RenderGlyph32_Blended(font, ch, white);
+        if (rendered[ch] == nullptr)
+        {
+            continue; // Whitespace has no surface, only an advance
+        }
+
+        int w = rendered[ch]->w;
+        int h = rendered[ch]->h;
+        if (penX + w > ATLAS_WIDTH)
+        {
+            penX = 0;
+            penY += rowHeight + ATLAS_PADDING;
+            rowHeight = 0;
+        }
+        glyphs[ch].src = {penX, penY, w, h};
+        penX += w + ATLAS_PADDING;
+        if (h > rowHeight)
+        {
+            rowHeight = h;
+        }
+    }
+
+    atlasWidth = ATLAS_WIDTH;
+    atlasHeight = 1;
+    while (atlasHeight < penY + rowHeight)
+    {
+        atlasHeight *= 2;
+    }
+
+    SDL_Surface *page = SDL_CreateRGBSurfaceWithFormat(0, atlasWidth, atlasHeight, 32, SDL_PIXELFORMAT_RGBA32);
+    if (page == nullptr)
+    {
+        std::cout << "Failed to create glyph atlas surface: " << SDL_GetError() << std::endl;
+        for (SDL_Surface *surface : rendered)
+        {
+            SDL_FreeSurface(surface);
+        }
+        destroy();
+        return false;
+    }
+
+    SDL_FillRect(page, nullptr, SDL_MapRGBA(page->format, 255, 255, 255, 0));
+    for (int ch = 0; ch < 256; ch++)
+    {
+        if (rendered[ch] == nullptr)
+        {
+            continue;
+        }
+
+        // Copy the alpha channel as is instead of blending onto the empty page
+        SDL_SetSurfaceBlendMode(rendered[ch], SDL_BLENDMODE_NONE);
+        SDL_BlitSurface(rendered[ch], nullptr, page, &glyphs[ch].src);
+        SDL_FreeSurface(rendered[ch]);
+        builtGlyphs++;
+    }
+
+    texture = SDL_CreateTextureFromSurface(renderer, page);
+    SDL_FreeSurface(page);
+    if (texture == nullptr)
+    {
+        std::cout << "Failed to create glyph atlas texture: " << SDL_GetError() << std::endl;
+        destroy();
+        return false;
+    }
+    SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+
+    useKerning = TTF_GetFontKerning(font) != 0;
+    vertices.reserve(1024);
+    indices.reserve(1536);
+    return true;
+}
+
+void GlyphAtlas::destroy()
+{
+    if (texture != nullptr)
+    {
+        SDL_DestroyTexture(texture);
+        texture = nullptr;
+    }
+    for (Glyph &glyph : glyphs)
+    {
+        glyph = {};
+    }
+    builtGlyphs = 0;
+    vertices.clear();
+    indices.clear();
+}
+
+int GlyphAtlas::kerning(unsigned char previous, unsigned char current) const
+{
+    if (!useKerning || previous == 0)
+    {
+        return 0;
+    }
+    return TTF_GetFontKerningSizeGlyphs32(font, previous, current);
+}
+
+int GlyphAtlas::measure(const std::string &text)
+{
+    if (texture == nullptr)
+    {
+        const CachedText *cached = fallback.get(font, text, {255, 255, 255, 255});
+        return cached != nullptr ? cached->w : 0;
+    }
+
+    int width = 0;
+    unsigned char previous = 0;
+    for (unsigned char ch : text)
+    {
+        width += kerning(previous, ch) + glyphs[ch].advance;
+        previous = ch;
+    }
+    return width;
+}
+
+void GlyphAtlas::draw(const std::string &text, int x, int y, SDL_Color color)
+{
+    if (texture == nullptr)
+    {
+        const CachedText *cached = fallback.get(font, text, color);
+        if (cached != nullptr)
+        {
+            SDL_Rect rect = {x, y, cached->w, cached->h};
+            SDL_RenderCopy(renderer, cached->texture, NULL, &rect);
+        }
+        return;
+    }
+
+    float invWidth = 1.0f / atlasWidth;
+    float invHeight = 1.0f / atlasHeight;
+    int penX = x;
+    unsigned char previous = 0;
+    for (unsigned char ch : text)
+    {
+        penX += kerning(previous, ch);
+        previous = ch;
+
+        const Glyph &glyph = glyphs[ch];
+        if (glyph.src.w > 0)
+        {
+            float left = (float)(penX + glyph.xOffset);
+            float top = (float)y;
+            float right = left + glyph.src.w;
+            float bottom = top + glyph.src.h;
+            float u0 = glyph.src.x * invWidth;
+            float v0 = glyph.src.y * invHeight;
+            float u1 = (glyph.src.x + glyph.src.w) * invWidth;
+            float v1 = (glyph.src.y + glyph.src.h) * invHeight;
+
+            int base = (int)vertices.size();
+            vertices.push_back({{left, top}, color, {u0, v0}});
+            vertices.push_back({{right, top}, color, {u1, v0}});
+            vertices.push_back({{right, bottom}, color, {u1, v1}});
+            vertices.push_back({{left, bottom}, color, {u0, v1}});
+            indices.push_back(base);
+            indices.push_back(base + 1);
+            indices.push_back(base + 2);
+            indices.push_back(base);
+            indices.push_back(base + 2);
+            indices.push_back(base + 3);
+        }
+
+        penX += glyph.advance;
+    }
+}
+
+void GlyphAtlas::drawCentered(const std::string &text, const SDL_Rect &rect, SDL_Color color)
+{
+    int x = rect.x + (rect.w - measure(text)) / 2;
+    int y = rect.y + (rect.h - height) / 2;
+    draw(text, x, y, color);
+}
+
+void GlyphAtlas::flush()
+{
+    if (vertices.empty())
+    {
+        return;
+    }
+
+    if (SDL_RenderGeometry(renderer, texture, vertices.data(), (int)vertices.size(), indices.data(), (int)indices.size()) < 0)
+    {
+        std::cout << "Failed to render text geometry: " << SDL_GetError() << std::endl;
+    }
+    batchCount++;
+
+    // Keep the capacity so later frames do not allocate
+    vertices.clear();
+    indices.clear();
+}
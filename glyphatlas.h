@@ -0,0 +1,64 @@
+#ifndef GLYPHATLAS_H
+#define GLYPHATLAS_H
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+#include <string>
+#include <vector>
+#include "textcache.h"
+
+// Renders text from a single texture page holding every printable Latin-1
+// glyph of a font (the same encoding TTF_RenderText_* uses). Text drawn
+// during a frame is only queued as vertices; flush() submits all of it with
+// one SDL_RenderGeometry call, so changing strings never creates textures.
+// If the atlas cannot be built, text falls back to the TextCache and is
+// drawn immediately.
+class GlyphAtlas
+{
+public:
+    GlyphAtlas(SDL_Renderer *renderer, TextCache &fallback);
+    ~GlyphAtlas();
+
+    GlyphAtlas(const GlyphAtlas &) = delete;
+    GlyphAtlas &operator=(const GlyphAtlas &) = delete;
+
+    bool build(TTF_Font *font);
+    void destroy();
+
+    int measure(const std::string &text);
+    int lineHeight() const { return height; }
+
+    void draw(const std::string &text, int x, int y, SDL_Color color);
+    void drawCentered(const std::string &text, const SDL_Rect &rect, SDL_Color color);
+    void flush();
+
+    bool isBuilt() const { return texture != nullptr; }
+    int glyphCount() const { return builtGlyphs; }
+    Uint64 batches() const { return batchCount; }
+
+private:
+    struct Glyph
+    {
+        SDL_Rect src;   // Cell inside the atlas, zero sized if the glyph is missing
+        int xOffset;    // Cell position relative to the pen
+        int advance;
+    };
+
+    int kerning(unsigned char previous, unsigned char current) const;
+
+    SDL_Renderer *renderer;
+    TextCache &fallback;
+    TTF_Font *font = nullptr;
+    SDL_Texture *texture = nullptr;
+    int atlasWidth = 0;
+    int atlasHeight = 0;
+    int height = 0;
+    int builtGlyphs = 0;
+    bool useKerning = false;
+    Glyph glyphs[256] = {};
+    Uint64 batchCount = 0;
+    std::vector<SDL_Vertex> vertices;
+    std::vector<int> indices;
+};
+
+#endif
@@ -0,0 +1,324 @@
+#include "ingester.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+const size_t PROBE_BATCH = 128; // Files of a folder probed by one job
+
+static std::string lowerExtension(const std::filesystem::path &path)
+{
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    return extension;
+}
+
+bool hasAudioExtension(const std::string &path)
+{
+    static const char *const extensions[] = {".wav", ".flac", ".ogg", ".oga", ".opus", ".mp3", ".aif", ".aiff", ".aifc",
+                                             ".voc", ".mid", ".midi", ".mod", ".xm", ".s3m", ".it", ".wv"};
+    std::string extension = lowerExtension(path);
+    for (const char *known : extensions)
+    {
+        if (extension == known)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Ingester::probe(const std::string &path)
+{
+    SDL_RWops *file = SDL_RWFromFile(path.c_str(), "rb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    Uint8 header[12] = {0};
+    size_t length = SDL_RWread(file, header, 1, sizeof(header));
+    SDL_RWclose(file);
+    if (length < 4)
+    {
+        return false;
+    }
+
+    const char *bytes = (const char *)header;
+    if (std::memcmp(bytes, "RIFF", 4) == 0)
+    {
+        return length == sizeof(header) && (std::memcmp(bytes + 8, "WAVE", 4) == 0 || std::memcmp(bytes + 8, "RMID", 4) == 0);
+    }
+    if (std::memcmp(bytes, "FORM", 4) == 0)
+    {
+        return length == sizeof(header) && (std::memcmp(bytes + 8, "AIFF", 4) == 0 || std::memcmp(bytes + 8, "AIFC", 4) == 0);
+    }
+    if (std::memcmp(bytes, "fLaC", 4) == 0 || std::memcmp(bytes, "OggS", 4) == 0 || std::memcmp(bytes, "ID3", 3) == 0 ||
+        std::memcmp(bytes, "MThd", 4) == 0 || std::memcmp(bytes, "Crea", 4) == 0 || std::memcmp(bytes, "wvpk", 4) == 0)
+    {
+        return true;
+    }
+    // MPEG audio frame sync without an ID3 tag
+    if (header[0] == 0xFF && (header[1] & 0xE0) == 0xE0)
+    {
+        return true;
+    }
+    // Tracker modules have their signature deep in the file, if at all
+    std::string extension = lowerExtension(path);
+    return extension == ".mod" || extension == ".xm" || extension == ".s3m" || extension == ".it";
+}
+
+bool Ingester::start(int workers, void (*onComplete)())
+{
+    this->onComplete = onComplete;
+    stopping = false;
+    mutex = SDL_CreateMutex();
+    cond = SDL_CreateCond();
+    if (mutex == nullptr || cond == nullptr)
+    {
+        std::cout << "Failed to create ingester lock: " << SDL_GetError() << std::endl;
+        stop();
+        return false;
+    }
+
+    for (int i = 0; i < SDL_max(workers, 1); i++)
+    {
+        SDL_Thread *thread = SDL_CreateThread(run, "Ingester", this);
+        if (thread == nullptr)
+        {
+            std::cout << "Failed to create ingester thread: " << SDL_GetError() << std::endl;
+            break;
+        }
+        threads.push_back(thread);
+    }
+    if (threads.empty())
+    {
+        stop();
+        return false;
+    }
+    return true;
+}
+
+void Ingester::stop()
+{
+    if (!threads.empty())
+    {
+        SDL_LockMutex(mutex);
+        stopping = true;
+        SDL_CondBroadcast(cond);
+        SDL_UnlockMutex(mutex);
+        for (SDL_Thread *thread : threads)
+        {
+            SDL_WaitThread(thread, nullptr);
+        }
+        threads.clear();
+    }
+    pending.clear();
+    roots.clear();
+    ready.clear();
+
+    if (cond != nullptr)
+    {
+        SDL_DestroyCond(cond);
+        cond = nullptr;
+    }
+    if (mutex != nullptr)
+    {
+        SDL_DestroyMutex(mutex);
+        mutex = nullptr;
+    }
+}
+
+void Ingester::add(const std::vector<std::string> &paths)
+{
+    if (mutex == nullptr || paths.empty())
+    {
+        return;
+    }
+
+    SDL_LockMutex(mutex);
+    for (const std::string &path : paths)
+    {
+        pending.push_back({JOB_PICKED, firstRoot + roots.size(), {path}});
+        roots.push_back({1, false, {}});
+    }
+    SDL_CondBroadcast(cond);
+    SDL_UnlockMutex(mutex);
+}
+
+bool Ingester::poll(std::vector<std::string> &files, size_t maxFiles)
+{
+    files.clear();
+    if (mutex == nullptr)
+    {
+        return false;
+    }
+
+    SDL_LockMutex(mutex);
+    while (!ready.empty() && files.size() < maxFiles)
+    {
+        files.push_back(std::move(ready.front()));
+        ready.pop_front();
+    }
+    SDL_UnlockMutex(mutex);
+    return !files.empty();
+}
+
+bool Ingester::idle()
+{
+    if (mutex == nullptr)
+    {
+        return true;
+    }
+    SDL_LockMutex(mutex);
+    bool done = roots.empty() && ready.empty();
+    SDL_UnlockMutex(mutex);
+    return done;
+}
+
+Uint32 Ingester::filesChecked()
+{
+    SDL_LockMutex(mutex);
+    Uint32 count = checkedCount;
+    SDL_UnlockMutex(mutex);
+    return count;
+}
+
+Uint32 Ingester::filesRejected()
+{
+    SDL_LockMutex(mutex);
+    Uint32 count = rejectedCount;
+    SDL_UnlockMutex(mutex);
+    return count;
+}
+
+// A folder's subfolders become jobs of their own and its files are probed
+// in batches, so one huge folder still spreads over the workers
+void Ingester::listFolder(const Job &job, std::vector<Job> &found)
+{
+    std::vector<std::string> files;
+    std::error_code error;
+    auto options = std::filesystem::directory_options::skip_permission_denied;
+    for (std::filesystem::directory_iterator it(job.paths[0], options, error), end; !error && it != end; it.increment(error))
+    {
+        const std::filesystem::directory_entry &entry = *it;
+        std::error_code entryError;
+        if (entry.is_directory(entryError))
+        {
+            // Symlinked folders could lead back up the tree
+            if (!entry.is_symlink(entryError))
+            {
+                found.push_back({JOB_FOLDER, job.root, {entry.path().string()}});
+            }
+        }
+        else if (hasAudioExtension(entry.path().string()))
+        {
+            files.push_back(entry.path().string());
+            if (files.size() == PROBE_BATCH)
+            {
+                found.push_back({JOB_FILES, job.root, std::move(files)});
+                files.clear();
+            }
+        }
+    }
+    if (error)
+    {
+        std::cout << "Failed to list " << job.paths[0] << ": " << error.message() << std::endl;
+    }
+    if (!files.empty())
+    {
+        found.push_back({JOB_FILES, job.root, std::move(files)});
+    }
+}
+
+// Requires the mutex
+void Ingester::releaseFinishedRoots()
+{
+    bool released = false;
+    while (!roots.empty() && roots.front().jobs == 0)
+    {
+        Root &root = roots.front();
+        if (root.folder)
+        {
+            std::sort(root.files.begin(), root.files.end());
+        }
+        for (std::string &file : root.files)
+        {
+            ready.push_back(std::move(file));
+        }
+        released = released || !root.files.empty();
+        roots.pop_front();
+        firstRoot++;
+    }
+    if (released && onComplete != nullptr)
+    {
+        onComplete();
+    }
+}
+
+int SDLCALL Ingester::run(void *data)
+{
+    Ingester *ingester = static_cast<Ingester *>(data);
+
+    SDL_LockMutex(ingester->mutex);
+    while (!ingester->stopping)
+    {
+        if (ingester->pending.empty())
+        {
+            SDL_CondWait(ingester->cond, ingester->mutex);
+            continue;
+        }
+
+        Job job = std::move(ingester->pending.front());
+        ingester->pending.pop_front();
+
+        // Listing folders and probing files is all disk access, so do it
+        // without holding the lock
+        SDL_UnlockMutex(ingester->mutex);
+        std::vector<Job> found;
+        std::vector<std::string> accepted;
+        Uint32 rejected = 0;
+        std::error_code error;
+        bool folder = job.kind == JOB_FOLDER || (job.kind == JOB_PICKED && std::filesystem::is_directory(job.paths[0], error));
+        if (folder)
+        {
+            listFolder(job, found);
+        }
+        else
+        {
+            for (const std::string &path : job.paths)
+            {
+                if (probe(path))
+                {
+                    accepted.push_back(path);
+                    continue;
+                }
+                rejected++;
+                if (job.kind == JOB_PICKED)
+                {
+                    std::cout << "Not an audio file: " << path << std::endl;
+                }
+            }
+        }
+        SDL_LockMutex(ingester->mutex);
+
+        Root &root = ingester->roots[job.root - ingester->firstRoot];
+        root.folder = root.folder || folder;
+        root.files.insert(root.files.end(), std::make_move_iterator(accepted.begin()), std::make_move_iterator(accepted.end()));
+        root.jobs += (Uint32)found.size();
+        root.jobs--;
+        ingester->checkedCount += (Uint32)accepted.size() + rejected;
+        ingester->rejectedCount += rejected;
+        for (Job &next : found)
+        {
+            ingester->pending.push_back(std::move(next));
+        }
+        if (!found.empty())
+        {
+            SDL_CondBroadcast(ingester->cond);
+        }
+        ingester->releaseFinishedRoots();
+    }
+    SDL_UnlockMutex(ingester->mutex);
+    return 0;
+}
@@ -0,0 +1,82 @@
+#ifndef INGESTER_H
+#define INGESTER_H
+
+#include <SDL2/SDL.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+// True for the file extensions of formats SDL_mixer decodes
+bool hasAudioExtension(const std::string &path);
+
+// Does the slow part of adding files to the queue on a pool of worker
+// threads: folders are listed recursively, each subfolder a job of its own
+// so big trees are walked in parallel, and every file is checked to exist
+// and probed for a known audio header. Files found in folders are skipped
+// silently unless their extension looks like audio.
+//
+// Each path given to add() comes out in order: a file on its own, a folder
+// as all the audio files below it sorted by path, once the whole folder has
+// been walked. Like the TrackLoader, results are collected with poll() on
+// the UI thread and the callback only wakes the main loop.
+class Ingester
+{
+public:
+    bool start(int workers, void (*onComplete)());
+    void stop();
+
+    // Files or folders; returns right away
+    void add(const std::vector<std::string> &paths);
+    // Moves up to maxFiles checked files into files, in order. False if none
+    // are ready.
+    bool poll(std::vector<std::string> &files, size_t maxFiles);
+
+    // True when nothing is being walked, probed or waiting to be polled
+    bool idle();
+    Uint32 filesChecked();
+    Uint32 filesRejected();
+
+    // True if the file starts like a format SDL_mixer decodes. Any thread.
+    static bool probe(const std::string &path);
+
+private:
+    enum JobKind
+    {
+        JOB_PICKED, // A path given to add(), file or folder
+        JOB_FOLDER, // A folder to list
+        JOB_FILES   // Files found in a folder, to probe
+    };
+
+    struct Job
+    {
+        JobKind kind;
+        Uint64 root; // Index of the path given to add() it belongs to
+        std::vector<std::string> paths;
+    };
+
+    struct Root
+    {
+        Uint32 jobs; // Still waiting or running
+        bool folder;
+        std::vector<std::string> files;
+    };
+
+    static int SDLCALL run(void *data);
+    static void listFolder(const Job &job, std::vector<Job> &found);
+    void releaseFinishedRoots();
+
+    std::vector<SDL_Thread *> threads;
+    SDL_mutex *mutex = nullptr;
+    SDL_cond *cond = nullptr;
+    void (*onComplete)() = nullptr;
+    bool stopping = false;
+    std::deque<Job> pending;
+    std::deque<Root> roots; // Not yet released, oldest first
+    Uint64 firstRoot = 0;   // Index of roots.front()
+    std::deque<std::string> ready;
+
+    Uint32 checkedCount = 0;
+    Uint32 rejectedCount = 0;
+};
+
+#endif
@@ -0,0 +1,771 @@
+#include "library.h"
+#include "ingester.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <cerrno>
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+const char INDEX_MAGIC[8] = {'A', 'F', 'L', 'I', 'B', 'R', 'A', 'R'};
+const Uint32 INDEX_VERSION = 1;
+const size_t PROBE_THREADS_MIN_FILES = 64; // Fewer changed files are probed on the worker itself
+const Uint32 RESCAN_QUIET_MS = 2000;       // Quiet time after a change before rescanning
+const int WATCH_POLL_MS = 250;
+
+bool LibraryIndex::open(const std::string &file)
+{
+    close();
+
+#if defined(_WIN32)
+    HANDLE handle = CreateFileA(file.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+                                FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    fileHandle = handle;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(handle, &fileSize) || fileSize.QuadPart < (LONGLONG)sizeof(Header))
+    {
+        close();
+        return false;
+    }
+    mappingHandle = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    void *view = mappingHandle != nullptr ? MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (view == nullptr)
+    {
+        close();
+        return false;
+    }
+    data = (const Uint8 *)view;
+    bytes = (size_t)fileSize.QuadPart;
+#else
+    int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat status;
+    void *view = MAP_FAILED;
+    if (fstat(fd, &status) == 0 && status.st_size >= (off_t)sizeof(Header))
+    {
+        view = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    ::close(fd); // The mapping keeps the file open
+    if (view == MAP_FAILED)
+    {
+        return false;
+    }
+    data = (const Uint8 *)view;
+    bytes = (size_t)status.st_size;
+#endif
+
+    // Only the header is checked, which keeps opening independent of the
+    // size of the library. Every string offset is checked when it is read.
+    const Header *header = (const Header *)data;
+    Uint64 recordsEnd = sizeof(Header) + (Uint64)header->count * sizeof(Record);
+    if (std::memcmp(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 || header->version != INDEX_VERSION ||
+        header->recordSize != sizeof(Record) || header->fileBytes != bytes || header->stringsOffset != recordsEnd ||
+        header->stringsBytes == 0 || header->stringsOffset + header->stringsBytes != bytes || data[bytes - 1] != '\0')
+    {
+        std::cout << "Ignoring invalid library index " << file << std::endl;
+        close();
+        return false;
+    }
+    records = (const Record *)(data + sizeof(Header));
+    count = header->count;
+    strings = (const char *)data + header->stringsOffset;
+    stringsBytes = header->stringsBytes;
+    return true;
+}
+
+void LibraryIndex::close()
+{
+#if defined(_WIN32)
+    if (data != nullptr)
+    {
+        UnmapViewOfFile(data);
+    }
+    if (mappingHandle != nullptr)
+    {
+        CloseHandle(mappingHandle);
+        mappingHandle = nullptr;
+    }
+    if (fileHandle != nullptr)
+    {
+        CloseHandle(fileHandle);
+        fileHandle = nullptr;
+    }
+#else
+    if (data != nullptr)
+    {
+        munmap((void *)data, bytes);
+    }
+#endif
+    data = nullptr;
+    bytes = 0;
+    records = nullptr;
+    count = 0;
+    strings = nullptr;
+    stringsBytes = 0;
+}
+
+Uint32 LibraryIndex::lowerBound(const std::string &path) const
+{
+    // Records are sorted by path, compared like std::string compares
+    Uint32 low = 0;
+    Uint32 high = count;
+    while (low < high)
+    {
+        Uint32 middle = low + (high - low) / 2;
+        if (std::strcmp(this->path(middle), path.c_str()) < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+Uint32 LibraryIndex::find(const std::string &path) const
+{
+    Uint32 record = lowerBound(path);
+    return record < count && std::strcmp(this->path(record), path.c_str()) == 0 ? record : NONE;
+}
+
+static bool containsIgnoringCase(const char *text, const std::string &lowerNeedle)
+{
+    for (; *text != '\0'; text++)
+    {
+        size_t i = 0;
+        while (i < lowerNeedle.size() && text[i] != '\0' && std::tolower((unsigned char)text[i]) == (unsigned char)lowerNeedle[i])
+        {
+            i++;
+        }
+        if (i == lowerNeedle.size())
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<std::string> LibraryIndex::search(const std::string &text) const
+{
+    std::string needle = text;
+    std::transform(needle.begin(), needle.end(), needle.begin(), ::tolower);
+
+    std::vector<std::string> paths;
+    for (Uint32 record = 0; record < count; record++)
+    {
+        if (containsIgnoringCase(title(record), needle) || containsIgnoringCase(artist(record), needle) ||
+            containsIgnoringCase(album(record), needle) || containsIgnoringCase(path(record), needle))
+        {
+            paths.push_back(path(record));
+        }
+    }
+    return paths;
+}
+
+bool LibraryIndex::write(const std::string &file, std::vector<LibraryEntry> &entries, const LibraryIndex &previous)
+{
+    // Offset 0 is the empty string, used for missing tags
+    std::string pool(1, '\0');
+    std::unordered_map<std::string, Uint32> tags;
+    auto addTag = [&pool, &tags](const std::string &tag) -> Uint32 {
+        if (tag.empty())
+        {
+            return 0;
+        }
+        auto inserted = tags.emplace(tag, (Uint32)pool.size());
+        if (inserted.second)
+        {
+            pool.append(tag).push_back('\0');
+        }
+        return inserted.first->second;
+    };
+
+    std::vector<Record> output(entries.size());
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        const LibraryEntry &entry = entries[i];
+        Record &record = output[i];
+        record.size = entry.size;
+        record.modified = entry.modified;
+        record.path = (Uint32)pool.size();
+        pool.append(entry.path).push_back('\0');
+        if (entry.previous != NONE)
+        {
+            record.title = addTag(previous.title(entry.previous));
+            record.artist = addTag(previous.artist(entry.previous));
+            record.album = addTag(previous.album(entry.previous));
+            record.durationMs = previous.records[entry.previous].durationMs;
+            record.sourceRate = previous.records[entry.previous].sourceRate;
+            record.type = previous.records[entry.previous].type;
+        }
+        else
+        {
+            record.title = addTag(entry.info.title);
+            record.artist = addTag(entry.info.artist);
+            record.album = addTag(entry.info.album);
+            record.durationMs = (Uint32)(entry.info.duration * 1000.0 + 0.5);
+            record.sourceRate = (Uint32)entry.info.sourceRate;
+            record.type = (Uint32)entry.info.type;
+        }
+        record.reserved = 0;
+        if (pool.size() >= NONE)
+        {
+            std::cout << "Library is too big for the index format" << std::endl;
+            return false;
+        }
+    }
+
+    Header header;
+    std::memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.version = INDEX_VERSION;
+    header.recordSize = sizeof(Record);
+    header.count = (Uint32)output.size();
+    header.reserved = 0;
+    header.stringsOffset = sizeof(Header) + (Uint64)output.size() * sizeof(Record);
+    header.stringsBytes = pool.size();
+    header.fileBytes = header.stringsOffset + header.stringsBytes;
+
+    std::ofstream out(file, std::ios::binary | std::ios::trunc);
+    out.write((const char *)&header, sizeof(header));
+    out.write((const char *)output.data(), (std::streamsize)(output.size() * sizeof(Record)));
+    out.write(pool.data(), (std::streamsize)pool.size());
+    out.close();
+    if (!out)
+    {
+        std::cout << "Failed to write library index " << file << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Library::start(const std::string &indexFile, const std::vector<std::string> &folders, void (*onComplete)())
+{
+    this->indexFile = indexFile;
+    this->folders = folders;
+    this->onComplete = onComplete;
+    stopping = false;
+    swapPending = false;
+    busy = false;
+
+    Uint64 begin = SDL_GetPerformanceCounter();
+    current.open(indexFile);
+    openTime = (double)(SDL_GetPerformanceCounter() - begin) * 1000.0 / SDL_GetPerformanceFrequency();
+
+    if (folders.empty())
+    {
+        return true;
+    }
+    mutex = SDL_CreateMutex();
+    cond = SDL_CreateCond();
+    if (mutex == nullptr || cond == nullptr)
+    {
+        std::cout << "Failed to create library lock: " << SDL_GetError() << std::endl;
+        stop();
+        return false;
+    }
+
+#if defined(__linux__)
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd < 0)
+    {
+        std::cout << "Library changes will only be picked up at the next start" << std::endl;
+    }
+    else
+    {
+        watchThread = SDL_CreateThread(watch, "LibraryWatch", this);
+    }
+#endif
+
+    // Bring the index up to date with what is on disk right away
+    rescanRequested = true;
+    thread = SDL_CreateThread(run, "Library", this);
+    if (thread == nullptr)
+    {
+        std::cout << "Failed to create library thread: " << SDL_GetError() << std::endl;
+        stop();
+        return false;
+    }
+    return true;
+}
+
+void Library::stop()
+{
+    if (mutex != nullptr)
+    {
+        SDL_LockMutex(mutex);
+        stopping = true;
+        SDL_CondBroadcast(cond);
+        SDL_UnlockMutex(mutex);
+    }
+    if (thread != nullptr)
+    {
+        SDL_WaitThread(thread, nullptr);
+        thread = nullptr;
+    }
+#if defined(__linux__)
+    if (watchThread != nullptr)
+    {
+        SDL_WaitThread(watchThread, nullptr);
+        watchThread = nullptr;
+    }
+    if (inotifyFd >= 0)
+    {
+        ::close(inotifyFd);
+        inotifyFd = -1;
+    }
+#endif
+    current.close();
+
+    if (cond != nullptr)
+    {
+        SDL_DestroyCond(cond);
+        cond = nullptr;
+    }
+    if (mutex != nullptr)
+    {
+        SDL_DestroyMutex(mutex);
+        mutex = nullptr;
+    }
+}
+
+bool Library::poll()
+{
+    if (mutex == nullptr)
+    {
+        return false;
+    }
+    SDL_LockMutex(mutex);
+    bool swap = swapPending;
+    SDL_UnlockMutex(mutex);
+    if (!swap)
+    {
+        return false;
+    }
+
+    // The worker waits for this, so nothing else uses the old mapping. It
+    // has to be gone before the file can be replaced on Windows.
+    current.close();
+    std::error_code error;
+    std::filesystem::rename(indexFile + ".new", indexFile, error);
+    if (error)
+    {
+        std::cout << "Failed to replace library index: " << error.message() << std::endl;
+    }
+    current.open(indexFile);
+
+    SDL_LockMutex(mutex);
+    swapPending = false;
+    SDL_CondBroadcast(cond);
+    SDL_UnlockMutex(mutex);
+    return true;
+}
+
+bool Library::scanning()
+{
+    if (mutex == nullptr)
+    {
+        return false;
+    }
+    SDL_LockMutex(mutex);
+    bool scanning = busy || rescanRequested;
+    SDL_UnlockMutex(mutex);
+    return scanning;
+}
+
+Uint32 Library::filesProbed()
+{
+    if (mutex == nullptr)
+    {
+        return 0;
+    }
+    SDL_LockMutex(mutex);
+    Uint32 count = probedCount;
+    SDL_UnlockMutex(mutex);
+    return count;
+}
+
+bool Library::stopRequested()
+{
+    SDL_LockMutex(mutex);
+    bool stop = stopping;
+    SDL_UnlockMutex(mutex);
+    return stop;
+}
+
+#if defined(__linux__)
+void Library::addWatch(const std::string &folder)
+{
+    if (inotifyFd < 0)
+    {
+        return;
+    }
+    // Watching a folder again just returns its existing watch
+    Uint32 events = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_ONLYDIR;
+    if (inotify_add_watch(inotifyFd, folder.c_str(), events) < 0 && errno == ENOSPC && !watchLimitReported)
+    {
+        watchLimitReported = true;
+        std::cout << "Too many library folders to watch them all, raise fs.inotify.max_user_watches" << std::endl;
+    }
+}
+
+int SDLCALL Library::watch(void *data)
+{
+    Library *library = static_cast<Library *>(data);
+    alignas(struct inotify_event) char buffer[16384];
+    bool changed = false;
+    Uint32 lastChange = 0;
+
+    while (!library->stopRequested())
+    {
+        struct pollfd watched = {library->inotifyFd, POLLIN, 0};
+        if (::poll(&watched, 1, WATCH_POLL_MS) > 0)
+        {
+            ssize_t length;
+            while ((length = read(library->inotifyFd, buffer, sizeof(buffer))) > 0)
+            {
+                for (char *next = buffer; next < buffer + length;)
+                {
+                    const struct inotify_event *event = (const struct inotify_event *)next;
+                    next += sizeof(struct inotify_event) + event->len;
+                    // Only folders and music files matter, not cover art or playlists.
+                    // After the kernel's queue overflowed, events were lost and
+                    // anything may have changed.
+                    bool folder = (event->mask & (IN_ISDIR | IN_DELETE_SELF)) != 0;
+                    bool lost = (event->mask & IN_Q_OVERFLOW) != 0;
+                    if (folder || lost || (event->len > 0 && hasAudioExtension(event->name)))
+                    {
+                        changed = true;
+                        lastChange = SDL_GetTicks();
+                    }
+                }
+            }
+        }
+
+        // Copying a whole album is one rescan, not one per file
+        if (changed && SDL_GetTicks() - lastChange >= RESCAN_QUIET_MS)
+        {
+            changed = false;
+            SDL_LockMutex(library->mutex);
+            library->rescanRequested = true;
+            SDL_CondBroadcast(library->cond);
+            SDL_UnlockMutex(library->mutex);
+        }
+    }
+    return 0;
+}
+#endif
+
+int SDLCALL Library::probeFiles(void *data)
+{
+    Library *library = static_cast<Library *>(data);
+    SDL_LockMutex(library->mutex);
+    while (!library->stopping && library->nextProbe < library->probing->size())
+    {
+        LibraryEntry &entry = (*library->probing)[library->nextProbe++];
+        if (entry.previous != LibraryIndex::NONE)
+        {
+            continue;
+        }
+        SDL_UnlockMutex(library->mutex);
+        // Files that can not be opened stay in the index without tags, so
+        // they are not probed again until they change
+        probeTrack(entry.path, entry.info);
+        SDL_LockMutex(library->mutex);
+        library->probedCount++;
+    }
+    SDL_UnlockMutex(library->mutex);
+    return 0;
+}
+
+void Library::probeChanged(std::vector<LibraryEntry> &entries)
+{
+    size_t changed = std::count_if(entries.begin(), entries.end(), [](const LibraryEntry &entry) { return entry.previous == LibraryIndex::NONE; });
+    SDL_LockMutex(mutex);
+    probing = &entries;
+    nextProbe = 0;
+    SDL_UnlockMutex(mutex);
+
+    // Opening files is slow and mostly waits for the disk and the decoders'
+    // header parsing, so a big first scan is spread over a few threads
+    std::vector<SDL_Thread *> threads;
+    if (changed >= PROBE_THREADS_MIN_FILES)
+    {
+        for (int i = 1; i < std::clamp(SDL_GetCPUCount() - 1, 1, 4); i++)
+        {
+            SDL_Thread *probeThread = SDL_CreateThread(probeFiles, "LibraryProbe", this);
+            if (probeThread != nullptr)
+            {
+                threads.push_back(probeThread);
+            }
+        }
+    }
+    probeFiles(this);
+    for (SDL_Thread *probeThread : threads)
+    {
+        SDL_WaitThread(probeThread, nullptr);
+    }
+
+    SDL_LockMutex(mutex);
+    probing = nullptr;
+    SDL_UnlockMutex(mutex);
+}
+
+static bool isBelow(const char *path, const std::string &folder)
+{
+    if (std::strncmp(path, folder.c_str(), folder.size()) != 0)
+    {
+        return false;
+    }
+    char separator = folder.empty() ? '\0' : folder.back();
+    separator = separator == '/' || separator == '\\' ? separator : path[folder.size()];
+    return separator == '/' || separator == '\\';
+}
+
+// Adds the indexed tracks below folder that are missing from
+// entries[listed...], as they are in the index. Returns how many.
+size_t Library::keepIndexed(const std::string &folder, std::vector<LibraryEntry> &entries, size_t listed)
+{
+    auto byPath = [](const LibraryEntry &a, const LibraryEntry &b) { return a.path < b.path; };
+    std::sort(entries.begin() + listed, entries.end(), byPath);
+    size_t end = entries.size();
+    size_t kept = 0;
+    for (Uint32 record = current.lowerBound(folder); record < current.size() && isBelow(current.path(record), folder); record++)
+    {
+        LibraryEntry entry = {current.path(record), current.fileSize(record), current.modified(record), LibraryIndex::NONE, TrackInfo()};
+        if (!std::binary_search(entries.begin() + listed, entries.begin() + end, entry, byPath))
+        {
+            entries.push_back(std::move(entry));
+            kept++;
+        }
+    }
+    return kept;
+}
+
+bool Library::rescan()
+{
+    Uint64 begin = SDL_GetPerformanceCounter();
+    std::vector<LibraryEntry> entries;
+    for (const std::string &folder : folders)
+    {
+#if defined(__linux__)
+        addWatch(folder);
+#endif
+        size_t listed = entries.size();
+        std::error_code error;
+        auto options = std::filesystem::directory_options::skip_permission_denied;
+        for (std::filesystem::recursive_directory_iterator it(folder, options, error), end; !error && it != end; it.increment(error))
+        {
+            const std::filesystem::directory_entry &file = *it;
+            std::error_code fileError;
+            if (file.is_directory(fileError))
+            {
+#if defined(__linux__)
+                addWatch(file.path().string());
+#endif
+                continue;
+            }
+            std::string path = file.path().string();
+            if (!hasAudioExtension(path))
+            {
+                continue;
+            }
+            // The same stamp the loudness cache uses
+            std::uintmax_t size = file.file_size(fileError);
+            std::filesystem::file_time_type time = file.last_write_time(fileError);
+            if (!fileError)
+            {
+                entries.push_back({path, (Sint64)size, (Sint64)time.time_since_epoch().count(), LibraryIndex::NONE, TrackInfo()});
+            }
+        }
+        if (error)
+        {
+            std::cout << "Failed to scan library folder " << folder << ": " << error.message() << std::endl;
+        }
+
+        // A folder that can not be walked, or has no music left at all, is
+        // most likely an unmounted drive or share, or a mount point without
+        // its drive. Its tracks stay in the library as they were rather than
+        // being dropped until it comes back.
+        if (error || entries.size() == listed)
+        {
+            size_t kept = keepIndexed(folder, entries, listed);
+            if (kept > 0)
+            {
+                std::cout << "Library folder " << folder << " is not reachable, keeping " << kept << " tracks from the index" << std::endl;
+            }
+        }
+        if (stopRequested())
+        {
+            return false;
+        }
+    }
+
+    // Folders may overlap
+    std::sort(entries.begin(), entries.end(), [](const LibraryEntry &a, const LibraryEntry &b) { return a.path < b.path; });
+    entries.erase(std::unique(entries.begin(), entries.end(), [](const LibraryEntry &a, const LibraryEntry &b) { return a.path == b.path; }),
+                  entries.end());
+
+    // Files with the size and modification time in the index are not opened
+    size_t unchanged = 0;
+    for (LibraryEntry &entry : entries)
+    {
+        Uint32 record = current.find(entry.path);
+        if (record != LibraryIndex::NONE && current.fileSize(record) == entry.size && current.modified(record) == entry.modified)
+        {
+            entry.previous = record;
+            unchanged++;
+        }
+    }
+    if (unchanged == entries.size() && unchanged == current.size())
+    {
+        return false;
+    }
+
+    probeChanged(entries);
+    if (stopRequested() || !LibraryIndex::write(indexFile + ".new", entries, current))
+    {
+        return false;
+    }
+    double seconds = (double)(SDL_GetPerformanceCounter() - begin) / SDL_GetPerformanceFrequency();
+    std::cout << "Library: " << entries.size() << " tracks, " << entries.size() - unchanged << " new or changed, "
+              << current.size() - unchanged << " gone, rescanned in " << seconds << " s" << std::endl;
+    return true;
+}
+
+int SDLCALL Library::run(void *data)
+{
+    Library *library = static_cast<Library *>(data);
+
+    SDL_LockMutex(library->mutex);
+    while (!library->stopping)
+    {
+        // A new index is not started on until the last one was swapped in
+        if (!library->rescanRequested || library->swapPending)
+        {
+            SDL_CondWait(library->cond, library->mutex);
+            continue;
+        }
+        library->rescanRequested = false;
+        library->busy = true;
+
+        SDL_UnlockMutex(library->mutex);
+        bool changed = library->rescan();
+        SDL_LockMutex(library->mutex);
+
+        library->busy = false;
+        library->swapPending = changed && !library->stopping;
+        // Also when nothing changed, so the UI sees the scan has finished
+        if (library->onComplete != nullptr)
+        {
+            library->onComplete();
+        }
+    }
+    SDL_UnlockMutex(library->mutex);
+    return 0;
+}
+
+void benchmarkLibrary()
+{
+    const Uint32 tracks = 500000;
+    const Uint32 lookups = 100000;
+
+    std::vector<LibraryEntry> entries(tracks);
+    for (Uint32 i = 0; i < tracks; i++)
+    {
+        LibraryEntry &entry = entries[i];
+        std::string artist = "Artist " + std::to_string(i / 500);
+        std::string album = "Album " + std::to_string(i / 10);
+        entry.path = "/home/user/Music/" + artist + "/" + album + "/" + std::to_string(i % 10 + 1) + " Track " + std::to_string(i) + ".flac";
+        entry.size = 30000000 + i;
+        entry.modified = 1700000000000000000ll + i;
+        entry.previous = LibraryIndex::NONE;
+        entry.info.title = "Track " + std::to_string(i);
+        entry.info.artist = artist;
+        entry.info.album = album;
+        entry.info.duration = 180.0 + i % 120;
+        entry.info.sourceRate = 44100;
+        entry.info.type = MUS_FLAC;
+    }
+    std::sort(entries.begin(), entries.end(), [](const LibraryEntry &a, const LibraryEntry &b) { return a.path < b.path; });
+
+    std::string file = (std::filesystem::temp_directory_path() / "audioflow-bench.index").string();
+    auto milliseconds = [](Uint64 begin) { return (double)(SDL_GetPerformanceCounter() - begin) * 1000.0 / SDL_GetPerformanceFrequency(); };
+
+    Uint64 begin = SDL_GetPerformanceCounter();
+    LibraryIndex empty;
+    if (!LibraryIndex::write(file, entries, empty))
+    {
+        return;
+    }
+    double writeTime = milliseconds(begin);
+
+    begin = SDL_GetPerformanceCounter();
+    LibraryIndex index;
+    bool opened = index.open(file);
+    double openTime = milliseconds(begin);
+    if (!opened)
+    {
+        std::cout << "Failed to open " << file << std::endl;
+        return;
+    }
+
+    Uint64 state = 0x2545F4914F6CDD1Dull;
+    begin = SDL_GetPerformanceCounter();
+    Uint32 found = 0;
+    for (Uint32 i = 0; i < lookups; i++)
+    {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        found += index.find(entries[(state * 0x2545F4914F6CDD1Dull >> 32) % tracks].path) != LibraryIndex::NONE ? 1 : 0;
+    }
+    double findTime = milliseconds(begin);
+
+    begin = SDL_GetPerformanceCounter();
+    double totalSeconds = 0.0;
+    for (Uint32 record = 0; record < index.size(); record++)
+    {
+        totalSeconds += index.duration(record);
+    }
+    double walkTime = milliseconds(begin);
+
+    begin = SDL_GetPerformanceCounter();
+    std::vector<std::string> matches = index.search("artist 420/");
+    double searchTime = milliseconds(begin);
+
+    std::error_code error;
+    Uint64 fileBytes = std::filesystem::file_size(file, error);
+    std::cout << "Library index of " << index.size() << " tracks, " << fileBytes / (1024 * 1024) << " MiB (" << fileBytes / tracks
+              << " bytes per track)" << std::endl;
+    std::cout << "  write: " << writeTime << " ms, open: " << openTime << " ms" << std::endl;
+    std::cout << "  find: " << findTime * 1e6 / lookups << " ns per path (" << found << " of " << lookups << " found)" << std::endl;
+    std::cout << "  every record: " << walkTime << " ms (" << (Uint64)(totalSeconds / 3600.0) << " hours of music), search: "
+              << searchTime << " ms (" << matches.size() << " matches)" << std::endl;
+    index.close();
+    std::filesystem::remove(file, error);
+}
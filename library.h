@@ -0,0 +1,174 @@
+#ifndef LIBRARY_H
+#define LIBRARY_H
+
+#include <SDL2/SDL.h>
+#include <string>
+#include <vector>
+#include "track.h"
+
+// One file of the library as it is about to be written to the index
+struct LibraryEntry
+{
+    std::string path;
+    Sint64 size;
+    Sint64 modified;
+    Uint32 previous; // Record in the current index it is unchanged from, or LibraryIndex::NONE
+    TrackInfo info;  // Filled in when previous is NONE
+};
+
+// Read-only view of an index file, memory-mapped so opening it costs the
+// same for ten tracks or a million: only the header is checked and pages
+// are read in as records are touched.
+//
+// The file is a header, fixed-size records sorted by path and a pool of
+// NUL-terminated strings the records point into, all in native byte order.
+// Tags are stored once however many tracks share them.
+class LibraryIndex
+{
+public:
+    static const Uint32 NONE = 0xFFFFFFFF;
+
+    LibraryIndex() = default;
+    ~LibraryIndex() { close(); }
+
+    LibraryIndex(const LibraryIndex &) = delete;
+    LibraryIndex &operator=(const LibraryIndex &) = delete;
+
+    // False if the file is missing or not a valid index; the index is empty then
+    bool open(const std::string &file);
+    void close();
+
+    Uint32 size() const { return count; }
+    // Record for path, NONE if it is not in the library. O(log n).
+    Uint32 find(const std::string &path) const;
+    // First record whose path is not less than path, size() if none
+    Uint32 lowerBound(const std::string &path) const;
+
+    const char *path(Uint32 record) const { return string(records[record].path); }
+    const char *title(Uint32 record) const { return string(records[record].title); }
+    const char *artist(Uint32 record) const { return string(records[record].artist); }
+    const char *album(Uint32 record) const { return string(records[record].album); }
+    Sint64 fileSize(Uint32 record) const { return records[record].size; }
+    Sint64 modified(Uint32 record) const { return records[record].modified; }
+    double duration(Uint32 record) const { return records[record].durationMs / 1000.0; }
+    int sourceRate(Uint32 record) const { return (int)records[record].sourceRate; }
+    Mix_MusicType type(Uint32 record) const { return (Mix_MusicType)records[record].type; }
+
+    // Paths of the tracks whose path or tags contain text, ignoring case,
+    // sorted by path
+    std::vector<std::string> search(const std::string &text) const;
+
+    // Entries must be sorted by path without duplicates. Unchanged ones are
+    // copied from previous.
+    static bool write(const std::string &file, std::vector<LibraryEntry> &entries, const LibraryIndex &previous);
+
+private:
+    struct Header
+    {
+        char magic[8];
+        Uint32 version;
+        Uint32 recordSize;
+        Uint32 count;
+        Uint32 reserved;
+        Uint64 stringsOffset;
+        Uint64 stringsBytes;
+        Uint64 fileBytes;
+    };
+
+    struct Record
+    {
+        Sint64 size;
+        Sint64 modified;
+        Uint32 path; // Offsets into the string pool
+        Uint32 title;
+        Uint32 artist;
+        Uint32 album;
+        Uint32 durationMs;
+        Uint32 sourceRate;
+        Uint32 type;
+        Uint32 reserved;
+    };
+
+    const char *string(Uint32 offset) const { return offset < stringsBytes ? strings + offset : ""; }
+
+    const Uint8 *data = nullptr;
+    size_t bytes = 0;
+    const Record *records = nullptr;
+    Uint32 count = 0;
+    const char *strings = nullptr;
+    Uint64 stringsBytes = 0;
+#if defined(_WIN32)
+    void *fileHandle = nullptr;
+    void *mappingHandle = nullptr;
+#endif
+};
+
+// The music library: every audio file below the configured folders, with
+// its tags, length and format, kept in an index file between runs.
+//
+// At start the existing index is mapped, which is all that is needed to use
+// the library. A worker thread then rescans the folders: files are listed
+// and stat'ed, and only those whose size or modification time differ from
+// the index are opened and probed, on a few threads. If anything changed,
+// a new index is written next to the old one and poll() swaps it in. A
+// folder that can not be read, like an unmounted drive, keeps its tracks. On
+// Linux, inotify watches every folder and changes trigger another rescan
+// once things have been quiet for a moment; elsewhere the library is
+// brought up to date at each start.
+class Library
+{
+public:
+    // onComplete is called from the worker after every rescan
+    bool start(const std::string &indexFile, const std::vector<std::string> &folders, void (*onComplete)());
+    void stop();
+
+    // UI thread. Swaps in a finished rescan; true if the index changed.
+    bool poll();
+    // UI thread, valid until the next poll()
+    const LibraryIndex &index() const { return current; }
+    double openMilliseconds() const { return openTime; }
+
+    bool scanning();
+    Uint32 filesProbed();
+
+private:
+    static int SDLCALL run(void *data);
+    static int SDLCALL probeFiles(void *data);
+    bool stopRequested();
+    bool rescan();
+    void probeChanged(std::vector<LibraryEntry> &entries);
+    size_t keepIndexed(const std::string &folder, std::vector<LibraryEntry> &entries, size_t listed);
+#if defined(__linux__)
+    static int SDLCALL watch(void *data);
+    void addWatch(const std::string &folder);
+#endif
+
+    std::string indexFile;
+    std::vector<std::string> folders;
+    LibraryIndex current;
+    double openTime = 0.0;
+
+    SDL_Thread *thread = nullptr;
+    SDL_mutex *mutex = nullptr;
+    SDL_cond *cond = nullptr;
+    void (*onComplete)() = nullptr;
+    bool stopping = false;
+    bool rescanRequested = false;
+    bool swapPending = false; // A new index waits for poll(); the worker leaves current alone
+    bool busy = false;
+    Uint32 probedCount = 0;
+    std::vector<LibraryEntry> *probing = nullptr; // Entries the probe threads work through
+    size_t nextProbe = 0;
+
+#if defined(__linux__)
+    SDL_Thread *watchThread = nullptr;
+    int inotifyFd = -1;
+    bool watchLimitReported = false;
+#endif
+};
+
+// Writes a synthetic index of 500,000 tracks and times opening it, looking
+// tracks up and searching it
+void benchmarkLibrary();
+
+#endif
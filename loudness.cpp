@@ -0,0 +1,411 @@
+#include "loudness.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+const double PI = 3.14159265358979323846;
+const int BLOCK_FRAMES = 4096;
+
+// True peak interpolation: 4x oversampling with a 48 tap windowed sinc
+const int OVERSAMPLING = 4;
+const int PHASE_TAPS = 12;
+
+struct Biquad
+{
+    double b0, b1, b2, a1, a2;
+    double z1 = 0.0, z2 = 0.0;
+
+    double process(double x)
+    {
+        double y = b0 * x + z1;
+        z1 = b1 * x - a1 * y + z2;
+        z2 = b2 * x - a2 * y;
+        return y;
+    }
+};
+
+// The two stages of the BS.1770 K-weighting filter (high shelf, then high
+// pass), derived for any sample rate from the analog prototype
+static void kWeighting(int frequency, Biquad &shelf, Biquad &highPass)
+{
+    double f0 = 1681.974450955533;
+    double gain = 3.999843853973347;
+    double q = 0.7071752369554196;
+    double k = std::tan(PI * f0 / frequency);
+    double vh = std::pow(10.0, gain / 20.0);
+    double vb = std::pow(vh, 0.4996667741545416);
+    double a0 = 1.0 + k / q + k * k;
+    shelf.b0 = (vh + vb * k / q + k * k) / a0;
+    shelf.b1 = 2.0 * (k * k - vh) / a0;
+    shelf.b2 = (vh - vb * k / q + k * k) / a0;
+    shelf.a1 = 2.0 * (k * k - 1.0) / a0;
+    shelf.a2 = (1.0 - k / q + k * k) / a0;
+
+    f0 = 38.13547087602444;
+    q = 0.5003270373238773;
+    k = std::tan(PI * f0 / frequency);
+    a0 = 1.0 + k / q + k * k;
+    highPass.b0 = 1.0;
+    highPass.b1 = -2.0;
+    highPass.b2 = 1.0;
+    highPass.a1 = 2.0 * (k * k - 1.0) / a0;
+    highPass.a2 = (1.0 - k / q + k * k) / a0;
+}
+
+static void oversamplingFilter(float taps[OVERSAMPLING][PHASE_TAPS])
+{
+    const int length = OVERSAMPLING * PHASE_TAPS;
+    for (int n = 0; n < length; n++)
+    {
+        double t = (n - (length - 1) / 2.0) / OVERSAMPLING;
+        double sinc = t == 0.0 ? 1.0 : std::sin(PI * t) / (PI * t);
+        double window = 0.5 - 0.5 * std::cos(2.0 * PI * (n + 0.5) / length);
+        taps[n % OVERSAMPLING][n / OVERSAMPLING] = (float)(sinc * window);
+    }
+}
+
+// Channel weights of BS.1770 for SDL's channel order, surrounds count more
+static double channelWeight(int channel, int channels)
+{
+    if (channels == 6)
+    {
+        const double weights[] = {1.0, 1.0, 1.0, 0.0, 1.41, 1.41};
+        return weights[channel];
+    }
+    if (channels == 4 && channel >= 2)
+    {
+        return 1.41;
+    }
+    return 1.0;
+}
+
+static double energyToLoudness(double energy)
+{
+    return -0.691 + 10.0 * std::log10(energy);
+}
+
+// Mean energy of the blocks above the absolute gate, then of those above the
+// relative gate. Returns 0 if nothing passes.
+static double gatedEnergy(const std::vector<double> &blocks, double relativeGate, std::vector<double> *passed)
+{
+    const double absoluteGate = std::pow(10.0, (-70.0 + 0.691) / 10.0);
+
+    double sum = 0.0;
+    int count = 0;
+    for (double energy : blocks)
+    {
+        if (energy > absoluteGate)
+        {
+            sum += energy;
+            count++;
+        }
+    }
+    if (count == 0)
+    {
+        return 0.0;
+    }
+
+    double threshold = sum / count * std::pow(10.0, relativeGate / 10.0);
+    sum = 0.0;
+    count = 0;
+    for (double energy : blocks)
+    {
+        if (energy > absoluteGate && energy > threshold)
+        {
+            sum += energy;
+            count++;
+            if (passed != nullptr)
+            {
+                passed->push_back(energy);
+            }
+        }
+    }
+    return count > 0 ? sum / count : 0.0;
+}
+
+// The filter of one channel and its weight in the sum
+struct KWeighting
+{
+    double weight;
+    Biquad shelf;
+    Biquad highPass;
+};
+
+struct LoudnessMeter::ChannelState
+{
+    KWeighting filter;
+    // Input block with the history the interpolation filter needs in front
+    std::vector<float> input;
+};
+
+// Weighted energy of count samples after the K-weighting filter
+static double weightedEnergy(KWeighting &channel, const float *x, int count)
+{
+    double sum = 0.0;
+    for (int i = 0; i < count; i++)
+    {
+        double filtered = channel.highPass.process(channel.shelf.process(x[i]));
+        sum += filtered * filtered;
+    }
+    return channel.weight * sum;
+}
+
+// The same for two channels at once, one in each lane of a vector of two
+// doubles. The filters are the same for every channel, only their state
+// differs, and the recursion of one channel is a chain of dependent
+// multiply-adds, so the second channel comes for free. Each lane computes
+// exactly what weightedEnergy() does.
+static double weightedEnergyPair(KWeighting &first, KWeighting &second, const float *x0, const float *x1, int count)
+{
+#if defined(__SSE2__)
+    const Biquad &s = first.shelf;
+    const Biquad &h = first.highPass;
+    __m128d sb0 = _mm_set1_pd(s.b0), sb1 = _mm_set1_pd(s.b1), sb2 = _mm_set1_pd(s.b2);
+    __m128d sa1 = _mm_set1_pd(s.a1), sa2 = _mm_set1_pd(s.a2);
+    __m128d hb0 = _mm_set1_pd(h.b0), hb1 = _mm_set1_pd(h.b1), hb2 = _mm_set1_pd(h.b2);
+    __m128d ha1 = _mm_set1_pd(h.a1), ha2 = _mm_set1_pd(h.a2);
+    __m128d sz1 = _mm_set_pd(second.shelf.z1, first.shelf.z1);
+    __m128d sz2 = _mm_set_pd(second.shelf.z2, first.shelf.z2);
+    __m128d hz1 = _mm_set_pd(second.highPass.z1, first.highPass.z1);
+    __m128d hz2 = _mm_set_pd(second.highPass.z2, first.highPass.z2);
+    __m128d sum = _mm_setzero_pd();
+    for (int i = 0; i < count; i++)
+    {
+        __m128d x = _mm_set_pd(x1[i], x0[i]);
+        __m128d y = _mm_add_pd(_mm_mul_pd(sb0, x), sz1);
+        sz1 = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(sb1, x), _mm_mul_pd(sa1, y)), sz2);
+        sz2 = _mm_sub_pd(_mm_mul_pd(sb2, x), _mm_mul_pd(sa2, y));
+        __m128d filtered = _mm_add_pd(_mm_mul_pd(hb0, y), hz1);
+        hz1 = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(hb1, y), _mm_mul_pd(ha1, filtered)), hz2);
+        hz2 = _mm_sub_pd(_mm_mul_pd(hb2, y), _mm_mul_pd(ha2, filtered));
+        sum = _mm_add_pd(sum, _mm_mul_pd(filtered, filtered));
+    }
+    double lanes[2];
+    _mm_storel_pd(&first.shelf.z1, sz1);
+    _mm_storeh_pd(&second.shelf.z1, sz1);
+    _mm_storel_pd(&first.shelf.z2, sz2);
+    _mm_storeh_pd(&second.shelf.z2, sz2);
+    _mm_storel_pd(&first.highPass.z1, hz1);
+    _mm_storeh_pd(&second.highPass.z1, hz1);
+    _mm_storel_pd(&first.highPass.z2, hz2);
+    _mm_storeh_pd(&second.highPass.z2, hz2);
+    _mm_storeu_pd(lanes, sum);
+    return first.weight * lanes[0] + second.weight * lanes[1];
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const Biquad &s = first.shelf;
+    const Biquad &h = first.highPass;
+    float64x2_t sz1 = {first.shelf.z1, second.shelf.z1};
+    float64x2_t sz2 = {first.shelf.z2, second.shelf.z2};
+    float64x2_t hz1 = {first.highPass.z1, second.highPass.z1};
+    float64x2_t hz2 = {first.highPass.z2, second.highPass.z2};
+    float64x2_t sum = vdupq_n_f64(0.0);
+    for (int i = 0; i < count; i++)
+    {
+        float64x2_t x = {x0[i], x1[i]};
+        float64x2_t y = vaddq_f64(vmulq_n_f64(x, s.b0), sz1);
+        sz1 = vaddq_f64(vsubq_f64(vmulq_n_f64(x, s.b1), vmulq_n_f64(y, s.a1)), sz2);
+        sz2 = vsubq_f64(vmulq_n_f64(x, s.b2), vmulq_n_f64(y, s.a2));
+        float64x2_t filtered = vaddq_f64(vmulq_n_f64(y, h.b0), hz1);
+        hz1 = vaddq_f64(vsubq_f64(vmulq_n_f64(y, h.b1), vmulq_n_f64(filtered, h.a1)), hz2);
+        hz2 = vsubq_f64(vmulq_n_f64(y, h.b2), vmulq_n_f64(filtered, h.a2));
+        sum = vaddq_f64(sum, vmulq_f64(filtered, filtered));
+    }
+    first.shelf.z1 = vgetq_lane_f64(sz1, 0);
+    second.shelf.z1 = vgetq_lane_f64(sz1, 1);
+    first.shelf.z2 = vgetq_lane_f64(sz2, 0);
+    second.shelf.z2 = vgetq_lane_f64(sz2, 1);
+    first.highPass.z1 = vgetq_lane_f64(hz1, 0);
+    second.highPass.z1 = vgetq_lane_f64(hz1, 1);
+    first.highPass.z2 = vgetq_lane_f64(hz2, 0);
+    second.highPass.z2 = vgetq_lane_f64(hz2, 1);
+    return first.weight * vgetq_lane_f64(sum, 0) + second.weight * vgetq_lane_f64(sum, 1);
+#else
+    return weightedEnergy(first, x0, count) + weightedEnergy(second, x1, count);
+#endif
+}
+
+LoudnessMeter::LoudnessMeter(int channels, int frequency) : channels(channels)
+{
+    if (channels <= 0 || frequency < 10)
+    {
+        return;
+    }
+    subBlockFrames = frequency / 10;
+    oversamplingFilter(taps);
+    interpolated.resize(BLOCK_FRAMES);
+    state.resize(channels);
+    for (int channel = 0; channel < channels; channel++)
+    {
+        state[channel].filter.weight = channelWeight(channel, channels);
+        kWeighting(frequency, state[channel].filter.shelf, state[channel].filter.highPass);
+        state[channel].input.assign(PHASE_TAPS - 1 + BLOCK_FRAMES, 0.0f);
+    }
+}
+
+LoudnessMeter::~LoudnessMeter() = default;
+
+void LoudnessMeter::add(const Uint8 *pcm, Uint32 frames, Uint16 format)
+{
+    if ((format != AUDIO_S16SYS && format != AUDIO_F32SYS) || state.empty())
+    {
+        return;
+    }
+
+    // Energy per 100 ms, gating blocks and short-term windows are built from these
+    energy.resize((size_t)((measuredFrames + frames) / subBlockFrames) + 1, 0.0);
+
+    for (Uint32 start = 0; start < frames; start += BLOCK_FRAMES)
+    {
+        int count = (int)SDL_min((Uint32)BLOCK_FRAMES, frames - start);
+        for (int channel = 0; channel < channels; channel++)
+        {
+            ChannelState &current = state[channel];
+            float *x = current.input.data() + PHASE_TAPS - 1;
+            if (format == AUDIO_S16SYS)
+            {
+                const Sint16 *samples = (const Sint16 *)pcm + (size_t)start * channels + channel;
+                for (int i = 0; i < count; i++)
+                {
+                    x[i] = samples[(size_t)i * channels] * (1.0f / 32768.0f);
+                }
+            }
+            else
+            {
+                const float *samples = (const float *)pcm + (size_t)start * channels + channel;
+                for (int i = 0; i < count; i++)
+                {
+                    x[i] = samples[(size_t)i * channels];
+                }
+            }
+
+            // Each phase is a short FIR over the block, written tap by tap so
+            // the inner loop is a plain multiply-add the compiler vectorizes
+            for (int phase = 0; phase < OVERSAMPLING; phase++)
+            {
+                float *__restrict y = interpolated.data();
+                std::fill(y, y + count, 0.0f);
+                for (int tap = 0; tap < PHASE_TAPS; tap++)
+                {
+                    const float *__restrict source = x - tap;
+                    float coefficient = taps[phase][tap];
+                    for (int i = 0; i < count; i++)
+                    {
+                        y[i] += coefficient * source[i];
+                    }
+                }
+                for (int i = 0; i < count; i++)
+                {
+                    float magnitude = std::fabs(y[i]);
+                    peak = magnitude > peak ? magnitude : peak;
+                }
+            }
+
+            // The history goes in front of the block, which stays for the
+            // K-weighting below
+            std::copy(x + count - (PHASE_TAPS - 1), x + count, current.input.begin());
+        }
+
+        // K-weighting, channels in pairs, a sub-block at a time
+        Uint64 frame = measuredFrames + start;
+        for (int i = 0; i < count;)
+        {
+            int run = (int)SDL_min((Uint64)(count - i), subBlockFrames - frame % subBlockFrames);
+            double sum = 0.0;
+            int channel = 0;
+            for (; channel + 1 < channels; channel += 2)
+            {
+                sum += weightedEnergyPair(state[channel].filter, state[channel + 1].filter,
+                                          state[channel].input.data() + PHASE_TAPS - 1 + i,
+                                          state[channel + 1].input.data() + PHASE_TAPS - 1 + i, run);
+            }
+            if (channel < channels)
+            {
+                sum += weightedEnergy(state[channel].filter, state[channel].input.data() + PHASE_TAPS - 1 + i, run);
+            }
+            energy[frame / subBlockFrames] += sum;
+            i += run;
+            frame += run;
+        }
+    }
+    measuredFrames += frames;
+}
+
+bool LoudnessMeter::finish(LoudnessInfo &info)
+{
+    if (state.empty())
+    {
+        return false;
+    }
+
+    // Only whole 100 ms sub-blocks count
+    size_t subBlocks = (size_t)(measuredFrames / subBlockFrames);
+    if (subBlocks < 4)
+    {
+        return false;
+    }
+    energy.resize(subBlocks);
+    for (double &value : energy)
+    {
+        value /= subBlockFrames;
+    }
+
+    // 400 ms gating blocks with 75% overlap, relative gate at -10 LU
+    std::vector<double> blocks;
+    for (size_t i = 0; i + 4 <= subBlocks; i++)
+    {
+        blocks.push_back((energy[i] + energy[i + 1] + energy[i + 2] + energy[i + 3]) / 4.0);
+    }
+    double integrated = gatedEnergy(blocks, -10.0, nullptr);
+    info.integrated = integrated > 0.0 ? energyToLoudness(integrated) : -70.0;
+
+    // 3 s short-term windows every second, relative gate at -20 LU, then the
+    // spread between the 10th and 95th percentile
+    std::vector<double> shortTerm;
+    for (size_t i = 0; i + 30 <= subBlocks; i += 10)
+    {
+        double sum = 0.0;
+        for (size_t j = i; j < i + 30; j++)
+        {
+            sum += energy[j];
+        }
+        shortTerm.push_back(sum / 30.0);
+    }
+    std::vector<double> passed;
+    gatedEnergy(shortTerm, -20.0, &passed);
+    info.range = 0.0;
+    if (!passed.empty())
+    {
+        std::sort(passed.begin(), passed.end());
+        size_t last = passed.size() - 1;
+        double low = passed[(size_t)std::lround(0.10 * last)];
+        double high = passed[(size_t)std::lround(0.95 * last)];
+        info.range = energyToLoudness(high) - energyToLoudness(low);
+    }
+
+    info.truePeak = peak > 0.0f ? 20.0 * std::log10(peak) : -120.0;
+    return true;
+}
+
+bool measureLoudness(const Uint8 *pcm, Uint32 frames, Uint16 format, int channels, int frequency, LoudnessInfo &info)
+{
+    if ((format != AUDIO_S16SYS && format != AUDIO_F32SYS) || channels <= 0 || frequency <= 0)
+    {
+        return false;
+    }
+    LoudnessMeter meter(channels, frequency);
+    meter.add(pcm, frames, format);
+    return meter.finish(info);
+}
+
+double loudnessGainDb(double loudness, double truePeak, double ceilingDb)
+{
+    double gain = LOUDNESS_TARGET_LUFS - loudness;
+    return gain > 0.0 ? SDL_min(gain, SDL_max(ceilingDb - truePeak, 0.0)) : gain;
+}
@@ -0,0 +1,51 @@
+#ifndef LOUDNESS_H
+#define LOUDNESS_H
+
+#include <SDL2/SDL.h>
+#include <vector>
+
+// Loudness reference of ReplayGain 2.0, gains bring tracks to this level
+const double LOUDNESS_TARGET_LUFS = -18.0;
+
+struct LoudnessInfo
+{
+    double integrated; // LUFS, gated as in ITU-R BS.1770-4
+    double range;      // LU, EBU Tech 3342
+    double truePeak;   // dBTP, 4x oversampled
+};
+
+// Measures interleaved PCM in AUDIO_S16SYS or AUDIO_F32SYS. Returns false
+// for other formats or if the audio is too short to contain a gating block.
+bool measureLoudness(const Uint8 *pcm, Uint32 frames, Uint16 format, int channels, int frequency, LoudnessInfo &info);
+
+// Measures a track handed over in pieces, for tracks that are not decoded
+// whole. Takes the same formats as measureLoudness().
+class LoudnessMeter
+{
+public:
+    LoudnessMeter(int channels, int frequency);
+    ~LoudnessMeter();
+
+    void add(const Uint8 *pcm, Uint32 frames, Uint16 format);
+    // False if what was added is too short to contain a gating block
+    bool finish(LoudnessInfo &info);
+
+private:
+    struct ChannelState;
+
+    int channels;
+    Uint32 subBlockFrames = 0;
+    std::vector<ChannelState> state;
+    float taps[4][12]; // Phases of the true peak interpolation filter
+    std::vector<float> interpolated;
+    std::vector<double> energy; // Per 100 ms sub-block
+    Uint64 measuredFrames = 0;
+    float peak = 0.0f;
+};
+
+// Gain in dB that brings `loudness` to the target. A boost is held to the
+// headroom between `truePeak` and the limiter ceiling, both in dBTP, so
+// it never pushes peaks into the limiter; a cut is never held back.
+double loudnessGainDb(double loudness, double truePeak, double ceilingDb);
+
+#endif
@@ -0,0 +1,482 @@
+#include "loudnessscanner.h"
+#include "audiofile.h"
+#include "track.h"
+#include "trackstream.h"
+
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+bool parseReplayGainMode(const std::string &name, ReplayGainMode &mode)
+{
+    for (int i = REPLAYGAIN_OFF; i <= REPLAYGAIN_ALBUM; i++)
+    {
+        if (name == replayGainModeName((ReplayGainMode)i))
+        {
+            mode = (ReplayGainMode)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *replayGainModeName(ReplayGainMode mode)
+{
+    switch (mode)
+    {
+    case REPLAYGAIN_OFF:
+        return "off";
+    case REPLAYGAIN_TRACK:
+        return "track";
+    case REPLAYGAIN_ALBUM:
+        return "album";
+    }
+    return "unknown";
+}
+
+bool LoudnessScanner::start(const std::string &cacheFile, int workers, void (*onComplete)())
+{
+    this->cacheFile = cacheFile;
+    this->onComplete = onComplete;
+    stopping = false;
+    mutex = SDL_CreateMutex();
+    fileMutex = SDL_CreateMutex();
+    cond = SDL_CreateCond();
+    if (mutex == nullptr || fileMutex == nullptr || cond == nullptr)
+    {
+        std::cout << "Failed to create loudness scanner lock: " << SDL_GetError() << std::endl;
+        stop();
+        return false;
+    }
+
+    loadCache();
+    compactCache();
+
+    for (int i = 0; i < SDL_max(workers, 1); i++)
+    {
+        SDL_Thread *thread = SDL_CreateThread(run, "LoudnessScanner", this);
+        if (thread == nullptr)
+        {
+            std::cout << "Failed to create loudness scanner thread: " << SDL_GetError() << std::endl;
+            break;
+        }
+        threads.push_back(thread);
+    }
+    if (threads.empty())
+    {
+        stop();
+        return false;
+    }
+    return true;
+}
+
+void LoudnessScanner::stop()
+{
+    if (!threads.empty())
+    {
+        SDL_LockMutex(mutex);
+        stopping = true;
+        SDL_CondBroadcast(cond);
+        SDL_UnlockMutex(mutex);
+        for (SDL_Thread *thread : threads)
+        {
+            SDL_WaitThread(thread, nullptr);
+        }
+        threads.clear();
+    }
+    pending.clear();
+    queued.clear();
+    completed.clear();
+
+    if (cond != nullptr)
+    {
+        SDL_DestroyCond(cond);
+        cond = nullptr;
+    }
+    if (mutex != nullptr)
+    {
+        SDL_DestroyMutex(mutex);
+        mutex = nullptr;
+    }
+    if (fileMutex != nullptr)
+    {
+        SDL_DestroyMutex(fileMutex);
+        fileMutex = nullptr;
+    }
+}
+
+void LoudnessScanner::request(const std::string &path)
+{
+    if (mutex == nullptr)
+    {
+        return;
+    }
+
+    // Whether the cached result is still valid is checked by the worker, so
+    // queueing thousands of files at once does no disk access here
+    SDL_LockMutex(mutex);
+    if (queued.insert(path).second)
+    {
+        pending.push_back(path);
+        SDL_CondSignal(cond);
+    }
+    SDL_UnlockMutex(mutex);
+}
+
+bool LoudnessScanner::poll(std::string &path)
+{
+    if (mutex == nullptr)
+    {
+        return false;
+    }
+
+    SDL_LockMutex(mutex);
+    bool found = !completed.empty();
+    if (found)
+    {
+        path = completed.front();
+        completed.pop_front();
+    }
+    SDL_UnlockMutex(mutex);
+    return found;
+}
+
+bool LoudnessScanner::gainDb(const std::string &path, ReplayGainMode mode, double ceilingDb, double &gain)
+{
+    if (mode == REPLAYGAIN_OFF || mutex == nullptr)
+    {
+        return false;
+    }
+
+    SDL_LockMutex(mutex);
+    auto it = entries.find(path);
+    bool found = it != entries.end() && it->second.verified && !it->second.failed;
+    if (found)
+    {
+        double loudness = it->second.info.integrated;
+        double truePeak = it->second.info.truePeak;
+        if (mode == REPLAYGAIN_ALBUM && it->second.album != "Unknown")
+        {
+            auto album = albums.find(albumKey(path, it->second.album));
+            if (album != albums.end() && album->second.duration > 0.0)
+            {
+                loudness = 10.0 * std::log10(album->second.energy / album->second.duration);
+                truePeak = *album->second.truePeaks.rbegin();
+            }
+        }
+        gain = loudnessGainDb(loudness, truePeak, ceilingDb);
+    }
+    SDL_UnlockMutex(mutex);
+    return found;
+}
+
+bool LoudnessScanner::idle()
+{
+    SDL_LockMutex(mutex);
+    bool done = queued.empty();
+    SDL_UnlockMutex(mutex);
+    return done;
+}
+
+Uint32 LoudnessScanner::filesScanned()
+{
+    SDL_LockMutex(mutex);
+    Uint32 count = scannedCount;
+    SDL_UnlockMutex(mutex);
+    return count;
+}
+
+double LoudnessScanner::speed()
+{
+    SDL_LockMutex(mutex);
+    double speed = busySeconds > 0.0 ? audioSeconds / busySeconds : 0.0;
+    SDL_UnlockMutex(mutex);
+    return speed;
+}
+
+// Files of one album share a folder and the album tag
+std::string LoudnessScanner::albumKey(const std::string &path, const std::string &album)
+{
+    return std::filesystem::path(path).parent_path().string() + '\n' + album;
+}
+
+void LoudnessScanner::storeEntry(const std::string &path, const LoudnessEntry &entry)
+{
+    removeEntry(path);
+    entries[path] = entry;
+    addToAlbum(path, entry, 1);
+}
+
+void LoudnessScanner::removeEntry(const std::string &path)
+{
+    auto it = entries.find(path);
+    if (it != entries.end())
+    {
+        addToAlbum(path, it->second, -1);
+        entries.erase(it);
+    }
+}
+
+void LoudnessScanner::addToAlbum(const std::string &path, const LoudnessEntry &entry, int sign)
+{
+    if (entry.failed || entry.album == "Unknown")
+    {
+        return;
+    }
+    std::string key = albumKey(path, entry.album);
+    AlbumLoudness &album = albums[key];
+    album.energy += sign * entry.duration * std::pow(10.0, entry.info.integrated / 10.0);
+    album.duration += sign * entry.duration;
+    album.files += sign;
+    if (sign > 0)
+    {
+        album.truePeaks.insert(entry.info.truePeak);
+    }
+    else if (album.truePeaks.count(entry.info.truePeak) > 0)
+    {
+        album.truePeaks.erase(album.truePeaks.find(entry.info.truePeak));
+    }
+    if (album.files <= 0)
+    {
+        albums.erase(key);
+    }
+}
+
+// One entry per line: size, mtime, integrated, range, true peak, duration,
+// album and path, separated by tabs, or for a file that failed size, mtime,
+// "failed" and path. Later lines replace earlier ones.
+void LoudnessScanner::loadCache()
+{
+    if (cacheFile.empty())
+    {
+        return;
+    }
+
+    std::ifstream in(cacheFile);
+    std::string line;
+    cacheLines = 0;
+    while (std::getline(in, line))
+    {
+        cacheLines++;
+        std::istringstream fields(line);
+        LoudnessEntry entry;
+        std::string path;
+        std::string integrated;
+        fields >> entry.size >> entry.modified >> integrated;
+        entry.failed = integrated == "failed";
+        if (!entry.failed)
+        {
+            std::istringstream(integrated) >> entry.info.integrated;
+            fields >> entry.info.range >> entry.info.truePeak >> entry.duration;
+        }
+        fields.ignore(1);
+        if (!fields || (!entry.failed && !std::getline(fields, entry.album, '\t')) || !std::getline(fields, path) ||
+            path.empty())
+        {
+            continue;
+        }
+        storeEntry(path, entry);
+    }
+}
+
+std::string LoudnessScanner::cacheLine(const std::string &path, const LoudnessEntry &entry)
+{
+    std::ostringstream line;
+    line << entry.size << '\t' << entry.modified << '\t';
+    if (entry.failed)
+    {
+        line << "failed\t" << path << '\n';
+        return line.str();
+    }
+
+    std::string album = entry.album;
+    for (char &c : album)
+    {
+        c = c == '\t' || c == '\n' ? ' ' : c;
+    }
+    line << entry.info.integrated << '\t' << entry.info.range << '\t' << entry.info.truePeak << '\t' << entry.duration << '\t'
+         << album << '\t' << path << '\n';
+    return line.str();
+}
+
+void LoudnessScanner::appendToCache(const std::string &line)
+{
+    if (cacheFile.empty())
+    {
+        return;
+    }
+
+    std::ofstream out(cacheFile, std::ios::app);
+    out << line;
+    if (!out)
+    {
+        std::cout << "Failed to write loudness cache " << cacheFile << std::endl;
+        return;
+    }
+    cacheLines++;
+}
+
+// Rewrites the cache with one line per entry once more than half of its
+// lines were replaced by later ones. Written next to it and renamed over it,
+// so a crash leaves the old file.
+void LoudnessScanner::compactCache()
+{
+    if (cacheFile.empty())
+    {
+        return;
+    }
+
+    SDL_LockMutex(mutex);
+    bool stale = cacheLines > 2 * entries.size() + 64;
+    std::string text;
+    if (stale)
+    {
+        for (const auto &entry : entries)
+        {
+            text += cacheLine(entry.first, entry.second);
+        }
+    }
+    size_t lines = entries.size();
+    SDL_UnlockMutex(mutex);
+    if (!stale)
+    {
+        return;
+    }
+
+    std::string temporary = cacheFile + ".tmp";
+    std::ofstream out(temporary, std::ios::trunc);
+    out << text;
+    out.close();
+    std::error_code error;
+    if (!out || (std::filesystem::rename(temporary, cacheFile, error), error))
+    {
+        std::cout << "Failed to rewrite loudness cache " << cacheFile << std::endl;
+        std::filesystem::remove(temporary, error);
+        return;
+    }
+    cacheLines = lines;
+}
+
+// WAV, FLAC, MP3 and Ogg Vorbis are measured at their own rate a piece at
+// a time, so they neither wait for nor hold up a change of the device
+// format, and a long file never has to fit in memory
+static bool measureSource(AudioFileReader &reader, LoudnessInfo &info, double &duration)
+{
+    const Uint32 PIECE_FRAMES = 65536;
+    LoudnessMeter meter(reader.channelCount(), reader.frequency());
+    std::vector<float> samples((size_t)PIECE_FRAMES * reader.channelCount());
+    Uint64 frames = 0;
+    Uint32 got;
+    while ((got = reader.read(samples.data(), PIECE_FRAMES)) > 0)
+    {
+        meter.add((const Uint8 *)samples.data(), got, AUDIO_F32SYS);
+        frames += got;
+    }
+    duration = (double)frames / reader.frequency();
+    return meter.finish(info);
+}
+
+int SDLCALL LoudnessScanner::run(void *data)
+{
+    LoudnessScanner *scanner = static_cast<LoudnessScanner *>(data);
+
+    SDL_LockMutex(scanner->mutex);
+    while (!scanner->stopping)
+    {
+        if (scanner->pending.empty())
+        {
+            SDL_CondWait(scanner->cond, scanner->mutex);
+            continue;
+        }
+
+        std::string path = scanner->pending.front();
+        scanner->pending.pop_front();
+
+        // Decoding and measuring take a while, so do it without holding the lock
+        SDL_UnlockMutex(scanner->mutex);
+        Uint64 begin = SDL_GetPerformanceCounter();
+        LoudnessEntry entry;
+        bool measured = false;
+        bool stamped = fileStamp(path, entry.size, entry.modified);
+        bool cached = false;
+        if (stamped)
+        {
+            SDL_LockMutex(scanner->mutex);
+            auto it = scanner->entries.find(path);
+            cached = it != scanner->entries.end() && it->second.size == entry.size && it->second.modified == entry.modified;
+            if (cached && !it->second.verified)
+            {
+                // The cached result is good for this run, gains can use it now
+                it->second.verified = true;
+                scanner->completed.push_back(path);
+                if (scanner->onComplete != nullptr)
+                {
+                    scanner->onComplete();
+                }
+            }
+            SDL_UnlockMutex(scanner->mutex);
+        }
+        AudioFileReader reader;
+        if (stamped && !cached && openWithSeekTable(reader, path))
+        {
+            measured = measureSource(reader, entry.info, entry.duration);
+            entry.album = reader.album().size() >= 2 ? reader.album() : "Unknown";
+            reader.close();
+        }
+        else if (stamped && !cached)
+        {
+            // Other formats, and MP3 and Ogg Vorbis without their decoder
+            // libraries, only SDL_mixer decodes, straight into the device format
+            Track *track = loadTrack(path);
+            int frequency;
+            Uint16 format;
+            int channels;
+            // Only the rate can change between decoding and here, the track knows its own
+            if (track != nullptr && track->chunk != nullptr && Mix_QuerySpec(&frequency, &format, &channels) != 0)
+            {
+                measured = measureLoudness(track->chunk->abuf, (Uint32)track->frames, format, channels, track->frequency, entry.info);
+                entry.duration = track->duration;
+                entry.album = track->album;
+            }
+            freeTrack(track);
+        }
+        double seconds = (double)(SDL_GetPerformanceCounter() - begin) / SDL_GetPerformanceFrequency();
+        SDL_LockMutex(scanner->mutex);
+
+        scanner->queued.erase(path);
+        if (stamped && !cached)
+        {
+            // Failures are remembered too, a broken file is not decoded again until it changes
+            entry.verified = true;
+            entry.failed = !measured;
+            scanner->storeEntry(path, entry);
+        }
+        if (measured)
+        {
+            scanner->scannedCount++;
+            scanner->audioSeconds += entry.duration;
+            scanner->busySeconds += seconds;
+            scanner->completed.push_back(path);
+            if (scanner->onComplete != nullptr)
+            {
+                scanner->onComplete();
+            }
+        }
+
+        // The cache file is written without holding up the other workers or gainDb()
+        if (stamped && !cached)
+        {
+            SDL_UnlockMutex(scanner->mutex);
+            SDL_LockMutex(scanner->fileMutex);
+            scanner->appendToCache(cacheLine(path, entry));
+            scanner->compactCache();
+            SDL_UnlockMutex(scanner->fileMutex);
+            SDL_LockMutex(scanner->mutex);
+        }
+    }
+    SDL_UnlockMutex(scanner->mutex);
+
+    return 0;
+}
@@ -0,0 +1,107 @@
+#ifndef LOUDNESSSCANNER_H
+#define LOUDNESSSCANNER_H
+
+#include <SDL2/SDL.h>
+#include <deque>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "loudness.h"
+
+enum ReplayGainMode
+{
+    REPLAYGAIN_OFF,
+    REPLAYGAIN_TRACK,
+    REPLAYGAIN_ALBUM // Same gain for every track of an album, keeps the album's dynamics
+};
+
+bool parseReplayGainMode(const std::string &name, ReplayGainMode &mode);
+const char *replayGainModeName(ReplayGainMode mode);
+
+struct LoudnessEntry
+{
+    LoudnessInfo info;
+    double duration; // Seconds
+    std::string album;
+    Sint64 size;
+    Sint64 modified;
+    bool verified = false; // A worker found the file unchanged, or measured it, this run
+    bool failed = false;   // The file could not be measured, so it is not tried again until it changes
+};
+
+// Measures the loudness of files on a pool of worker threads. Results,
+// failures included, are kept in a cache file keyed by path, and an entry
+// only counts as long as the file's size and modification time still match,
+// so edited files are measured again. The file is rewritten once replaced
+// entries make up most of it. Like the TrackLoader, finished files are collected with
+// poll() on the UI thread and the callback only wakes the main loop.
+class LoudnessScanner
+{
+public:
+    // cacheFile may be empty to keep the results in memory only
+    bool start(const std::string &cacheFile, int workers, void (*onComplete)());
+    void stop();
+
+    // Does nothing if the file is already waiting; files whose result is
+    // cached are skipped by the workers
+    void request(const std::string &path);
+    bool poll(std::string &path);
+
+    // Gain in dB for the file if its loudness is known and a worker has
+    // checked the result against the file since it was requested. In album
+    // mode the album is every measured file in the same folder with the same
+    // album tag; its loudness is the duration weighted energy of those
+    // files and its peak the highest of theirs. A boost stops where the peak
+    // would reach ceilingDb. Only looks up results, never touches the disk.
+    bool gainDb(const std::string &path, ReplayGainMode mode, double ceilingDb, double &gain);
+
+    // True once every requested file was measured or failed to be
+    bool idle();
+    Uint32 filesScanned();
+    // Seconds of audio decoded and measured per second of work on one worker
+    double speed();
+
+private:
+    // Running sums of the entries of one album
+    struct AlbumLoudness
+    {
+        double energy = 0.0; // Duration weighted
+        double duration = 0.0;
+        int files = 0;
+        std::multiset<double> truePeaks; // Of every file, so one can be taken out again
+    };
+
+    static int SDLCALL run(void *data);
+    static std::string albumKey(const std::string &path, const std::string &album);
+    // Require the mutex
+    void storeEntry(const std::string &path, const LoudnessEntry &entry);
+    void removeEntry(const std::string &path);
+    void addToAlbum(const std::string &path, const LoudnessEntry &entry, int sign);
+    void loadCache();
+    static std::string cacheLine(const std::string &path, const LoudnessEntry &entry);
+    // Require fileMutex but not the mutex
+    void appendToCache(const std::string &line);
+    void compactCache();
+
+    std::vector<SDL_Thread *> threads;
+    SDL_mutex *mutex = nullptr;
+    SDL_mutex *fileMutex = nullptr; // Taken before the mutex, never after it
+    SDL_cond *cond = nullptr;
+    void (*onComplete)() = nullptr;
+    bool stopping = false;
+    std::string cacheFile;
+    size_t cacheLines = 0; // In the file, under fileMutex
+    std::deque<std::string> pending;
+    std::unordered_set<std::string> queued; // Pending or being measured
+    std::deque<std::string> completed;
+    std::unordered_map<std::string, LoudnessEntry> entries;
+    std::unordered_map<std::string, AlbumLoudness> albums; // By albumKey()
+
+    Uint32 scannedCount = 0;
+    double audioSeconds = 0.0;
+    double busySeconds = 0.0;
+};
+
+#endif
@@ -3,27 +3,131 @@
 #include <SDL2/SDL_mixer.h>
 #include <SDL2/SDL_ttf.h>
 #include <SDL2/SDL_image.h>
+#include <algorithm>
+#include <cmath>
 #include <cstdlib>
+#include <deque>
 #include <string>
-#include <queue>
+#include <vector>
 #include <filesystem>
+#include <fstream>
 #include <Tiny_File_Dialogs/tinyfiledialogs.h>
+#include "audiodevice.h"
+#include "audioengine.h"
+#include "audiofile.h"
+#include "bounce.h"
+#include "dynamics.h"
+#include "glyphatlas.h"
+#include "ingester.h"
+#include "library.h"
+#include "loudnessscanner.h"
+#include "playlist.h"
+#include "realtime.h"
+#include "resampler.h"
+#include "scheduler.h"
+#include "textcache.h"
+#include "timestretch.h"
+#include "track.h"
+#include "trackcache.h"
+#include "trackloader.h"
+#include "trackstream.h"
 
 const int WIDTH = 1920, HEIGHT = 1080;
-std::queue<std::string> songQueue;
+const size_t TEXT_CACHE_BYTES = 4 * 1024 * 1024;
+const int DEFAULT_RING_MS = 250; // Depth of the decoder thread's PCM ring, 0 renders in the callback
+const int PROGRESS_BAR_WIDTH = 600;
+const Uint32 MIN_REDRAW_MS = 16; // Upper bound for how often the progress display is redrawn
+const int DEFAULT_CACHE_MB = 512;  // Decoded tracks kept around for replaying
+const double RESTART_SECONDS = 3.0; // Going back later than this restarts the current song
+const size_t MAX_HISTORY = 100;
+const size_t INGEST_FILES_PER_FRAME = 1000; // Checked files moved into the queue per main loop pass
+const int LOUDNESS_LOOKAHEAD = 3;           // Queue entries measured ahead of the one that plays
+const Uint32 INGEST_REDRAW_MS = 250;        // How often the count of checked files is redrawn
+const Uint32 DEVICE_RETRY_MS = 1000;        // How often a lost audio device is opened again
+Playlist songQueue;
 std::string currentFilename;
 bool quit = false;
 bool isMusicPlaying = false;
 bool isMusicPaused = false;
-int startTime = 0;
-int pauseTime = 0;
-
-Mix_Music *music = nullptr;
-int musicDuration = 0;
+Track *currentTrack = nullptr; // Owned by the engine, only used to address seeks
+// The current track plays frame segmentTrackFrame at output stream frame
+// segmentStreamFrame and moves on segmentSpeed frames per output frame,
+// updated when it starts, after every seek and when the speed changes
+Uint64 segmentStreamFrame = 0;
+Uint64 segmentTrackFrame = 0;
+float segmentSpeed = 1.0f;
+double musicDuration = 0.0;
+FrameScheduler scheduler;
+AudioDevice audioDevice;
+AudioEngine engine;
+TrackLoader loader;
+TrackCache trackCache;
+LoudnessScanner loudnessScanner;
+Ingester ingester;
+Library library;
+std::vector<std::string> libraryFolders;
+std::string librarySearch; // Queued once the library has tracks
+ReplayGainMode replayGainMode = REPLAYGAIN_TRACK;
+EqualizerPreset eqPreset = EQ_PRESET_FLAT;
+int ringMilliseconds = DEFAULT_RING_MS;
+double currentVolumeDb = -6.0; // Set initial volume to half the amplitude
+bool nativeRate = false;       // Reopen the device at the rate of what is played
+ResamplerQuality resamplerQuality = RESAMPLER_MEDIUM;
+// Everything is rendered, mixed and processed in float; SDL converts to the
+// hardware format once at the end. S16 halves the memory decoded tracks take.
+Uint16 sampleFormat = AUDIO_F32SYS;
 std::string albumTag;
 std::string artistTag;
 std::string titleTag;
 
+// Crossfade lengths offered by the crossfade button, in seconds
+const int CROSSFADE_STEPS[] = {0, 2, 4, 8, CROSSFADE_MAX_SECONDS};
+const int CROSSFADE_STEP_COUNT = sizeof(CROSSFADE_STEPS) / sizeof(CROSSFADE_STEPS[0]);
+int crossfadeStep = 0;
+CrossfadeCurve crossfadeCurve = CROSSFADE_EQUAL_POWER;
+
+// Speeds and pitch shifts (in semitones) offered by their buttons
+const float SPEED_STEPS[] = {1.0f, 1.25f, 1.5f, 2.0f, 3.0f, 0.5f, 0.75f};
+const int PITCH_STEPS[] = {0, 2, 4, 7, 12, -12, -7, -4, -2};
+float playbackSpeed = 1.0f;
+int pitchSemitones = 0;
+StretchMode stretchMode = STRETCH_MUSIC;
+
+// Output dynamics: the true-peak limiter is always on unless its look-ahead is 0
+int limiterLookaheadMs = LIMITER_DEFAULT_LOOKAHEAD_MS;
+double limiterCeilingDb = LIMITER_DEFAULT_CEILING_DB;
+bool compressorEnabled = false;
+float limiterMeterDb = 0.0f; // Gain reduction shown, falling back slowly after a peak
+float compressorMeterDb = 0.0f;
+
+// Tracks are opened on the loader thread; the UI only keeps the request ids
+Uint32 playRequestId = 0;   // Track to start as soon as it is loaded, 0 if none
+std::string loadingFilename;
+// The next queue entry is taken out of songQueue as soon as it is preloaded
+Uint32 nextRequestId = 0;   // Load in progress, 0 if none
+Track *nextTrack = nullptr; // Handed to the engine but not started yet
+bool isDrained = true;      // The engine has no track to play
+// Queue entry of another rate family; it can not be spliced in, so it
+// starts on a reopened device once the current song is over
+std::string rateChangePath;
+// Song to start once the device is reopened at its rate, which waits until
+// no track is being converted into the device format
+Track *rateSwitchTrack = nullptr;
+// Set while a reopen has left the device closed; the engine is stopped and
+// the songs it held start over once the device is back
+bool audioDeviceLost = false;
+Uint32 deviceRetryTicks = 0;
+std::string lostPlayingPath;
+std::string lostNextPath;
+std::vector<std::string> playHistory; // Songs in the order they started, the current one last
+
+// Headless mode: lines read from stdin by a background thread
+bool headless = false;
+SDL_mutex *stdinMutex = nullptr;
+std::deque<std::string> stdinLines;
+bool stdinClosed = false;
+bool stdinStopped = false; // Set at exit, the thread must not touch anything else afterwards
+
 bool isPointInRect(int x, int y, const SDL_Rect &rect)
 {
     return (x >= rect.x && x <= rect.x + rect.w && y >= rect.y && y <= rect.y + rect.h);
@@ -36,79 +140,1198 @@ std::string formatTime(int seconds)
     return std::to_string(minutes) + ":" + (remainingSeconds < 10 ? "0" : "") + std::to_string(remainingSeconds);
 }
 
+// Position in the current track as heard from the speakers, in seconds
+double playbackSeconds()
+{
+    double played = SDL_max(engine.playbackFrame() - (double)segmentStreamFrame, 0.0);
+    double seconds = (segmentTrackFrame + played * segmentSpeed) / engine.frequency();
+    return SDL_clamp(seconds, 0.0, musicDuration);
+}
+
+// Linear gain that normalizes the track, unity until its loudness is known
+float trackGain(const Track *track)
+{
+    double gain;
+    if (!loudnessScanner.gainDb(track->path, replayGainMode, limiterCeilingDb, gain))
+    {
+        return 1.0f;
+    }
+    return (float)std::pow(10.0, gain / 20.0);
+}
+
+void startTrack(Track *track)
+{
+    engine.play(track, trackGain(track));
+    isMusicPlaying = true;
+    isDrained = false;
+}
+
+// Loads the file in the background and starts it once it is ready
+void requestPlay(const std::string &filepath)
+{
+    loudnessScanner.request(filepath);
+    playRequestId = loader.request(filepath, true);
+    loadingFilename = std::filesystem::path(filepath).filename().string();
+    isMusicPlaying = true;
+}
+
+// Called from the audio thread, so only wake up the main loop here
+void onEngineEvent()
+{
+    scheduler.postTrackFinished();
+}
+
+// Called from the loader, loudness scanner, ingester and library threads,
+// and by the last decode to let go of the audio format
+void onLoadComplete()
+{
+    scheduler.postWork();
+}
+
+// Native-rate playback switches the device when the rate family changes;
+// within a family SDL or the resampler convert by a simple ratio
+bool needsRateChange(const Track *track)
+{
+    return nativeRate && track->sourceRate > 0 &&
+           sampleRateFamily(track->sourceRate) != sampleRateFamily(audioDevice.spec().frequency);
+}
+
+// Starts the engine on the open device with the current settings
+bool restartEngine()
+{
+    if (!engine.start(onEngineEvent, ringMilliseconds))
+    {
+        std::cout << "Failed to restart the audio engine" << std::endl;
+        return false;
+    }
+    engine.setPaused(isMusicPaused);
+    engine.setVolumeDb(currentVolumeDb);
+    engine.setEqualizer(equalizerPreset(eqPreset));
+    engine.setCrossfade(CROSSFADE_STEPS[crossfadeStep] * 1000, crossfadeCurve);
+    engine.setTimeStretch(playbackSpeed, (float)pitchSemitones, stretchMode);
+    engine.setLimiterCeiling(limiterCeilingDb);
+    engine.setCompressor(compressorEnabled);
+    return true;
+}
+
+// After a reopen that left the device closed. The engine can not run
+// without it and is stopped; retryAudioDevice() opens the device again and
+// starts the song that played over, with the preloaded next one.
+void loseAudioDevice(const std::string &playingPath, const std::string &nextPath)
+{
+    engine.stop();
+    nextTrack = nullptr;
+    currentTrack = nullptr;
+    isDrained = true;
+    audioDeviceLost = true;
+    lostPlayingPath = playingPath;
+    lostNextPath = nextPath;
+    deviceRetryTicks = SDL_GetTicks();
+    std::cout << "Audio stopped, trying to open the device again every " << DEVICE_RETRY_MS << " ms" << std::endl;
+}
+
+// Every pass of the main loop while the device is lost
+void retryAudioDevice()
+{
+    Uint32 now = SDL_GetTicks();
+    if (now - deviceRetryTicks < DEVICE_RETRY_MS || !AudioDevice::tryLockFormat(onLoadComplete))
+    {
+        return;
+    }
+    deviceRetryTicks = now;
+    bool recovered = audioDevice.recover();
+    AudioDevice::unlockFormat();
+    if (!recovered || !restartEngine())
+    {
+        return;
+    }
+
+    audioDeviceLost = false;
+    std::cout << "Audio device is back at " << audioDevice.spec().frequency << " Hz" << std::endl;
+    if (!lostPlayingPath.empty() && playRequestId == 0)
+    {
+        requestPlay(lostPlayingPath);
+    }
+    if (!lostNextPath.empty() && nextRequestId == 0)
+    {
+        nextRequestId = loader.request(lostNextPath);
+    }
+    lostPlayingPath.clear();
+    lostNextPath.clear();
+}
+
+// With the format locked. Restarts the engine on a device opened at the
+// new rate. Everything the engine holds was decoded for the old rate and is
+// dropped, a preloaded next song is loaded again. Returns false if the
+// device kept its rate, or was lost.
+bool switchDeviceRate(int frequency)
+{
+    std::string nextPath = nextTrack != nullptr ? nextTrack->path : "";
+    engine.stop();
+    nextTrack = nullptr;
+    currentTrack = nullptr;
+    isDrained = true;
+
+    bool switched = audioDevice.setFrequency(frequency);
+    if (!audioDevice.opened())
+    {
+        loseAudioDevice("", nextPath);
+        return false;
+    }
+    if (!restartEngine())
+    {
+        return false;
+    }
+    if (switched)
+    {
+        std::cout << "Audio device now runs at " << audioDevice.spec().frequency << " Hz" << std::endl;
+    }
+
+    if (!nextPath.empty() && nextRequestId == 0)
+    {
+        nextRequestId = loader.request(nextPath);
+    }
+    return switched;
+}
+
+// Switches the device to the rate of rateSwitchTrack and plays it, only
+// while no track is being converted into the device format. Otherwise the
+// current song plays on and the last conversion to finish wakes the main
+// loop to try again.
+void applyDeviceRate()
+{
+    if (rateSwitchTrack == nullptr || !AudioDevice::tryLockFormat(onLoadComplete))
+    {
+        return;
+    }
+    Track *track = rateSwitchTrack;
+    rateSwitchTrack = nullptr;
+    bool switched = switchDeviceRate(track->sourceRate);
+    AudioDevice::unlockFormat();
+    if (audioDeviceLost)
+    {
+        lostPlayingPath = track->path;
+        freeTrack(track);
+    }
+    else if (switched || track->frequency != engine.frequency())
+    {
+        // Decoded for the old device rate, decode it again for the new one
+        std::string path = track->path;
+        freeTrack(track);
+        playRequestId = loader.request(path, true);
+    }
+    else
+    {
+        startTrack(track);
+    }
+}
+
+void applyTimeStretch()
+{
+    if (!engine.setTimeStretch(playbackSpeed, (float)pitchSemitones, stretchMode))
+    {
+        std::cout << "Speed and pitch control need the float sample format (--sample-format f32)" << std::endl;
+    }
+}
+
+// Loudness is measured for the song that plays and the few queued after
+// it, not for everything queued: adding a big folder or a library search
+// would otherwise keep every scanner worker decoding during playback.
+// Files already measured or waiting cost the scanner only a stat.
+void requestUpcomingLoudness()
+{
+    int count = 0;
+    for (PlaylistId id = songQueue.front(); id != 0 && count < LOUDNESS_LOOKAHEAD; id = songQueue.next(id), count++)
+    {
+        loudnessScanner.request(songQueue.path(id));
+    }
+}
+
 void playNextSong()
 {
     if (!songQueue.empty())
     {
-        std::string filepath = songQueue.front();
-        songQueue.pop();
+        requestPlay(songQueue.takeFront());
+        requestUpcomingLoudness();
+    }
+}
+
+// Opens and decodes the next queue entry in the background while the current
+// one plays, so the engine can splice it in without a gap
+void preloadNextSong()
+{
+    if (isMusicPlaying && nextRequestId == 0 && nextTrack == nullptr && rateChangePath.empty() && rateSwitchTrack == nullptr &&
+        !songQueue.empty())
+    {
+        std::string path = songQueue.takeFront();
+        loudnessScanner.request(path);
+        nextRequestId = loader.request(path);
+        requestUpcomingLoudness();
+    }
+}
+
+void handleLoadResults()
+{
+    LoadResult result;
+    while (loader.poll(result))
+    {
+        if (result.id == playRequestId)
+        {
+            playRequestId = 0;
+            if (result.track != nullptr && needsRateChange(result.track))
+            {
+                freeTrack(rateSwitchTrack);
+                rateSwitchTrack = result.track;
+                applyDeviceRate();
+            }
+            else if (result.track != nullptr && result.track->frequency != engine.frequency())
+            {
+                // Decoded for another device rate, decode it again for the current one
+                freeTrack(result.track);
+                playRequestId = loader.request(result.path, true);
+            }
+            else if (result.track != nullptr)
+            {
+                // It replaces a song still waiting for the device to switch
+                freeTrack(rateSwitchTrack);
+                rateSwitchTrack = nullptr;
+                startTrack(result.track);
+            }
+            else if (isDrained)
+            {
+                // Nothing is playing, so move on to the next queued song
+                playNextSong();
+            }
+        }
+        else if (result.id == nextRequestId)
+        {
+            nextRequestId = 0;
+            if (result.track != nullptr && result.track->frequency != engine.frequency())
+            {
+                freeTrack(result.track);
+                nextRequestId = loader.request(result.path);
+            }
+            else if (result.track != nullptr && needsRateChange(result.track))
+            {
+                rateChangePath = result.path;
+                freeTrack(result.track);
+            }
+            else if (result.track != nullptr)
+            {
+                nextTrack = result.track;
+                engine.setNext(result.track, trackGain(result.track));
+            }
+        }
+        else
+        {
+            freeTrack(result.track);
+        }
+    }
+}
+
+void handleEngineEvents()
+{
+    EngineEvent event;
+    while (engine.pollEvent(event))
+    {
+        if (event.type == ENGINE_TRACK_STARTED)
+        {
+            if (event.track == nextTrack)
+            {
+                nextTrack = nullptr;
+            }
+            isDrained = false;
+            titleTag = event.track->title;
+            artistTag = event.track->artist;
+            albumTag = event.track->album;
+            currentFilename = event.track->filename;
+            musicDuration = event.track->duration;
+            currentTrack = event.track;
+            if (headless)
+            {
+                std::cout << "Playing " << event.track->filename << " (" << formatTime((int)event.track->duration) << ")" << std::endl;
+            }
+            segmentStreamFrame = event.streamFrame;
+            segmentTrackFrame = 0;
+            segmentSpeed = event.speed;
+            playHistory.push_back(event.track->path);
+            if (playHistory.size() > MAX_HISTORY)
+            {
+                playHistory.erase(playHistory.begin());
+            }
+            if (playHistory.size() >= 2)
+            {
+                // Where the back button goes, so it should not wait for unpacking
+                trackCache.unpackAhead(playHistory[playHistory.size() - 2]);
+            }
+        }
+        else if (event.type == ENGINE_TRACK_SEEKED)
+        {
+            if (event.track == currentTrack)
+            {
+                segmentStreamFrame = event.streamFrame;
+                segmentTrackFrame = event.trackFrame;
+                segmentSpeed = event.speed;
+            }
+        }
+        else if (event.type == ENGINE_TRACK_RELEASED)
+        {
+            if (event.track == nextTrack)
+            {
+                nextTrack = nullptr;
+            }
+            if (event.track == currentTrack)
+            {
+                currentTrack = nullptr;
+            }
+            freeTrack(event.track);
+        }
+        else if (event.type == ENGINE_DRAINED)
+        {
+            isDrained = true;
+        }
+    }
+
+    // A song of another rate family follows once the engine ran dry
+    if (isDrained && playRequestId == 0 && rateSwitchTrack == nullptr && !rateChangePath.empty())
+    {
+        requestPlay(rateChangePath);
+        rateChangePath.clear();
+    }
+
+    // Nothing left to play once the engine ran dry and no successor is on its way
+    if (isDrained && playRequestId == 0 && nextRequestId == 0 && nextTrack == nullptr && rateSwitchTrack == nullptr &&
+        songQueue.empty())
+    {
+        isMusicPlaying = false;
+    }
+}
+
+// Switches the device to another buffer size without interrupting the engine
+// Only while no track is being converted into the device format; otherwise
+// the last conversion to finish wakes the main loop to try again
+void reopenAudioDevice(int bufferFrames)
+{
+    if (!AudioDevice::tryLockFormat(onLoadComplete))
+    {
+        return;
+    }
+    engine.detach();
+    bool reopened = audioDevice.reopen(bufferFrames);
+    AudioDevice::unlockFormat();
+    if (!audioDevice.opened())
+    {
+        loseAudioDevice(currentTrack != nullptr ? currentTrack->path : "", nextTrack != nullptr ? nextTrack->path : "");
+        return;
+    }
+    engine.attach();
+    if (reopened)
+    {
+        std::cout << "Audio buffer is now " << audioDevice.spec().bufferFrames << " frames" << std::endl;
+    }
+}
+
+std::string audioFormatName(Uint16 format)
+{
+    std::string name = SDL_AUDIO_ISFLOAT(format) ? "F" : (SDL_AUDIO_ISSIGNED(format) ? "S" : "U");
+    return name + std::to_string(SDL_AUDIO_BITSIZE(format));
+}
+
+// A measurement may come in after the next track was handed to the engine;
+// it still gets its gain as long as it has not started
+void handleLoudnessResults()
+{
+    std::string path;
+    bool changed = false;
+    while (loudnessScanner.poll(path))
+    {
+        changed = true;
+    }
+    if (changed && nextTrack != nullptr)
+    {
+        engine.setGain(nextTrack, trackGain(nextTrack));
+    }
+}
+
+// Moves files the ingester has checked into the queue, a slice per pass of
+// the main loop so adding a huge folder never holds up a frame
+void handleIngestResults()
+{
+    std::vector<std::string> files;
+    if (!ingester.poll(files, INGEST_FILES_PER_FRAME))
+    {
+        return;
+    }
+    bool wasEmpty = songQueue.empty();
+    for (const std::string &file : files)
+    {
+        if (songQueue.append(file) == 0)
+        {
+            std::cout << "Can not queue " << file << std::endl;
+        }
+    }
+    if (!isMusicPlaying && playRequestId == 0)
+    {
+        playNextSong();
+    }
+    else if (wasEmpty)
+    {
+        requestUpcomingLoudness();
+    }
+    if (files.size() == INGEST_FILES_PER_FRAME)
+    {
+        scheduler.postWork();
+    }
+}
+
+// Splits the result of a multiple selection file dialog
+std::vector<std::string> splitDialogPaths(const char *selection)
+{
+    std::vector<std::string> paths;
+    std::string remaining(selection);
+    size_t begin = 0;
+    while (begin <= remaining.size())
+    {
+        size_t end = remaining.find('|', begin);
+        end = end == std::string::npos ? remaining.size() : end;
+        if (end > begin)
+        {
+            paths.push_back(remaining.substr(begin, end - begin));
+        }
+        begin = end + 1;
+    }
+    return paths;
+}
+
+void addToQueue(const char *filepath)
+{
+    std::string songPath(filepath);
+    if (songQueue.append(songPath) == 0)
+    {
+        std::cout << "Can not queue " << songPath << std::endl;
+        return;
+    }
+
+    if (!isMusicPlaying)
+    {
+        playNextSong();
+    }
+    else
+    {
+        requestUpcomingLoudness();
+    }
+}
+
+// The files given on the command line were queued before the loudness
+// scanner ran; start the first, which measures it and the next few
+void queueCommandLineFiles()
+{
+    if (!isMusicPlaying)
+    {
+        playNextSong();
+    }
+}
+
+// Loudness results and the library are kept in the user's preference
+// folder across runs
+std::string preferenceFile(const char *name)
+{
+    std::string path;
+    char *prefPath = SDL_GetPrefPath("Lvbor", "AudioFlow");
+    if (prefPath != nullptr)
+    {
+        path = std::string(prefPath) + name;
+        SDL_free(prefPath);
+    }
+    return path;
+}
+
+// The library folders, one per line
+void loadLibraryFolders()
+{
+    std::ifstream in(preferenceFile("library-folders.txt"));
+    std::string folder;
+    while (std::getline(in, folder))
+    {
+        if (!folder.empty())
+        {
+            libraryFolders.push_back(folder);
+        }
+    }
+}
+
+void addLibraryFolder(const std::string &folder)
+{
+    std::error_code error;
+    std::string absolute = std::filesystem::absolute(folder, error).lexically_normal().string();
+    if (error || !std::filesystem::is_directory(absolute, error))
+    {
+        std::cout << "Not a folder: " << folder << std::endl;
+        return;
+    }
+    if (std::find(libraryFolders.begin(), libraryFolders.end(), absolute) != libraryFolders.end())
+    {
+        return;
+    }
+    libraryFolders.push_back(absolute);
+    std::ofstream out(preferenceFile("library-folders.txt"), std::ios::trunc);
+    for (const std::string &saved : libraryFolders)
+    {
+        out << saved << '\n';
+    }
+}
+
+// Queues every library track whose path or tags contain text
+void queueLibraryMatches(const std::string &text)
+{
+    std::vector<std::string> paths = library.index().search(text);
+    for (const std::string &path : paths)
+    {
+        songQueue.append(path);
+    }
+    std::cout << "Queued " << paths.size() << " library tracks matching \"" << text << "\"" << std::endl;
+    if (!isMusicPlaying && playRequestId == 0)
+    {
+        playNextSong();
+    }
+    else
+    {
+        requestUpcomingLoudness();
+    }
+}
+
+// Maps the index from the last run, which is usable right away, and brings
+// it up to date in the background
+void startLibrary()
+{
+    if (libraryFolders.empty())
+    {
+        return;
+    }
+    library.start(preferenceFile("library.index"), libraryFolders, onLoadComplete);
+    std::cout << "Library: " << library.index().size() << " tracks, opened in " << library.openMilliseconds() << " ms" << std::endl;
+    if (!librarySearch.empty() && library.index().size() > 0)
+    {
+        queueLibraryMatches(librarySearch);
+        librarySearch.clear();
+    }
+}
+
+// Swaps in the index of a finished rescan
+void handleLibraryResults()
+{
+    if (!library.poll())
+    {
+        return;
+    }
+    std::cout << "Library updated: " << library.index().size() << " tracks" << std::endl;
+    if (!librarySearch.empty())
+    {
+        queueLibraryMatches(librarySearch);
+        librarySearch.clear();
+    }
+}
+
+// What the engine, the device and the background workers did this session
+void printPlaybackSummary(const RealtimeOptions &realtimeOptions, const std::string &telemetryFile)
+{
+    std::cout << "Transitions: " << engine.transitions() << ", longest gap " << engine.maxGapFrames() << " samples, longest crossfade "
+              << engine.longestOverlapFrames() << " samples" << std::endl;
+    if (engine.usesDecoderThread())
+    {
+        PcmRingStats ring = engine.ringStats();
+        int frameBytes = engine.frameBytes();
+        std::cout << "Decoder ring: " << ring.capacityBytes / frameBytes << " frames, lowest fill " << ring.minFillBytes / frameBytes
+                  << " frames, " << ring.underruns << " underruns in " << ring.reads << " reads" << std::endl;
+    }
+    const EngineTelemetry &telemetry = engine.stats();
+    printHistogramSummary(std::cout, "Callback load", "%", telemetry.load);
+    printHistogramSummary(std::cout, "Callback jitter", " us", telemetry.jitter);
+    if (engine.usesDecoderThread())
+    {
+        printHistogramSummary(std::cout, "Ring fill", "%", telemetry.ringFill);
+        printHistogramSummary(std::cout, "Decoder block time", " us", telemetry.decoderTime);
+    }
+    if (!telemetryFile.empty())
+    {
+        // Every bin of every histogram, for plotting
+        std::ofstream out(telemetryFile);
+        printHistogram(out, "Callback load", "%", telemetry.load);
+        printHistogram(out, "Post-mix load", "%", telemetry.postMixLoad);
+        printHistogram(out, "Callback jitter", " us", telemetry.jitter);
+        printHistogram(out, "Ring fill", "%", telemetry.ringFill);
+        printHistogram(out, "Decoder block time", " us", telemetry.decoderTime);
+        out << "Underruns: " << engine.underruns() << std::endl;
+        if (!out)
+        {
+            std::cout << "Failed to write telemetry to " << telemetryFile << std::endl;
+        }
+    }
+    double measuredRate = engine.measuredDeviceRate();
+    if (measuredRate > 0.0)
+    {
+        std::cout << "Playback clock: device ran at " << measuredRate << " Hz, "
+                  << (measuredRate / engine.frequency() - 1.0) * 1e6 << " ppm off nominal" << std::endl;
+    }
+    Dynamics &dynamics = engine.outputDynamics();
+    if (dynamics.limiterEnabled())
+    {
+        double limitedShare = dynamics.processedFrames() > 0 ? 100.0 * dynamics.limitedFrames() / dynamics.processedFrames() : 0.0;
+        std::cout << "Limiter: " << limiterLookaheadMs << " ms look-ahead (" << dynamics.latencyFrames() << " frames latency), "
+                  << limiterCeilingDb << " dBTP ceiling, reduced " << limitedShare << "% of the time, at most "
+                  << dynamics.maxLimiterReductionDb() << " dB, compressor " << (compressorEnabled ? "on" : "off") << std::endl;
+    }
+    RealtimeStatus realtime = realtimeStatus();
+    std::cout << "Audio thread: " << (realtimeOptions.realtime ? "real-time" : "time critical") << " priority "
+              << (realtime.promoted ? "granted" : "refused") << ", "
+              << (realtimeOptions.core < 0 ? "not pinned" : realtime.pinned ? "pinned to core " + std::to_string(realtimeOptions.core) : "pinning failed")
+              << ", memory " << (realtime.memoryLocked ? "locked" : "not locked") << ", " << realtime.audioThreads << " threads" << std::endl;
+    if (realtimeGuardEnabled())
+    {
+        RealtimeViolations violations = realtimeViolations();
+        std::cout << "Real-time guard: " << violations.allocations << " allocations, " << violations.locks << " locks, "
+                  << violations.syscalls << " system calls in the audio callback" << std::endl;
+    }
+    std::cout << "Resampler: " << resamplerQualityName(resamplerQuality) << " (" << resamplerKernelName() << " kernel), native rate "
+              << (nativeRate ? "on" : "off") << std::endl;
+    const AudioDeviceSpec &deviceSpec = audioDevice.spec();
+    std::cout << "Audio device: " << deviceSpec.frequency << " Hz, " << audioFormatName(deviceSpec.format) << ", " << deviceSpec.channels
+              << " channels, " << deviceSpec.bufferFrames << " frame buffer (" << latencyProfileName(audioDevice.profile()) << ", "
+              << audioDevice.reopens() << " reopens), " << engine.underruns() << " underruns, " << engine.droppedEvents()
+              << " dropped engine events" << std::endl;
+    std::cout << "Loudness scanner: " << loudnessScanner.filesScanned() << " files at " << loudnessScanner.speed()
+              << "x real time per worker" << std::endl;
+    TrackCacheStats cache = trackCache.stats();
+    std::cout << "Track cache: " << cache.hits << " hits, " << cache.misses << " misses, " << cache.decodedTracks << " decoded ("
+              << cache.decodedBytes / (1024 * 1024) << " MiB), " << cache.packedTracks << " packed ("
+              << cache.packedBytes / (1024 * 1024) << " of " << cache.unpackedBytes / (1024 * 1024) << " MiB)" << std::endl;
+}
+
+// Blocks on stdin, so it is detached instead of joined at exit. A read can
+// still return while the program shuts down; from then on only the mutex,
+// which is never destroyed, and stdinStopped are safe to use. Waking the
+// main loop happens under the mutex so teardown can not pass it halfway.
+int SDLCALL readStdin(void *)
+{
+    std::string line;
+    bool reading = true;
+    while (reading)
+    {
+        reading = (bool)std::getline(std::cin, line);
+        SDL_LockMutex(stdinMutex);
+        if (stdinStopped)
+        {
+            SDL_UnlockMutex(stdinMutex);
+            return 0;
+        }
+        if (reading)
+        {
+            stdinLines.push_back(line);
+        }
+        else
+        {
+            stdinClosed = true;
+        }
+        scheduler.postWork();
+        SDL_UnlockMutex(stdinMutex);
+    }
+    return 0;
+}
+
+// A command or else a file to queue. Returns false on quit.
+bool handleStdinLine(const std::string &line)
+{
+    if (line.empty())
+    {
+        return true;
+    }
+    if (line == "quit")
+    {
+        return false;
+    }
+    if (line == "shuffle")
+    {
+        songQueue.shuffle(SDL_GetPerformanceCounter());
+        requestUpcomingLoudness();
+    }
+    else if (line == "pause" || line == "resume")
+    {
+        isMusicPaused = isMusicPlaying && line == "pause";
+        engine.setPaused(isMusicPaused);
+    }
+    else if (line.compare(0, 7, "volume ") == 0)
+    {
+        currentVolumeDb = SDL_clamp(std::atof(line.c_str() + 7), GAIN_MIN_DB, 0.0);
+        engine.setVolumeDb(currentVolumeDb);
+    }
+    else if (line.compare(0, 8, "library ") == 0)
+    {
+        queueLibraryMatches(line.substr(8));
+    }
+    else
+    {
+        ingester.add({line});
+    }
+    return true;
+}
+
+// Plays the queue without a window: only the audio and event subsystems and
+// the mixer are initialized, no video, fonts or images. Files come from the
+// command line and from stdin, one file or folder per line, along with the commands pause,
+// resume, volume <dB>, shuffle, library <text> and quit. Exits once stdin is closed and
+// everything queued has played.
+int runHeadless(LatencyProfile latencyProfile, int bufferFrames, const std::string &audioDeviceName, int cacheMegabytes,
+                bool cachePacking, const RealtimeOptions &realtimeOptions, const std::string &telemetryFile)
+{
+    headless = true;
+    // The event subsystem carries the wake-ups from the engine and the workers
+    if (SDL_Init(SDL_INIT_AUDIO | SDL_INIT_EVENTS) != 0)
+    {
+        std::cout << "SDL initialization failed: " << SDL_GetError() << std::endl;
+        return 1;
+    }
+    if (!scheduler.init() || !audioDevice.open(latencyProfile, bufferFrames, sampleFormat, audioDeviceName))
+    {
+        SDL_Quit();
+        return 1;
+    }
+
+    setTrackResampler(resamplerQuality);
+    setSeekIndexFile(preferenceFile("seek.index"));
+    const AudioDeviceSpec &spec = audioDevice.spec();
+    if (!trackCache.start((size_t)cacheMegabytes * 1024 * 1024, cachePacking, spec.format, spec.channels))
+    {
+        std::cout << "Playing without a track cache" << std::endl;
+    }
+    engine.setLimiterLookahead(limiterLookaheadMs);
+    if (!engine.start(onEngineEvent, ringMilliseconds) || !loader.start(onLoadComplete, &trackCache))
+    {
+        engine.stop();
+        trackCache.stop();
+        audioDevice.close();
+        SDL_Quit();
+        return 1;
+    }
+    int scanWorkers = std::clamp(SDL_GetCPUCount() - 1, 1, 4);
+    if (!loudnessScanner.start(preferenceFile("loudness.cache"), scanWorkers, onLoadComplete))
+    {
+        std::cout << "Playing without loudness normalization" << std::endl;
+    }
+    // Listing folders and probing files mostly waits for the disk
+    if (!ingester.start(std::clamp(SDL_GetCPUCount(), 2, 8), onLoadComplete))
+    {
+        std::cout << "Folders can not be added" << std::endl;
+    }
+    if (realtimeOptions.lockMemory)
+    {
+        lockProcessMemory();
+    }
+
+    engine.setVolumeDb(currentVolumeDb);
+    engine.setEqualizer(equalizerPreset(eqPreset));
+    engine.setCrossfade(CROSSFADE_STEPS[crossfadeStep] * 1000, crossfadeCurve);
+    engine.setLimiterCeiling(limiterCeilingDb);
+    engine.setCompressor(compressorEnabled);
+    if (playbackSpeed != 1.0f || pitchSemitones != 0)
+    {
+        applyTimeStretch();
+    }
+
+    queueCommandLineFiles();
+    startLibrary();
+
+    stdinMutex = SDL_CreateMutex();
+    SDL_Thread *stdinThread = stdinMutex != nullptr ? SDL_CreateThread(readStdin, "StdinReader", nullptr) : nullptr;
+    if (stdinThread != nullptr)
+    {
+        SDL_DetachThread(stdinThread);
+    }
+    else
+    {
+        stdinClosed = true;
+    }
+
+    SDL_Event event;
+    while (!quit)
+    {
+        // Sleeps until the engine, a worker, stdin or a signal wakes it up
+        bool hasEvent = scheduler.waitEvent(event);
+        while (hasEvent)
+        {
+            quit = quit || event.type == SDL_QUIT;
+            hasEvent = SDL_PollEvent(&event);
+        }
+
+        std::deque<std::string> lines;
+        bool closed = true;
+        if (stdinMutex != nullptr)
+        {
+            SDL_LockMutex(stdinMutex);
+            std::swap(lines, stdinLines);
+            closed = stdinClosed;
+            SDL_UnlockMutex(stdinMutex);
+        }
+        for (const std::string &line : lines)
+        {
+            quit = quit || !handleStdinLine(line);
+        }
+
+        handleLoadResults();
+        handleEngineEvents();
+        handleLoudnessResults();
+        handleIngestResults();
+        handleLibraryResults();
+        preloadNextSong();
+        reportRealtimeViolations();
+
+        int adaptedFrames = audioDevice.adapt(engine.underruns());
+        if (audioDeviceLost)
+        {
+            retryAudioDevice();
+        }
+        else if (rateSwitchTrack != nullptr)
+        {
+            applyDeviceRate();
+        }
+        else if (adaptedFrames > 0)
+        {
+            reopenAudioDevice(adaptedFrames);
+        }
+        else
+        {
+            AudioDevice::cancelLockFormat();
+        }
+
+        // A search given on the command line waits for the first scan
+        bool searchPending = !librarySearch.empty() && library.scanning();
+        if (closed && !isMusicPlaying && playRequestId == 0 && songQueue.empty() && ingester.idle() && !searchPending &&
+            !audioDeviceLost)
+        {
+            quit = true;
+        }
+        if (audioDeviceLost)
+        {
+            scheduler.scheduleTick(DEVICE_RETRY_MS);
+        }
+    }
+
+    if (stdinMutex != nullptr)
+    {
+        SDL_LockMutex(stdinMutex);
+        stdinStopped = true;
+        SDL_UnlockMutex(stdinMutex);
+    }
+    printPlaybackSummary(realtimeOptions, telemetryFile);
+    // Decodes waiting for a reopen that will not happen would hold up the workers
+    AudioDevice::cancelLockFormat();
+    freeTrack(rateSwitchTrack);
+    rateSwitchTrack = nullptr;
+    library.stop();
+    ingester.stop();
+    loader.stop();
+    loudnessScanner.stop();
+    engine.stop();
+    trackCache.stop();
+    audioDevice.close();
+    // The stdin thread may still be blocked in a read and keeps the mutex alive;
+    // it leaves stdinLines and the scheduler alone once stdinStopped is set
+    SDL_Quit();
+    return 0;
+}
+
+// Renders the whole queue into a file as fast as possible, with no window
+// and no sound. The mixer runs on SDL's dummy driver, which plays nowhere;
+// it is only opened because tracks are decoded for its spec.
+int bounceQueue(const std::string &outputPath, LatencyProfile latencyProfile, int bufferFrames, const std::string &audioDeviceName)
+{
+    SDL_SetHintWithPriority(SDL_HINT_AUDIODRIVER, "dummy", SDL_HINT_OVERRIDE);
+    if (SDL_Init(SDL_INIT_AUDIO) != 0)
+    {
+        std::cout << "SDL initialization failed: " << SDL_GetError() << std::endl;
+        return 1;
+    }
+    if (!audioDevice.open(latencyProfile, bufferFrames, sampleFormat, audioDeviceName))
+    {
+        SDL_Quit();
+        return 1;
+    }
+    setTrackResampler(resamplerQuality);
+    setSeekIndexFile(preferenceFile("seek.index"));
+    engine.setLimiterLookahead(limiterLookaheadMs);
+    if (!engine.startOffline())
+    {
+        audioDevice.close();
+        SDL_Quit();
+        return 1;
+    }
+    engine.setVolumeDb(currentVolumeDb);
+    engine.setEqualizer(equalizerPreset(eqPreset));
+    engine.setCrossfade(CROSSFADE_STEPS[crossfadeStep] * 1000, crossfadeCurve);
+    engine.setLimiterCeiling(limiterCeilingDb);
+    engine.setCompressor(compressorEnabled);
+    if (playbackSpeed != 1.0f || pitchSemitones != 0)
+    {
+        applyTimeStretch();
+    }
 
-        if (music != nullptr)
+    std::vector<std::string> paths;
+    while (!songQueue.empty())
+    {
+        paths.push_back(songQueue.takeFront());
+    }
+
+    // Measure every file first, so the gains do not depend on how fast the
+    // scanner happens to be
+    if (replayGainMode != REPLAYGAIN_OFF && loudnessScanner.start(preferenceFile("loudness.cache"), std::clamp(SDL_GetCPUCount(), 1, 8), nullptr))
+    {
+        for (const std::string &path : paths)
+        {
+            loudnessScanner.request(path);
+        }
+        while (!loudnessScanner.idle())
+        {
+            SDL_Delay(10);
+        }
+    }
+
+    AudioFileWriter writer;
+    BounceStats stats;
+    const AudioDeviceSpec &spec = audioDevice.spec();
+    bool bounced = writer.open(outputPath, spec.frequency, spec.format, spec.channels) &&
+                   bounceTracks(engine, paths, replayGainMode != REPLAYGAIN_OFF ? trackGain : nullptr, writer, stats);
+    bounced = writer.close() && bounced;
+    if (bounced)
+    {
+        std::cout << "Bounced " << stats.tracks << " tracks (" << stats.failed << " failed) to " << outputPath << ": "
+                  << stats.audioSeconds << " s of audio in " << stats.wallSeconds << " s, " << stats.realtimeFactor()
+                  << "x real time, " << stats.decodeSeconds << " s of it loading tracks" << std::endl;
+        printHistogramSummary(std::cout, "Render time per 1024 frames", "% of real time", engine.stats().load);
+        std::cout << "Transitions: " << engine.transitions() << ", longest gap " << engine.maxGapFrames() << " samples, longest crossfade "
+                  << engine.longestOverlapFrames() << " samples" << std::endl;
+    }
+
+    loudnessScanner.stop();
+    engine.stop();
+    audioDevice.close();
+    SDL_Quit();
+    return bounced ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+    LatencyProfile latencyProfile = LATENCY_BALANCED;
+    int bufferFrames = 0;
+    std::string audioDeviceName;
+    int cacheMegabytes = DEFAULT_CACHE_MB;
+    bool cachePacking = false;
+    RealtimeOptions realtimeOptions = {true, -1, false};
+    std::string telemetryFile;
+    std::string bouncePath;
+    bool headlessMode = false;
+    bool shuffleQueue = false;
+    installRealtimeGuard();
+    loadLibraryFolders();
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--ring-ms" && i + 1 < argc)
+        {
+            ringMilliseconds = std::atoi(argv[++i]);
+        }
+        else if (arg == "--latency" && i + 1 < argc)
+        {
+            if (!parseLatencyProfile(argv[++i], latencyProfile))
+            {
+                std::cout << "Unknown latency profile: " << argv[i] << " (use safe, balanced, low or adaptive)" << std::endl;
+            }
+        }
+        else if (arg == "--buffer" && i + 1 < argc)
+        {
+            bufferFrames = std::atoi(argv[++i]);
+        }
+        else if (arg == "--audio-device" && i + 1 < argc)
+        {
+            audioDeviceName = argv[++i];
+        }
+        else if (arg == "--eq" && i + 1 < argc)
+        {
+            if (!parseEqualizerPreset(argv[++i], eqPreset))
+            {
+                std::cout << "Unknown equalizer preset: " << argv[i] << " (use flat, bass, treble, vocal or loudness)" << std::endl;
+            }
+        }
+        else if (arg == "--bench-eq")
+        {
+            benchmarkEqualizer();
+            return 0;
+        }
+        else if (arg == "--resampler" && i + 1 < argc)
+        {
+            if (!parseResamplerQuality(argv[++i], resamplerQuality))
+            {
+                std::cout << "Unknown resampler quality: " << argv[i] << " (use sdl, fast, medium or best)" << std::endl;
+            }
+        }
+        else if (arg == "--sample-format" && i + 1 < argc)
+        {
+            std::string name = argv[++i];
+            if (name == "f32" || name == "s16")
+            {
+                sampleFormat = name == "f32" ? AUDIO_F32SYS : AUDIO_S16SYS;
+            }
+            else
+            {
+                std::cout << "Unknown sample format: " << name << " (use f32 or s16)" << std::endl;
+            }
+        }
+        else if (arg == "--bench-formats")
+        {
+            benchmarkSampleFormats();
+            return 0;
+        }
+        else if (arg == "--cache-mb" && i + 1 < argc)
         {
-            Mix_FreeMusic(music);
-            music = nullptr;
+            cacheMegabytes = SDL_max(std::atoi(argv[++i]), 0);
         }
-
-        music = Mix_LoadMUS(filepath.c_str());
-        if (music == nullptr)
+        else if (arg == "--cache-pack")
         {
-            std::cout << "Failed to load music: " << Mix_GetError() << std::endl;
+            cachePacking = true;
         }
-        else
+        else if (arg == "--native-rate")
+        {
+            nativeRate = true;
+        }
+        else if (arg == "--bench-resampler")
+        {
+            benchmarkResampler();
+            return 0;
+        }
+        else if (arg == "--speed" && i + 1 < argc)
+        {
+            playbackSpeed = SDL_clamp((float)std::atof(argv[++i]), STRETCH_MIN_SPEED, STRETCH_MAX_SPEED);
+        }
+        else if (arg == "--pitch" && i + 1 < argc)
+        {
+            pitchSemitones = SDL_clamp(std::atoi(argv[++i]), -(int)STRETCH_MAX_SEMITONES, (int)STRETCH_MAX_SEMITONES);
+        }
+        else if (arg == "--stretch" && i + 1 < argc)
+        {
+            if (!parseStretchMode(argv[++i], stretchMode))
+            {
+                std::cout << "Unknown stretch mode: " << argv[i] << " (use speech or music)" << std::endl;
+            }
+        }
+        else if (arg == "--bench-stretch")
+        {
+            benchmarkTimeStretch();
+            return 0;
+        }
+        else if (arg == "--bench-playlist")
+        {
+            benchmarkPlaylist();
+            return 0;
+        }
+        else if (arg == "--shuffle")
+        {
+            shuffleQueue = true;
+        }
+        else if (arg == "--library-folder" && i + 1 < argc)
+        {
+            addLibraryFolder(argv[++i]);
+        }
+        else if (arg == "--library-search" && i + 1 < argc)
+        {
+            librarySearch = argv[++i];
+        }
+        else if (arg == "--bench-library")
+        {
+            benchmarkLibrary();
+            return 0;
+        }
+        else if (arg == "--lookahead-ms" && i + 1 < argc)
+        {
+            limiterLookaheadMs = SDL_clamp(std::atoi(argv[++i]), 0, LIMITER_MAX_LOOKAHEAD_MS);
+        }
+        else if (arg == "--ceiling-db" && i + 1 < argc)
+        {
+            limiterCeilingDb = SDL_min(std::atof(argv[++i]), 0.0);
+        }
+        else if (arg == "--compressor")
+        {
+            compressorEnabled = true;
+        }
+        else if (arg == "--telemetry" && i + 1 < argc)
+        {
+            telemetryFile = argv[++i];
+        }
+        else if (arg == "--no-realtime")
+        {
+            realtimeOptions.realtime = false;
+        }
+        else if (arg == "--audio-core" && i + 1 < argc)
+        {
+            realtimeOptions.core = std::atoi(argv[++i]);
+        }
+        else if (arg == "--mlock")
+        {
+            realtimeOptions.lockMemory = true;
+        }
+        else if (arg == "--replaygain" && i + 1 < argc)
+        {
+            if (!parseReplayGainMode(argv[++i], replayGainMode))
+            {
+                std::cout << "Unknown ReplayGain mode: " << argv[i] << " (use off, track or album)" << std::endl;
+            }
+        }
+        else if (arg == "--headless")
+        {
+            headlessMode = true;
+        }
+        else if (arg == "--bounce" && i + 1 < argc)
+        {
+            bouncePath = argv[++i];
+        }
+        else if (arg == "--volume-db" && i + 1 < argc)
+        {
+            currentVolumeDb = SDL_clamp(std::atof(argv[++i]), GAIN_MIN_DB, 0.0);
+        }
+        else if (arg == "--crossfade" && i + 1 < argc)
         {
-            musicDuration = Mix_MusicDuration(music);
-            if (musicDuration <= 0)
+            const int *step = std::find(std::begin(CROSSFADE_STEPS), std::end(CROSSFADE_STEPS), std::atoi(argv[++i]));
+            if (step != std::end(CROSSFADE_STEPS))
             {
-                std::cout << "Failed to get music duration: " << Mix_GetError() << std::endl;
+                crossfadeStep = (int)(step - CROSSFADE_STEPS);
             }
             else
             {
-                if (Mix_PlayMusic(music, 0) == -1)
-                {
-                    std::cout << "Failed to play music: " << Mix_GetError() << std::endl;
-                }
-                else
-                {
-                    albumTag = Mix_GetMusicAlbumTag(music);
-                    if (albumTag.c_str() == nullptr || strlen(albumTag.c_str()) < 2)
-                    {
-                        albumTag = "Unknown";
-                    }
-
-                    artistTag = Mix_GetMusicArtistTag(music);
-                    if (artistTag.c_str() == nullptr || strlen(artistTag.c_str()) < 2)
-                    {
-                        artistTag = "Unknown";
-                    }
-
-                    titleTag = Mix_GetMusicTitle(music);
-                    if (titleTag.c_str() == nullptr || strlen(titleTag.c_str()) < 2)
-                    {
-                        titleTag = "Unknown";
-                    }
-
-                    currentFilename = std::filesystem::path(filepath).filename().string(); // Extract the filename
-                    isMusicPlaying = true;
-                    startTime = SDL_GetTicks() / 1000;
-                }
+                std::cout << "Unsupported crossfade length: " << argv[i] << " (use 0, 2, 4, 8 or " << CROSSFADE_MAX_SECONDS << " seconds)" << std::endl;
             }
         }
+        else if (arg.compare(0, 2, "--") != 0)
+        {
+            // Anything else is a file to queue
+            songQueue.append(arg);
+        }
+        else
+        {
+            std::cout << "Unknown option: " << arg << std::endl;
+        }
     }
-}
-
-void addToQueue(const char *filepath)
-{
-    std::string songPath(filepath);
-    songQueue.push(songPath);
+    if (shuffleQueue)
+    {
+        songQueue.shuffle(SDL_GetPerformanceCounter());
+    }
+    configureRealtime(realtimeOptions);
 
-    if (!isMusicPlaying)
+    if (!bouncePath.empty())
     {
-        playNextSong();
+        return bounceQueue(bouncePath, latencyProfile, bufferFrames, audioDeviceName);
+    }
+    if (headlessMode)
+    {
+        return runHeadless(latencyProfile, bufferFrames, audioDeviceName, cacheMegabytes, cachePacking, realtimeOptions, telemetryFile);
     }
-}
 
-int main(int argc, char *argv[])
-{
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) != 0)
     {
         std::cout << "SDL initialization failed: " << SDL_GetError() << std::endl;
@@ -133,11 +1356,18 @@ int main(int argc, char *argv[])
     }
 
     SDL_Event windowEvent;
+    std::vector<std::string> droppedPaths;
+    if (!scheduler.init())
+    {
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+        return 1;
+    }
 
     // Initialize SDL2_mixer
-    if (Mix_OpenAudio(44100, MIX_DEFAULT_FORMAT, 2, 2048) < 0)
+    if (!audioDevice.open(latencyProfile, bufferFrames, sampleFormat, audioDeviceName))
     {
-        std::cout << "SDL2_mixer could not initialize: " << Mix_GetError() << std::endl;
         SDL_DestroyRenderer(renderer);
         SDL_DestroyWindow(window);
         SDL_Quit();
@@ -150,7 +1380,7 @@ int main(int argc, char *argv[])
         std::cout << "SDL_ttf could not initialize: " << TTF_GetError() << std::endl;
         SDL_DestroyRenderer(renderer);
         SDL_DestroyWindow(window);
-        Mix_CloseAudio();
+        audioDevice.close();
         SDL_Quit();
         return 1;
     }
@@ -161,7 +1391,7 @@ int main(int argc, char *argv[])
         std::cout << "SDL2_image could not initialize: " << IMG_GetError() << std::endl;
         SDL_DestroyRenderer(renderer);
         SDL_DestroyWindow(window);
-        Mix_CloseAudio();
+        audioDevice.close();
         TTF_Quit();
         SDL_Quit();
         return 1;
@@ -174,7 +1404,7 @@ int main(int argc, char *argv[])
         std::cout << "Failed to load background image: " << IMG_GetError() << std::endl;
         SDL_DestroyRenderer(renderer);
         SDL_DestroyWindow(window);
-        Mix_CloseAudio();
+        audioDevice.close();
         TTF_Quit();
         SDL_Quit();
         return 1;
@@ -187,7 +1417,7 @@ int main(int argc, char *argv[])
         std::cout << "Failed to create background texture: " << SDL_GetError() << std::endl;
         SDL_DestroyRenderer(renderer);
         SDL_DestroyWindow(window);
-        Mix_CloseAudio();
+        audioDevice.close();
         TTF_Quit();
         SDL_Quit();
         return 1;
@@ -201,24 +1431,100 @@ int main(int argc, char *argv[])
         SDL_DestroyTexture(backgroundTexture);
         SDL_DestroyRenderer(renderer);
         SDL_DestroyWindow(window);
-        Mix_CloseAudio();
+        audioDevice.close();
+        TTF_Quit();
+        SDL_Quit();
+        return 1;
+    }
+
+    TextCache textCache(renderer, TEXT_CACHE_BYTES);
+    GlyphAtlas glyphAtlas(renderer, textCache);
+    if (!glyphAtlas.build(font))
+    {
+        std::cout << "Falling back to cached text textures" << std::endl;
+    }
+
+    // Start the playback engine and the background loader
+    setTrackResampler(resamplerQuality);
+    setSeekIndexFile(preferenceFile("seek.index"));
+    const AudioDeviceSpec &spec = audioDevice.spec();
+    if (!trackCache.start((size_t)cacheMegabytes * 1024 * 1024, cachePacking, spec.format, spec.channels))
+    {
+        std::cout << "Playing without a track cache" << std::endl;
+    }
+    engine.setLimiterLookahead(limiterLookaheadMs);
+    if (!engine.start(onEngineEvent, ringMilliseconds) || !loader.start(onLoadComplete, &trackCache))
+    {
+        glyphAtlas.destroy();
+        textCache.clear();
+        TTF_CloseFont(font);
+        SDL_DestroyTexture(backgroundTexture);
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroyWindow(window);
+        engine.stop();
+        trackCache.stop();
+        audioDevice.close();
         TTF_Quit();
         SDL_Quit();
         return 1;
     }
 
-    int currentVolume = MIX_MAX_VOLUME / 2; // Set initial volume to 50%
+    int scanWorkers = std::clamp(SDL_GetCPUCount() - 1, 1, 4);
+    if (!loudnessScanner.start(preferenceFile("loudness.cache"), scanWorkers, onLoadComplete))
+    {
+        std::cout << "Playing without loudness normalization" << std::endl;
+    }
+    // Listing folders and probing files mostly waits for the disk
+    if (!ingester.start(std::clamp(SDL_GetCPUCount(), 2, 8), onLoadComplete))
+    {
+        std::cout << "Folders can not be added" << std::endl;
+    }
+
+    // Everything the audio thread touches exists by now
+    if (realtimeOptions.lockMemory)
+    {
+        lockProcessMemory();
+    }
+
+    engine.setVolumeDb(currentVolumeDb);
+    engine.setEqualizer(equalizerPreset(eqPreset));
+    engine.setLimiterCeiling(limiterCeilingDb);
+    engine.setCompressor(compressorEnabled);
+    engine.setCrossfade(CROSSFADE_STEPS[crossfadeStep] * 1000, crossfadeCurve);
+    if (playbackSpeed != 1.0f || pitchSemitones != 0)
+    {
+        applyTimeStretch();
+    }
+
+    // Files given on the command line play right away
+    queueCommandLineFiles();
+    startLibrary();
     while (!quit)
     {
-        while (SDL_PollEvent(&windowEvent))
+        // Sleep until there is input, a progress tick or background work to handle
+        bool hasEvent = scheduler.waitEvent(windowEvent);
+        while (hasEvent)
         {
             if (windowEvent.type == SDL_QUIT)
             {
                 quit = true;
                 break;
             }
+            else if (windowEvent.type == SDL_WINDOWEVENT || scheduler.isTrackFinished(windowEvent) || scheduler.isWork(windowEvent))
+            {
+                scheduler.requestRedraw();
+            }
+            else if (windowEvent.type == SDL_DROPFILE)
+            {
+                // Files and folders dropped on the window, queued together
+                // once the drop is complete
+                droppedPaths.push_back(windowEvent.drop.file);
+                SDL_free(windowEvent.drop.file);
+            }
             else if (windowEvent.type == SDL_MOUSEBUTTONDOWN)
             {
+                scheduler.requestRedraw();
+
                 int mouseX = windowEvent.button.x;
                 int mouseY = windowEvent.button.y;
 
@@ -232,57 +1538,9 @@ int main(int argc, char *argv[])
                     if (filepath != nullptr)
                     {
                         isMusicPaused = false;
-                        if (music != nullptr)
-                        {
-                            Mix_FreeMusic(music);
-                            music = nullptr;
-                        }
-
-                        music = Mix_LoadMUS(filepath);
-                        if (music == nullptr)
-                        {
-                            std::cout << "Failed to load music: " << Mix_GetError() << std::endl;
-                        }
-                        else
-                        {
-                            albumTag = Mix_GetMusicAlbumTag(music);
-                            if (albumTag.c_str() == nullptr || strlen(albumTag.c_str()) < 2)
-                            {
-                                albumTag = "Unknown";
-                            }
-
-                            artistTag = Mix_GetMusicArtistTag(music);
-                            if (artistTag.c_str() == nullptr || strlen(artistTag.c_str()) < 2)
-                            {
-                                artistTag = "Unknown";
-                            }
-
-                            titleTag = Mix_GetMusicTitle(music);
-                            if (titleTag.c_str() == nullptr || strlen(titleTag.c_str()) < 2)
-                            {
-                                titleTag = "Unknown";
-                            }
-                            musicDuration = Mix_MusicDuration(music);                              // Get the duration of the music file
-                            currentFilename = std::filesystem::path(filepath).filename().string(); // Extract the filename
-                            if (musicDuration <= 0)
-                            {
-                                std::cout << "Failed to get music duration: " << Mix_GetError() << std::endl;
-                            }
-                            else
-                            {
-                                if (Mix_PlayMusic(music, 0) == -1)
-                                {
-                                    std::cout << "Failed to play music: " << Mix_GetError() << std::endl;
-                                }
-                                else
-                                {
-                                    isMusicPlaying = true;
-                                    startTime = SDL_GetTicks() / 1000;
-                                }
-                            }
-                        }
-
-                        SDL_free((void *)filepath);
+                        engine.setPaused(false);
+                        requestPlay(filepath);
+                        // Don't use SDL_free for filepath, as it wasn't allocated by SDL_malloc
                     }
                 }
 
@@ -294,49 +1552,212 @@ int main(int argc, char *argv[])
                         if (isMusicPaused)
                         {
                             // Resume the music
-                            Mix_ResumeMusic();
+                            engine.setPaused(false);
                             isMusicPaused = false;
-
-                            // Update the start time by subtracting the paused time
-                            startTime += (SDL_GetTicks() / 1000 - pauseTime);
                         }
                         else
                         {
                             // Pause the music
-                            Mix_PauseMusic();
+                            engine.setPaused(true);
                             isMusicPaused = true;
-
-                            // Store the current time as the paused time
-                            pauseTime = SDL_GetTicks() / 1000;
                         }
                     }
                 }
+                // Go back: restart the current song, or play the previous one early in a song
+                SDL_Rect backButtonRect = {WIDTH / 2 - 320, HEIGHT - 200, 200, 50};
+                if (isPointInRect(mouseX, mouseY, backButtonRect) && !playHistory.empty())
+                {
+                    bool playing = isMusicPlaying && !isDrained && currentTrack != nullptr;
+                    if (playing && (playbackSeconds() >= RESTART_SECONDS || playHistory.size() < 2))
+                    {
+                        engine.seek(currentTrack, 0);
+                    }
+                    else
+                    {
+                        if (playing)
+                        {
+                            playHistory.pop_back();
+                        }
+                        // Comes back into the history once it starts; usually still cached
+                        std::string path = playHistory.back();
+                        playHistory.pop_back();
+                        isMusicPaused = false;
+                        engine.setPaused(false);
+                        requestPlay(path);
+                    }
+                }
+
                 // Check if the mouse click is inside the volume slider area
                 SDL_Rect volumeSliderRect = {(WIDTH - 200) / 2, HEIGHT - 400, 200, 20};
                 if (isPointInRect(mouseX, mouseY, volumeSliderRect))
                 {
-                    // Calculate the new volume based on the mouse position within the slider
-                    int sliderPosition = mouseX - volumeSliderRect.x;
-                    int sliderMaxPosition = volumeSliderRect.w;
-                    currentVolume = (sliderPosition * MIX_MAX_VOLUME) / sliderMaxPosition;
+                    // The slider is linear in dB, its left end is silence
+                    double sliderPosition = (double)(mouseX - volumeSliderRect.x) / volumeSliderRect.w;
+                    currentVolumeDb = GAIN_MIN_DB * (1.0 - SDL_clamp(sliderPosition, 0.0, 1.0));
 
-                    // Set the new volume
-                    Mix_VolumeMusic(currentVolume);
+                    // Set the new volume, the engine glides there without zipper noise
+                    engine.setVolumeDb(currentVolumeDb);
                 }
 
                 SDL_Rect queueButtonRect = {(WIDTH - 200) / 2, HEIGHT - 300, 200, 50};
                 if (isPointInRect(mouseX, mouseY, queueButtonRect))
                 {
-                    // Open file dialog to choose a music file
-                    const char *filepath = tinyfd_openFileDialog("Choose Music File", "", 0, nullptr, nullptr, 0);
+                    // Open file dialog to choose any number of music files
+                    const char *selection = tinyfd_openFileDialog("Choose Music Files", "", 0, nullptr, nullptr, 1);
 
-                    if (filepath != nullptr)
+                    if (selection != nullptr)
                     {
-                        addToQueue(filepath);
-                        // Don't use SDL_free for filepath, as it wasn't allocated by SDL_malloc
+                        ingester.add(splitDialogPaths(selection));
+                        // Don't use SDL_free for selection, as it wasn't allocated by SDL_malloc
+                    }
+                }
+
+                // Queue every music file in a folder and its subfolders
+                SDL_Rect folderButtonRect = {WIDTH / 2 + 340, HEIGHT - 300, 200, 50};
+                if (isPointInRect(mouseX, mouseY, folderButtonRect))
+                {
+                    const char *folder = tinyfd_selectFolderDialog("Choose Music Folder", "");
+                    if (folder != nullptr)
+                    {
+                        ingester.add({folder});
+                    }
+                }
+
+                // Seek to the clicked spot of the progress bar, with some slack above and below it.
+                // While paused the track resumes from there.
+                SDL_Rect progressBarRect = {(WIDTH - PROGRESS_BAR_WIDTH) / 2, 95 + glyphAtlas.lineHeight() - 10, PROGRESS_BAR_WIDTH, 26};
+                if (isMusicPlaying && !isDrained && currentTrack != nullptr && isPointInRect(mouseX, mouseY, progressBarRect))
+                {
+                    double fraction = SDL_clamp((double)(mouseX - progressBarRect.x) / progressBarRect.w, 0.0, 1.0);
+                    engine.seek(currentTrack, (Uint64)(fraction * currentTrack->frames));
+                }
+
+                // Cycle through the crossfade lengths and toggle the fade curve
+                SDL_Rect crossfadeButtonRect = {WIDTH / 2 - 210, HEIGHT - 500, 200, 50};
+                SDL_Rect curveButtonRect = {WIDTH / 2 + 10, HEIGHT - 500, 200, 50};
+                if (isPointInRect(mouseX, mouseY, crossfadeButtonRect) || isPointInRect(mouseX, mouseY, curveButtonRect))
+                {
+                    if (isPointInRect(mouseX, mouseY, crossfadeButtonRect))
+                    {
+                        crossfadeStep = (crossfadeStep + 1) % CROSSFADE_STEP_COUNT;
+                    }
+                    else
+                    {
+                        crossfadeCurve = crossfadeCurve == CROSSFADE_EQUAL_POWER ? CROSSFADE_LINEAR : CROSSFADE_EQUAL_POWER;
                     }
+                    engine.setCrossfade(CROSSFADE_STEPS[crossfadeStep] * 1000, crossfadeCurve);
+                }
+
+                // Cycle through the equalizer presets
+                SDL_Rect eqButtonRect = {WIDTH / 2 - 320, HEIGHT - 300, 200, 50};
+                if (isPointInRect(mouseX, mouseY, eqButtonRect))
+                {
+                    eqPreset = (EqualizerPreset)((eqPreset + 1) % EQ_PRESET_COUNT);
+                    if (!engine.setEqualizer(equalizerPreset(eqPreset)))
+                    {
+                        std::cout << "Failed to change the equalizer: audio thread is busy" << std::endl;
+                    }
+                }
+
+                // Cycle through the loudness normalization modes
+                SDL_Rect gainButtonRect = {WIDTH / 2 + 120, HEIGHT - 300, 200, 50};
+                if (isPointInRect(mouseX, mouseY, gainButtonRect))
+                {
+                    replayGainMode = (ReplayGainMode)((replayGainMode + 1) % (REPLAYGAIN_ALBUM + 1));
+                    if (nextTrack != nullptr)
+                    {
+                        engine.setGain(nextTrack, trackGain(nextTrack));
+                    }
+                }
+
+                // Cycle through the playback speeds and pitch shifts
+                SDL_Rect speedButtonRect = {WIDTH / 2 + 120, HEIGHT - 200, 200, 50};
+                SDL_Rect pitchButtonRect = {WIDTH / 2 + 120, HEIGHT - 100, 200, 50};
+                if (isPointInRect(mouseX, mouseY, speedButtonRect))
+                {
+                    const float *step = std::find(std::begin(SPEED_STEPS), std::end(SPEED_STEPS), playbackSpeed);
+                    playbackSpeed = step == std::end(SPEED_STEPS) || step + 1 == std::end(SPEED_STEPS) ? SPEED_STEPS[0] : step[1];
+                    applyTimeStretch();
+                }
+                if (isPointInRect(mouseX, mouseY, pitchButtonRect))
+                {
+                    const int *step = std::find(std::begin(PITCH_STEPS), std::end(PITCH_STEPS), pitchSemitones);
+                    pitchSemitones = step == std::end(PITCH_STEPS) || step + 1 == std::end(PITCH_STEPS) ? PITCH_STEPS[0] : step[1];
+                    applyTimeStretch();
+                }
+
+                // Toggle the program compressor
+                SDL_Rect compressorButtonRect = {WIDTH / 2 - 320, HEIGHT - 100, 200, 50};
+                if (isPointInRect(mouseX, mouseY, compressorButtonRect))
+                {
+                    compressorEnabled = !compressorEnabled;
+                    engine.setCompressor(compressorEnabled);
                 }
             }
+
+            hasEvent = SDL_PollEvent(&windowEvent);
+        }
+        if (!droppedPaths.empty())
+        {
+            ingester.add(droppedPaths);
+            droppedPaths.clear();
+            scheduler.requestRedraw();
+        }
+
+        // Pick up track transitions and finished loads, then keep the next song preloaded
+        handleLoadResults();
+        handleEngineEvents();
+        handleLoudnessResults();
+        handleIngestResults();
+        handleLibraryResults();
+        preloadNextSong();
+        reportRealtimeViolations();
+
+        // The adaptive latency profile resizes the device buffer after underruns
+        int adaptedFrames = audioDevice.adapt(engine.underruns());
+        if (audioDeviceLost)
+        {
+            retryAudioDevice();
+        }
+        else if (rateSwitchTrack != nullptr)
+        {
+            applyDeviceRate();
+            scheduler.requestRedraw();
+        }
+        else if (adaptedFrames > 0)
+        {
+            reopenAudioDevice(adaptedFrames);
+            scheduler.requestRedraw();
+        }
+        else
+        {
+            AudioDevice::cancelLockFormat();
+        }
+
+        // Redraw when the progress text or bar changes next
+        if (isMusicPlaying && !isDrained && !isMusicPaused && musicDuration > 0.0)
+        {
+            double position = playbackSeconds();
+            double secondsPerPixel = musicDuration / PROGRESS_BAR_WIDTH;
+            double untilChange = SDL_min(1.0 - std::fmod(position, 1.0), secondsPerPixel - std::fmod(position, secondsPerPixel)) / segmentSpeed;
+            scheduler.scheduleTick(SDL_clamp((Uint32)std::ceil(untilChange * 1000.0), MIN_REDRAW_MS, 1000u));
+        }
+        else if (!ingester.idle() || library.scanning())
+        {
+            // Keep the count of checked or scanned files moving
+            scheduler.scheduleTick(INGEST_REDRAW_MS);
+        }
+        else if (audioDeviceLost)
+        {
+            scheduler.scheduleTick(DEVICE_RETRY_MS);
+        }
+        else
+        {
+            scheduler.cancelTick();
+        }
+        if (!scheduler.beginFrame())
+        {
+            continue;
         }
 
         SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
@@ -352,16 +1773,7 @@ int main(int argc, char *argv[])
 
         // Render the text
         SDL_Color textColor = {230, 230, 230, 230}; // White color
-        SDL_Surface *textSurface = TTF_RenderText_Solid(font, "CHOOSE FILE", textColor);
-        SDL_Texture *textTexture = SDL_CreateTextureFromSurface(renderer, textSurface);
-        int textWidth = textSurface->w;
-        int textHeight = textSurface->h;
-        int textX = buttonRect.x + (buttonRect.w - textWidth) / 2;  // Center horizontally
-        int textY = buttonRect.y + (buttonRect.h - textHeight) / 2; // Center vertically
-        SDL_Rect textRect = {textX, textY, textWidth, textHeight};
-        SDL_RenderCopy(renderer, textTexture, NULL, &textRect);
-        SDL_FreeSurface(textSurface);
-        SDL_DestroyTexture(textTexture);
+        glyphAtlas.drawCentered("CHOOSE FILE", buttonRect, textColor);
 
         // Render the volume slider
         SDL_Rect volumeSliderRect = {(WIDTH - 200) / 2, HEIGHT - 400, 200, 30};
@@ -370,40 +1782,41 @@ int main(int argc, char *argv[])
 
         // Render the volume text
         SDL_Color purpleTextColor = {128, 0, 128, 255}; // White color
-        SDL_Surface *volumeSurface = TTF_RenderText_Solid(font, "VOLUME", purpleTextColor);
-        SDL_Texture *volumeTexture = SDL_CreateTextureFromSurface(renderer, volumeSurface);
-        int volumeWidth = volumeSurface->w;
-        int volumeHeight = volumeSurface->h;
-        int volumeX = volumeSliderRect.x - volumeWidth - 10;                        // Position the text to the left of the slider with a margin of 10 pixels
-        int volumeY = volumeSliderRect.y + (volumeSliderRect.h - volumeHeight) / 2; // Center the text vertically
-        SDL_Rect volumeRect = {volumeX, volumeY, volumeWidth, volumeHeight};
-        SDL_RenderCopy(renderer, volumeTexture, NULL, &volumeRect);
-        SDL_FreeSurface(volumeSurface);
-        SDL_DestroyTexture(volumeTexture);
+        int volumeX = volumeSliderRect.x - glyphAtlas.measure("VOLUME") - 10;                        // Position the text to the left of the slider with a margin of 10 pixels
+        int volumeY = volumeSliderRect.y + (volumeSliderRect.h - glyphAtlas.lineHeight()) / 2; // Center the text vertically
+        glyphAtlas.draw("VOLUME", volumeX, volumeY, purpleTextColor);
 
         // Calculate the position of the volume slider handle
-        int sliderPosition = (currentVolume * volumeSliderRect.w) / MIX_MAX_VOLUME;
+        int sliderPosition = (int)((1.0 - currentVolumeDb / GAIN_MIN_DB) * volumeSliderRect.w);
         SDL_Rect volumeSliderHandleRect = {volumeSliderRect.x + sliderPosition - 5, volumeSliderRect.y - 5, 10, 40};
         SDL_SetRenderDrawColor(renderer, 230, 230, 230, 230); // White color
         SDL_RenderFillRect(renderer, &volumeSliderHandleRect);
 
+        // Render the volume in dB to the right of the slider
+        char volumeText[16];
+        if (currentVolumeDb <= GAIN_MIN_DB)
+        {
+            SDL_strlcpy(volumeText, "MUTE", sizeof(volumeText));
+        }
+        else
+        {
+            SDL_snprintf(volumeText, sizeof(volumeText), "%.1f DB", currentVolumeDb);
+        }
+        glyphAtlas.draw(volumeText, volumeSliderRect.x + volumeSliderRect.w + 10, volumeY, purpleTextColor);
+
         // Render the pause/resume button
         SDL_Rect pauseButtonRect = {(WIDTH - 200) / 2, (HEIGHT - 200), 200, 50};
         SDL_SetRenderDrawColor(renderer, 128, 0, 128, 255); // Purple color
         SDL_RenderFillRect(renderer, &pauseButtonRect);
 
         // Render the text on the pause/resume button
-        std::string pauseButtonText = isMusicPaused ? "RESUME" : "PAUSE";
-        SDL_Surface *pauseButtonSurface = TTF_RenderText_Solid(font, pauseButtonText.c_str(), textColor);
-        SDL_Texture *pauseButtonTexture = SDL_CreateTextureFromSurface(renderer, pauseButtonSurface);
-        int pauseButtonWidth = pauseButtonSurface->w;
-        int pauseButtonHeight = pauseButtonSurface->h;
-        int pauseButtonX = pauseButtonRect.x + (pauseButtonRect.w - pauseButtonWidth) / 2;  // Center horizontally
-        int pauseButtonY = pauseButtonRect.y + (pauseButtonRect.h - pauseButtonHeight) / 2; // Center vertically
-        SDL_Rect pauseButtonRenderRect = {pauseButtonX, pauseButtonY, pauseButtonWidth, pauseButtonHeight};
-        SDL_RenderCopy(renderer, pauseButtonTexture, NULL, &pauseButtonRenderRect);
-        SDL_FreeSurface(pauseButtonSurface);
-        SDL_DestroyTexture(pauseButtonTexture);
+        glyphAtlas.drawCentered(isMusicPaused ? "RESUME" : "PAUSE", pauseButtonRect, textColor);
+
+        // Render the back button
+        SDL_Rect backButtonRect = {WIDTH / 2 - 320, HEIGHT - 200, 200, 50};
+        SDL_SetRenderDrawColor(renderer, 128, 0, 128, 255); // Purple color
+        SDL_RenderFillRect(renderer, &backButtonRect);
+        glyphAtlas.drawCentered("BACK", backButtonRect, textColor);
 
         // Render the Queue button
         SDL_Rect queueButtonRect = {(WIDTH - 200) / 2, HEIGHT - 300, 200, 50};
@@ -411,104 +1824,172 @@ int main(int argc, char *argv[])
         SDL_RenderFillRect(renderer, &queueButtonRect);
 
         // Render the text on the Queue button
-        std::string queueButtonText = "ADD TO QUEUE";
-        SDL_Surface *queueButtonSurface = TTF_RenderText_Solid(font, queueButtonText.c_str(), textColor);
-        SDL_Texture *queueButtonTexture = SDL_CreateTextureFromSurface(renderer, queueButtonSurface);
-        int queueButtonWidth = queueButtonSurface->w;
-        int queueButtonHeight = queueButtonSurface->h;
-        int queueButtonX = queueButtonRect.x + (queueButtonRect.w - queueButtonWidth) / 2;  // Center horizontally
-        int queueButtonY = queueButtonRect.y + (queueButtonRect.h - queueButtonHeight) / 2; // Center vertically
-        SDL_Rect queueButtonRenderRect = {queueButtonX, queueButtonY, queueButtonWidth, queueButtonHeight};
-        SDL_RenderCopy(renderer, queueButtonTexture, nullptr, &queueButtonRenderRect);
-
-        // Cleanup
-        SDL_FreeSurface(queueButtonSurface);
-        SDL_DestroyTexture(queueButtonTexture);
-
-        // Render the music progress
-        if (isMusicPlaying && Mix_PlayingMusic() && !isMusicPaused)
-        {
-            int currentTime = SDL_GetTicks() / 1000 - startTime;
-            std::string progressText = formatTime(currentTime) + " / " + formatTime(musicDuration);
-
-            SDL_Surface *progressSurface = TTF_RenderText_Solid(font, progressText.c_str(), textColor);
-            SDL_Texture *progressTexture = SDL_CreateTextureFromSurface(renderer, progressSurface);
-            int progressWidth = progressSurface->w;
-            int progressHeight = progressSurface->h;
-            int progressX = (WIDTH - progressWidth) / 2; // Center horizontally
-            int progressY = 85;                          
-            SDL_Rect progressRect = {progressX, progressY, progressWidth, progressHeight};
-            SDL_RenderCopy(renderer, progressTexture, NULL, &progressRect);
-            SDL_FreeSurface(progressSurface);
-            SDL_DestroyTexture(progressTexture);
-
-            // Render the title tag
-            SDL_Surface *titleSurface = TTF_RenderText_Solid(font, titleTag.substr(0, 45).c_str(), textColor);
-            SDL_Texture *titleTexture = SDL_CreateTextureFromSurface(renderer, titleSurface);
-            int titleWidth = titleSurface->w;
-            int titleHeight = titleSurface->h;
-            int titleX = (WIDTH - titleWidth) / 2;     // Center horizontally
-            int titleY = 205; 
-            SDL_Rect titleRect = {titleX, titleY, titleWidth, titleHeight};
-            SDL_RenderCopy(renderer, titleTexture, NULL, &titleRect);
-            SDL_FreeSurface(titleSurface);
-            SDL_DestroyTexture(titleTexture);
-
-            // Render the artist tag
-            SDL_Surface *artistSurface = TTF_RenderText_Solid(font, artistTag.substr(0, 45).c_str(), textColor);
-            SDL_Texture *artistTexture = SDL_CreateTextureFromSurface(renderer, artistSurface);
-            int artistWidth = artistSurface->w;
-            int artistHeight = artistSurface->h;
-            int artistX = (WIDTH - artistWidth) / 2;     // Center horizontally
-            int artistY = 325; 
-            SDL_Rect artistRect = {artistX, artistY, artistWidth, artistHeight};
-            SDL_RenderCopy(renderer, artistTexture, NULL, &artistRect);
-            SDL_FreeSurface(artistSurface);
-            SDL_DestroyTexture(artistTexture);
-
-            // Render the album tag
-            SDL_Surface *albumSurface = TTF_RenderText_Solid(font, albumTag.substr(0, 45).c_str(), textColor);
-            SDL_Texture *albumTexture = SDL_CreateTextureFromSurface(renderer, albumSurface);
-            int albumWidth = albumSurface->w;
-            int albumHeight = albumSurface->h;
-            int albumX = (WIDTH - albumWidth) / 2;     // Center horizontally
-            int albumY = 445; 
-            SDL_Rect albumRect = {albumX, albumY, albumWidth, albumHeight};
-            SDL_RenderCopy(renderer, albumTexture, NULL, &albumRect);
-            SDL_FreeSurface(albumSurface);
-            SDL_DestroyTexture(albumTexture);
-
-            // Render the filename text
-            SDL_Surface *filenameSurface = TTF_RenderText_Solid(font, currentFilename.substr(0, 45).c_str(), textColor);
-            SDL_Texture *filenameTexture = SDL_CreateTextureFromSurface(renderer, filenameSurface);
-            int filenameWidth = filenameSurface->w;
-            int filenameHeight = filenameSurface->h;
-            int filenameX = (WIDTH - filenameWidth) / 2;     // Center horizontally
-            int filenameY = 565; 
-            SDL_Rect filenameRect = {filenameX, filenameY, filenameWidth, filenameHeight};
-            SDL_RenderCopy(renderer, filenameTexture, NULL, &filenameRect);
-            SDL_FreeSurface(filenameSurface);
-            SDL_DestroyTexture(filenameTexture);
-
-        }
-
-        if (isMusicPlaying && !Mix_PlayingMusic() && !isMusicPaused)
-        {
-            playNextSong();
+        glyphAtlas.drawCentered("ADD TO QUEUE", queueButtonRect, textColor);
+
+        // Render the add folder button next to it
+        SDL_Rect folderButtonRect = {WIDTH / 2 + 340, HEIGHT - 300, 200, 50};
+        SDL_SetRenderDrawColor(renderer, 128, 0, 128, 255); // Purple color
+        SDL_RenderFillRect(renderer, &folderButtonRect);
+        glyphAtlas.drawCentered("ADD FOLDER", folderButtonRect, textColor);
+
+        // Render the crossfade buttons
+        SDL_Rect crossfadeButtonRect = {WIDTH / 2 - 210, HEIGHT - 500, 200, 50};
+        SDL_Rect curveButtonRect = {WIDTH / 2 + 10, HEIGHT - 500, 200, 50};
+        SDL_SetRenderDrawColor(renderer, 128, 0, 128, 255); // Purple color
+        SDL_RenderFillRect(renderer, &crossfadeButtonRect);
+        SDL_RenderFillRect(renderer, &curveButtonRect);
+
+        int crossfadeSeconds = CROSSFADE_STEPS[crossfadeStep];
+        std::string crossfadeText = crossfadeSeconds == 0 ? "CROSSFADE OFF" : "CROSSFADE " + std::to_string(crossfadeSeconds) + " S";
+        glyphAtlas.drawCentered(crossfadeText, crossfadeButtonRect, textColor);
+        glyphAtlas.drawCentered(crossfadeCurve == CROSSFADE_EQUAL_POWER ? "EQUAL POWER" : "LINEAR", curveButtonRect, textColor);
+
+        // Render the equalizer preset button
+        SDL_Rect eqButtonRect = {WIDTH / 2 - 320, HEIGHT - 300, 200, 50};
+        SDL_SetRenderDrawColor(renderer, 128, 0, 128, 255); // Purple color
+        SDL_RenderFillRect(renderer, &eqButtonRect);
+        std::string eqText = std::string("EQ ") + equalizerPresetName(eqPreset);
+        std::transform(eqText.begin(), eqText.end(), eqText.begin(), ::toupper);
+        glyphAtlas.drawCentered(eqText, eqButtonRect, textColor);
+
+        // Render the loudness normalization button
+        SDL_Rect gainButtonRect = {WIDTH / 2 + 120, HEIGHT - 300, 200, 50};
+        SDL_SetRenderDrawColor(renderer, 128, 0, 128, 255); // Purple color
+        SDL_RenderFillRect(renderer, &gainButtonRect);
+        const char *gainLabels[] = {"GAIN OFF", "TRACK GAIN", "ALBUM GAIN"};
+        glyphAtlas.drawCentered(gainLabels[replayGainMode], gainButtonRect, textColor);
+
+        // Render the speed and pitch buttons
+        SDL_Rect speedButtonRect = {WIDTH / 2 + 120, HEIGHT - 200, 200, 50};
+        SDL_Rect pitchButtonRect = {WIDTH / 2 + 120, HEIGHT - 100, 200, 50};
+        SDL_SetRenderDrawColor(renderer, 128, 0, 128, 255); // Purple color
+        SDL_RenderFillRect(renderer, &speedButtonRect);
+        SDL_RenderFillRect(renderer, &pitchButtonRect);
+        char speedText[32];
+        SDL_snprintf(speedText, sizeof(speedText), "SPEED %.3gX", playbackSpeed);
+        glyphAtlas.drawCentered(speedText, speedButtonRect, textColor);
+        std::string pitchText = pitchSemitones == 0 ? "PITCH 0" : "PITCH " + std::string(pitchSemitones > 0 ? "+" : "") + std::to_string(pitchSemitones);
+        glyphAtlas.drawCentered(pitchText, pitchButtonRect, textColor);
+
+        // Render the compressor button
+        SDL_Rect compressorButtonRect = {WIDTH / 2 - 320, HEIGHT - 100, 200, 50};
+        SDL_SetRenderDrawColor(renderer, 128, 0, 128, 255); // Purple color
+        SDL_RenderFillRect(renderer, &compressorButtonRect);
+        glyphAtlas.drawCentered(compressorEnabled ? "COMPRESSOR ON" : "COMPRESSOR OFF", compressorButtonRect, textColor);
+
+        // Show which file is being opened until it starts playing
+        if (playRequestId != 0)
+        {
+            SDL_Rect loadingRect = {0, 25, WIDTH, glyphAtlas.lineHeight()};
+            glyphAtlas.drawCentered("LOADING " + loadingFilename.substr(0, 45), loadingRect, textColor);
+        }
+
+        // Render the music progress, held still while paused so it can still be clicked
+        if (isMusicPlaying && !isDrained)
+        {
+            double currentTime = playbackSeconds();
+            std::string progressText = formatTime((int)currentTime) + " / " + formatTime((int)musicDuration);
+
+            SDL_Rect progressRect = {0, 85, WIDTH, glyphAtlas.lineHeight()};
+            glyphAtlas.drawCentered(progressText, progressRect, textColor);
+
+            // Render the progress bar
+            SDL_Rect progressBarRect = {(WIDTH - PROGRESS_BAR_WIDTH) / 2, 95 + glyphAtlas.lineHeight(), PROGRESS_BAR_WIDTH, 6};
+            SDL_SetRenderDrawColor(renderer, 128, 0, 128, 255); // Purple color
+            SDL_RenderFillRect(renderer, &progressBarRect);
+            progressBarRect.w = musicDuration > 0.0 ? (int)(PROGRESS_BAR_WIDTH * currentTime / musicDuration) : 0;
+            SDL_SetRenderDrawColor(renderer, 230, 230, 230, 230); // White color
+            SDL_RenderFillRect(renderer, &progressBarRect);
+
+            // Render the title, artist and album tags and the filename
+            const std::string *lines[] = {&titleTag, &artistTag, &albumTag, &currentFilename};
+            for (int i = 0; i < 4; i++)
+            {
+                SDL_Rect lineRect = {0, 205 + i * 120, WIDTH, glyphAtlas.lineHeight()};
+                glyphAtlas.drawCentered(lines[i]->substr(0, 45), lineRect, textColor);
+            }
+        }
+
+        // Render the negotiated device spec and the underrun counter
+        const AudioDeviceSpec &deviceSpec = audioDevice.spec();
+        char latencyText[32];
+        SDL_snprintf(latencyText, sizeof(latencyText), "%.1f MS", audioDevice.latencyMs(engine.outputLatencyFrames()));
+        std::string deviceText = std::to_string(deviceSpec.frequency) + " HZ " + audioFormatName(deviceSpec.format) + " " +
+                                 std::to_string(deviceSpec.channels) + " CH, " + std::to_string(deviceSpec.bufferFrames) +
+                                 " FRAMES (" + latencyText + "), " + std::to_string(engine.underruns()) + " UNDERRUNS";
+        if (audioDeviceLost)
+        {
+            deviceText = "AUDIO DEVICE LOST, RETRYING";
+        }
+        glyphAtlas.draw(deviceText, 10, HEIGHT - 10 - glyphAtlas.lineHeight(), purpleTextColor);
+
+        // Render the engine's timing statistics above it
+        const EngineTelemetry &telemetry = engine.stats();
+        char telemetryText[128];
+        int telemetryLength = SDL_snprintf(telemetryText, sizeof(telemetryText), "DSP %.0f%% AVG %.0f%% P99, JITTER P99 %.1f MS",
+                                           telemetry.load.mean(), telemetry.load.percentile(0.99), telemetry.jitter.percentile(0.99) / 1000.0);
+        if (engine.usesDecoderThread())
+        {
+            SDL_snprintf(telemetryText + telemetryLength, sizeof(telemetryText) - telemetryLength, ", RING %.0f%% P1, DECODE P99 %.2f MS",
+                         telemetry.ringFill.percentile(0.01), telemetry.decoderTime.percentile(0.99) / 1000.0);
+        }
+        glyphAtlas.draw(telemetryText, 10, HEIGHT - 10 - 2 * glyphAtlas.lineHeight(), purpleTextColor);
+
+        // Render the gain reduction of the limiter and compressor above that
+        Dynamics &dynamics = engine.outputDynamics();
+        limiterMeterDb = SDL_max(dynamics.takeLimiterReductionDb(), limiterMeterDb * 0.9f);
+        compressorMeterDb = SDL_max(dynamics.takeCompressorReductionDb(), compressorMeterDb * 0.9f);
+        char dynamicsText[96];
+        if (dynamics.limiterEnabled())
+        {
+            SDL_snprintf(dynamicsText, sizeof(dynamicsText), "LIMITER -%.1f DB, COMPRESSOR -%.1f DB", limiterMeterDb, compressorMeterDb);
+        }
+        else
+        {
+            SDL_snprintf(dynamicsText, sizeof(dynamicsText), "LIMITER OFF, COMPRESSOR -%.1f DB", compressorMeterDb);
+        }
+        glyphAtlas.draw(dynamicsText, 10, HEIGHT - 10 - 3 * glyphAtlas.lineHeight(), purpleTextColor);
+
+        // Show how far adding files has got while the ingester works
+        if (!ingester.idle())
+        {
+            std::string ingestText = "ADDING FILES, " + std::to_string(ingester.filesChecked()) + " CHECKED";
+            glyphAtlas.draw(ingestText, 10, HEIGHT - 10 - 4 * glyphAtlas.lineHeight(), purpleTextColor);
+        }
+        else if (library.scanning())
+        {
+            std::string libraryText = "SCANNING LIBRARY, " + std::to_string(library.filesProbed()) + " FILES READ";
+            glyphAtlas.draw(libraryText, 10, HEIGHT - 10 - 4 * glyphAtlas.lineHeight(), purpleTextColor);
         }
 
+        // Submit all text queued above in a single batch
+        glyphAtlas.flush();
+
         SDL_RenderPresent(renderer);
     }
 
+    std::cout << "Frames: " << scheduler.framesRendered() << " rendered, " << scheduler.framesSkipped() << " skipped" << std::endl;
+    std::cout << "Glyph atlas: " << glyphAtlas.glyphCount() << " glyphs, " << glyphAtlas.batches() << " batches" << std::endl;
+    printPlaybackSummary(realtimeOptions, telemetryFile);
+    std::cout << "Text cache: " << textCache.hits() << " hits, " << textCache.misses() << " misses, "
+              << textCache.entries() << " textures (" << textCache.bytesUsed() / 1024 << " KiB)" << std::endl;
+
     // Clean up resources
+    glyphAtlas.destroy();
+    textCache.clear();
     SDL_DestroyTexture(backgroundTexture);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
-    if (music != nullptr)
-    {
-        Mix_FreeMusic(music);
-    }
-    Mix_CloseAudio();
+    AudioDevice::cancelLockFormat();
+    freeTrack(rateSwitchTrack);
+    rateSwitchTrack = nullptr;
+    library.stop();
+    ingester.stop();
+    loader.stop();
+    loudnessScanner.stop();
+    engine.stop();
+    trackCache.stop();
+    audioDevice.close();
     TTF_CloseFont(font);
     TTF_Quit();
     IMG_Quit();
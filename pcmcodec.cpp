@@ -0,0 +1,207 @@
+#include "pcmcodec.h"
+#include "bitwriter.h"
+
+#include <cmath>
+
+const int BLOCK_FRAMES = 4096;
+const int ESCAPE_QUOTIENT = 24; // Longer unary codes store the value raw instead
+const int RAW_BITS = 20;        // A zigzagged second order residual of 16-bit audio takes up to 19
+const int MAX_CHANNELS = 8;
+
+static int countLeadingZeros(Uint64 value)
+{
+#ifdef __GNUC__
+    return value == 0 ? 64 : __builtin_clzll(value);
+#else
+    int zeros = 0;
+    while (zeros < 64 && (value >> (63 - zeros) & 1) == 0)
+    {
+        zeros++;
+    }
+    return zeros;
+#endif
+}
+
+class BitReader
+{
+public:
+    explicit BitReader(const std::vector<Uint8> &in) : in(in) {}
+
+    Uint32 get(int bits)
+    {
+        refill(bits);
+        count -= bits;
+        return (Uint32)(accumulator >> count) & (Uint32)((1ull << bits) - 1);
+    }
+
+    // Counts set bits up to a clear one, which is consumed, or up to limit
+    int unary(int limit)
+    {
+        refill(limit + 1);
+        // Left align the unread bits; inverted, the leading ones become leading zeros
+        Uint64 inverted = ~(accumulator << (64 - count));
+        int ones = SDL_min(countLeadingZeros(inverted), limit);
+        count -= ones < limit ? ones + 1 : ones;
+        return ones;
+    }
+
+    // True if more bits were consumed than there are
+    bool overrun() const { return position * 8 - count > in.size() * 8; }
+
+private:
+    void refill(int bits)
+    {
+        while (count < bits)
+        {
+            accumulator = accumulator << 8 | (position < in.size() ? in[position] : 0);
+            position++;
+            count += 8;
+        }
+    }
+
+    const std::vector<Uint8> &in;
+    size_t position = 0;
+    Uint64 accumulator = 0;
+    int count = 0;
+};
+
+static Uint32 zigzag(Sint32 value)
+{
+    return (Uint32)value << 1 ^ (Uint32)(value >> 31);
+}
+
+static Sint32 unzigzag(Uint32 value)
+{
+    return (Sint32)(value >> 1) ^ -(Sint32)(value & 1);
+}
+
+// One block of one channel as 16-bit integers. Float qualifies only if it
+// converts back bit for bit, so not with a negative zero, which would come
+// back positive.
+static bool readChannel(const Uint8 *pcm, size_t first, size_t count, int channels, Uint16 format, Sint32 *samples)
+{
+    if (format == AUDIO_S16SYS)
+    {
+        const Sint16 *source = (const Sint16 *)pcm + first;
+        for (size_t i = 0; i < count; i++)
+        {
+            samples[i] = source[i * channels];
+        }
+        return true;
+    }
+    if (format != AUDIO_F32SYS)
+    {
+        return false;
+    }
+    const float *source = (const float *)pcm + first;
+    for (size_t i = 0; i < count; i++)
+    {
+        float scaled = source[i * channels] * 32768.0f;
+        if (!(scaled >= -32768.0f && scaled <= 32767.0f) || (float)(Sint32)scaled != scaled ||
+            (scaled == 0.0f && std::signbit(scaled)))
+        {
+            return false;
+        }
+        samples[i] = (Sint32)scaled;
+    }
+    return true;
+}
+
+bool packPcm(const Uint8 *pcm, Uint32 bytes, Uint16 format, int channels, std::vector<Uint8> &packed)
+{
+    if (channels <= 0 || channels > MAX_CHANNELS)
+    {
+        return false;
+    }
+    size_t frames = bytes / (SDL_AUDIO_BITSIZE(format) / 8) / channels;
+
+    packed.clear();
+    packed.reserve(bytes / 2);
+    BitWriter writer(packed);
+    Sint32 history[MAX_CHANNELS][2] = {};
+    std::vector<Sint32> samples(BLOCK_FRAMES);
+    std::vector<Uint32> residuals(BLOCK_FRAMES);
+    for (size_t block = 0; block < frames; block += BLOCK_FRAMES)
+    {
+        size_t count = SDL_min((size_t)BLOCK_FRAMES, frames - block);
+        for (int channel = 0; channel < channels; channel++)
+        {
+            if (!readChannel(pcm, block * channels + channel, count, channels, format, samples.data()))
+            {
+                return false;
+            }
+            Uint64 sum = 0;
+            for (size_t i = 0; i < count; i++)
+            {
+                Sint32 prediction = 2 * history[channel][0] - history[channel][1];
+                history[channel][1] = history[channel][0];
+                history[channel][0] = samples[i];
+                residuals[i] = zigzag(samples[i] - prediction);
+                sum += residuals[i];
+            }
+
+            // The Rice parameter that fits the block's average residual
+            int k = 0;
+            while (k < RAW_BITS - 1 && ((Uint64)count << (k + 1)) < sum)
+            {
+                k++;
+            }
+            writer.put(k, 5);
+            for (size_t i = 0; i < count; i++)
+            {
+                Uint32 quotient = residuals[i] >> k;
+                if (quotient >= (Uint32)ESCAPE_QUOTIENT)
+                {
+                    writer.put((1u << ESCAPE_QUOTIENT) - 1, ESCAPE_QUOTIENT);
+                    writer.put(residuals[i], RAW_BITS);
+                    continue;
+                }
+                writer.put(((1u << quotient) - 1) << 1, quotient + 1);
+                writer.put(residuals[i] & ((1u << k) - 1), k);
+            }
+        }
+    }
+    writer.flush();
+
+    // Noise-like material barely shrinks, keeping it decoded is cheaper
+    return packed.size() < (size_t)bytes / 10 * 9;
+}
+
+bool unpackPcm(const std::vector<Uint8> &packed, Uint8 *pcm, Uint32 bytes, Uint16 format, int channels)
+{
+    if (channels <= 0 || channels > MAX_CHANNELS || (format != AUDIO_S16SYS && format != AUDIO_F32SYS))
+    {
+        return false;
+    }
+    size_t frames = bytes / (SDL_AUDIO_BITSIZE(format) / 8) / channels;
+
+    BitReader reader(packed);
+    Sint32 history[MAX_CHANNELS][2] = {};
+    for (size_t block = 0; block < frames; block += BLOCK_FRAMES)
+    {
+        size_t count = SDL_min((size_t)BLOCK_FRAMES, frames - block);
+        for (int channel = 0; channel < channels; channel++)
+        {
+            int k = (int)reader.get(5);
+            for (size_t i = 0; i < count; i++)
+            {
+                int quotient = reader.unary(ESCAPE_QUOTIENT);
+                Uint32 residual = quotient == ESCAPE_QUOTIENT ? reader.get(RAW_BITS) : (Uint32)quotient << k | reader.get(k);
+                Sint32 sample = unzigzag(residual) + 2 * history[channel][0] - history[channel][1];
+                history[channel][1] = history[channel][0];
+                history[channel][0] = sample;
+
+                size_t index = (block + i) * channels + channel;
+                if (format == AUDIO_S16SYS)
+                {
+                    ((Sint16 *)pcm)[index] = (Sint16)sample;
+                }
+                else
+                {
+                    ((float *)pcm)[index] = (float)sample / 32768.0f;
+                }
+            }
+        }
+    }
+    return !reader.overrun();
+}
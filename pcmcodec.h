@@ -0,0 +1,20 @@
+#ifndef PCMCODEC_H
+#define PCMCODEC_H
+
+#include <SDL2/SDL.h>
+#include <vector>
+
+// Lossless packing of decoded 16-bit audio for the track cache. Each block
+// of 4096 frames is predicted per channel with a second order fixed
+// predictor (like FLAC's) and the residuals are Rice coded with a
+// parameter chosen per block and channel. Float audio qualifies as long as
+// every sample is a 16-bit value scaled by 1/32768, which is what 16-bit
+// files decode to; anything else is left alone.
+
+// Returns false if the audio can not be packed or would not get smaller
+bool packPcm(const Uint8 *pcm, Uint32 bytes, Uint16 format, int channels, std::vector<Uint8> &packed);
+
+// pcm must hold the bytes that were packed, in the same format
+bool unpackPcm(const std::vector<Uint8> &packed, Uint8 *pcm, Uint32 bytes, Uint16 format, int channels);
+
+#endif
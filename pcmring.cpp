@@ -0,0 +1,134 @@
+#include "pcmring.h"
+
+#include <iostream>
+
+PcmRing::~PcmRing()
+{
+    destroy();
+}
+
+bool PcmRing::init(Uint32 capacityBytes)
+{
+    destroy();
+
+    size = 1;
+    while (size < capacityBytes)
+    {
+        size *= 2;
+    }
+
+    buffer = static_cast<Uint8 *>(SDL_malloc(size));
+    if (buffer == nullptr)
+    {
+        std::cout << "Failed to allocate PCM ring buffer of " << size << " bytes" << std::endl;
+        size = 0;
+        return false;
+    }
+
+    readIndex = 0;
+    writeIndex = 0;
+    flushIndex = 0;
+    flushGeneration = 0;
+    seenFlushGeneration = 0;
+    readTotal = 0;
+    resetStats();
+    return true;
+}
+
+void PcmRing::destroy()
+{
+    SDL_free(buffer);
+    buffer = nullptr;
+    size = 0;
+}
+
+Uint32 PcmRing::fill() const
+{
+    // Indices wrap at 2^32, which is a multiple of the power of two size
+    return writeIndex.load(std::memory_order_acquire) - readIndex.load(std::memory_order_acquire);
+}
+
+Uint32 PcmRing::write(const Uint8 *data, Uint32 len)
+{
+    Uint32 write = writeIndex.load(std::memory_order_relaxed);
+    Uint32 available = size - (write - readIndex.load(std::memory_order_acquire));
+    len = SDL_min(len, available);
+
+    Uint32 start = write & (size - 1);
+    Uint32 first = SDL_min(len, size - start);
+    SDL_memcpy(buffer + start, data, first);
+    SDL_memcpy(buffer, data + first, len - first);
+
+    writeIndex.store(write + len, std::memory_order_release);
+    return len;
+}
+
+void PcmRing::flush()
+{
+    flushIndex.store(writeIndex.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    flushGeneration.fetch_add(1, std::memory_order_release);
+}
+
+Uint32 PcmRing::read(Uint8 *dst, Uint32 len)
+{
+    Uint32 read = readIndex.load(std::memory_order_relaxed);
+    Uint32 firstRead = read;
+
+    Uint32 generation = flushGeneration.load(std::memory_order_acquire);
+    if (generation != seenFlushGeneration)
+    {
+        seenFlushGeneration = generation;
+        // Skip stale data, unless it was already played before the flush became visible
+        Uint32 target = flushIndex.load(std::memory_order_relaxed);
+        if ((Sint32)(target - read) > 0)
+        {
+            read = target;
+        }
+    }
+
+    Uint32 available = writeIndex.load(std::memory_order_acquire) - read;
+    if (available < minFill.load(std::memory_order_relaxed))
+    {
+        minFill.store(available, std::memory_order_relaxed);
+    }
+    readCount.fetch_add(1, std::memory_order_relaxed);
+    if (available < len)
+    {
+        underrunCount.fetch_add(1, std::memory_order_relaxed);
+        len = available;
+    }
+
+    Uint32 start = read & (size - 1);
+    Uint32 first = SDL_min(len, size - start);
+    SDL_memcpy(dst, buffer + start, first);
+    if (len > first)
+    {
+        SDL_memcpy(dst + first, buffer, len - first);
+    }
+
+    readIndex.store(read + len, std::memory_order_release);
+    readTotal += read + len - firstRead;
+    return len;
+}
+
+PcmRingStats PcmRing::stats() const
+{
+    PcmRingStats stats;
+    stats.capacityBytes = size;
+    stats.fillBytes = fill();
+    stats.minFillBytes = minFill.load(std::memory_order_relaxed);
+    stats.underruns = underrunCount.load(std::memory_order_relaxed);
+    stats.reads = readCount.load(std::memory_order_relaxed);
+    if (stats.minFillBytes > size)
+    {
+        stats.minFillBytes = stats.fillBytes; // Nothing was read yet
+    }
+    return stats;
+}
+
+void PcmRing::resetStats()
+{
+    minFill = 0xFFFFFFFF;
+    underrunCount = 0;
+    readCount = 0;
+}
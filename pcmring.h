@@ -0,0 +1,67 @@
+#ifndef PCMRING_H
+#define PCMRING_H
+
+#include <SDL2/SDL.h>
+#include <atomic>
+
+struct PcmRingStats
+{
+    Uint32 capacityBytes;
+    Uint32 fillBytes;    // Right now
+    Uint32 minFillBytes; // Lowest fill seen by the consumer since the last reset
+    Uint64 underruns;    // Reads that could not be satisfied completely
+    Uint64 reads;
+};
+
+// Lock-free single-producer/single-consumer ring of raw PCM bytes. The
+// decode thread writes, the audio callback reads. The producer can ask the
+// consumer to drop everything written so far (e.g. when the user starts
+// another track), which the consumer applies on its next read.
+class PcmRing
+{
+public:
+    PcmRing() = default;
+    ~PcmRing();
+
+    PcmRing(const PcmRing &) = delete;
+    PcmRing &operator=(const PcmRing &) = delete;
+
+    // Capacity is rounded up to a power of two
+    bool init(Uint32 capacityBytes);
+    void destroy();
+
+    Uint32 capacity() const { return size; }
+    Uint32 fill() const;
+    Uint32 space() const { return size - fill(); }
+
+    // Producer side
+    Uint32 write(const Uint8 *data, Uint32 len);
+    void flush();
+
+    // Consumer side. Copies up to len bytes into dst and leaves the rest of
+    // it untouched, so dst should already contain silence. Returns the number
+    // of bytes read.
+    Uint32 read(Uint8 *dst, Uint32 len);
+    // Bytes consumed since init, including those skipped by a flush
+    Uint64 readOffset() const { return readTotal; }
+
+    PcmRingStats stats() const;
+    Uint64 underruns() const { return underrunCount.load(std::memory_order_relaxed); }
+    void resetStats();
+
+private:
+    Uint8 *buffer = nullptr;
+    Uint32 size = 0;
+    std::atomic<Uint32> readIndex{0};  // Only written by the consumer
+    std::atomic<Uint32> writeIndex{0}; // Only written by the producer
+    std::atomic<Uint32> flushIndex{0};
+    std::atomic<Uint32> flushGeneration{0};
+    Uint32 seenFlushGeneration = 0;
+    Uint64 readTotal = 0; // Only touched by the consumer
+
+    std::atomic<Uint32> minFill{0xFFFFFFFF};
+    std::atomic<Uint64> underrunCount{0};
+    std::atomic<Uint64> readCount{0};
+};
+
+#endif
@@ -0,0 +1,116 @@
+#include "playbackclock.h"
+
+void PlaybackClock::reset(int frequency)
+{
+    ticksPerFrame = frequency > 0 ? (double)SDL_GetPerformanceFrequency() / frequency : 0.0;
+
+    for (Period &period : periods)
+    {
+        period.counter = 0;
+        period.streamFrame = 0;
+        period.frames = 0;
+        period.latency = 0;
+    }
+    sequence = 0;
+    restartRate();
+}
+
+void PlaybackClock::restartRate()
+{
+    firstCounter = 0;
+    lastCounter = 0;
+    deviceFrameCount = 0;
+}
+
+void PlaybackClock::advance(Uint64 streamFrame, int contentFrames, int deviceFrames)
+{
+    Uint64 now = SDL_GetPerformanceCounter();
+
+    // Seqlock: readers retry while the sequence is odd or changed under them
+    Uint32 s = sequence.load(std::memory_order_relaxed);
+    sequence.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    // The device plays out the buffer it already holds before this one
+    Period &period = periods[(s / 2) % HISTORY];
+    period.counter.store(now, std::memory_order_relaxed);
+    period.streamFrame.store(streamFrame, std::memory_order_relaxed);
+    period.frames.store(contentFrames, std::memory_order_relaxed);
+    period.latency.store(deviceFrames + extraLatency.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+    sequence.store(s + 2, std::memory_order_release);
+
+    if (firstCounter.load(std::memory_order_relaxed) == 0)
+    {
+        firstCounter.store(now, std::memory_order_relaxed);
+    }
+    else
+    {
+        deviceFrameCount.fetch_add(deviceFrames, std::memory_order_relaxed);
+    }
+    lastCounter.store(now, std::memory_order_relaxed);
+}
+
+double PlaybackClock::audibleFrame() const
+{
+    Uint64 counter[HISTORY];
+    Uint64 streamFrame[HISTORY];
+    Uint32 frames[HISTORY];
+    Uint32 latency[HISTORY];
+    Uint32 published;
+
+    for (;;)
+    {
+        Uint32 s = sequence.load(std::memory_order_acquire);
+        if ((s & 1) == 0)
+        {
+            for (int i = 0; i < HISTORY; i++)
+            {
+                counter[i] = periods[i].counter.load(std::memory_order_relaxed);
+                streamFrame[i] = periods[i].streamFrame.load(std::memory_order_relaxed);
+                frames[i] = periods[i].frames.load(std::memory_order_relaxed);
+                latency[i] = periods[i].latency.load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (sequence.load(std::memory_order_relaxed) == s)
+            {
+                published = s / 2;
+                break;
+            }
+        }
+        SDL_CPUPauseInstruction();
+    }
+
+    if (published == 0 || ticksPerFrame <= 0.0)
+    {
+        return 0.0;
+    }
+
+    // Newest period whose first frame has reached the speakers
+    Uint64 now = SDL_GetPerformanceCounter();
+    Uint32 available = SDL_min(published, (Uint32)HISTORY);
+    int oldest = (published - available) % HISTORY;
+    for (Uint32 age = 1; age <= available; age++)
+    {
+        int i = (published - age) % HISTORY;
+        double audibleAt = counter[i] + latency[i] * ticksPerFrame;
+        if ((double)now >= audibleAt)
+        {
+            double played = ((double)now - audibleAt) / ticksPerFrame;
+            return streamFrame[i] + SDL_min(played, (double)frames[i]);
+        }
+    }
+    return (double)streamFrame[oldest];
+}
+
+double PlaybackClock::measuredRate() const
+{
+    Uint64 first = firstCounter.load(std::memory_order_relaxed);
+    Uint64 last = lastCounter.load(std::memory_order_relaxed);
+    Uint64 ticksPerSecond = SDL_GetPerformanceFrequency();
+    if (first == 0 || last - first < ticksPerSecond)
+    {
+        return 0.0;
+    }
+    return (double)deviceFrameCount.load(std::memory_order_relaxed) * ticksPerSecond / (last - first);
+}
@@ -0,0 +1,58 @@
+#ifndef PLAYBACKCLOCK_H
+#define PLAYBACKCLOCK_H
+
+#include <SDL2/SDL.h>
+#include <atomic>
+
+// Tracks which frame of the engine's output stream is audible right now.
+// The audio thread reports every device period from the post-mix hook: the
+// stream position of the first frame it delivered and how many frames of
+// content it delivered (0 while paused). A period written at time T starts
+// playing once the device has played out what it already holds, so readers
+// pick the newest period that is audible by now and interpolate inside it
+// with SDL_GetPerformanceCounter. Reading is lock-free and never waits for
+// the audio thread, so the UI can ask for the position on every frame.
+class PlaybackClock
+{
+public:
+    void reset(int frequency);
+
+    // Audio thread, once per device callback
+    void advance(Uint64 streamFrame, int contentFrames, int deviceFrames);
+
+    // Latency added after the post-mix hook (e.g. by look-ahead processing)
+    void setExtraLatency(int frames) { extraLatency.store(frames, std::memory_order_relaxed); }
+
+    // Any thread. Stream frame that is leaving the speakers, with fractions.
+    double audibleFrame() const;
+
+    // Starts a new rate measurement, e.g. after the device was reopened
+    void restartRate();
+
+    // Device rate measured from the frames handed over since the last reset
+    // against the performance counter, 0 until enough time has passed
+    double measuredRate() const;
+
+private:
+    static const int HISTORY = 4; // Periods kept, covers a few buffers of output latency
+
+    struct Period
+    {
+        std::atomic<Uint64> counter{0};
+        std::atomic<Uint64> streamFrame{0};
+        std::atomic<Uint32> frames{0};
+        std::atomic<Uint32> latency{0};
+    };
+
+    double ticksPerFrame = 0.0;
+    Period periods[HISTORY];
+    std::atomic<Uint32> sequence{0}; // Odd while the audio thread is writing
+    std::atomic<int> extraLatency{0};
+
+    // Rate measurement
+    std::atomic<Uint64> firstCounter{0};
+    std::atomic<Uint64> lastCounter{0};
+    std::atomic<Uint64> deviceFrameCount{0}; // Frames after the first callback
+};
+
+#endif
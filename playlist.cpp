@@ -0,0 +1,742 @@
+#include "playlist.h"
+
+#include <cstring>
+#include <iostream>
+#include <queue>
+
+const Uint32 MAX_CHUNKS = 65535; // Keeps every handle below PathArena::INVALID
+
+static Uint32 hashPath(const char *path, size_t length)
+{
+    // FNV-1a
+    Uint32 hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ (Uint8)path[i]) * 16777619u;
+    }
+    return hash;
+}
+
+Uint32 PathArena::intern(const char *path, size_t length)
+{
+    if (length >= CHUNK_SIZE)
+    {
+        return INVALID;
+    }
+    if ((stored + 1) * 4 > (Uint32)table.size() * 3)
+    {
+        growTable();
+    }
+
+    Uint32 mask = (Uint32)table.size() - 1;
+    for (Uint32 i = hashPath(path, length) & mask;; i = (i + 1) & mask)
+    {
+        if (table[i] == 0)
+        {
+            Uint32 handle = store(path, length);
+            if (handle != INVALID)
+            {
+                table[i] = handle + 1;
+                stored++;
+            }
+            return handle;
+        }
+        const char *candidate = get(table[i] - 1);
+        if (std::memcmp(candidate, path, length) == 0 && candidate[length] == '\0')
+        {
+            return table[i] - 1;
+        }
+    }
+}
+
+Uint32 PathArena::store(const char *path, size_t length)
+{
+    if (chunkUsed + length + 1 > CHUNK_SIZE)
+    {
+        if (chunks.size() == MAX_CHUNKS)
+        {
+            return INVALID;
+        }
+        chunks.emplace_back(new char[CHUNK_SIZE]);
+        chunkUsed = 0;
+    }
+    Uint32 handle = (Uint32)(chunks.size() - 1) << CHUNK_BITS | chunkUsed;
+    char *destination = chunks.back().get() + chunkUsed;
+    std::memcpy(destination, path, length);
+    destination[length] = '\0';
+    chunkUsed += (Uint32)length + 1;
+    return handle;
+}
+
+void PathArena::growTable()
+{
+    std::vector<Uint32> old;
+    old.swap(table);
+    table.assign(old.empty() ? 64 : old.size() * 2, 0);
+    Uint32 mask = (Uint32)table.size() - 1;
+    for (Uint32 entry : old)
+    {
+        if (entry != 0)
+        {
+            const char *path = get(entry - 1);
+            Uint32 i = hashPath(path, std::strlen(path)) & mask;
+            while (table[i] != 0)
+            {
+                i = (i + 1) & mask;
+            }
+            table[i] = entry;
+        }
+    }
+}
+
+const char *PathArena::get(Uint32 handle) const
+{
+    return chunks[handle >> CHUNK_BITS].get() + (handle & (CHUNK_SIZE - 1));
+}
+
+void PathArena::clear()
+{
+    chunks.clear();
+    chunks.shrink_to_fit();
+    chunkUsed = CHUNK_SIZE;
+    table.clear();
+    table.shrink_to_fit();
+    stored = 0;
+}
+
+size_t PathArena::memoryBytes() const
+{
+    return chunks.capacity() * sizeof(chunks[0]) + chunks.size() * CHUNK_SIZE + table.capacity() * sizeof(Uint32);
+}
+
+Uint32 Playlist::priority(Uint32 slot)
+{
+    // Murmur3's finalizer: slots are handed out in order, the priorities
+    // must look random
+    slot ^= slot >> 16;
+    slot *= 0x85EBCA6Bu;
+    slot ^= slot >> 13;
+    slot *= 0xC2B2AE35u;
+    slot ^= slot >> 16;
+    return slot;
+}
+
+Uint32 Playlist::slotOf(PlaylistId id) const
+{
+    Uint32 slot = (Uint32)id;
+    if (slot == 0 || slot >= nodes.size() || nodes[slot].size == 0 || generations[slot] != id >> 32)
+    {
+        return 0;
+    }
+    return slot;
+}
+
+Uint32 Playlist::allocate(Uint32 folder, Uint32 name)
+{
+    Uint32 slot = freeSlots;
+    if (slot != 0)
+    {
+        freeSlots = nodes[slot].parent;
+    }
+    else
+    {
+        if (nodes.size() > PLAYLIST_MAX_ENTRIES)
+        {
+            return 0;
+        }
+        slot = (Uint32)nodes.size();
+        nodes.push_back(Node{0, 0, 0, 0, 0, 0});
+        generations.push_back(0);
+    }
+    nodes[slot] = Node{0, 0, 0, 1, folder, name};
+    return slot;
+}
+
+PlaylistId Playlist::insert(const std::string &path, Uint32 position)
+{
+    size_t separator = path.find_last_of("/\\");
+    size_t split = separator == std::string::npos ? 0 : separator + 1;
+    Uint32 folder = strings.intern(path.c_str(), split);
+    Uint32 name = strings.intern(path.c_str() + split, path.size() - split);
+    if (folder == PathArena::INVALID || name == PathArena::INVALID)
+    {
+        return 0;
+    }
+    Uint32 slot = allocate(folder, name);
+    if (slot == 0)
+    {
+        return 0;
+    }
+    link(slot, SDL_min(position, size()));
+    return idOf(slot);
+}
+
+bool Playlist::remove(PlaylistId id)
+{
+    Uint32 slot = slotOf(id);
+    if (slot == 0)
+    {
+        return false;
+    }
+    unlink(slot);
+    nodes[slot] = Node{0, 0, freeSlots, 0, 0, 0};
+    generations[slot]++;
+    freeSlots = slot;
+    return true;
+}
+
+bool Playlist::move(PlaylistId id, Uint32 position)
+{
+    Uint32 slot = slotOf(id);
+    if (slot == 0)
+    {
+        return false;
+    }
+    unlink(slot);
+    nodes[slot] = Node{0, 0, 0, 1, nodes[slot].folder, nodes[slot].name};
+    link(slot, SDL_min(position, size()));
+    return true;
+}
+
+void Playlist::clear()
+{
+    nodes.assign(1, Node{0, 0, 0, 0, 0, 0});
+    nodes.shrink_to_fit();
+    generations.assign(1, 0);
+    generations.shrink_to_fit();
+    root = 0;
+    freeSlots = 0;
+    strings.clear();
+}
+
+void Playlist::replaceChild(Uint32 parent, Uint32 oldChild, Uint32 newChild)
+{
+    if (parent == 0)
+    {
+        root = newChild;
+    }
+    else if (nodes[parent].left == oldChild)
+    {
+        nodes[parent].left = newChild;
+    }
+    else
+    {
+        nodes[parent].right = newChild;
+    }
+    if (newChild != 0)
+    {
+        nodes[newChild].parent = parent;
+    }
+}
+
+void Playlist::rotateUp(Uint32 slot)
+{
+    Uint32 parent = nodes[slot].parent;
+    Uint32 grandparent = nodes[parent].parent;
+    if (nodes[parent].left == slot)
+    {
+        Uint32 inner = nodes[slot].right;
+        nodes[parent].left = inner;
+        nodes[slot].right = parent;
+        if (inner != 0)
+        {
+            nodes[inner].parent = parent;
+        }
+    }
+    else
+    {
+        Uint32 inner = nodes[slot].left;
+        nodes[parent].right = inner;
+        nodes[slot].left = parent;
+        if (inner != 0)
+        {
+            nodes[inner].parent = parent;
+        }
+    }
+    nodes[parent].parent = slot;
+    replaceChild(grandparent, parent, slot);
+    updateSize(parent);
+    updateSize(slot);
+}
+
+void Playlist::link(Uint32 slot, Uint32 position)
+{
+    if (root == 0)
+    {
+        root = slot;
+        nodes[slot].parent = 0;
+        return;
+    }
+
+    // Down to the leaf that becomes the new entry's parent, counting it in
+    // every subtree on the way
+    Uint32 current = root;
+    while (true)
+    {
+        nodes[current].size++;
+        Uint32 leftSize = nodes[nodes[current].left].size;
+        if (position <= leftSize)
+        {
+            if (nodes[current].left == 0)
+            {
+                nodes[current].left = slot;
+                break;
+            }
+            current = nodes[current].left;
+        }
+        else
+        {
+            position -= leftSize + 1;
+            if (nodes[current].right == 0)
+            {
+                nodes[current].right = slot;
+                break;
+            }
+            current = nodes[current].right;
+        }
+    }
+    nodes[slot].parent = current;
+
+    // Then up again until the priorities are in heap order
+    while (nodes[slot].parent != 0 && priority(slot) > priority(nodes[slot].parent))
+    {
+        rotateUp(slot);
+    }
+}
+
+void Playlist::unlink(Uint32 slot)
+{
+    // Rotated down until it has at most one child, which takes its place
+    while (nodes[slot].left != 0 && nodes[slot].right != 0)
+    {
+        Uint32 left = nodes[slot].left;
+        Uint32 right = nodes[slot].right;
+        rotateUp(priority(left) > priority(right) ? left : right);
+    }
+    Uint32 child = nodes[slot].left != 0 ? nodes[slot].left : nodes[slot].right;
+    Uint32 parent = nodes[slot].parent;
+    replaceChild(parent, slot, child);
+    for (Uint32 ancestor = parent; ancestor != 0; ancestor = nodes[ancestor].parent)
+    {
+        nodes[ancestor].size--;
+    }
+}
+
+std::string Playlist::path(PlaylistId id) const
+{
+    Uint32 slot = slotOf(id);
+    if (slot == 0)
+    {
+        return std::string();
+    }
+    return std::string(strings.get(nodes[slot].folder)) + strings.get(nodes[slot].name);
+}
+
+PlaylistId Playlist::front() const
+{
+    Uint32 slot = root;
+    while (slot != 0 && nodes[slot].left != 0)
+    {
+        slot = nodes[slot].left;
+    }
+    return slot != 0 ? idOf(slot) : 0;
+}
+
+PlaylistId Playlist::back() const
+{
+    Uint32 slot = root;
+    while (slot != 0 && nodes[slot].right != 0)
+    {
+        slot = nodes[slot].right;
+    }
+    return slot != 0 ? idOf(slot) : 0;
+}
+
+PlaylistId Playlist::at(Uint32 position) const
+{
+    if (position >= size())
+    {
+        return 0;
+    }
+    Uint32 slot = root;
+    while (true)
+    {
+        Uint32 leftSize = nodes[nodes[slot].left].size;
+        if (position == leftSize)
+        {
+            return idOf(slot);
+        }
+        if (position < leftSize)
+        {
+            slot = nodes[slot].left;
+        }
+        else
+        {
+            position -= leftSize + 1;
+            slot = nodes[slot].right;
+        }
+    }
+}
+
+PlaylistId Playlist::next(PlaylistId id) const
+{
+    Uint32 slot = slotOf(id);
+    if (slot == 0)
+    {
+        return 0;
+    }
+    if (nodes[slot].right != 0)
+    {
+        slot = nodes[slot].right;
+        while (nodes[slot].left != 0)
+        {
+            slot = nodes[slot].left;
+        }
+        return idOf(slot);
+    }
+    Uint32 parent = nodes[slot].parent;
+    while (parent != 0 && nodes[parent].right == slot)
+    {
+        slot = parent;
+        parent = nodes[slot].parent;
+    }
+    return parent != 0 ? idOf(parent) : 0;
+}
+
+PlaylistId Playlist::previous(PlaylistId id) const
+{
+    Uint32 slot = slotOf(id);
+    if (slot == 0)
+    {
+        return 0;
+    }
+    if (nodes[slot].left != 0)
+    {
+        slot = nodes[slot].left;
+        while (nodes[slot].right != 0)
+        {
+            slot = nodes[slot].right;
+        }
+        return idOf(slot);
+    }
+    Uint32 parent = nodes[slot].parent;
+    while (parent != 0 && nodes[parent].left == slot)
+    {
+        slot = parent;
+        parent = nodes[slot].parent;
+    }
+    return parent != 0 ? idOf(parent) : 0;
+}
+
+Uint32 Playlist::positionOf(PlaylistId id) const
+{
+    Uint32 slot = slotOf(id);
+    if (slot == 0)
+    {
+        return size();
+    }
+    Uint32 position = nodes[nodes[slot].left].size;
+    for (Uint32 parent = nodes[slot].parent; parent != 0; slot = parent, parent = nodes[slot].parent)
+    {
+        if (nodes[parent].right == slot)
+        {
+            position += nodes[nodes[parent].left].size + 1;
+        }
+    }
+    return position;
+}
+
+std::string Playlist::takeFront()
+{
+    PlaylistId id = front();
+    if (id == 0)
+    {
+        return std::string();
+    }
+    std::string result = path(id);
+    remove(id);
+    return result;
+}
+
+void Playlist::shuffle(Uint64 seed)
+{
+    Uint32 count = size();
+    if (count < 2)
+    {
+        return;
+    }
+
+    std::vector<Uint32> order;
+    order.reserve(count);
+    for (PlaylistId id = front(); id != 0; id = next(id))
+    {
+        order.push_back((Uint32)id);
+    }
+
+    // Fisher-Yates with xorshift64*
+    Uint64 state = seed != 0 ? seed : 0x9E3779B97F4A7C15ull;
+    for (Uint32 i = count - 1; i > 0; i--)
+    {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        Uint32 j = (Uint32)(((state * 0x2545F4914F6CDD1Dull) >> 32) % (i + 1));
+        std::swap(order[i], order[j]);
+    }
+
+    // The new tree in one pass: the priorities are fixed per slot, so it is
+    // the Cartesian tree of the sequence. The stack holds the right spine.
+    // A node's subtree covers the positions from just after the nearest
+    // higher priority before it to just before the nearest one after it.
+    std::vector<Uint32> spine;
+    std::vector<Uint32> firstPosition(count);
+    for (Uint32 i = 0; i < count; i++)
+    {
+        Uint32 slot = order[i];
+        nodes[slot].left = 0;
+        nodes[slot].right = 0;
+        Uint32 last = 0;
+        while (!spine.empty() && priority(order[spine.back()]) < priority(slot))
+        {
+            Uint32 popped = order[spine.back()];
+            nodes[popped].size = i - firstPosition[spine.back()];
+            last = popped;
+            spine.pop_back();
+        }
+        nodes[slot].left = last;
+        if (last != 0)
+        {
+            nodes[last].parent = slot;
+        }
+        firstPosition[i] = spine.empty() ? 0 : spine.back() + 1;
+        if (!spine.empty())
+        {
+            nodes[order[spine.back()]].right = slot;
+        }
+        nodes[slot].parent = spine.empty() ? 0 : order[spine.back()];
+        spine.push_back(i);
+    }
+    for (Uint32 index : spine)
+    {
+        nodes[order[index]].size = count - firstPosition[index];
+    }
+    root = order[spine.front()];
+}
+
+bool Playlist::validate(std::string &problem) const
+{
+    if (nodes[0].size != 0 || nodes[0].left != 0 || nodes[0].right != 0)
+    {
+        problem = "the empty tree was written to";
+        return false;
+    }
+    if (root != 0 && nodes[root].parent != 0)
+    {
+        problem = "the root has a parent";
+        return false;
+    }
+
+    // Depth first without recursion, the tree is only balanced on average
+    std::vector<Uint32> pending;
+    std::vector<bool> reached(nodes.size(), false);
+    Uint32 live = 0;
+    if (root != 0)
+    {
+        pending.push_back(root);
+    }
+    while (!pending.empty())
+    {
+        Uint32 slot = pending.back();
+        pending.pop_back();
+        if (slot >= nodes.size() || reached[slot])
+        {
+            problem = "slot " + std::to_string(slot) + " is reached twice or does not exist";
+            return false;
+        }
+        reached[slot] = true;
+        live++;
+        const Node &node = nodes[slot];
+        if (node.size != nodes[node.left].size + nodes[node.right].size + 1)
+        {
+            problem = "slot " + std::to_string(slot) + " has size " + std::to_string(node.size) + ", its children add up to " +
+                      std::to_string(nodes[node.left].size + nodes[node.right].size + 1);
+            return false;
+        }
+        for (Uint32 child : {node.left, node.right})
+        {
+            if (child == 0)
+            {
+                continue;
+            }
+            if (child >= nodes.size() || nodes[child].parent != slot)
+            {
+                problem = "slot " + std::to_string(child) + " does not link back to its parent " + std::to_string(slot);
+                return false;
+            }
+            if (priority(child) > priority(slot))
+            {
+                problem = "slot " + std::to_string(child) + " outranks its parent " + std::to_string(slot);
+                return false;
+            }
+            pending.push_back(child);
+        }
+    }
+    if (live != size())
+    {
+        problem = std::to_string(live) + " entries in the tree, the root counts " + std::to_string(size());
+        return false;
+    }
+
+    Uint32 free = 0;
+    for (Uint32 slot = freeSlots; slot != 0; slot = nodes[slot].parent)
+    {
+        if (slot >= nodes.size() || reached[slot] || nodes[slot].size != 0)
+        {
+            problem = "free slot " + std::to_string(slot) + " is in use or listed twice";
+            return false;
+        }
+        reached[slot] = true;
+        free++;
+    }
+    if (live + free + 1 != nodes.size())
+    {
+        problem = std::to_string(nodes.size() - 1 - live - free) + " slots are neither in the tree nor free";
+        return false;
+    }
+    return true;
+}
+
+size_t Playlist::memoryBytes() const
+{
+    return nodes.capacity() * sizeof(Node) + generations.capacity() * sizeof(Uint32) + strings.memoryBytes();
+}
+
+void benchmarkPlaylist()
+{
+    const Uint32 entries = 1000000;
+    const Uint32 operations = 100000;
+
+    // Paths shaped like a real library: shared folders, distinct file names
+    std::vector<std::string> files;
+    files.reserve(entries);
+    for (Uint32 i = 0; i < entries; i++)
+    {
+        files.push_back("/home/user/Music/Artist " + std::to_string(i / 1000) + "/Album " + std::to_string(i / 10 % 100) +
+                        "/" + std::to_string(i % 10 + 1) + " - Track " + std::to_string(i) + ".flac");
+    }
+    size_t pathBytes = 0;
+    for (const std::string &file : files)
+    {
+        pathBytes += file.size();
+    }
+
+    auto seconds = [](Uint64 begin) { return (double)(SDL_GetPerformanceCounter() - begin) / SDL_GetPerformanceFrequency(); };
+    auto perOperation = [](double elapsed, Uint32 count) { return elapsed * 1e9 / count; };
+    Uint64 state = 0x2545F4914F6CDD1Dull;
+    auto random = [&state](Uint32 range) {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return (Uint32)(((state * 0x2545F4914F6CDD1Dull) >> 32) % range);
+    };
+
+    // The old queue: one heap string per entry unless it fits the small
+    // string buffer, in deque blocks. Heap blocks are counted with a typical
+    // 16 byte allocator overhead.
+    Uint64 begin = SDL_GetPerformanceCounter();
+    size_t queueBytes = 0;
+    double queueAppend = 0.0;
+    {
+        std::queue<std::string> queue;
+        for (const std::string &file : files)
+        {
+            queue.push(file);
+        }
+        queueAppend = seconds(begin);
+        queueBytes = (size_t)entries * sizeof(std::string) + entries / 16 * 8;
+        for (const std::string &file : files)
+        {
+            queueBytes += file.capacity() > 15 ? (file.capacity() + 1 + 16 + 15) / 16 * 16 : 0;
+        }
+    }
+
+    Playlist playlist;
+    begin = SDL_GetPerformanceCounter();
+    std::vector<PlaylistId> ids;
+    ids.reserve(entries);
+    for (const std::string &file : files)
+    {
+        ids.push_back(playlist.append(file));
+    }
+    double append = seconds(begin);
+    size_t playlistBytes = playlist.memoryBytes();
+
+    // Re-adding the same files stores no paths
+    begin = SDL_GetPerformanceCounter();
+    for (Uint32 i = 0; i < operations; i++)
+    {
+        playlist.append(files[random(entries)]);
+    }
+    double appendDuplicate = seconds(begin);
+
+    begin = SDL_GetPerformanceCounter();
+    size_t checksum = 0;
+    for (Uint32 i = 0; i < operations; i++)
+    {
+        checksum += playlist.at(random(playlist.size()));
+    }
+    double lookup = seconds(begin);
+
+    begin = SDL_GetPerformanceCounter();
+    for (Uint32 i = 0; i < operations; i++)
+    {
+        checksum += playlist.positionOf(ids[random(entries)]);
+    }
+    double position = seconds(begin);
+
+    begin = SDL_GetPerformanceCounter();
+    for (Uint32 i = 0; i < operations; i++)
+    {
+        playlist.move(ids[random(entries)], random(playlist.size()));
+    }
+    double move = seconds(begin);
+
+    begin = SDL_GetPerformanceCounter();
+    Uint32 walked = 0;
+    for (PlaylistId id = playlist.front(); id != 0; id = playlist.next(id))
+    {
+        walked++;
+    }
+    double walk = seconds(begin);
+
+    begin = SDL_GetPerformanceCounter();
+    playlist.shuffle(12345);
+    double shuffle = seconds(begin);
+
+    begin = SDL_GetPerformanceCounter();
+    Uint32 removed = 0;
+    for (Uint32 i = 0; i < operations; i++)
+    {
+        removed += playlist.remove(ids[random(entries)]) ? 1 : 0;
+    }
+    double remove = seconds(begin);
+
+    begin = SDL_GetPerformanceCounter();
+    for (Uint32 i = 0; i < operations; i++)
+    {
+        checksum += playlist.takeFront().size();
+    }
+    double take = seconds(begin);
+
+    std::cout << "Playlist of " << entries << " entries, " << pathBytes / entries << " bytes per path on average" << std::endl;
+    std::cout << "  memory: " << playlistBytes / (1024 * 1024) << " MiB (" << playlistBytes / entries << " bytes per entry), std::queue<std::string> about "
+              << queueBytes / (1024 * 1024) << " MiB (" << queueBytes / entries << " bytes per entry)" << std::endl;
+    std::cout << "  append: " << perOperation(append, entries) << " ns, std::queue " << perOperation(queueAppend, entries) << " ns; duplicate path "
+              << perOperation(appendDuplicate, operations) << " ns" << std::endl;
+    std::cout << "  at(position): " << perOperation(lookup, operations) << " ns, positionOf: " << perOperation(position, operations)
+              << " ns, move: " << perOperation(move, operations) << " ns" << std::endl;
+    std::cout << "  next: " << perOperation(walk, walked) << " ns, shuffle: " << shuffle * 1000.0 << " ms, remove: "
+              << perOperation(remove, removed) << " ns, takeFront: " << perOperation(take, operations) << " ns" << std::endl;
+    std::cout << "  " << playlist.size() << " entries left, " << playlist.uniqueStrings() << " unique folders and names (checksum " << checksum % 1000 << ")"
+              << std::endl;
+}
@@ -0,0 +1,137 @@
+#ifndef PLAYLIST_H
+#define PLAYLIST_H
+
+#include <SDL2/SDL.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Identifies a playlist entry for as long as it is in the playlist, however
+// it is moved around. 0 is never a valid id. The slot is in the low 32 bits
+// and its generation in the high ones.
+typedef Uint64 PlaylistId;
+
+// Slots are 32 bits and slot 0 is the empty tree, and the slot count,
+// including that one, has to fit a Uint32 as well. Memory runs out long
+// before, at 28 bytes an entry.
+const Uint32 PLAYLIST_MAX_ENTRIES = SDL_MAX_UINT32 - 1;
+
+// Append-only storage for paths. Every distinct path is stored once, NUL
+// terminated, in 64 KiB chunks that never move, so the pointers handed out
+// stay valid until clear(). Handles are 32 bits: chunk index and offset.
+class PathArena
+{
+public:
+    static const Uint32 INVALID = 0xFFFFFFFF;
+
+    // The handle of path, storing it if it is new. INVALID for paths of
+    // 64 KiB or more and once all 65536 chunks are used.
+    Uint32 intern(const char *path, size_t length);
+    const char *get(Uint32 handle) const;
+    void clear();
+
+    Uint32 count() const { return stored; }
+    size_t memoryBytes() const;
+
+private:
+    static const int CHUNK_BITS = 16;
+    static const Uint32 CHUNK_SIZE = 1u << CHUNK_BITS;
+
+    Uint32 store(const char *path, size_t length);
+    void growTable();
+
+    std::vector<std::unique_ptr<char[]>> chunks;
+    Uint32 chunkUsed = CHUNK_SIZE; // Bytes used in the last chunk
+    std::vector<Uint32> table;     // Open addressing, handle + 1, 0 is empty
+    Uint32 stored = 0;
+};
+
+// The play queue: an ordered list of paths, where each entry has a stable
+// id. Paths are split into folder and file name, each interned, so a folder
+// is stored once however many of its files are queued. Entries live in
+// flat arrays indexed by slot, and the order is an
+// implicit treap over them (a binary tree kept balanced by pseudo-random
+// priorities, with subtree sizes for positions), so
+//   append, insert, remove, move     O(log n) expected, O(1) rotations
+//   front, at(position), positionOf  O(log n)
+//   next, previous                   O(1) amortized
+//   shuffle                          O(n), rebuilds the tree in one pass
+// An entry costs 28 bytes plus its file name, and names and folders are
+// only freed by clear(). Freed slots are reused, with a 32-bit generation
+// count in the id so stale ids are recognized; a slot would have to be
+// freed four billion times before an old id matched again.
+class Playlist
+{
+public:
+    bool empty() const { return size() == 0; }
+    Uint32 size() const { return nodes[root].size; }
+
+    // 0 if the playlist is full or the path is too long
+    PlaylistId append(const std::string &path) { return insert(path, size()); }
+    PlaylistId insert(const std::string &path, Uint32 position);
+    bool remove(PlaylistId id);
+    // Moves the entry so it ends up at position, clamped to the last one
+    bool move(PlaylistId id, Uint32 position);
+    void clear();
+
+    bool contains(PlaylistId id) const { return slotOf(id) != 0; }
+    // "" for ids not in the playlist
+    std::string path(PlaylistId id) const;
+    // 0 past either end
+    PlaylistId front() const;
+    PlaylistId back() const;
+    PlaylistId at(Uint32 position) const;
+    PlaylistId next(PlaylistId id) const;
+    PlaylistId previous(PlaylistId id) const;
+    // size() for ids not in the playlist
+    Uint32 positionOf(PlaylistId id) const;
+
+    // Removes the first entry and returns its path, "" if empty
+    std::string takeFront();
+
+    // Puts the entries in a random order given by seed. Ids stay the same.
+    void shuffle(Uint64 seed);
+
+    // Walks the whole tree for the tests: subtree sizes, parent links, heap
+    // order of the priorities and the free list. False with the first
+    // problem found in problem.
+    bool validate(std::string &problem) const;
+
+    size_t memoryBytes() const;
+    // Distinct folders and file names stored
+    Uint32 uniqueStrings() const { return strings.count(); }
+
+private:
+    struct Node
+    {
+        Uint32 left;
+        Uint32 right;
+        Uint32 parent; // Next free slot while the slot is free
+        Uint32 size;   // Entries in the subtree, 0 for free slots
+        Uint32 folder; // Including the trailing separator, if any
+        Uint32 name;
+    };
+
+    static Uint32 priority(Uint32 slot);
+    PlaylistId idOf(Uint32 slot) const { return slot | (PlaylistId)generations[slot] << 32; }
+    Uint32 slotOf(PlaylistId id) const;
+    Uint32 allocate(Uint32 folder, Uint32 name);
+    void link(Uint32 slot, Uint32 position);
+    void unlink(Uint32 slot);
+    void rotateUp(Uint32 slot);
+    void replaceChild(Uint32 parent, Uint32 oldChild, Uint32 newChild);
+    void updateSize(Uint32 slot) { nodes[slot].size = nodes[nodes[slot].left].size + nodes[nodes[slot].right].size + 1; }
+
+    // Slot 0 is the empty tree: every missing child points there
+    std::vector<Node> nodes = std::vector<Node>(1, Node{0, 0, 0, 0, 0, 0});
+    std::vector<Uint32> generations = std::vector<Uint32>(1, 0);
+    Uint32 root = 0;
+    Uint32 freeSlots = 0;
+    PathArena strings;
+};
+
+// Fills a playlist with a million entries and times each operation against
+// a std::queue<std::string>, and prints the memory both take
+void benchmarkPlaylist();
+
+#endif
@@ -0,0 +1,698 @@
+#include "realtime.h"
+
+#include <atomic>
+#include <iostream>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#endif
+
+static RealtimeOptions realtimeOptions = {true, -1, false};
+static std::atomic<SDL_threadID> audioThread{0};
+static std::atomic<Uint32> audioThreadCount{0};
+static std::atomic<bool> audioThreadPromoted{false};
+static std::atomic<bool> audioThreadPinned{false};
+static bool memoryLocked = false;
+
+void configureRealtime(const RealtimeOptions &options)
+{
+    realtimeOptions = options;
+    if (options.realtime)
+    {
+        // SDL then maps its time critical priority to SCHED_RR, through rtkit
+        // when the user may not set it directly
+        SDL_SetHint(SDL_HINT_THREAD_FORCE_REALTIME_TIME_CRITICAL, "1");
+    }
+}
+
+static bool promoteCurrentThread()
+{
+    if (SDL_SetThreadPriority(SDL_THREAD_PRIORITY_TIME_CRITICAL) != 0)
+    {
+        return false;
+    }
+#if defined(_WIN32)
+    if (realtimeOptions.realtime)
+    {
+        // The multimedia class scheduler (MMCSS) boosts registered audio
+        // threads into the real-time range. avrt is loaded on demand so the
+        // build needs no extra import library.
+        typedef HANDLE(WINAPI * SetCharacteristics)(LPCWSTR, LPDWORD);
+        static void *avrt = SDL_LoadObject("avrt.dll");
+        SetCharacteristics setCharacteristics =
+            avrt != nullptr ? (SetCharacteristics)SDL_LoadFunction(avrt, "AvSetMmThreadCharacteristicsW") : nullptr;
+        DWORD taskIndex = 0;
+        return setCharacteristics != nullptr && setCharacteristics(L"Pro Audio", &taskIndex) != nullptr;
+    }
+    return GetThreadPriority(GetCurrentThread()) == THREAD_PRIORITY_TIME_CRITICAL;
+#elif defined(__linux__)
+    if (realtimeOptions.realtime)
+    {
+        int policy = sched_getscheduler(0);
+        return policy == SCHED_FIFO || policy == SCHED_RR;
+    }
+    return true;
+#else
+    return true;
+#endif
+}
+
+static bool pinCurrentThread(int core)
+{
+#if defined(_WIN32)
+    if (core >= (int)sizeof(DWORD_PTR) * 8)
+    {
+        return false;
+    }
+    return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << core) != 0;
+#elif defined(__linux__)
+    if (core >= CPU_SETSIZE)
+    {
+        return false;
+    }
+    cpu_set_t cores;
+    CPU_ZERO(&cores);
+    CPU_SET(core, &cores);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cores), &cores) == 0;
+#else
+    (void)core;
+    return false;
+#endif
+}
+
+void prepareAudioThread()
+{
+    SDL_threadID self = SDL_ThreadID();
+    if (audioThread.load(std::memory_order_relaxed) == self)
+    {
+        return;
+    }
+
+    // A new audio thread, after the first open or a reopen. This runs once per
+    // thread and may make system calls, so it stays outside the guarded scope.
+    audioThread.store(self, std::memory_order_relaxed);
+    audioThreadCount++;
+    audioThreadPromoted = promoteCurrentThread();
+    audioThreadPinned = realtimeOptions.core >= 0 && pinCurrentThread(realtimeOptions.core);
+}
+
+bool lockProcessMemory()
+{
+#if defined(__linux__)
+    // With a limited memlock budget MCL_FUTURE would make large track
+    // allocations fail later on, so only lock the current mappings then
+    struct rlimit limit;
+    int flags = MCL_CURRENT;
+    if (getrlimit(RLIMIT_MEMLOCK, &limit) == 0 && limit.rlim_cur == RLIM_INFINITY)
+    {
+        flags |= MCL_FUTURE;
+    }
+    if (mlockall(flags) != 0)
+    {
+        std::cout << "Failed to lock process memory: raise the memlock limit (ulimit -l)" << std::endl;
+        return false;
+    }
+    memoryLocked = true;
+    if ((flags & MCL_FUTURE) == 0)
+    {
+        std::cout << "Locked the current process memory; tracks loaded later are not locked" << std::endl;
+    }
+    return true;
+#else
+    std::cout << "Locking process memory is not supported on this platform" << std::endl;
+    return false;
+#endif
+}
+
+RealtimeStatus realtimeStatus()
+{
+    RealtimeStatus status;
+    status.audioThreads = audioThreadCount;
+    status.promoted = audioThreadPromoted;
+    status.pinned = audioThreadPinned;
+    status.memoryLocked = memoryLocked;
+    return status;
+}
+
+#ifdef AUDIOFLOW_RT_GUARD
+
+#include <cstdlib>
+#include <new>
+
+#if defined(_WIN32)
+#include <cstring>
+#include <tlhelp32.h>
+#elif defined(__linux__)
+#include <dlfcn.h>
+#include <poll.h>
+#include <semaphore.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+static std::atomic<Uint64> allocationCount{0};
+static std::atomic<Uint64> lockCount{0};
+static std::atomic<Uint64> syscallCount{0};
+static Uint64 reportedTotal = 0;
+
+#if defined(_WIN32)
+
+// MinGW implements thread_local with emutls, which allocates and locks the
+// first time a thread touches it; the hooks below must not do either. The
+// depth is kept in a Win32 TLS slot instead, without disturbing the last
+// error of whoever called the hook.
+static DWORD guardedDepthSlot = TLS_OUT_OF_INDEXES;
+
+static int guardedDepth()
+{
+    if (guardedDepthSlot == TLS_OUT_OF_INDEXES)
+    {
+        return 0;
+    }
+    DWORD error = GetLastError();
+    int depth = (int)(INT_PTR)TlsGetValue(guardedDepthSlot);
+    SetLastError(error);
+    return depth;
+}
+
+static void setGuardedDepth(int depth)
+{
+    if (guardedDepthSlot != TLS_OUT_OF_INDEXES)
+    {
+        TlsSetValue(guardedDepthSlot, (LPVOID)(INT_PTR)depth);
+    }
+}
+
+#else
+
+static thread_local int threadGuardedDepth = 0;
+
+static int guardedDepth()
+{
+    return threadGuardedDepth;
+}
+
+static void setGuardedDepth(int depth)
+{
+    threadGuardedDepth = depth;
+}
+
+#endif
+
+RealtimeScope::RealtimeScope()
+{
+    setGuardedDepth(guardedDepth() + 1);
+}
+
+RealtimeScope::~RealtimeScope()
+{
+    setGuardedDepth(guardedDepth() - 1);
+}
+
+static inline void noteViolation(std::atomic<Uint64> &counter)
+{
+    if (guardedDepth() > 0)
+    {
+        counter.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// Heap allocations from C++ code
+
+void *operator new(size_t size)
+{
+    noteViolation(allocationCount);
+    void *block = std::malloc(size == 0 ? 1 : size);
+    if (block == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return block;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    noteViolation(allocationCount);
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+void operator delete(void *block) noexcept
+{
+    if (block != nullptr)
+    {
+        noteViolation(allocationCount);
+    }
+    std::free(block);
+}
+
+void operator delete[](void *block) noexcept
+{
+    operator delete(block);
+}
+
+void operator delete(void *block, size_t) noexcept
+{
+    operator delete(block);
+}
+
+void operator delete[](void *block, size_t) noexcept
+{
+    operator delete(block);
+}
+
+// Heap allocations from SDL and the SDL libraries, e.g. SDL_PushEvent
+
+static SDL_malloc_func sdlMalloc;
+static SDL_calloc_func sdlCalloc;
+static SDL_realloc_func sdlRealloc;
+static SDL_free_func sdlFree;
+
+static void *SDLCALL guardedMalloc(size_t size)
+{
+    noteViolation(allocationCount);
+    return sdlMalloc(size);
+}
+
+static void *SDLCALL guardedCalloc(size_t count, size_t size)
+{
+    noteViolation(allocationCount);
+    return sdlCalloc(count, size);
+}
+
+static void *SDLCALL guardedRealloc(void *block, size_t size)
+{
+    noteViolation(allocationCount);
+    return sdlRealloc(block, size);
+}
+
+static void SDLCALL guardedFree(void *block)
+{
+    if (block != nullptr)
+    {
+        noteViolation(allocationCount);
+    }
+    sdlFree(block);
+}
+
+#if defined(__linux__)
+
+// Locks and blocking system calls made through the shared libraries (SDL
+// locks its mutexes with pthread_mutex_lock) resolve to these first. glibc
+// calls its own internal entry points, so only calls made from our code and
+// from the libraries are seen.
+
+template <typename Function>
+static Function nextSymbol(Function &cached, const char *name)
+{
+    if (cached == nullptr)
+    {
+        cached = (Function)dlsym(RTLD_NEXT, name);
+    }
+    return cached;
+}
+
+static int (*realMutexLock)(pthread_mutex_t *);
+static int (*realSemWait)(sem_t *);
+static ssize_t (*realRead)(int, void *, size_t);
+static ssize_t (*realWrite)(int, const void *, size_t);
+static int (*realPoll)(struct pollfd *, nfds_t, int);
+static int (*realNanosleep)(const struct timespec *, struct timespec *);
+static int (*realClockNanosleep)(clockid_t, int, const struct timespec *, struct timespec *);
+static int (*realUsleep)(useconds_t);
+static int (*realSchedYield)();
+
+extern "C"
+{
+    int pthread_mutex_lock(pthread_mutex_t *mutex)
+    {
+        noteViolation(lockCount);
+        return nextSymbol(realMutexLock, "pthread_mutex_lock")(mutex);
+    }
+
+    int sem_wait(sem_t *semaphore)
+    {
+        noteViolation(lockCount);
+        return nextSymbol(realSemWait, "sem_wait")(semaphore);
+    }
+
+    ssize_t read(int fd, void *buffer, size_t count)
+    {
+        noteViolation(syscallCount);
+        return nextSymbol(realRead, "read")(fd, buffer, count);
+    }
+
+    ssize_t write(int fd, const void *buffer, size_t count)
+    {
+        noteViolation(syscallCount);
+        return nextSymbol(realWrite, "write")(fd, buffer, count);
+    }
+
+    int poll(struct pollfd *fds, nfds_t count, int timeout)
+    {
+        noteViolation(syscallCount);
+        return nextSymbol(realPoll, "poll")(fds, count, timeout);
+    }
+
+    int nanosleep(const struct timespec *duration, struct timespec *remaining)
+    {
+        noteViolation(syscallCount);
+        return nextSymbol(realNanosleep, "nanosleep")(duration, remaining);
+    }
+
+    int clock_nanosleep(clockid_t clock, int flags, const struct timespec *duration, struct timespec *remaining)
+    {
+        noteViolation(syscallCount);
+        return nextSymbol(realClockNanosleep, "clock_nanosleep")(clock, flags, duration, remaining);
+    }
+
+    int usleep(useconds_t microseconds)
+    {
+        noteViolation(syscallCount);
+        return nextSymbol(realUsleep, "usleep")(microseconds);
+    }
+
+    int sched_yield()
+    {
+        noteViolation(syscallCount);
+        return nextSymbol(realSchedYield, "sched_yield")();
+    }
+}
+
+#elif defined(_WIN32)
+
+// Windows resolves imports per module, so nothing can be interposed by
+// name. Instead the import address tables of the program and of the DLLs
+// next to it (SDL, SDL_mixer, the MinGW runtime) are pointed at these.
+// SDL looks the SRW lock and WaitOnAddress functions up at run time, so
+// GetProcAddress is redirected as well; SDL_LockMutex, SDL_SemWait,
+// SDL_CondWait and SDL_Delay all end up in one of them. System DLLs keep
+// their own imports, and DLLs loaded after installRealtimeGuard() are not
+// patched.
+
+// Declared by the SDK only when targeting Windows 8
+typedef BOOL(WINAPI *WaitOnAddressFunction)(volatile VOID *, PVOID, SIZE_T, DWORD);
+
+static decltype(&EnterCriticalSection) realEnterCriticalSection;
+static decltype(&AcquireSRWLockExclusive) realAcquireSRWLockExclusive;
+static decltype(&AcquireSRWLockShared) realAcquireSRWLockShared;
+static decltype(&SleepConditionVariableCS) realSleepConditionVariableCS;
+static decltype(&SleepConditionVariableSRW) realSleepConditionVariableSRW;
+static decltype(&WaitForSingleObject) realWaitForSingleObject;
+static decltype(&WaitForSingleObjectEx) realWaitForSingleObjectEx;
+static decltype(&WaitForMultipleObjects) realWaitForMultipleObjects;
+static decltype(&Sleep) realSleep;
+static decltype(&SleepEx) realSleepEx;
+static decltype(&SwitchToThread) realSwitchToThread;
+static decltype(&ReadFile) realReadFile;
+static decltype(&WriteFile) realWriteFile;
+static WaitOnAddressFunction realWaitOnAddress;
+static decltype(&GetProcAddress) realGetProcAddress;
+
+static void WINAPI guardedEnterCriticalSection(LPCRITICAL_SECTION section)
+{
+    noteViolation(lockCount);
+    realEnterCriticalSection(section);
+}
+
+static void WINAPI guardedAcquireSRWLockExclusive(PSRWLOCK lock)
+{
+    noteViolation(lockCount);
+    realAcquireSRWLockExclusive(lock);
+}
+
+static void WINAPI guardedAcquireSRWLockShared(PSRWLOCK lock)
+{
+    noteViolation(lockCount);
+    realAcquireSRWLockShared(lock);
+}
+
+static BOOL WINAPI guardedSleepConditionVariableCS(PCONDITION_VARIABLE condition, PCRITICAL_SECTION section, DWORD milliseconds)
+{
+    noteViolation(lockCount);
+    return realSleepConditionVariableCS(condition, section, milliseconds);
+}
+
+static BOOL WINAPI guardedSleepConditionVariableSRW(PCONDITION_VARIABLE condition, PSRWLOCK lock, DWORD milliseconds, ULONG flags)
+{
+    noteViolation(lockCount);
+    return realSleepConditionVariableSRW(condition, lock, milliseconds, flags);
+}
+
+static DWORD WINAPI guardedWaitForSingleObject(HANDLE handle, DWORD milliseconds)
+{
+    noteViolation(lockCount);
+    return realWaitForSingleObject(handle, milliseconds);
+}
+
+static DWORD WINAPI guardedWaitForSingleObjectEx(HANDLE handle, DWORD milliseconds, BOOL alertable)
+{
+    noteViolation(lockCount);
+    return realWaitForSingleObjectEx(handle, milliseconds, alertable);
+}
+
+static DWORD WINAPI guardedWaitForMultipleObjects(DWORD count, const HANDLE *handles, BOOL waitAll, DWORD milliseconds)
+{
+    noteViolation(lockCount);
+    return realWaitForMultipleObjects(count, handles, waitAll, milliseconds);
+}
+
+static void WINAPI guardedSleep(DWORD milliseconds)
+{
+    noteViolation(syscallCount);
+    realSleep(milliseconds);
+}
+
+static DWORD WINAPI guardedSleepEx(DWORD milliseconds, BOOL alertable)
+{
+    noteViolation(syscallCount);
+    return realSleepEx(milliseconds, alertable);
+}
+
+static BOOL WINAPI guardedSwitchToThread()
+{
+    noteViolation(syscallCount);
+    return realSwitchToThread();
+}
+
+static BOOL WINAPI guardedReadFile(HANDLE file, LPVOID buffer, DWORD count, LPDWORD read, LPOVERLAPPED overlapped)
+{
+    noteViolation(syscallCount);
+    return realReadFile(file, buffer, count, read, overlapped);
+}
+
+static BOOL WINAPI guardedWriteFile(HANDLE file, LPCVOID buffer, DWORD count, LPDWORD written, LPOVERLAPPED overlapped)
+{
+    noteViolation(syscallCount);
+    return realWriteFile(file, buffer, count, written, overlapped);
+}
+
+static BOOL WINAPI guardedWaitOnAddress(volatile VOID *address, PVOID compare, SIZE_T size, DWORD milliseconds)
+{
+    noteViolation(lockCount);
+    return realWaitOnAddress(address, compare, size, milliseconds);
+}
+
+static FARPROC WINAPI guardedGetProcAddress(HMODULE module, LPCSTR name);
+
+struct GuardedImport
+{
+    const char *name;
+    void **real;
+    void *guard;
+};
+
+#define GUARDED_IMPORT(function) {#function, (void **)&real##function, (void *)guarded##function}
+
+static const GuardedImport guardedImports[] = {
+    GUARDED_IMPORT(EnterCriticalSection),     GUARDED_IMPORT(AcquireSRWLockExclusive),
+    GUARDED_IMPORT(AcquireSRWLockShared),     GUARDED_IMPORT(SleepConditionVariableCS),
+    GUARDED_IMPORT(SleepConditionVariableSRW), GUARDED_IMPORT(WaitForSingleObject),
+    GUARDED_IMPORT(WaitForSingleObjectEx),    GUARDED_IMPORT(WaitForMultipleObjects),
+    GUARDED_IMPORT(Sleep),                    GUARDED_IMPORT(SleepEx),
+    GUARDED_IMPORT(SwitchToThread),           GUARDED_IMPORT(ReadFile),
+    GUARDED_IMPORT(WriteFile),                GUARDED_IMPORT(WaitOnAddress),
+    GUARDED_IMPORT(GetProcAddress),
+};
+
+// Not a violation in itself, it hands out the guards for run time lookups
+static FARPROC WINAPI guardedGetProcAddress(HMODULE module, LPCSTR name)
+{
+    FARPROC function = realGetProcAddress(module, name);
+    if (function == nullptr || IS_INTRESOURCE(name))
+    {
+        return function;
+    }
+    for (const GuardedImport &hook : guardedImports)
+    {
+        if (*hook.real != nullptr && strcmp(name, hook.name) == 0)
+        {
+            return (FARPROC)hook.guard;
+        }
+    }
+    return function;
+}
+
+// Imports are matched by name whatever DLL they come from, since newer
+// DLLs import these from API sets such as api-ms-win-core-synch-l1-2-0
+static void patchImports(HMODULE module)
+{
+    BYTE *base = (BYTE *)module;
+    const IMAGE_NT_HEADERS *headers = (const IMAGE_NT_HEADERS *)(base + ((const IMAGE_DOS_HEADER *)base)->e_lfanew);
+    const IMAGE_DATA_DIRECTORY &directory = headers->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_IMPORT];
+    if (directory.VirtualAddress == 0)
+    {
+        return;
+    }
+    for (const IMAGE_IMPORT_DESCRIPTOR *library = (const IMAGE_IMPORT_DESCRIPTOR *)(base + directory.VirtualAddress);
+         library->Name != 0; library++)
+    {
+        if (library->OriginalFirstThunk == 0)
+        {
+            continue; // Without the lookup table the names are gone once bound
+        }
+        const IMAGE_THUNK_DATA *names = (const IMAGE_THUNK_DATA *)(base + library->OriginalFirstThunk);
+        IMAGE_THUNK_DATA *slots = (IMAGE_THUNK_DATA *)(base + library->FirstThunk);
+        for (; names->u1.AddressOfData != 0; names++, slots++)
+        {
+            if (IMAGE_SNAP_BY_ORDINAL(names->u1.Ordinal))
+            {
+                continue;
+            }
+            const char *name = (const char *)((const IMAGE_IMPORT_BY_NAME *)(base + names->u1.AddressOfData))->Name;
+            for (const GuardedImport &hook : guardedImports)
+            {
+                DWORD protection;
+                if (*hook.real != nullptr && strcmp(name, hook.name) == 0 &&
+                    VirtualProtect(&slots->u1.Function, sizeof(slots->u1.Function), PAGE_READWRITE, &protection))
+                {
+                    slots->u1.Function = (ULONG_PTR)hook.guard;
+                    VirtualProtect(&slots->u1.Function, sizeof(slots->u1.Function), protection, &protection);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+// The program and every module loaded from its folder
+static void patchApplicationModules()
+{
+    wchar_t program[MAX_PATH];
+    DWORD length = GetModuleFileNameW(nullptr, program, MAX_PATH);
+    if (length == 0 || length == MAX_PATH)
+    {
+        return;
+    }
+    size_t folderLength = wcsrchr(program, L'\\') - program + 1;
+
+    HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPMODULE, GetCurrentProcessId());
+    if (snapshot == INVALID_HANDLE_VALUE)
+    {
+        patchImports(GetModuleHandleW(nullptr));
+        return;
+    }
+    MODULEENTRY32W entry;
+    entry.dwSize = sizeof(entry);
+    for (BOOL found = Module32FirstW(snapshot, &entry); found; found = Module32NextW(snapshot, &entry))
+    {
+        if (_wcsnicmp(entry.szExePath, program, folderLength) == 0 && wcschr(entry.szExePath + folderLength, L'\\') == nullptr)
+        {
+            patchImports(entry.hModule);
+        }
+    }
+    CloseHandle(snapshot);
+}
+
+#endif
+
+void installRealtimeGuard()
+{
+    SDL_GetMemoryFunctions(&sdlMalloc, &sdlCalloc, &sdlRealloc, &sdlFree);
+    SDL_SetMemoryFunctions(guardedMalloc, guardedCalloc, guardedRealloc, guardedFree);
+#if defined(__linux__)
+    // Resolve everything up front instead of on the first guarded call
+    nextSymbol(realMutexLock, "pthread_mutex_lock");
+    nextSymbol(realSemWait, "sem_wait");
+    nextSymbol(realRead, "read");
+    nextSymbol(realWrite, "write");
+    nextSymbol(realPoll, "poll");
+    nextSymbol(realNanosleep, "nanosleep");
+    nextSymbol(realClockNanosleep, "clock_nanosleep");
+    nextSymbol(realUsleep, "usleep");
+    nextSymbol(realSchedYield, "sched_yield");
+#elif defined(_WIN32)
+    guardedDepthSlot = TlsAlloc();
+    // WaitOnAddress only exists from Windows 8 on and not in kernel32;
+    // whatever is missing is left unpatched
+    HMODULE kernel = GetModuleHandleW(L"kernel32.dll");
+    HMODULE kernelBase = GetModuleHandleW(L"kernelbase.dll");
+    for (const GuardedImport &hook : guardedImports)
+    {
+        *hook.real = (void *)GetProcAddress(kernel, hook.name);
+        if (*hook.real == nullptr && kernelBase != nullptr)
+        {
+            *hook.real = (void *)GetProcAddress(kernelBase, hook.name);
+        }
+    }
+    patchApplicationModules();
+#endif
+}
+
+bool realtimeGuardEnabled()
+{
+    return true;
+}
+
+RealtimeViolations realtimeViolations()
+{
+    return {allocationCount.load(), lockCount.load(), syscallCount.load()};
+}
+
+void reportRealtimeViolations()
+{
+    RealtimeViolations violations = realtimeViolations();
+    Uint64 total = violations.allocations + violations.locks + violations.syscalls;
+    if (total > reportedTotal)
+    {
+        reportedTotal = total;
+        std::cout << "Audio callback is not real-time safe: " << violations.allocations << " allocations, " << violations.locks
+                  << " locks, " << violations.syscalls << " system calls so far" << std::endl;
+    }
+}
+
+#else
+
+void installRealtimeGuard()
+{
+}
+
+bool realtimeGuardEnabled()
+{
+    return false;
+}
+
+RealtimeViolations realtimeViolations()
+{
+    return {0, 0, 0};
+}
+
+void reportRealtimeViolations()
+{
+}
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <SDL2/SDL.h>
+
+struct RealtimeOptions
+{
+    bool realtime;   // Ask for a real-time scheduling class, not just the highest normal priority
+    int core;        // CPU core to pin the audio thread to, -1 leaves it to the OS
+    bool lockMemory; // Keep the whole process in RAM so the callback never page faults
+};
+
+struct RealtimeStatus
+{
+    Uint32 audioThreads; // Audio threads set up so far, SDL starts a new one per device open
+    bool promoted;       // The last one got the priority that was asked for
+    bool pinned;
+    bool memoryLocked;
+};
+
+// Must be called before the audio device is opened, SDL promotes its audio
+// thread as it starts it
+void configureRealtime(const RealtimeOptions &options);
+
+// Called at the top of every audio callback. Sets the thread up the first
+// time it sees it (priority, multimedia class, core); afterwards it only
+// compares the thread id.
+void prepareAudioThread();
+
+// mlockall on Linux. Locks future allocations too when the memlock limit
+// allows it, otherwise only what is mapped right now. Other platforms
+// report that it is not supported.
+bool lockProcessMemory();
+
+RealtimeStatus realtimeStatus();
+
+// Debug builds (make debug) define AUDIOFLOW_RT_GUARD. The audio callbacks
+// then mark themselves with a RealtimeScope and everything that can block
+// the audio thread is counted while one is open: heap allocations through
+// new and SDL_malloc everywhere, mutex locks and semaphore waits, and the
+// common blocking system calls (read, write, poll, sleeps). Linux interposes
+// the pthread and libc functions; Windows patches the import tables of the
+// program and the DLLs next to it (critical sections, SRW locks, waits,
+// Sleep, ReadFile, WriteFile), which covers SDL_LockMutex, SDL_SemWait and
+// SDL_Delay. Semaphore posts are the one wake-up the callback may use.
+// Release builds compile all of it away.
+struct RealtimeViolations
+{
+    Uint64 allocations;
+    Uint64 locks;
+    Uint64 syscalls;
+};
+
+// Call first thing in main, before SDL allocates anything
+void installRealtimeGuard();
+bool realtimeGuardEnabled();
+RealtimeViolations realtimeViolations();
+// Prints the counters when they went up since the last call, from the UI thread
+void reportRealtimeViolations();
+
+#ifdef AUDIOFLOW_RT_GUARD
+class RealtimeScope
+{
+public:
+    RealtimeScope();
+    ~RealtimeScope();
+};
+#else
+class RealtimeScope
+{
+public:
+    RealtimeScope() {}
+};
+#endif
+
+#endif
@@ -0,0 +1,350 @@
+#include "resampler.h"
+#include "dotproduct.h"
+
+#include <cmath>
+#include <iostream>
+#include <numeric>
+
+const double PI = 3.14159265358979323846;
+
+struct QualityTier
+{
+    int taps;           // Per output sample when not downsampling
+    double attenuation; // Stopband, dB
+};
+
+static QualityTier qualityTier(ResamplerQuality quality)
+{
+    switch (quality)
+    {
+    case RESAMPLER_FAST:
+        return {32, 70.0};
+    case RESAMPLER_MEDIUM:
+        return {64, 100.0};
+    default:
+        return {128, 130.0};
+    }
+}
+
+bool parseResamplerQuality(const std::string &name, ResamplerQuality &quality)
+{
+    for (int i = RESAMPLER_SDL; i <= RESAMPLER_BEST; i++)
+    {
+        if (name == resamplerQualityName((ResamplerQuality)i))
+        {
+            quality = (ResamplerQuality)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *resamplerQualityName(ResamplerQuality quality)
+{
+    switch (quality)
+    {
+    case RESAMPLER_SDL:
+        return "sdl";
+    case RESAMPLER_FAST:
+        return "fast";
+    case RESAMPLER_MEDIUM:
+        return "medium";
+    case RESAMPLER_BEST:
+        return "best";
+    }
+    return "unknown";
+}
+
+int sampleRateFamily(int frequency)
+{
+    if (frequency % 11025 == 0)
+    {
+        return 44100;
+    }
+    if (frequency % 8000 == 0)
+    {
+        return 48000;
+    }
+    return frequency;
+}
+
+const char *resamplerKernelName()
+{
+    return dotProductKernelName();
+}
+
+// Zeroth order modified Bessel function of the first kind, for the Kaiser window
+static double besselI0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 50; k++)
+    {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-17)
+        {
+            break;
+        }
+    }
+    return sum;
+}
+
+bool Resampler::init(int inRate, int outRate, ResamplerQuality quality)
+{
+    if (inRate <= 0 || outRate <= 0)
+    {
+        return false;
+    }
+
+    Uint64 divisor = std::gcd((Uint64)inRate, (Uint64)outRate);
+    upFactor = outRate / divisor;
+    downFactor = inRate / divisor;
+    phases = upFactor <= (Uint64)MAX_PHASES ? (int)upFactor : MAX_PHASES;
+
+    // Kaiser's estimates: the filter length and stopband attenuation give
+    // the width of the transition band, which ends right at Nyquist
+    QualityTier tier = qualityTier(quality);
+    double beta = 0.1102 * (tier.attenuation - 8.7);
+    double transition = (tier.attenuation - 7.95) / (2.285 * (tier.taps - 1)) / PI; // Fraction of Nyquist
+    double scale = SDL_min((double)outRate / inRate, 1.0);
+    double cutoff = (1.0 - transition / 2.0) * scale;
+    halfLength = (int)std::ceil(tier.taps / 2 / scale);
+    tapCount = (2 * halfLength + 7) / 8 * 8;
+
+    coefficients.assign((size_t)phases * tapCount, 0.0f);
+    double windowNorm = besselI0(beta);
+    std::vector<double> taps(2 * halfLength);
+    for (int phase = 0; phase < phases; phase++)
+    {
+        double fraction = (double)phase / phases;
+        float *row = &coefficients[(size_t)phase * tapCount];
+        double sum = 0.0;
+        for (int tap = 0; tap < 2 * halfLength; tap++)
+        {
+            // Distance from the output position to the input sample
+            double t = fraction - (tap - halfLength + 1);
+            double x = t / halfLength;
+            double window = x * x < 1.0 ? besselI0(beta * std::sqrt(1.0 - x * x)) / windowNorm : 0.0;
+            double sinc = t == 0.0 ? 1.0 : std::sin(PI * cutoff * t) / (PI * cutoff * t);
+            taps[tap] = cutoff * sinc * window;
+            sum += taps[tap];
+        }
+        // Every phase passes DC at exactly unity
+        for (int tap = 0; tap < 2 * halfLength; tap++)
+        {
+            row[tap] = (float)(taps[tap] / sum);
+        }
+    }
+    return true;
+}
+
+Uint64 Resampler::outputFrames(Uint64 inputFrames) const
+{
+    return (inputFrames * upFactor + downFactor - 1) / downFactor;
+}
+
+// Input frame the taps of output frame n are centred on, and its phase
+void Resampler::locate(Uint64 n, Uint64 &index, int &phase) const
+{
+    Uint64 position = n * downFactor;
+    index = position / upFactor;
+    Uint64 remainder = position % upFactor;
+    if (phases == (int)upFactor)
+    {
+        phase = (int)remainder;
+        return;
+    }
+    phase = (int)((remainder * phases + upFactor / 2) / upFactor);
+    if (phase == phases)
+    {
+        phase = 0;
+        index++;
+    }
+}
+
+void Resampler::inputSpan(Uint64 firstOutput, Uint32 count, Sint64 &begin, Sint64 &end) const
+{
+    Uint64 first;
+    Uint64 last;
+    int phase;
+    locate(firstOutput, first, phase);
+    locate(firstOutput + SDL_max(count, 1u) - 1, last, phase);
+    // The taps start halfLength - 1 samples before the output position
+    begin = (Sint64)first - halfLength + 1;
+    end = (Sint64)last - halfLength + 1 + tapCount;
+}
+
+void Resampler::process(const float *input, Uint32 frames, int stride, float *output) const
+{
+    process(input, 0, frames, stride, 0, (Uint32)outputFrames(frames), output);
+}
+
+void Resampler::process(const float *input, Sint64 inputStart, Uint32 frames, int stride, Uint64 firstOutput, Uint32 count,
+                        float *output) const
+{
+    if (count == 0)
+    {
+        return;
+    }
+    DotProduct dot = dotProductKernel();
+
+    // Contiguous copy of the span the taps cover, zero wherever input has
+    // nothing, so no tap reads outside
+    Sint64 begin;
+    Sint64 end;
+    inputSpan(firstOutput, count, begin, end);
+    std::vector<float> padded((size_t)(end - begin), 0.0f);
+    Sint64 from = SDL_max(begin, inputStart);
+    Sint64 to = SDL_min(end, inputStart + (Sint64)frames);
+    for (Sint64 i = from; i < to; i++)
+    {
+        padded[(size_t)(i - begin)] = input[(size_t)(i - inputStart) * stride];
+    }
+
+    for (Uint32 n = 0; n < count; n++)
+    {
+        Uint64 index;
+        int phase;
+        locate(firstOutput + n, index, phase);
+        const float *window = &padded[(size_t)((Sint64)index - halfLength + 1 - begin)];
+        output[(size_t)n * stride] = dot(&coefficients[(size_t)phase * tapCount], window, tapCount);
+    }
+}
+
+static std::vector<float> generateTone(int frequency, double tone, Uint32 frames)
+{
+    std::vector<float> samples(frames);
+    for (Uint32 i = 0; i < frames; i++)
+    {
+        samples[i] = (float)(0.5 * std::sin(2.0 * PI * tone * i / frequency));
+    }
+    return samples;
+}
+
+// Fits a sine of the tone's frequency with any phase and reports how far
+// the rest lies below it. The ends, where the filters ring in, are skipped.
+static double toneSnr(const std::vector<float> &samples, int frequency, double tone)
+{
+    size_t begin = 4096;
+    size_t end = samples.size() - 4096;
+    double ss = 0.0, sc = 0.0, cc = 0.0, ys = 0.0, yc = 0.0;
+    for (size_t i = begin; i < end; i++)
+    {
+        double s = std::sin(2.0 * PI * tone * i / frequency);
+        double c = std::cos(2.0 * PI * tone * i / frequency);
+        ss += s * s;
+        sc += s * c;
+        cc += c * c;
+        ys += samples[i] * s;
+        yc += samples[i] * c;
+    }
+    double determinant = ss * cc - sc * sc;
+    double a = (ys * cc - yc * sc) / determinant;
+    double b = (yc * ss - ys * sc) / determinant;
+
+    double signal = 0.0;
+    double noise = 0.0;
+    for (size_t i = begin; i < end; i++)
+    {
+        double fit = a * std::sin(2.0 * PI * tone * i / frequency) + b * std::cos(2.0 * PI * tone * i / frequency);
+        signal += fit * fit;
+        noise += (samples[i] - fit) * (samples[i] - fit);
+    }
+    return 10.0 * std::log10(signal / SDL_max(noise, 1e-30));
+}
+
+// Level of what is left of a tone above the output Nyquist, relative to the input
+static double aliasLevel(const std::vector<float> &input, const std::vector<float> &output)
+{
+    double in = 0.0;
+    double out = 0.0;
+    for (size_t i = 4096; i + 4096 < input.size(); i++)
+    {
+        in += (double)input[i] * input[i];
+    }
+    for (size_t i = 4096; i + 4096 < output.size(); i++)
+    {
+        out += (double)output[i] * output[i];
+    }
+    in /= input.size() - 8192;
+    out /= output.size() - 8192;
+    return 10.0 * std::log10(SDL_max(out, 1e-30) / in);
+}
+
+// Converts mono or interleaved float audio with SDL_AudioCVT, empty on failure
+static std::vector<float> convertWithSdl(const std::vector<float> &input, int channels, int inRate, int outRate)
+{
+    SDL_AudioCVT cvt;
+    if (SDL_BuildAudioCVT(&cvt, AUDIO_F32SYS, channels, inRate, AUDIO_F32SYS, channels, outRate) < 0)
+    {
+        std::cout << "Failed to build SDL converter: " << SDL_GetError() << std::endl;
+        return {};
+    }
+    cvt.len = (int)(input.size() * sizeof(float));
+    std::vector<Uint8> buffer((size_t)cvt.len * cvt.len_mult);
+    SDL_memcpy(buffer.data(), input.data(), cvt.len);
+    cvt.buf = buffer.data();
+    if (SDL_ConvertAudio(&cvt) < 0)
+    {
+        std::cout << "Failed to convert with SDL: " << SDL_GetError() << std::endl;
+        return {};
+    }
+    return std::vector<float>((float *)buffer.data(), (float *)(buffer.data() + cvt.len_cvt));
+}
+
+static std::vector<float> convertWithResampler(const std::vector<float> &input, int channels, int inRate, int outRate,
+                                               ResamplerQuality quality)
+{
+    Resampler resampler;
+    resampler.init(inRate, outRate, quality);
+    Uint32 frames = (Uint32)(input.size() / channels);
+    std::vector<float> output((size_t)resampler.outputFrames(frames) * channels);
+    for (int channel = 0; channel < channels; channel++)
+    {
+        resampler.process(input.data() + channel, frames, channels, output.data() + channel);
+    }
+    return output;
+}
+
+void benchmarkResampler()
+{
+    const int seconds = 10;
+    const int channels = 2;
+
+    std::vector<float> low = generateTone(44100, 1000.0, 44100 * seconds);
+    std::vector<float> high = generateTone(44100, 18000.0, 44100 * seconds);
+    std::vector<float> alias = generateTone(48000, 23000.0, 48000 * seconds);
+    std::vector<float> stereo(44100 * seconds * channels);
+    for (size_t i = 0; i < stereo.size(); i++)
+    {
+        stereo[i] = low[i / channels];
+    }
+
+    std::cout << "Resampler kernel: " << resamplerKernelName() << std::endl;
+    for (int i = RESAMPLER_SDL; i <= RESAMPLER_BEST; i++)
+    {
+        ResamplerQuality quality = (ResamplerQuality)i;
+        auto convert = [quality](const std::vector<float> &input, int channels, int inRate, int outRate) {
+            return quality == RESAMPLER_SDL ? convertWithSdl(input, channels, inRate, outRate)
+                                            : convertWithResampler(input, channels, inRate, outRate, quality);
+        };
+
+        std::vector<float> lowOut = convert(low, 1, 44100, 48000);
+        std::vector<float> highOut = convert(high, 1, 44100, 48000);
+        std::vector<float> aliasOut = convert(alias, 1, 48000, 44100);
+        if (lowOut.size() < 16384 || highOut.size() < 16384 || aliasOut.size() < 16384)
+        {
+            continue;
+        }
+
+        Uint64 begin = SDL_GetPerformanceCounter();
+        std::vector<float> stereoOut = convert(stereo, channels, 44100, 48000);
+        double elapsed = (double)(SDL_GetPerformanceCounter() - begin) / SDL_GetPerformanceFrequency();
+
+        std::cout << "Resampler " << resamplerQualityName(quality) << ": SNR " << toneSnr(lowOut, 48000, 1000.0) << " dB at 1 kHz, "
+                  << toneSnr(highOut, 48000, 18000.0) << " dB at 18 kHz (44.1 -> 48 kHz), 23 kHz alias at "
+                  << aliasLevel(alias, aliasOut) << " dB (48 -> 44.1 kHz), " << seconds / elapsed << "x real time in stereo"
+                  << std::endl;
+    }
+}
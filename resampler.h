@@ -0,0 +1,75 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <SDL2/SDL.h>
+#include <string>
+#include <vector>
+
+enum ResamplerQuality
+{
+    RESAMPLER_SDL,    // Leave sample rate conversion to SDL
+    RESAMPLER_FAST,   // 32 taps, about 70 dB stopband
+    RESAMPLER_MEDIUM, // 64 taps, about 100 dB stopband
+    RESAMPLER_BEST    // 128 taps, about 130 dB stopband
+};
+
+bool parseResamplerQuality(const std::string &name, ResamplerQuality &quality);
+const char *resamplerQualityName(ResamplerQuality quality);
+
+// Instruction set the filter kernel runs on, picked once at runtime
+const char *resamplerKernelName();
+
+// 44.1 kHz and its multiples form one family, 48 kHz and 8 kHz multiples
+// the other. Switching between rates of one family is a cheap integer ratio.
+int sampleRateFamily(int frequency);
+
+// Polyphase windowed-sinc sample rate converter for decoded tracks.
+// The ratio is reduced to outRate/inRate = L/M and the Kaiser windowed sinc
+// is tabulated for each of the L output phases, so every output sample is a
+// single dot product of taps against the input. Common ratios such as
+// 44100 -> 48000 (160/147) get an exact table; unusual ones are rounded to
+// the nearest of MAX_PHASES phases. When downsampling the cutoff moves to
+// the output Nyquist and the filter grows to keep the transition band.
+class Resampler
+{
+public:
+    bool init(int inRate, int outRate, ResamplerQuality quality);
+
+    Uint64 outputFrames(Uint64 inputFrames) const;
+
+    // Converts one channel. Reads stride apart, so interleaved float audio
+    // can be passed with stride set to the channel count; output is packed
+    // the same way. output must hold outputFrames(frames) * stride floats.
+    void process(const float *input, Uint32 frames, int stride, float *output) const;
+
+    // The same for a piece of a longer signal, so it can be converted a
+    // block at a time: input holds input frames [inputStart, inputStart +
+    // frames) and everything outside counts as silence. Writes output frames
+    // [firstOutput, firstOutput + count), exactly as a single pass would.
+    void process(const float *input, Sint64 inputStart, Uint32 frames, int stride, Uint64 firstOutput, Uint32 count,
+                 float *output) const;
+    // Input frames [begin, end) that output frames [firstOutput, firstOutput + count) depend on
+    void inputSpan(Uint64 firstOutput, Uint32 count, Sint64 &begin, Sint64 &end) const;
+
+    // Filter taps per output sample
+    int taps() const { return tapCount; }
+
+private:
+    static const int MAX_PHASES = 1024;
+
+    void locate(Uint64 n, Uint64 &index, int &phase) const;
+
+    Uint64 upFactor = 1;   // L
+    Uint64 downFactor = 1; // M
+    int phases = 1;
+    int halfLength = 0; // Input samples on each side of the output position
+    int tapCount = 0;   // Padded to a multiple of 8 for the vector kernels
+    std::vector<float> coefficients; // phases x tapCount
+};
+
+// Resamples generated tones with this resampler at every quality and with
+// SDL's converter, and prints the signal to noise ratio, alias rejection and
+// speed of each
+void benchmarkResampler();
+
+#endif
@@ -0,0 +1,76 @@
+#include "scheduler.h"
+
+#include <iostream>
+
+bool FrameScheduler::init()
+{
+    Uint32 first = SDL_RegisterEvents(2);
+    if (first == (Uint32)-1)
+    {
+        std::cout << "Failed to register user events: " << SDL_GetError() << std::endl;
+        return false;
+    }
+
+    trackFinishedEvent = first;
+    workEvent = first + 1;
+    return true;
+}
+
+bool FrameScheduler::waitEvent(SDL_Event &event)
+{
+    int timeout = -1; // Sleep until the next event
+    if (tickPending)
+    {
+        timeout = SDL_max((Sint32)(tickDue - SDL_GetTicks()), 0);
+    }
+
+    bool received = timeout < 0 ? SDL_WaitEvent(&event) == 1 : SDL_WaitEventTimeout(&event, timeout) == 1;
+
+    if (tickPending && (Sint32)(SDL_GetTicks() - tickDue) >= 0)
+    {
+        tickPending = false;
+        dirty = true;
+    }
+
+    return received;
+}
+
+void FrameScheduler::scheduleTick(Uint32 milliseconds)
+{
+    tickPending = true;
+    tickDue = SDL_GetTicks() + milliseconds;
+}
+
+void FrameScheduler::postTrackFinished()
+{
+    pushEvent(trackFinishedEvent);
+}
+
+void FrameScheduler::postWork()
+{
+    pushEvent(workEvent);
+}
+
+bool FrameScheduler::beginFrame()
+{
+    if (!dirty)
+    {
+        skippedCount++;
+        return false;
+    }
+
+    dirty = false;
+    renderedCount++;
+    return true;
+}
+
+void FrameScheduler::pushEvent(Uint32 type)
+{
+    SDL_Event event;
+    SDL_zero(event);
+    event.type = type;
+    if (SDL_PushEvent(&event) < 0)
+    {
+        std::cout << "Failed to push event: " << SDL_GetError() << std::endl;
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <SDL2/SDL.h>
+
+// Drives the main loop from SDL_WaitEventTimeout instead of busy polling.
+// The loop wakes up for input, for a tick scheduled when the progress display
+// changes next, and for user events posted from other threads (end of track,
+// finished background work). A frame is only rendered when something marked
+// the scene as dirty; every other wake-up is counted as a skipped frame.
+class FrameScheduler
+{
+public:
+    // Registers the custom event types, must be called after SDL_Init
+    bool init();
+
+    // Blocks until an event arrives or the scheduled tick is due. Returns true
+    // if an event was stored in `event`, false on timeout.
+    bool waitEvent(SDL_Event &event);
+
+    // Safe to call from any thread, including the audio callback
+    void postTrackFinished();
+    void postWork();
+
+    bool isTrackFinished(const SDL_Event &event) const { return event.type == trackFinishedEvent; }
+    bool isWork(const SDL_Event &event) const { return event.type == workEvent; }
+
+    // Marks the frame dirty once `milliseconds` have passed, replacing the
+    // previously scheduled tick. cancelTick() drops it.
+    void scheduleTick(Uint32 milliseconds);
+    void cancelTick() { tickPending = false; }
+    void requestRedraw() { dirty = true; }
+
+    // Call once per wake-up; returns true if the frame has to be rendered
+    bool beginFrame();
+
+    Uint64 framesRendered() const { return renderedCount; }
+    Uint64 framesSkipped() const { return skippedCount; }
+
+private:
+    void pushEvent(Uint32 type);
+
+    Uint32 trackFinishedEvent = 0;
+    Uint32 workEvent = 0;
+    bool tickPending = false;
+    Uint32 tickDue = 0;
+    bool dirty = true;
+    Uint64 renderedCount = 0;
+    Uint64 skippedCount = 0;
+};
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+
+// Fixed size lock-free queue for exactly one producer thread and one
+// consumer thread. Neither side ever blocks or allocates, so it is safe to
+// use from the audio callback.
+template <typename T, size_t Capacity>
+class SpscQueue
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    // Returns false if the queue is full
+    bool push(const T &item)
+    {
+        size_t tail = tailIndex.load(std::memory_order_relaxed);
+        if (tail - headIndex.load(std::memory_order_acquire) == Capacity)
+        {
+            return false;
+        }
+        items[tail & (Capacity - 1)] = item;
+        tailIndex.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Returns false if the queue is empty
+    bool pop(T &item)
+    {
+        size_t head = headIndex.load(std::memory_order_relaxed);
+        if (head == tailIndex.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        item = items[head & (Capacity - 1)];
+        headIndex.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const
+    {
+        return headIndex.load(std::memory_order_acquire) == tailIndex.load(std::memory_order_acquire);
+    }
+
+private:
+    T items[Capacity];
+    alignas(64) std::atomic<size_t> headIndex{0}; // Only written by the consumer
+    alignas(64) std::atomic<size_t> tailIndex{0}; // Only written by the producer
+};
+
+#endif
@@ -0,0 +1,75 @@
+#include "telemetry.h"
+
+void Histogram::record(double value)
+{
+    int index = value <= 0.0 ? 0 : (int)SDL_min(value / width, (double)(BINS - 1));
+    // Only this thread writes, so load and store need no read-modify-write
+    bins[index].store(bins[index].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    sum.store(sum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    if (value > peak.load(std::memory_order_relaxed))
+    {
+        peak.store(value, std::memory_order_relaxed);
+    }
+    total.store(total.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+double Histogram::mean() const
+{
+    Uint64 samples = count();
+    return samples > 0 ? sum.load(std::memory_order_relaxed) / samples : 0.0;
+}
+
+double Histogram::percentile(double fraction) const
+{
+    Uint64 samples = 0;
+    for (int i = 0; i < BINS; i++)
+    {
+        samples += bin(i);
+    }
+    if (samples == 0)
+    {
+        return 0.0;
+    }
+
+    Uint64 target = (Uint64)SDL_ceil(fraction * samples);
+    Uint64 seen = 0;
+    for (int i = 0; i < BINS - 1; i++)
+    {
+        seen += bin(i);
+        if (seen >= target)
+        {
+            return (i + 1) * width;
+        }
+    }
+    return max(); // In the open-ended last bin
+}
+
+void printHistogramSummary(std::ostream &out, const char *name, const char *unit, const Histogram &histogram)
+{
+    out << name << ": " << histogram.count() << " samples, mean " << histogram.mean() << unit << ", p50 "
+        << histogram.percentile(0.5) << unit << ", p99 " << histogram.percentile(0.99) << unit << ", max " << histogram.max()
+        << unit << std::endl;
+}
+
+void printHistogram(std::ostream &out, const char *name, const char *unit, const Histogram &histogram)
+{
+    printHistogramSummary(out, name, unit, histogram);
+    for (int i = 0; i < Histogram::BINS; i++)
+    {
+        Uint64 samples = histogram.bin(i);
+        if (samples == 0)
+        {
+            continue;
+        }
+        out << "  " << i * histogram.binWidth();
+        if (i < Histogram::BINS - 1)
+        {
+            out << " - " << (i + 1) * histogram.binWidth() << unit;
+        }
+        else
+        {
+            out << unit << " and up";
+        }
+        out << ": " << samples << std::endl;
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <SDL2/SDL.h>
+#include <atomic>
+#include <ostream>
+
+// Fixed-width histogram that one thread records into while any other reads
+// it. Every bin is an atomic counter written only by the recording thread,
+// so recording is a handful of relaxed stores and never waits. Readers see
+// each bin consistently, though a snapshot may be off by the samples
+// recorded while it was taken.
+class Histogram
+{
+public:
+    static const int BINS = 100;
+
+    // Bin i holds values in [i * binWidth, (i + 1) * binWidth), the last
+    // bin everything above as well
+    explicit Histogram(double binWidth) : width(binWidth) {}
+
+    // Recording thread only
+    void record(double value);
+
+    Uint64 count() const { return total.load(std::memory_order_relaxed); }
+    double mean() const;
+    double max() const { return peak.load(std::memory_order_relaxed); }
+    // Upper edge of the bin the given fraction of samples falls into
+    double percentile(double fraction) const;
+    double binWidth() const { return width; }
+    Uint64 bin(int index) const { return bins[index].load(std::memory_order_relaxed); }
+
+private:
+    double width;
+    std::atomic<Uint64> bins[BINS] = {};
+    std::atomic<Uint64> total{0};
+    std::atomic<double> sum{0.0};
+    std::atomic<double> peak{0.0};
+};
+
+// What the audio engine measures about itself, collected over the whole
+// session. Recorded by the audio callback and the decoder thread.
+struct EngineTelemetry
+{
+    Histogram load{2.0};          // Callback time (mix and post-mix) in % of the buffer period
+    Histogram postMixLoad{2.0};   // The post-mix hook (gain, equalizer, limiter) alone, in %
+    Histogram jitter{50.0};       // Deviation of the time between callbacks from the period, in us
+    Histogram ringFill{1.0};      // Decoder ring fill at each callback, in % (decoder thread mode)
+    Histogram decoderTime{20.0};  // Time to render one ring block, in us (decoder thread mode)
+};
+
+// One line with count, mean, 50th/99th percentile and maximum
+void printHistogramSummary(std::ostream &out, const char *name, const char *unit, const Histogram &histogram);
+// The summary followed by every non-empty bin
+void printHistogram(std::ostream &out, const char *name, const char *unit, const Histogram &histogram);
+
+#endif
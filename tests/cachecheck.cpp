@@ -0,0 +1,264 @@
+// Checks that the track cache gives back exactly what was put in: the PCM
+// codec on its own, for 16-bit and float audio from silence to noise, and
+// tracks packed by the cache's worker and unpacked again. Exits with 1 if
+// anything is off.
+#include "../pcmcodec.h"
+#include "../track.h"
+#include "../trackcache.h"
+
+#include <SDL2/SDL.h>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool ok, const std::string &what)
+{
+    if (!ok)
+    {
+        std::cout << "FAIL: " << what << std::endl;
+        failures++;
+    }
+}
+
+enum Signal
+{
+    SIGNAL_SILENCE,
+    SIGNAL_SINE,
+    SIGNAL_EXTREMES, // Full scale jumps, the largest residuals there are
+    SIGNAL_NOISE,    // Incompressible
+    SIGNAL_NOISE_BURST // Noise for the first quarter, so a track that packs has raw residuals too
+};
+
+static const char *signalName(Signal signal)
+{
+    switch (signal)
+    {
+    case SIGNAL_SILENCE:
+        return "silence";
+    case SIGNAL_SINE:
+        return "sine";
+    case SIGNAL_EXTREMES:
+        return "extremes";
+    case SIGNAL_NOISE:
+        return "noise";
+    default:
+        return "noise burst";
+    }
+}
+
+// 16-bit samples, interleaved, different on every channel
+static std::vector<Sint16> makeSamples(Signal signal, Uint32 frames, int channels, Uint32 seed)
+{
+    std::mt19937 random(seed);
+    std::vector<Sint16> samples((size_t)frames * channels);
+    for (Uint32 frame = 0; frame < frames; frame++)
+    {
+        for (int channel = 0; channel < channels; channel++)
+        {
+            Sint32 value = 0;
+            bool noise = signal == SIGNAL_NOISE || (signal == SIGNAL_NOISE_BURST && frame < frames / 4);
+            if (noise)
+            {
+                value = (Sint32)(random() & 0xffff) - 32768;
+            }
+            else if (signal == SIGNAL_SINE || signal == SIGNAL_NOISE_BURST)
+            {
+                value = (Sint32)std::lround(8000.0 * std::sin(frame * 0.01 * (channel + 1)));
+            }
+            else if (signal == SIGNAL_EXTREMES)
+            {
+                value = (frame + channel) % 3 == 0 ? -32768 : 32767;
+            }
+            samples[(size_t)frame * channels + channel] = (Sint16)value;
+        }
+    }
+    return samples;
+}
+
+// The samples in the device format, as a 16-bit file decodes to
+static std::vector<Uint8> makePcm(const std::vector<Sint16> &samples, Uint16 format)
+{
+    if (format == AUDIO_S16SYS)
+    {
+        std::vector<Uint8> pcm(samples.size() * sizeof(Sint16));
+        std::memcpy(pcm.data(), samples.data(), pcm.size());
+        return pcm;
+    }
+    std::vector<float> scaled(samples.size());
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        scaled[i] = samples[i] / 32768.0f;
+    }
+    std::vector<Uint8> pcm(scaled.size() * sizeof(float));
+    std::memcpy(pcm.data(), scaled.data(), pcm.size());
+    return pcm;
+}
+
+static std::string formatName(Uint16 format)
+{
+    return format == AUDIO_S16SYS ? "S16" : "F32";
+}
+
+// Whatever packPcm writes has to unpack bit for bit, also when it reports
+// the result as not worth keeping
+static void checkRoundTrip(Signal signal, Uint16 format, int channels, Uint32 frames)
+{
+    std::string name = formatName(format) + " " + signalName(signal) + ", " + std::to_string(channels) + " channels, " +
+                       std::to_string(frames) + " frames";
+    std::vector<Uint8> pcm = makePcm(makeSamples(signal, frames, channels, frames + channels), format);
+    std::vector<Uint8> packed;
+    bool smaller = packPcm(pcm.data(), (Uint32)pcm.size(), format, channels, packed);
+    check(!packed.empty(), name + ": nothing was packed");
+    if ((signal == SIGNAL_SILENCE || signal == SIGNAL_SINE) && frames >= 4096)
+    {
+        check(smaller, name + ": did not get smaller");
+    }
+    if (signal == SIGNAL_NOISE && format == AUDIO_S16SYS && frames >= 4096)
+    {
+        check(!smaller, name + ": noise was reported as smaller");
+    }
+
+    std::vector<Uint8> unpacked(pcm.size(), 0xA5);
+    check(unpackPcm(packed, unpacked.data(), (Uint32)unpacked.size(), format, channels), name + ": could not be unpacked");
+    check(unpacked == pcm, name + ": unpacked audio differs");
+}
+
+// Float that 16-bit does not hold exactly must be refused, never rounded
+static void checkRefused()
+{
+    std::vector<float> samples(4096 * 2, 0.25f);
+    std::vector<Uint8> packed;
+    samples[1000] = 0.1f;
+    check(!packPcm((const Uint8 *)samples.data(), (Uint32)(samples.size() * sizeof(float)), AUDIO_F32SYS, 2, packed),
+          "F32 between 16-bit steps was packed");
+    samples[1000] = -0.0f;
+    check(!packPcm((const Uint8 *)samples.data(), (Uint32)(samples.size() * sizeof(float)), AUDIO_F32SYS, 2, packed),
+          "F32 negative zero was packed");
+    samples[1000] = 1.0f;
+    check(!packPcm((const Uint8 *)samples.data(), (Uint32)(samples.size() * sizeof(float)), AUDIO_F32SYS, 2, packed),
+          "F32 beyond full scale was packed");
+}
+
+static Track *makeTrack(const std::string &path, const std::vector<Uint8> &pcm, int frameSize)
+{
+    Track *track = new Track;
+    track->path = path;
+    track->chunk = allocateChunk((Uint32)pcm.size());
+    std::memcpy(track->chunk->abuf, pcm.data(), pcm.size());
+    track->frameSize = frameSize;
+    track->frames = pcm.size() / frameSize;
+    track->frequency = 44100;
+    return track;
+}
+
+// The worker packs in the background; waits until it has packed count
+static bool waitForPacked(TrackCache &cache, Uint32 count)
+{
+    for (int i = 0; i < 500; i++)
+    {
+        if (cache.stats().packedTracks == count)
+        {
+            return true;
+        }
+        SDL_Delay(10);
+    }
+    return false;
+}
+
+// A cache with room for three quarters of a track packs every track once
+// released. Compressible ones come back from unpack() as they were;
+// incompressible ones stay decoded until they are dropped.
+static void checkCache(Uint16 format, int channels)
+{
+    const Uint32 frames = 44100 * 3;
+    int frameSize = SDL_AUDIO_BITSIZE(format) / 8 * channels;
+    std::string prefix = formatName(format) + " cache, " + std::to_string(channels) + " channels: ";
+
+    for (Signal signal : {SIGNAL_SINE, SIGNAL_NOISE_BURST, SIGNAL_NOISE})
+    {
+        std::string name = prefix + signalName(signal);
+        std::vector<Uint8> pcm = makePcm(makeSamples(signal, frames, channels, 1), format);
+        TrackCache cache;
+        if (!cache.start(pcm.size() / 4 * 3, true, format, channels))
+        {
+            check(false, name + ": the cache did not start");
+            return;
+        }
+
+        std::string path = std::string("/cache/") + signalName(signal) + ".wav";
+        Track *inserted = makeTrack(path, pcm, frameSize);
+        cache.insert(inserted, 1, 2);
+        freeTrack(cache.acquire(path, 44100, 1, 2)); // A hit while decoded
+        freeTrack(inserted);
+
+        // That handed the last use back and the entry is over budget. 16-bit
+        // noise does not pack; as float it still takes half the space.
+        if (signal == SIGNAL_NOISE && format == AUDIO_S16SYS)
+        {
+            for (int i = 0; i < 500 && cache.stats().decodedTracks != 0; i++)
+            {
+                SDL_Delay(10);
+            }
+            TrackCacheStats stats = cache.stats();
+            check(stats.packedTracks == 0 && stats.packedBytes == 0, name + ": was packed");
+            check(stats.decodedTracks == 0, name + ": was kept over the budget");
+            cache.stop();
+            continue;
+        }
+        if (!waitForPacked(cache, 1))
+        {
+            check(false, name + ": was not packed");
+            cache.stop();
+            continue;
+        }
+        TrackCacheStats stats = cache.stats();
+        check(stats.packedBytes < pcm.size() && stats.unpackedBytes == pcm.size(), name + ": packed sizes are off");
+
+        check(cache.acquire(path, 44100, 1, 2) == nullptr, name + ": acquired while packed");
+        Track *track = cache.unpack(path, 44100, 1, 2);
+        check(track != nullptr && track->chunk != nullptr && track->chunk->alen == pcm.size() &&
+                  std::memcmp(track->chunk->abuf, pcm.data(), pcm.size()) == 0,
+              name + ": unpacked audio differs");
+        freeTrack(track);
+        cache.stop();
+    }
+}
+
+// SDL's main on Windows wants the arguments even when they are not used
+int main(int, char *[])
+{
+    if (SDL_Init(0) != 0)
+    {
+        std::cout << "Failed to initialize SDL: " << SDL_GetError() << std::endl;
+        return 2;
+    }
+
+    Uint32 rounds = 0;
+    for (Uint16 format : {(Uint16)AUDIO_S16SYS, (Uint16)AUDIO_F32SYS})
+    {
+        for (int channels : {1, 2, 6})
+        {
+            // Block boundaries are 4096 frames apart
+            for (Uint32 frames : {1u, 4095u, 4096u, 4097u, 44100u})
+            {
+                for (Signal signal : {SIGNAL_SILENCE, SIGNAL_SINE, SIGNAL_EXTREMES, SIGNAL_NOISE, SIGNAL_NOISE_BURST})
+                {
+                    checkRoundTrip(signal, format, channels, frames);
+                    rounds++;
+                }
+            }
+            checkCache(format, channels);
+        }
+    }
+    checkRefused();
+
+    SDL_Quit();
+    std::cout << rounds << " codec round trips" << std::endl;
+    std::cout << (failures == 0 ? "All cache checks passed" : "Cache checks failed") << std::endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,182 @@
+// Runs random inserts, moves, removes and shuffles on a Playlist next to a
+// plain vector of the same entries, and after each step checks the treap
+// itself and every position against the vector. Exits with 1 if anything
+// is off.
+#include "../playlist.h"
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool ok, const std::string &what)
+{
+    if (!ok)
+    {
+        std::cout << "FAIL: " << what << std::endl;
+        failures++;
+    }
+}
+
+struct Entry
+{
+    PlaylistId id;
+    std::string path;
+};
+
+// The tree, then at(), positionOf(), path() and the walk both ways, all
+// against the model. Stops at the first difference, the rest would follow.
+static bool matches(const Playlist &playlist, const std::vector<Entry> &model, const std::string &step)
+{
+    std::string problem;
+    if (!playlist.validate(problem))
+    {
+        check(false, step + ": " + problem);
+        return false;
+    }
+    if (playlist.size() != model.size())
+    {
+        check(false, step + ": " + std::to_string(playlist.size()) + " entries, expected " + std::to_string(model.size()));
+        return false;
+    }
+    PlaylistId walked = playlist.front();
+    for (Uint32 i = 0; i < model.size(); i++)
+    {
+        const Entry &entry = model[i];
+        if (playlist.at(i) != entry.id || playlist.positionOf(entry.id) != i || playlist.path(entry.id) != entry.path ||
+            walked != entry.id)
+        {
+            check(false, step + ": position " + std::to_string(i) + " holds " + playlist.path(playlist.at(i)) + ", expected " +
+                             entry.path);
+            return false;
+        }
+        walked = playlist.next(walked);
+    }
+    walked = playlist.back();
+    for (Uint32 i = (Uint32)model.size(); i > 0; i--)
+    {
+        if (walked != model[i - 1].id)
+        {
+            check(false, step + ": walking back, position " + std::to_string(i - 1) + " is out of place");
+            return false;
+        }
+        walked = playlist.previous(walked);
+    }
+    if (walked != 0 || playlist.at((Uint32)model.size()) != 0)
+    {
+        check(false, step + ": entries past the ends");
+        return false;
+    }
+    return true;
+}
+
+// The order Playlist::shuffle must produce: the same Fisher-Yates with
+// xorshift64*, applied to the model
+static void shuffleModel(std::vector<Entry> &model, Uint64 seed)
+{
+    Uint64 state = seed != 0 ? seed : 0x9E3779B97F4A7C15ull;
+    for (Uint32 i = (Uint32)model.size() - 1; model.size() > 1 && i > 0; i--)
+    {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        Uint32 j = (Uint32)(((state * 0x2545F4914F6CDD1Dull) >> 32) % (i + 1));
+        std::swap(model[i], model[j]);
+    }
+}
+
+static void checkStale(const Playlist &playlist, PlaylistId id, const std::string &step)
+{
+    check(!playlist.contains(id) && playlist.path(id).empty() && playlist.positionOf(id) == playlist.size() &&
+              playlist.next(id) == 0 && playlist.previous(id) == 0,
+          step + ": a removed id is still accepted");
+}
+
+// SDL's main on Windows wants the arguments even when they are not used
+int main(int, char *[])
+{
+    std::mt19937 random(7);
+    Playlist playlist;
+    std::vector<Entry> model;
+    std::vector<PlaylistId> removed;
+    Uint32 counter = 0;
+    const int steps = 20000;
+
+    for (int step = 0; step < steps && failures == 0; step++)
+    {
+        std::string name = "step " + std::to_string(step);
+        Uint32 choice = random() % 100;
+        if (choice < 40 || model.size() < 2)
+        {
+            // A few folders shared by many files, so interning is exercised
+            std::string path = "/music/" + std::to_string(counter % 7) + "/" + std::to_string(counter) + ".ogg";
+            counter++;
+            Uint32 position = random() % (model.size() + 2);
+            PlaylistId id = playlist.insert(path, position);
+            check(id != 0, name + ": insert failed");
+            model.insert(model.begin() + SDL_min(position, (Uint32)model.size()), Entry{id, path});
+        }
+        else if (choice < 65)
+        {
+            Uint32 from = random() % model.size();
+            Uint32 position = random() % (model.size() + 2);
+            Entry entry = model[from];
+            check(playlist.move(entry.id, position), name + ": move failed");
+            model.erase(model.begin() + from);
+            model.insert(model.begin() + SDL_min(position, (Uint32)model.size()), entry);
+        }
+        else if (choice < 85)
+        {
+            Uint32 from = random() % model.size();
+            PlaylistId id = model[from].id;
+            check(playlist.remove(id), name + ": remove failed");
+            check(!playlist.remove(id), name + ": removed twice");
+            model.erase(model.begin() + from);
+            removed.push_back(id);
+            checkStale(playlist, id, name);
+        }
+        else if (choice < 95)
+        {
+            std::string path = playlist.takeFront();
+            check(path == model.front().path, name + ": takeFront returned " + path + ", expected " + model.front().path);
+            removed.push_back(model.front().id);
+            model.erase(model.begin());
+        }
+        else
+        {
+            Uint64 seed = ((Uint64)random() << 32) | random();
+            playlist.shuffle(seed);
+            shuffleModel(model, seed);
+            name += ", shuffle";
+        }
+        matches(playlist, model, name);
+    }
+
+    // Slots freed above are reused by now; none of the old ids may match
+    // the entries that took their place
+    for (PlaylistId id : removed)
+    {
+        checkStale(playlist, id, "after " + std::to_string(steps) + " steps");
+    }
+
+    // A large shuffle, where the rebuilt tree is deep enough to get wrong
+    for (Uint32 i = 0; i < 100000; i++)
+    {
+        std::string path = "/big/" + std::to_string(i % 100) + "/" + std::to_string(i) + ".flac";
+        model.push_back(Entry{playlist.append(path), path});
+    }
+    playlist.shuffle(12345);
+    shuffleModel(model, 12345);
+    matches(playlist, model, "large shuffle");
+
+    playlist.clear();
+    model.clear();
+    matches(playlist, model, "clear");
+
+    std::cout << steps << " random steps, " << removed.size() << " removed ids rejected" << std::endl;
+    std::cout << (failures == 0 ? "All playlist checks passed" : "Playlist checks failed") << std::endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,243 @@
+// Checks that TrackStream seeks land on the exact frame, for WAV, MP3 and
+// Ogg Vorbis, and that the seek index survives a restart. Takes the fixture
+// directory and a scratch directory; exits with 1 if anything is off.
+#include "../audiofile.h"
+#include "../track.h"
+#include "../trackstream.h"
+
+#include <SDL2/SDL.h>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool ok, const std::string &what)
+{
+    if (!ok)
+    {
+        std::cout << "FAIL: " << what << std::endl;
+        failures++;
+    }
+}
+
+// 16-bit stereo where the left sample holds the low 15 bits of the frame
+// number and the right one the next 15, so every frame can be told apart
+static bool writeRampWav(const std::string &path, int frequency, Uint32 frames)
+{
+    SDL_RWops *file = SDL_RWFromFile(path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    Uint32 bytes = frames * 4;
+    SDL_RWwrite(file, "RIFF", 1, 4);
+    SDL_WriteLE32(file, 36 + bytes);
+    SDL_RWwrite(file, "WAVEfmt ", 1, 8);
+    SDL_WriteLE32(file, 16);
+    SDL_WriteLE16(file, 1);
+    SDL_WriteLE16(file, 2);
+    SDL_WriteLE32(file, frequency);
+    SDL_WriteLE32(file, frequency * 4);
+    SDL_WriteLE16(file, 4);
+    SDL_WriteLE16(file, 16);
+    SDL_RWwrite(file, "data", 1, 4);
+    SDL_WriteLE32(file, bytes);
+    for (Uint32 frame = 0; frame < frames; frame++)
+    {
+        SDL_WriteLE16(file, frame & 0x7fff);
+        SDL_WriteLE16(file, (frame >> 15) & 0x7fff);
+    }
+    SDL_RWclose(file);
+    return true;
+}
+
+// The whole file read front to back, what every seek must agree with
+static bool decodeWhole(const std::string &path, std::vector<float> &samples, int &channels, int &frequency)
+{
+    AudioFileReader reader;
+    if (!reader.open(path) || reader.length() == 0)
+    {
+        return false;
+    }
+    channels = reader.channelCount();
+    frequency = reader.frequency();
+    samples.resize((size_t)reader.length() * channels);
+    Uint64 done = 0;
+    while (done < reader.length())
+    {
+        Uint32 got = reader.read(samples.data() + done * channels, (Uint32)SDL_min((Uint64)4096, reader.length() - done));
+        if (got == 0)
+        {
+            break;
+        }
+        done += got;
+    }
+    samples.resize((size_t)done * channels);
+    return done == reader.length();
+}
+
+// Opens the file as a stream at its own rate and channel count as float, so
+// nothing is converted, and reads it at random places in random order.
+// Decoders may round a little differently after a seek, never by a frame.
+static void checkStreamSeeks(const std::string &path, double tolerance)
+{
+    std::vector<float> whole;
+    int channels = 0;
+    int frequency = 0;
+    if (!decodeWhole(path, whole, channels, frequency))
+    {
+        check(false, path + ": could not be decoded");
+        return;
+    }
+    Uint64 frames = whole.size() / channels;
+
+    TrackStream stream;
+    stream.setBlocking(true);
+    if (!stream.open(path, frequency, AUDIO_F32SYS, channels, RESAMPLER_MEDIUM))
+    {
+        check(false, path + ": could not be streamed");
+        return;
+    }
+    check(stream.frames() == frames, path + ": stream length differs from the decoded length");
+
+    std::mt19937 random(1);
+    double worst = 0.0;
+    int misplaced = 0;
+    for (int i = 0; i < 200; i++)
+    {
+        Uint64 frame = random() % frames;
+        Uint32 count = 64;
+        const float *pcm = (const float *)stream.read(frame, count);
+        if (pcm == nullptr || count == 0 || count > 64 || frame + count > frames)
+        {
+            misplaced++;
+            continue;
+        }
+        for (Uint32 j = 0; j < count * channels; j++)
+        {
+            worst = SDL_max(worst, (double)std::fabs(pcm[j] - whole[frame * channels + j]));
+        }
+    }
+    check(misplaced == 0, path + ": " + std::to_string(misplaced) + " reads came back empty or too long");
+    check(worst <= tolerance, path + ": a seek landed off its frame, difference " + std::to_string(worst));
+    std::cout << path << ": " << frames << " frames, largest difference after a seek " << worst << std::endl;
+}
+
+static std::string readFile(const std::string &path)
+{
+    std::ifstream in(path);
+    std::stringstream text;
+    text << in.rdbuf();
+    return text.str();
+}
+
+// A stream keeps the MP3's frame table in the index file. After a restart
+// the reader opens from it instead of reading the file through: the length
+// it reports is the one in the file, which is shortened here to tell.
+static void checkSeekIndexReload(const std::string &mp3, const std::string &indexFile)
+{
+    std::remove(indexFile.c_str());
+    setSeekIndexFile(indexFile);
+    Uint64 frames;
+    SeekTable scanned;
+    {
+        TrackStream stream;
+        if (!stream.open(mp3, 44100, AUDIO_F32SYS, 2, RESAMPLER_MEDIUM))
+        {
+            check(false, mp3 + ": could not be streamed");
+            return;
+        }
+        frames = stream.frames();
+        AudioFileReader reader;
+        reader.open(mp3);
+        scanned = reader.seekTable();
+    }
+    check(!scanned.points.empty(), mp3 + ": no seek table");
+
+    std::istringstream lines(readFile(indexFile));
+    std::string header;
+    std::string line;
+    std::getline(lines, header);
+    std::getline(lines, line);
+    std::istringstream fields(line);
+    Sint64 size;
+    Sint64 modified;
+    Uint64 storedFrames = 0;
+    size_t count = 0;
+    fields >> size >> modified >> storedFrames >> count;
+    check(storedFrames == frames && count == scanned.points.size(), indexFile + ": does not hold the table of " + mp3);
+
+    std::string shortened = std::to_string(size) + '\t' + std::to_string(modified) + '\t' + std::to_string(frames - 1000) +
+                            line.substr(line.find('\t', line.find('\t', line.find('\t') + 1) + 1));
+    std::ofstream(indexFile, std::ios::trunc) << header << '\n' << shortened << '\n';
+
+    setSeekIndexFile(indexFile);
+    AudioFileReader reader;
+    check(openWithSeekTable(reader, mp3), mp3 + ": could not be opened after the restart");
+    check(reader.length() == frames - 1000, mp3 + ": the seek table was not taken from the index after a restart");
+    SeekTable restored = reader.seekTable();
+    bool same = restored.points.size() == scanned.points.size();
+    for (size_t i = 0; same && i < restored.points.size(); i++)
+    {
+        same = restored.points[i].frame == scanned.points[i].frame && restored.points[i].offset == scanned.points[i].offset;
+    }
+    check(same, mp3 + ": the restored seek table differs from the scanned one");
+
+    // And seeks through the restored table still land where a full decode does
+    std::vector<float> whole;
+    int channels = 0;
+    int frequency = 0;
+    decodeWhole(mp3, whole, channels, frequency);
+    std::vector<float> piece(256 * channels);
+    double worst = 0.0;
+    for (Uint64 frame : {(Uint64)70000, (Uint64)1153, (Uint64)40000, (Uint64)0})
+    {
+        if (!reader.seek(frame) || reader.read(piece.data(), 256) != 256)
+        {
+            check(false, mp3 + ": could not seek to " + std::to_string(frame) + " after the restart");
+            continue;
+        }
+        for (size_t j = 0; j < piece.size(); j++)
+        {
+            worst = SDL_max(worst, (double)std::fabs(piece[j] - whole[frame * channels + j]));
+        }
+    }
+    check(worst <= 1e-6, mp3 + ": a seek after the restart landed off its frame");
+    setSeekIndexFile("");
+    std::remove(indexFile.c_str());
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        std::cout << "Usage: streamcheck <fixture directory> <scratch directory>" << std::endl;
+        return 2;
+    }
+    std::string fixtures = std::string(argv[1]) + "/";
+    std::string scratch = std::string(argv[2]) + "/";
+
+    std::string ramp = scratch + "ramp.wav";
+    check(writeRampWav(ramp, 48000, 48000 * 40), ramp + ": could not be written");
+    checkStreamSeeks(ramp, 0.0);
+    std::vector<float> whole;
+    int channels;
+    int frequency;
+    check(decodeWhole(ramp, whole, channels, frequency) && whole[2 * 1234567] * 32768.0f == (1234567 & 0x7fff) &&
+              whole[2 * 1234567 + 1] * 32768.0f == (1234567 >> 15),
+          ramp + ": frames are not numbered");
+
+    checkStreamSeeks(fixtures + "vbr_stereo_44k.mp3", 1e-6);
+    checkStreamSeeks(fixtures + "vorbis_stereo_44k.ogg", 1e-6);
+    checkSeekIndexReload(fixtures + "vbr_stereo_44k.mp3", scratch + "seekindex.txt");
+
+    std::remove(ramp.c_str());
+    std::cout << (failures == 0 ? "All stream checks passed" : "Stream checks failed") << std::endl;
+    return failures == 0 ? 0 : 1;
+}
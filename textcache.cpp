@@ -0,0 +1,86 @@
+#include "textcache.h"
+
+#include <iostream>
+
+TextCache::TextCache(SDL_Renderer *renderer, size_t maxBytes)
+    : renderer(renderer), maxBytes(maxBytes)
+{
+}
+
+TextCache::~TextCache()
+{
+    clear();
+}
+
+const CachedText *TextCache::get(TTF_Font *font, const std::string &text, SDL_Color color)
+{
+    if (text.empty())
+    {
+        return nullptr;
+    }
+
+    // The key packs the font pointer and the color in front of the string itself
+    std::string key;
+    key.reserve(sizeof(font) + sizeof(color) + text.size());
+    key.append(reinterpret_cast<const char *>(&font), sizeof(font));
+    key.append(reinterpret_cast<const char *>(&color), sizeof(color));
+    key.append(text);
+
+    auto found = index.find(key);
+    if (found != index.end())
+    {
+        hitCount++;
+        lru.splice(lru.begin(), lru, found->second);
+        return &found->second->text;
+    }
+
+    missCount++;
+    SDL_Surface *surface = TTF_RenderText_Solid(font, text.c_str(), color);
+    if (surface == nullptr)
+    {
+        std::cout << "Failed to render text: " << TTF_GetError() << std::endl;
+        return nullptr;
+    }
+
+    SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, surface);
+    CachedText cached = {texture, surface->w, surface->h};
+    SDL_FreeSurface(surface);
+    if (texture == nullptr)
+    {
+        std::cout << "Failed to create text texture: " << SDL_GetError() << std::endl;
+        return nullptr;
+    }
+
+    // Textures are stored as 32-bit pixels by the renderer
+    size_t bytes = static_cast<size_t>(cached.w) * cached.h * 4;
+    lru.push_front({key, cached, bytes});
+    index[key] = lru.begin();
+    usedBytes += bytes;
+    evict();
+
+    return &lru.front().text;
+}
+
+void TextCache::clear()
+{
+    for (Entry &entry : lru)
+    {
+        SDL_DestroyTexture(entry.text.texture);
+    }
+    lru.clear();
+    index.clear();
+    usedBytes = 0;
+}
+
+void TextCache::evict()
+{
+    // Never evict the entry that was just inserted, even if it alone exceeds the cap
+    while (usedBytes > maxBytes && lru.size() > 1)
+    {
+        Entry &oldest = lru.back();
+        SDL_DestroyTexture(oldest.text.texture);
+        usedBytes -= oldest.bytes;
+        index.erase(oldest.key);
+        lru.pop_back();
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef TEXTCACHE_H
+#define TEXTCACHE_H
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+#include <cstddef>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+struct CachedText
+{
+    SDL_Texture *texture;
+    int w;
+    int h;
+};
+
+// Keeps rendered text textures keyed by (font, string, color) so labels are
+// only rasterized and uploaded when their content changes. Least recently
+// used entries are destroyed once the texture memory exceeds maxBytes.
+class TextCache
+{
+public:
+    TextCache(SDL_Renderer *renderer, size_t maxBytes);
+    ~TextCache();
+
+    TextCache(const TextCache &) = delete;
+    TextCache &operator=(const TextCache &) = delete;
+
+    // Returns nullptr if the text could not be rendered (e.g. empty string)
+    const CachedText *get(TTF_Font *font, const std::string &text, SDL_Color color);
+    void clear();
+
+    Uint64 hits() const { return hitCount; }
+    Uint64 misses() const { return missCount; }
+    size_t bytesUsed() const { return usedBytes; }
+    size_t entries() const { return lru.size(); }
+
+private:
+    struct Entry
+    {
+        std::string key;
+        CachedText text;
+        size_t bytes;
+    };
+
+    void evict();
+
+    SDL_Renderer *renderer;
+    size_t maxBytes;
+    size_t usedBytes = 0;
+    Uint64 hitCount = 0;
+    Uint64 missCount = 0;
+    std::list<Entry> lru; // Most recently used at the front
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+};
+
+#endif
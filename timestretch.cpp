@@ -0,0 +1,595 @@
+#include "timestretch.h"
+#include "dotproduct.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+const double PI = 3.14159265358979323846;
+const float TWO_PI_F = 6.28318530717958647692f;
+const float PI_F = 3.14159265358979323846f;
+
+bool parseStretchMode(const std::string &name, StretchMode &mode)
+{
+    if (name == "speech")
+    {
+        mode = STRETCH_SPEECH;
+        return true;
+    }
+    if (name == "music")
+    {
+        mode = STRETCH_MUSIC;
+        return true;
+    }
+    return false;
+}
+
+const char *stretchModeName(StretchMode mode)
+{
+    return mode == STRETCH_SPEECH ? "speech" : "music";
+}
+
+// Wraps a phase into [-pi, pi)
+static inline float wrapPhase(float phase)
+{
+    return phase - TWO_PI_F * std::floor((phase + PI_F) / TWO_PI_F);
+}
+
+bool TimeStretch::init(int frequency, int channels)
+{
+    if (frequency <= 0 || channels <= 0)
+    {
+        return false;
+    }
+
+    // About 43 ms vocoder frames at any rate, 2048 frames up to 48 kHz
+    this->channels = channels;
+    fftSize = 2048;
+    while ((Sint64)fftSize * 48000 < (Sint64)2048 * frequency)
+    {
+        fftSize *= 2;
+    }
+    hop = fftSize / 4;
+    tolerance = hop; // Covers a pitch period of voices down to 45 Hz
+
+    // Periodic Hann windows: the WSOLA one sums to 1 at half overlap, the
+    // square of the vocoder one to 1.5 at quarter hops
+    vocoderWindow.resize(fftSize);
+    for (int i = 0; i < fftSize; i++)
+    {
+        vocoderWindow[i] = (float)(0.5 - 0.5 * std::cos(2.0 * PI * i / fftSize));
+    }
+    wsolaWindow.resize(2 * hop);
+    for (int i = 0; i < 2 * hop; i++)
+    {
+        wsolaWindow[i] = (float)(0.5 - 0.5 * std::cos(2.0 * PI * i / (2 * hop)));
+    }
+
+    int bits = 0;
+    while ((1 << bits) < fftSize)
+    {
+        bits++;
+    }
+    bitReverse.resize(fftSize);
+    for (int i = 0; i < fftSize; i++)
+    {
+        int reversed = 0;
+        for (int bit = 0; bit < bits; bit++)
+        {
+            reversed |= (i >> bit & 1) << (bits - 1 - bit);
+        }
+        bitReverse[i] = reversed;
+    }
+    cosTable.resize(fftSize / 2);
+    sinTable.resize(fftSize / 2);
+    for (int k = 0; k < fftSize / 2; k++)
+    {
+        cosTable[k] = (float)std::cos(2.0 * PI * k / fftSize);
+        sinTable[k] = (float)-std::sin(2.0 * PI * k / fftSize);
+    }
+
+    int bins = fftSize / 2 + 1;
+    overlap.assign((size_t)fftSize * channels, 0.0f);
+    stretched.assign((size_t)(hop + 8) * channels, 0.0f);
+    real.assign(fftSize, 0.0f);
+    imag.assign(fftSize, 0.0f);
+    magnitude.assign((size_t)bins * channels, 0.0f);
+    phase.assign((size_t)bins * channels, 0.0f);
+    previousPhase.assign((size_t)bins * channels, 0.0f);
+    synthesisPhase.assign((size_t)bins * channels, 0.0f);
+    peaks.assign(bins, 0);
+    pattern.assign(hop, 0.0f);
+    region.assign(2 * tolerance + hop + 8, 0.0f);
+
+    // A WSOLA hop reads from where the previous frame continues to past the
+    // search range, which is furthest apart at the highest speed and pitch
+    int advance = (int)std::ceil(hop * STRETCH_MAX_SPEED * std::exp2(STRETCH_MAX_SEMITONES / 12.0f));
+    input.assign((size_t)SDL_max(fftSize + hop, advance + hop + 2 * tolerance + 2) * channels, 0.0f);
+
+    speed = 1.0f;
+    semitones = 0.0f;
+    pitch = 1.0f;
+    reset(0.0);
+    return true;
+}
+
+void TimeStretch::setParameters(float speed, float semitones, StretchMode mode)
+{
+    this->speed = SDL_clamp(speed, STRETCH_MIN_SPEED, STRETCH_MAX_SPEED);
+    this->semitones = SDL_clamp(semitones, -STRETCH_MAX_SEMITONES, STRETCH_MAX_SEMITONES);
+    this->mode = mode;
+    pitch = this->semitones == 0.0f ? 1.0f : std::exp2(this->semitones / 12.0f);
+}
+
+void TimeStretch::reset(double trackFrame)
+{
+    // Frames start this many hops before the first one that is complete, so
+    // synthesis starts that far back and drops them again. At speed 1 the
+    // first kept output frame is then exactly trackFrame.
+    int frameLength = mode == STRETCH_MUSIC ? fftSize : 2 * hop;
+    preroll = frameLength / hop - 1;
+    media = trackFrame;
+    analysis = trackFrame - (double)preroll * hop * speed / pitch;
+    first = true;
+    std::fill(overlap.begin(), overlap.end(), 0.0f);
+    stretchedFrames = 0;
+    readPosition = 0.0;
+}
+
+int TimeStretch::render(StretchSource source, void *context, Uint64 trackFrames, float *out, int frames, float gain)
+{
+    this->source = source;
+    this->context = context;
+    this->trackFrames = trackFrames;
+    starved = false;
+    for (; preroll > 0; preroll--)
+    {
+        if (!synthesizeHop())
+        {
+            starved = true;
+            break;
+        }
+        stretchedFrames = 0;
+    }
+
+    int written = 0;
+    while (!starved && written < frames && media < trackFrames)
+    {
+        int base = (int)readPosition;
+        if (base + 2 >= stretchedFrames)
+        {
+            // Keep the frame before base for the interpolator, drop the rest
+            int drop = SDL_max(base - 1, 0);
+            SDL_memmove(stretched.data(), stretched.data() + (size_t)drop * channels,
+                        (size_t)(stretchedFrames - drop) * channels * sizeof(float));
+            stretchedFrames -= drop;
+            readPosition -= drop;
+            starved = !synthesizeHop();
+            continue;
+        }
+
+        // Catmull-Rom between base and base + 1, exact when the pitch is unchanged
+        float t = (float)(readPosition - base);
+        const float *p1 = &stretched[(size_t)base * channels];
+        const float *p0 = base > 0 ? p1 - channels : p1;
+        const float *p2 = p1 + channels;
+        const float *p3 = p2 + channels;
+        float *frame = out + (size_t)written * channels;
+        for (int c = 0; c < channels; c++)
+        {
+            float value = p1[c] + 0.5f * t * (p2[c] - p0[c] + t * (2.0f * p0[c] - 5.0f * p1[c] + 4.0f * p2[c] - p3[c] +
+                                                               t * (3.0f * (p1[c] - p2[c]) + p3[c] - p0[c])));
+            frame[c] = value * gain;
+        }
+        readPosition += pitch;
+        media += speed;
+        written++;
+    }
+
+    this->source = nullptr;
+    this->context = nullptr;
+    return written;
+}
+
+float TimeStretch::sampleAt(Sint64 frame, int channel) const
+{
+    Sint64 index = frame - inputStart;
+    if (index < 0 || index >= inputFrames)
+    {
+        return 0.0f;
+    }
+    return input[(size_t)index * channels + channel];
+}
+
+// Copies track frames [begin, end) to input, silence outside the track.
+// False if the source does not have all of them right now.
+bool TimeStretch::gather(Sint64 begin, Sint64 end)
+{
+    Sint64 capacity = (Sint64)(input.size() / channels);
+    begin = SDL_max(begin, end - capacity);
+    inputStart = begin;
+    inputFrames = end - begin;
+    std::fill(input.begin(), input.begin() + (size_t)inputFrames * channels, 0.0f);
+
+    Sint64 frame = SDL_max(begin, (Sint64)0);
+    Sint64 last = SDL_min(end, (Sint64)trackFrames);
+    while (frame < last)
+    {
+        Uint32 count = (Uint32)(last - frame);
+        const float *samples = source(context, (Uint64)frame, count);
+        if (count == 0)
+        {
+            return false;
+        }
+        SDL_memcpy(&input[(size_t)(frame - begin) * channels], samples, (size_t)count * channels * sizeof(float));
+        frame += count;
+    }
+    return true;
+}
+
+// Nothing changes when the input of the hop is missing, the same hop is
+// tried again on the next render()
+bool TimeStretch::synthesizeHop()
+{
+    if (!(mode == STRETCH_SPEECH ? wsolaFrame() : vocoderFrame()))
+    {
+        return false;
+    }
+    first = false;
+    analysis += hop * (double)speed / pitch;
+
+    // No later frame reaches into the first hop of the accumulator any more
+    SDL_memcpy(&stretched[(size_t)stretchedFrames * channels], overlap.data(), (size_t)hop * channels * sizeof(float));
+    stretchedFrames += hop;
+    SDL_memmove(overlap.data(), overlap.data() + (size_t)hop * channels, (size_t)(fftSize - hop) * channels * sizeof(float));
+    std::fill(overlap.end() - (size_t)hop * channels, overlap.end(), 0.0f);
+    return true;
+}
+
+bool TimeStretch::wsolaFrame()
+{
+    Sint64 nominal = (Sint64)std::llround(analysis);
+    Sint64 start = nominal;
+    if (!gather(first ? nominal : SDL_min(nominal - tolerance, previousStart + hop), nominal + tolerance + 2 * hop + 1))
+    {
+        return false;
+    }
+    if (!first)
+    {
+        // Find where around the nominal position the track looks most like
+        // what would have followed the previous frame, on a mono mix
+        Sint64 natural = previousStart + hop;
+        int span = 2 * tolerance + hop + 1;
+        for (int i = 0; i < hop; i++)
+        {
+            float sum = 0.0f;
+            for (int c = 0; c < channels; c++)
+            {
+                sum += sampleAt(natural + i, c);
+            }
+            pattern[i] = sum;
+        }
+        for (int i = 0; i < span; i++)
+        {
+            float sum = 0.0f;
+            for (int c = 0; c < channels; c++)
+            {
+                sum += sampleAt(nominal - tolerance + i, c);
+            }
+            region[i] = sum;
+        }
+
+        DotProduct dot = dotProductKernel();
+        double energy = 0.0;
+        for (int i = 0; i < hop; i++)
+        {
+            energy += (double)region[i] * region[i];
+        }
+        double best = -1.0;
+        int bestOffset = tolerance;
+        for (int offset = 0; offset <= 2 * tolerance; offset++)
+        {
+            // Normalized, so loud candidates do not win by level alone
+            double score = dot(pattern.data(), region.data() + offset, hop) / std::sqrt(SDL_max(energy, 0.0) + 1e-9);
+            if (score > best)
+            {
+                best = score;
+                bestOffset = offset;
+            }
+            energy += (double)region[offset + hop] * region[offset + hop] - (double)region[offset] * region[offset];
+        }
+        start = nominal - tolerance + bestOffset;
+    }
+    previousStart = start;
+
+    for (int i = 0; i < 2 * hop; i++)
+    {
+        float weight = wsolaWindow[i];
+        float *frame = &overlap[(size_t)i * channels];
+        for (int c = 0; c < channels; c++)
+        {
+            frame[c] += weight * sampleAt(start + i, c);
+        }
+    }
+    return true;
+}
+
+bool TimeStretch::vocoderFrame()
+{
+    int bins = fftSize / 2 + 1;
+    Sint64 start = (Sint64)std::llround(analysis);
+    if (!gather(start - hop, start + fftSize))
+    {
+        return false;
+    }
+    // Analysis and synthesis window, inverse FFT and the overlap of four frames
+    float scale = 1.0f / (fftSize * 1.5f);
+
+    for (int c = 0; c < channels; c += 2)
+    {
+        int second = c + 1 < channels ? c + 1 : -1;
+        float *magnitude0 = &magnitude[(size_t)c * bins];
+        float *phase0 = &phase[(size_t)c * bins];
+        float *synthesis0 = &synthesisPhase[(size_t)c * bins];
+        float *magnitude1 = second >= 0 ? &magnitude[(size_t)second * bins] : nullptr;
+        float *phase1 = second >= 0 ? &phase[(size_t)second * bins] : nullptr;
+        float *synthesis1 = second >= 0 ? &synthesisPhase[(size_t)second * bins] : nullptr;
+
+        analyze(start, c, second, magnitude0, phase0, magnitude1, phase1);
+        if (first)
+        {
+            std::copy(phase0, phase0 + bins, synthesis0);
+            if (second >= 0)
+            {
+                std::copy(phase1, phase1 + bins, synthesis1);
+            }
+        }
+        else
+        {
+            // The same frame one hop earlier gives every bin's frequency
+            float *previous0 = &previousPhase[(size_t)c * bins];
+            float *previous1 = second >= 0 ? &previousPhase[(size_t)second * bins] : nullptr;
+            analyze(start - hop, c, second, nullptr, previous0, nullptr, previous1);
+            propagatePhases(magnitude0, phase0, previous0, synthesis0);
+            if (second >= 0)
+            {
+                propagatePhases(magnitude1, phase1, previous1, synthesis1);
+            }
+        }
+
+        // Both channels go back through one inverse FFT as z = x + iy,
+        // computed as the conjugate of the forward FFT of the conjugate
+        for (int k = 0; k < bins; k++)
+        {
+            bool edge = k == 0 || k == bins - 1; // DC and Nyquist are real
+            float xr = magnitude0[k] * std::cos(synthesis0[k]);
+            float xi = edge ? 0.0f : magnitude0[k] * std::sin(synthesis0[k]);
+            float yr = second >= 0 ? magnitude1[k] * std::cos(synthesis1[k]) : 0.0f;
+            float yi = second >= 0 && !edge ? magnitude1[k] * std::sin(synthesis1[k]) : 0.0f;
+            real[k] = xr - yi;
+            imag[k] = -(xi + yr);
+            if (!edge)
+            {
+                real[fftSize - k] = xr + yi;
+                imag[fftSize - k] = -(yr - xi);
+            }
+        }
+        fft(real.data(), imag.data());
+
+        for (int i = 0; i < fftSize; i++)
+        {
+            float weight = vocoderWindow[i] * scale;
+            float *frame = &overlap[(size_t)i * channels];
+            frame[c] += real[i] * weight;
+            if (second >= 0)
+            {
+                frame[second] -= imag[i] * weight;
+            }
+        }
+    }
+    return true;
+}
+
+// Spectra of two channels of the frame at start, from one complex FFT.
+// Magnitudes are skipped when their pointers are null.
+void TimeStretch::analyze(Sint64 start, int firstChannel, int secondChannel, float *magnitude0, float *phase0, float *magnitude1, float *phase1)
+{
+    for (int i = 0; i < fftSize; i++)
+    {
+        float weight = vocoderWindow[i];
+        real[i] = weight * sampleAt(start + i, firstChannel);
+        imag[i] = secondChannel >= 0 ? weight * sampleAt(start + i, secondChannel) : 0.0f;
+    }
+    fft(real.data(), imag.data());
+
+    int bins = fftSize / 2 + 1;
+    for (int k = 0; k < bins; k++)
+    {
+        // X[k] = (Z[k] + conj(Z[N - k])) / 2, Y[k] = (Z[k] - conj(Z[N - k])) / 2i
+        int mirror = (fftSize - k) & (fftSize - 1);
+        float xr = 0.5f * (real[k] + real[mirror]);
+        float xi = 0.5f * (imag[k] - imag[mirror]);
+        if (magnitude0 != nullptr)
+        {
+            magnitude0[k] = std::sqrt(xr * xr + xi * xi);
+        }
+        phase0[k] = std::atan2(xi, xr);
+        if (secondChannel >= 0)
+        {
+            float yr = 0.5f * (imag[k] + imag[mirror]);
+            float yi = -0.5f * (real[k] - real[mirror]);
+            if (magnitude1 != nullptr)
+            {
+                magnitude1[k] = std::sqrt(yr * yr + yi * yi);
+            }
+            phase1[k] = std::atan2(yi, yr);
+        }
+    }
+}
+
+// Advances the synthesis phase of every spectral peak by its measured
+// frequency over one hop and keeps the bins around it at the same phase
+// offsets from it as in the analysis, which holds partials together
+void TimeStretch::propagatePhases(const float *magnitude, const float *phase, const float *previousPhase, float *synthesis)
+{
+    int bins = fftSize / 2 + 1;
+    int peakCount = 0;
+    for (int k = 1; k < bins - 1; k++)
+    {
+        if (magnitude[k] > magnitude[k - 1] && magnitude[k] >= magnitude[k + 1])
+        {
+            peaks[peakCount++] = k;
+        }
+    }
+
+    auto advance = [&](int k) {
+        float expected = TWO_PI_F * k * hop / fftSize;
+        float deviation = wrapPhase(phase[k] - previousPhase[k] - expected);
+        synthesis[k] = wrapPhase(synthesis[k] + expected + deviation);
+    };
+
+    if (peakCount == 0)
+    {
+        for (int k = 0; k < bins; k++)
+        {
+            advance(k);
+        }
+        return;
+    }
+
+    for (int i = 0; i < peakCount; i++)
+    {
+        advance(peaks[i]);
+    }
+    int nearest = 0;
+    for (int k = 0; k < bins; k++)
+    {
+        while (nearest + 1 < peakCount && peaks[nearest + 1] - k <= k - peaks[nearest])
+        {
+            nearest++;
+        }
+        int peak = peaks[nearest];
+        if (k != peak)
+        {
+            synthesis[k] = synthesis[peak] + phase[k] - phase[peak];
+        }
+    }
+}
+
+// In place radix-2 forward FFT of fftSize points
+void TimeStretch::fft(float *real, float *imag) const
+{
+    for (int i = 0; i < fftSize; i++)
+    {
+        int j = bitReverse[i];
+        if (i < j)
+        {
+            std::swap(real[i], real[j]);
+            std::swap(imag[i], imag[j]);
+        }
+    }
+
+    for (int size = 2; size <= fftSize; size *= 2)
+    {
+        int half = size / 2;
+        int step = fftSize / size;
+        for (int start = 0; start < fftSize; start += size)
+        {
+            for (int k = 0; k < half; k++)
+            {
+                float wr = cosTable[k * step];
+                float wi = sinTable[k * step];
+                int a = start + k;
+                int b = a + half;
+                float tr = real[b] * wr - imag[b] * wi;
+                float ti = real[b] * wi + imag[b] * wr;
+                real[b] = real[a] - tr;
+                imag[b] = imag[a] - ti;
+                real[a] += tr;
+                imag[a] += ti;
+            }
+        }
+    }
+}
+
+// A voice-like signal: a 120 Hz pulse train with two formant-like
+// harmonics, chopped into 200 ms syllables
+static std::vector<float> generateSpeech(int frequency, int channels, int seconds)
+{
+    std::vector<float> audio((size_t)frequency * seconds * channels);
+    for (size_t i = 0; i < audio.size() / channels; i++)
+    {
+        double t = (double)i / frequency;
+        double envelope = std::fmod(t, 0.2) < 0.15 ? 1.0 : 0.0;
+        double voice = 0.3 * std::sin(2.0 * PI * 120.0 * t) + 0.2 * std::sin(2.0 * PI * 720.0 * t) + 0.1 * std::sin(2.0 * PI * 2400.0 * t);
+        for (int c = 0; c < channels; c++)
+        {
+            audio[i * channels + c] = (float)(envelope * voice);
+        }
+    }
+    return audio;
+}
+
+// A music-like signal: an A major chord with a little noise
+static std::vector<float> generateMusic(int frequency, int channels, int seconds)
+{
+    std::vector<float> audio((size_t)frequency * seconds * channels);
+    Uint32 seed = 12345;
+    for (size_t i = 0; i < audio.size() / channels; i++)
+    {
+        double t = (double)i / frequency;
+        double chord = 0.2 * (std::sin(2.0 * PI * 440.0 * t) + std::sin(2.0 * PI * 554.37 * t) + std::sin(2.0 * PI * 659.25 * t));
+        for (int c = 0; c < channels; c++)
+        {
+            seed = seed * 1664525 + 1013904223;
+            audio[i * channels + c] = (float)(chord + (Sint16)(seed >> 16) / 327680.0);
+        }
+    }
+    return audio;
+}
+
+void benchmarkTimeStretch()
+{
+    const int frequency = 48000;
+    const int channels = 2;
+    const int seconds = 20;
+    const int bufferFrames = 1024;
+    const float speeds[] = {0.5f, 1.5f, 3.0f, 1.0f};
+    const float pitches[] = {0.0f, 0.0f, 0.0f, 5.0f};
+
+    std::cout << "Time stretch kernel: " << dotProductKernelName() << std::endl;
+    for (int m = STRETCH_SPEECH; m <= STRETCH_MUSIC; m++)
+    {
+        StretchMode mode = (StretchMode)m;
+        std::vector<float> track = mode == STRETCH_SPEECH ? generateSpeech(frequency, channels, seconds)
+                                                          : generateMusic(frequency, channels, seconds);
+        Uint64 trackFrames = track.size() / channels;
+        StretchSource source = [](void *context, Uint64 frame, Uint32 &count) -> const float * {
+            const std::vector<float> &track = *(const std::vector<float> *)context;
+            count = (Uint32)SDL_min((Uint64)count, track.size() / channels - frame);
+            return track.data() + frame * channels;
+        };
+        std::vector<float> buffer((size_t)bufferFrames * channels);
+
+        TimeStretch stretch;
+        stretch.init(frequency, channels);
+        for (int i = 0; i < 4; i++)
+        {
+            stretch.setParameters(speeds[i], pitches[i], mode);
+            stretch.reset(0.0);
+
+            Uint64 begin = SDL_GetPerformanceCounter();
+            Uint64 produced = 0;
+            int written;
+            do
+            {
+                written = stretch.render(source, &track, trackFrames, buffer.data(), bufferFrames, 1.0f);
+                produced += written;
+            } while (written == bufferFrames);
+            double elapsed = (double)(SDL_GetPerformanceCounter() - begin) / SDL_GetPerformanceFrequency();
+
+            std::cout << "Time stretch " << stretchModeName(mode) << " at " << speeds[i] << "x, " << pitches[i] << " semitones: "
+                      << (double)produced / frequency / elapsed << "x real time in stereo" << std::endl;
+        }
+    }
+}
@@ -0,0 +1,136 @@
+#ifndef TIMESTRETCH_H
+#define TIMESTRETCH_H
+
+#include <SDL2/SDL.h>
+#include <string>
+#include <vector>
+
+enum StretchMode
+{
+    STRETCH_SPEECH, // WSOLA, keeps the waveform intact: voices, podcasts, lectures
+    STRETCH_MUSIC   // Phase vocoder, keeps the spectrum intact: sustained tones, chords
+};
+
+bool parseStretchMode(const std::string &name, StretchMode &mode);
+const char *stretchModeName(StretchMode mode);
+
+const float STRETCH_MIN_SPEED = 0.5f;
+const float STRETCH_MAX_SPEED = 3.0f;
+const float STRETCH_MAX_SEMITONES = 12.0f;
+
+// Points at up to count frames of interleaved float from frame on and sets
+// count to how many there are in a row, 0 if there are none right now
+typedef const float *(*StretchSource)(void *context, Uint64 frame, Uint32 &count);
+
+// Plays a decoded track faster or slower without changing its pitch, and
+// shifts its pitch without changing the speed. The stretcher asks the track
+// for whatever range each hop needs, wherever it is, and only keeps that
+// range instead of buffering input.
+//
+// Output is built in hops of a fixed number of frames, each one an
+// overlap-add of windowed frames taken from the track at the analysis
+// position, which moves speed / pitch track frames per output frame:
+// - WSOLA shifts every frame by up to one hop so that it lines up with the
+//   natural continuation of the previous one (a SIMD cross-correlation).
+// - The phase vocoder takes the spectrum of each frame and advances every
+//   bin's phase by its measured frequency times the hop, locking the bins
+//   around each peak to it (identity phase locking). Channels are
+//   transformed two at a time as the real and imaginary part of one FFT.
+// For a pitch shift the stretched audio is then resampled by the pitch
+// ratio with a cubic interpolator, which brings the speed back to the one
+// asked for. The amount of work per output frame does not depend on the
+// speed, 3x costs the same as 1x.
+class TimeStretch
+{
+public:
+    // Allocates everything; nothing later does
+    bool init(int frequency, int channels);
+
+    // Rendering thread. A speed of 1 and no pitch shift turn it off. Call
+    // reset() afterwards when it was off before or the mode changed.
+    void setParameters(float speed, float semitones, StretchMode mode);
+    bool active() const { return speed != 1.0f || pitch != 1.0f; }
+    float currentSpeed() const { return speed; }
+    float currentSemitones() const { return semitones; }
+    StretchMode currentMode() const { return mode; }
+
+    // Starts over at trackFrame, for a new track, a seek or a new mode
+    void reset(double trackFrame);
+
+    // Writes up to frames frames of interleaved output for the track that
+    // source reads (trackFrames long), scaled by gain. Returns fewer when the
+    // track ends, or when the source does not have frames a hop needs yet,
+    // see starving(). Frames before and after the track read as silence.
+    int render(StretchSource source, void *context, Uint64 trackFrames, float *out, int frames, float gain);
+    // The last render() stopped at mediaFrame() for frames the source did
+    // not have; the next one carries on from there
+    bool starving() const { return starved; }
+
+    // Frame of the track that the next output frame belongs to
+    double mediaFrame() const { return media; }
+
+private:
+    float sampleAt(Sint64 frame, int channel) const;
+    bool gather(Sint64 begin, Sint64 end);
+    bool synthesizeHop();
+    bool wsolaFrame();
+    bool vocoderFrame();
+    void analyze(Sint64 start, int firstChannel, int secondChannel, float *magnitude0, float *phase0, float *magnitude1, float *phase1);
+    void propagatePhases(const float *magnitude, const float *phase, const float *previousPhase, float *synthesis);
+    void fft(float *real, float *imag) const;
+
+    int channels = 0;
+    int fftSize = 0; // Phase vocoder frame, a WSOLA frame is half of it
+    int hop = 0;     // Output frames per hop, the same in both modes
+    int tolerance = 0; // WSOLA search range on either side
+
+    float speed = 1.0f;
+    float semitones = 0.0f;
+    float pitch = 1.0f; // Ratio
+    StretchMode mode = STRETCH_MUSIC;
+
+    // The track being rendered, only valid inside render()
+    StretchSource source = nullptr;
+    void *context = nullptr;
+    Uint64 trackFrames = 0;
+    // The part of it the current hop reads
+    std::vector<float> input;
+    Sint64 inputStart = 0;
+    Sint64 inputFrames = 0;
+
+    double media = 0.0;
+    double analysis = 0.0;   // Track frame the next synthesis frame starts at
+    Sint64 previousStart = 0; // Where the last WSOLA frame was actually taken from
+    bool first = true;        // No previous frame to line up with yet
+    bool starved = false;
+    int preroll = 0;          // Hops to synthesize and drop after a reset
+
+    std::vector<float> overlap;   // Overlap-add accumulator, fftSize frames
+    std::vector<float> stretched; // Finished hops waiting for the pitch stage
+    int stretchedFrames = 0;
+    double readPosition = 0.0; // Into stretched
+
+    // Windows and FFT tables
+    std::vector<float> vocoderWindow;
+    std::vector<float> wsolaWindow;
+    std::vector<float> cosTable;
+    std::vector<float> sinTable;
+    std::vector<int> bitReverse;
+
+    // Scratch
+    std::vector<float> real;
+    std::vector<float> imag;
+    std::vector<float> magnitude;     // channels x bins
+    std::vector<float> phase;         // channels x bins
+    std::vector<float> previousPhase; // Analysis one hop earlier, channels x bins
+    std::vector<float> synthesisPhase; // channels x bins, carried from hop to hop
+    std::vector<int> peaks;
+    std::vector<float> pattern; // WSOLA: the natural continuation, mono
+    std::vector<float> region;  // WSOLA: the search range, mono
+};
+
+// Stretches generated speech-like and music-like signals at several speeds
+// and pitches and prints how many times faster than real time each runs
+void benchmarkTimeStretch();
+
+#endif
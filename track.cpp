@@ -0,0 +1,467 @@
+#include "track.h"
+#include "audiodevice.h"
+#include "audiofile.h"
+#include "trackcache.h"
+#include "trackstream.h"
+
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <vector>
+
+static std::atomic<int> wavResampler{RESAMPLER_SDL};
+
+void setTrackResampler(ResamplerQuality quality)
+{
+    wavResampler.store(quality);
+}
+
+bool fileStamp(const std::string &path, Sint64 &size, Sint64 &modified)
+{
+    std::error_code error;
+    std::uintmax_t bytes = std::filesystem::file_size(path, error);
+    if (error)
+    {
+        return false;
+    }
+    std::filesystem::file_time_type time = std::filesystem::last_write_time(path, error);
+    if (error)
+    {
+        return false;
+    }
+    size = (Sint64)bytes;
+    modified = (Sint64)time.time_since_epoch().count();
+    return true;
+}
+
+static std::string tagOrUnknown(const char *tag)
+{
+    if (tag == nullptr || strlen(tag) < 2)
+    {
+        return "Unknown";
+    }
+    return tag;
+}
+
+static Uint32 readLE32(const Uint8 *bytes)
+{
+    return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (Uint32)bytes[3] << 24;
+}
+
+// Reads the sample rate from the headers of WAV, FLAC, Ogg and MP3 files
+static int probeSampleRate(const std::string &path)
+{
+    SDL_RWops *file = SDL_RWFromFile(path.c_str(), "rb");
+    if (file == nullptr)
+    {
+        return 0;
+    }
+    Uint8 header[4096];
+    size_t size = SDL_RWread(file, header, 1, sizeof(header));
+
+    int rate = 0;
+    if (size >= 12 && memcmp(header, "RIFF", 4) == 0 && memcmp(header + 8, "WAVE", 4) == 0)
+    {
+        // Walk the chunks to the format chunk; the rate follows the format tag and channel count
+        size_t offset = 12;
+        while (offset + 16 <= size)
+        {
+            Uint32 chunkSize = readLE32(header + offset + 4);
+            if (memcmp(header + offset, "fmt ", 4) == 0)
+            {
+                rate = (int)readLE32(header + offset + 12);
+                break;
+            }
+            offset += 8 + chunkSize + (chunkSize & 1);
+        }
+    }
+    else if (size >= 26 && memcmp(header, "fLaC", 4) == 0)
+    {
+        // STREAMINFO comes first, its 20 bit rate sits behind the block and frame sizes
+        const Uint8 *info = header + 8;
+        rate = info[10] << 12 | info[11] << 4 | info[12] >> 4;
+    }
+    else if (size >= 28 && memcmp(header, "OggS", 4) == 0)
+    {
+        // The identification packet starts right after the first page's segment table
+        size_t packet = 27 + header[26];
+        if (packet + 16 <= size && memcmp(header + packet, "\x01vorbis", 7) == 0)
+        {
+            rate = (int)readLE32(header + packet + 12);
+        }
+        else if (packet + 8 <= size && memcmp(header + packet, "OpusHead", 8) == 0)
+        {
+            rate = 48000; // Opus always decodes at 48 kHz
+        }
+    }
+    else
+    {
+        // MP3: skip an ID3v2 tag, whose size is stored in 7 bit bytes, then find a frame header
+        Sint64 offset = 0;
+        if (size >= 10 && memcmp(header, "ID3", 3) == 0)
+        {
+            offset = 10 + ((header[6] & 0x7F) << 21 | (header[7] & 0x7F) << 14 | (header[8] & 0x7F) << 7 | (header[9] & 0x7F));
+            if (SDL_RWseek(file, offset, RW_SEEK_SET) == offset)
+            {
+                size = SDL_RWread(file, header, 1, sizeof(header));
+            }
+            else
+            {
+                size = 0;
+            }
+        }
+        static const int rates[4][3] = {{11025, 12000, 8000}, {0, 0, 0}, {22050, 24000, 16000}, {44100, 48000, 32000}};
+        for (size_t i = 0; i + 4 <= size; i++)
+        {
+            int version = header[i + 1] >> 3 & 3;
+            int rateIndex = header[i + 2] >> 2 & 3;
+            if (header[i] == 0xFF && (header[i + 1] & 0xE0) == 0xE0 && version != 1 && rateIndex != 3 &&
+                (header[i + 1] & 0x06) != 0)
+            {
+                rate = rates[version][rateIndex];
+                break;
+            }
+        }
+    }
+
+    SDL_RWclose(file);
+    return rate;
+}
+
+// A file AudioFileReader can read, decoded at its own rate, before anything
+// depends on the device
+struct SourcePcm
+{
+    int frequency = 0;
+    int channels = 0;
+    Uint64 frames = 0;
+    std::vector<float> samples;
+};
+
+static bool decodeSource(AudioFileReader &reader, SourcePcm &source)
+{
+    const Uint32 PIECE_FRAMES = 1 << 20;
+    source.frequency = reader.frequency();
+    source.channels = reader.channelCount();
+    source.samples.resize((size_t)reader.length() * source.channels);
+    source.frames = 0;
+    while (source.frames < reader.length())
+    {
+        Uint32 count = (Uint32)SDL_min((Uint64)PIECE_FRAMES, reader.length() - source.frames);
+        Uint32 got = reader.read(source.samples.data() + (size_t)source.frames * source.channels, count);
+        if (got == 0)
+        {
+            break; // The file is shorter than its header says
+        }
+        source.frames += got;
+    }
+    return source.frames > 0;
+}
+
+// Runs a conversion that keeps the rate over a long buffer a piece at a
+// time, so byte counts stay within the int SDL's converter works with
+static bool convertFrames(SDL_AudioCVT &cvt, const Uint8 *input, int inputFrameBytes, Uint64 frames, Uint8 *output,
+                          int outputFrameBytes)
+{
+    const Uint64 PIECE_FRAMES = 65536;
+    if (!cvt.needed)
+    {
+        SDL_memcpy(output, input, (size_t)frames * inputFrameBytes);
+        return true;
+    }
+    std::vector<Uint8> buffer((size_t)PIECE_FRAMES * inputFrameBytes * cvt.len_mult);
+    for (Uint64 done = 0; done < frames; done += PIECE_FRAMES)
+    {
+        Uint64 count = SDL_min(PIECE_FRAMES, frames - done);
+        SDL_memcpy(buffer.data(), input + (size_t)done * inputFrameBytes, (size_t)count * inputFrameBytes);
+        cvt.buf = buffer.data();
+        cvt.len = (int)(count * inputFrameBytes);
+        if (SDL_ConvertAudio(&cvt) < 0)
+        {
+            return false;
+        }
+        SDL_memcpy(output + (size_t)done * outputFrameBytes, buffer.data(), (size_t)count * outputFrameBytes);
+    }
+    return true;
+}
+
+// Converts a decoded file into the device format, with the built-in
+// resampler unless SDL's converter was chosen
+static Mix_Chunk *convertSource(const SourcePcm &source, int frequency, Uint16 format, int channels, ResamplerQuality quality)
+{
+    int sourceFrameBytes = source.channels * (int)sizeof(float);
+    int floatFrameBytes = channels * (int)sizeof(float);
+    int frameSize = SDL_AUDIO_BITSIZE(format) / 8 * channels;
+    SDL_AudioCVT cvt;
+
+    if (quality == RESAMPLER_SDL && source.frequency != frequency)
+    {
+        // SDL's converter takes the whole file at once
+        Uint64 bytes = source.frames * sourceFrameBytes;
+        if (SDL_BuildAudioCVT(&cvt, AUDIO_F32SYS, source.channels, source.frequency, format, channels, frequency) < 0 ||
+            bytes * cvt.len_mult > SDL_MAX_SINT32)
+        {
+            return nullptr;
+        }
+        std::vector<Uint8> buffer((size_t)bytes * cvt.len_mult);
+        SDL_memcpy(buffer.data(), source.samples.data(), (size_t)bytes);
+        cvt.buf = buffer.data();
+        cvt.len = (int)bytes;
+        if (SDL_ConvertAudio(&cvt) < 0)
+        {
+            return nullptr;
+        }
+        Mix_Chunk *chunk = allocateChunk((Uint32)cvt.len_cvt);
+        if (chunk != nullptr)
+        {
+            SDL_memcpy(chunk->abuf, buffer.data(), (size_t)cvt.len_cvt);
+        }
+        return chunk;
+    }
+
+    // The device's channel layout, still float at the file's rate
+    const float *input = source.samples.data();
+    std::vector<float> mixed;
+    if (SDL_BuildAudioCVT(&cvt, AUDIO_F32SYS, source.channels, source.frequency, AUDIO_F32SYS, channels, source.frequency) < 0)
+    {
+        return nullptr;
+    }
+    if (cvt.needed)
+    {
+        mixed.resize((size_t)source.frames * channels);
+        if (!convertFrames(cvt, (const Uint8 *)input, sourceFrameBytes, source.frames, (Uint8 *)mixed.data(), floatFrameBytes))
+        {
+            return nullptr;
+        }
+        input = mixed.data();
+    }
+
+    // Then the rate
+    Uint64 frames = source.frames;
+    std::vector<float> resampled;
+    if (source.frequency != frequency)
+    {
+        Resampler resampler;
+        if (!resampler.init(source.frequency, frequency, quality))
+        {
+            return nullptr;
+        }
+        frames = resampler.outputFrames(source.frames);
+        if (frames * floatFrameBytes > TRACK_DECODE_LIMIT_BYTES)
+        {
+            return nullptr;
+        }
+        resampled.resize((size_t)frames * channels);
+        for (int channel = 0; channel < channels; channel++)
+        {
+            resampler.process(input + channel, (Uint32)source.frames, channels, resampled.data() + channel);
+        }
+        input = resampled.data();
+    }
+
+    // Then into the device format, SDL saturates where the filter overshoots
+    if (SDL_BuildAudioCVT(&cvt, AUDIO_F32SYS, channels, frequency, format, channels, frequency) < 0 ||
+        frames * frameSize > SDL_MAX_UINT32)
+    {
+        return nullptr;
+    }
+    Mix_Chunk *chunk = allocateChunk((Uint32)(frames * frameSize));
+    if (chunk != nullptr && !convertFrames(cvt, (const Uint8 *)input, floatFrameBytes, frames, chunk->abuf, frameSize))
+    {
+        Mix_FreeChunk(chunk);
+        return nullptr;
+    }
+    return chunk;
+}
+
+Track *loadTrack(const std::string &path)
+{
+    int frequency;
+    Uint16 format;
+    int channels;
+    {
+        AudioFormatLock lock;
+        if (Mix_QuerySpec(&frequency, &format, &channels) == 0)
+        {
+            std::cout << "Failed to load music: audio device is not open" << std::endl;
+            return nullptr;
+        }
+    }
+    Track *track = new Track;
+    track->path = path;
+    track->filename = std::filesystem::path(path).filename().string();
+
+    // Decode the whole file up front so playback can splice tracks sample
+    // accurately, unless that would not fit in memory. Sizes are checked in
+    // 64 bits, both the float samples at the file's rate and the result.
+    // WAV, FLAC, MP3 and Ogg Vorbis are decoded once, at their own rate,
+    // without holding up a change of the device format; only the conversion
+    // into it waits for one. The reader's tags and length are the track's.
+    ResamplerQuality quality = (ResamplerQuality)wavResampler.load();
+    SourcePcm source;
+    AudioFileReader reader;
+    bool readable = openWithSeekTable(reader, path) && reader.length() > 0;
+    if (readable)
+    {
+        track->title = tagOrUnknown(reader.title().c_str());
+        track->artist = tagOrUnknown(reader.artist().c_str());
+        track->album = tagOrUnknown(reader.album().c_str());
+        track->sourceRate = reader.frequency();
+
+        int frameSize = SDL_AUDIO_BITSIZE(format) / 8 * channels;
+        Uint64 sourceBytes = reader.length() * reader.channelCount() * sizeof(float);
+        Uint64 decodedBytes = reader.length() * frequency / reader.frequency() * SDL_max(frameSize, (int)(channels * sizeof(float)));
+        if (SDL_max(sourceBytes, decodedBytes) > TRACK_DECODE_LIMIT_BYTES)
+        {
+            // So the stream does not read an MP3 through a second time
+            keepSeekTable(reader, path);
+            reader.close();
+            track->frequency = frequency;
+            track->frameSize = frameSize;
+            track->stream = new TrackStream;
+            if (!track->stream->open(path, frequency, format, channels, quality))
+            {
+                std::cout << "Failed to stream music: " << path << std::endl;
+                freeTrack(track);
+                return nullptr;
+            }
+            track->frames = track->stream->frames();
+            track->duration = (double)track->frames / frequency;
+            return track;
+        }
+        decodeSource(reader, source);
+        reader.close();
+    }
+
+    // Keep the device format stable until the track is converted into it
+    AudioFormatLock lock;
+    if (Mix_QuerySpec(&frequency, &format, &channels) == 0)
+    {
+        std::cout << "Failed to load music: audio device is not open" << std::endl;
+        delete track;
+        return nullptr;
+    }
+    track->frequency = frequency;
+    track->frameSize = SDL_AUDIO_BITSIZE(format) / 8 * channels;
+    if (source.frames > 0)
+    {
+        track->chunk = convertSource(source, frequency, format, channels, quality);
+    }
+    if (track->chunk == nullptr)
+    {
+        // Everything else only SDL_mixer decodes, straight into the device
+        // format. Opening the file as music first is cheap and gives its tags.
+        Mix_Music *music = Mix_LoadMUS(path.c_str());
+        if (music == nullptr)
+        {
+            std::cout << "Failed to load music: " << Mix_GetError() << std::endl;
+            delete track;
+            return nullptr;
+        }
+        if (!readable)
+        {
+            track->title = tagOrUnknown(Mix_GetMusicTitle(music));
+            track->artist = tagOrUnknown(Mix_GetMusicArtistTag(music));
+            track->album = tagOrUnknown(Mix_GetMusicAlbumTag(music));
+            track->sourceRate = probeSampleRate(path);
+        }
+        double musicDuration = Mix_MusicDuration(music);
+        Mix_FreeMusic(music);
+        if (musicDuration > 0.0 && (Uint64)(musicDuration * frequency) * track->frameSize > TRACK_MIXER_LIMIT_BYTES)
+        {
+            std::cout << "Failed to load music: " << path << " is too long to decode, it is not a format that can be streamed"
+                      << std::endl;
+            delete track;
+            return nullptr;
+        }
+        track->chunk = Mix_LoadWAV(path.c_str());
+    }
+    if (track->chunk == nullptr)
+    {
+        std::cout << "Failed to decode music: " << Mix_GetError() << std::endl;
+        delete track;
+        return nullptr;
+    }
+
+    track->frames = track->chunk->alen / track->frameSize;
+    track->duration = (double)track->frames / frequency;
+    if (track->frames == 0)
+    {
+        std::cout << "Failed to get music duration: file is empty" << std::endl;
+        freeTrack(track);
+        return nullptr;
+    }
+
+    return track;
+}
+
+const Uint8 *Track::pcm(Uint64 frame, Uint32 &count) const
+{
+    if (stream != nullptr)
+    {
+        return stream->read(frame, count);
+    }
+    frame = SDL_min(frame, frames);
+    count = (Uint32)SDL_min((Uint64)count, frames - frame);
+    return chunk->abuf + (size_t)frame * frameSize;
+}
+
+bool probeTrack(const std::string &path, TrackInfo &info)
+{
+    AudioFormatLock lock;
+    Mix_Music *music = Mix_LoadMUS(path.c_str());
+    if (music == nullptr)
+    {
+        return false;
+    }
+    const char *title = Mix_GetMusicTitleTag(music);
+    const char *artist = Mix_GetMusicArtistTag(music);
+    const char *album = Mix_GetMusicAlbumTag(music);
+    info.title = title != nullptr ? title : "";
+    info.artist = artist != nullptr ? artist : "";
+    info.album = album != nullptr ? album : "";
+    info.duration = SDL_max(Mix_MusicDuration(music), 0.0);
+    info.type = Mix_GetMusicType(music);
+    Mix_FreeMusic(music);
+    info.sourceRate = probeSampleRate(path);
+    return true;
+}
+
+void freeTrack(Track *track)
+{
+    if (track == nullptr)
+    {
+        return;
+    }
+    if (track->cache != nullptr)
+    {
+        track->cache->release(track);
+        return;
+    }
+    if (track->chunk != nullptr)
+    {
+        Mix_FreeChunk(track->chunk);
+    }
+    delete track->stream;
+    delete track;
+}
+
+Mix_Chunk *allocateChunk(Uint32 bytes)
+{
+    Uint8 *buffer = static_cast<Uint8 *>(SDL_malloc(bytes));
+    Mix_Chunk *chunk = static_cast<Mix_Chunk *>(SDL_malloc(sizeof(Mix_Chunk)));
+    if (buffer == nullptr || chunk == nullptr)
+    {
+        SDL_free(buffer);
+        SDL_free(chunk);
+        return nullptr;
+    }
+
+    // Owned like a chunk from Mix_LoadWAV, so Mix_FreeChunk releases both
+    chunk->allocated = 1;
+    chunk->abuf = buffer;
+    chunk->alen = bytes;
+    chunk->volume = MIX_MAX_VOLUME;
+    return chunk;
+}
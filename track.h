@@ -0,0 +1,81 @@
+#ifndef TRACK_H
+#define TRACK_H
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_mixer.h>
+#include <string>
+#include "resampler.h"
+
+class TrackCache;
+class TrackStream;
+
+// Files up to this size in the device format are decoded whole, longer WAV,
+// FLAC, MP3 and Ogg Vorbis files are streamed
+const Uint64 TRACK_DECODE_LIMIT_BYTES = (Uint64)1 << 30;
+// Other formats, and MP3 and Ogg Vorbis without their decoder libraries,
+// can only be decoded whole, by SDL_mixer, whose converter counts bytes in
+// an int. Longer files are refused; the limit leaves room for durations
+// that are only estimated.
+const Uint64 TRACK_MIXER_LIMIT_BYTES = (Uint64)3 << 29;
+
+// A music file in the output device format, together with the tags read
+// from it. Usually the whole file is decoded into chunk, longer ones get a
+// stream instead. Tracks are immutable once
+// loaded, so they can be handed between the loader, the UI and the audio
+// thread without locks. Only the track cache touches the PCM of a track
+// nobody is using.
+struct Track
+{
+    std::string path;
+    std::string filename;
+    std::string title;
+    std::string artist;
+    std::string album;
+    Mix_Chunk *chunk = nullptr;
+    TrackStream *stream = nullptr;
+    Uint64 frames = 0;
+    int frameSize = 0;     // Bytes per frame in the device format
+    double duration = 0.0; // Seconds
+    int frequency = 0;     // Rate the track was decoded to, the device's at the time
+    int sourceRate = 0;    // Rate stored in the file, 0 if it could not be read
+    TrackCache *cache = nullptr; // Set while the cache shares the track
+    Track *releasedNext = nullptr; // The engine's list of released tracks the UI has not taken yet
+
+    // Rendering thread. Up to count frames from frame on, count is set to
+    // how many; 0 where a stream has not decoded that part yet.
+    const Uint8 *pcm(Uint64 frame, Uint32 &count) const;
+};
+
+// What the library keeps about a file, read without decoding it
+struct TrackInfo
+{
+    std::string title; // Empty if the file has no such tag
+    std::string artist;
+    std::string album;
+    double duration = 0.0; // Seconds, 0 if unknown
+    int sourceRate = 0;
+    Mix_MusicType type = MUS_NONE;
+};
+
+// How decoded WAV, FLAC, MP3 and Ogg Vorbis files are brought to the device
+// rate. Other formats are always converted by SDL_mixer's decoders, streamed ones never
+// by SDL (see TrackStream). Set it before loading tracks.
+void setTrackResampler(ResamplerQuality quality);
+
+// Size and modification time, which identify the version of a file
+bool fileStamp(const std::string &path, Sint64 &size, Sint64 &modified);
+
+// Blocking, may take a long time for big files. Prints the error and returns
+// nullptr on failure. Requires the audio device to be open.
+Track *loadTrack(const std::string &path);
+// Opens the file as music for its tags, length and format. Quiet on
+// failure, library scans meet all kinds of broken files. Requires the audio
+// device to be open.
+bool probeTrack(const std::string &path, TrackInfo &info);
+// Hands a cached track back to its cache, frees any other
+void freeTrack(Track *track);
+
+// A chunk with its own buffer of the given size, released by Mix_FreeChunk
+Mix_Chunk *allocateChunk(Uint32 bytes);
+
+#endif
@@ -0,0 +1,414 @@
+#include "trackcache.h"
+#include "pcmcodec.h"
+
+#include <iostream>
+
+bool TrackCache::start(size_t budgetBytes, bool pack, Uint16 format, int channels)
+{
+    budget = budgetBytes;
+    packing = pack;
+    this->format = format;
+    this->channels = channels;
+    stopping = false;
+    if (budget == 0)
+    {
+        return true;
+    }
+
+    mutex = SDL_CreateMutex();
+    cond = SDL_CreateCond();
+    unpacked = SDL_CreateCond();
+    if (mutex == nullptr || cond == nullptr || unpacked == nullptr)
+    {
+        std::cout << "Failed to create track cache lock: " << SDL_GetError() << std::endl;
+        stop();
+        return false;
+    }
+
+    if (packing)
+    {
+        thread = SDL_CreateThread(run, "TrackCache", this);
+        if (thread == nullptr)
+        {
+            std::cout << "Failed to create track cache thread: " << SDL_GetError() << std::endl;
+            packing = false;
+        }
+    }
+    return true;
+}
+
+void TrackCache::stop()
+{
+    if (thread != nullptr)
+    {
+        SDL_LockMutex(mutex);
+        stopping = true;
+        SDL_CondSignal(cond);
+        SDL_UnlockMutex(mutex);
+        SDL_WaitThread(thread, nullptr);
+        thread = nullptr;
+    }
+
+    // Tracks still in use become ordinary tracks their owners free
+    for (auto &entry : entries)
+    {
+        entry.second.track->cache = nullptr;
+        if (entry.second.users == 0)
+        {
+            freeTrack(entry.second.track);
+        }
+    }
+    entries.clear();
+    packQueue.clear();
+    aheadPath.clear();
+    aheadWanted = false;
+    decodedBytes = 0;
+    packedBytes = 0;
+    packingBytes = 0;
+    budget = 0;
+
+    if (cond != nullptr)
+    {
+        SDL_DestroyCond(cond);
+        cond = nullptr;
+    }
+    if (unpacked != nullptr)
+    {
+        SDL_DestroyCond(unpacked);
+        unpacked = nullptr;
+    }
+    if (mutex != nullptr)
+    {
+        SDL_DestroyMutex(mutex);
+        mutex = nullptr;
+    }
+}
+
+Track *TrackCache::acquire(const std::string &path, int frequency, Sint64 size, Sint64 modified)
+{
+    if (mutex == nullptr)
+    {
+        return nullptr;
+    }
+
+    Track *track = nullptr;
+    SDL_LockMutex(mutex);
+    Entry *entry = find(path, frequency, size, modified);
+    if (entry != nullptr && (entry->state == ENTRY_DECODED || entry->state == ENTRY_PACKING))
+    {
+        entry->users++;
+        entry->lastUse = ++useCounter;
+        hitCount++;
+        track = entry->track;
+    }
+    SDL_UnlockMutex(mutex);
+    return track;
+}
+
+Track *TrackCache::unpack(const std::string &path, int frequency, Sint64 size, Sint64 modified)
+{
+    if (mutex == nullptr)
+    {
+        return nullptr;
+    }
+
+    SDL_LockMutex(mutex);
+    Entry *entry = find(path, frequency, size, modified);
+    while (entry != nullptr && entry->state == ENTRY_UNPACKING)
+    {
+        // The worker got to it first, it is ready sooner than unpacking again
+        SDL_CondWait(unpacked, mutex);
+        entry = find(path, frequency, size, modified);
+    }
+    if (entry == nullptr || entry->state == ENTRY_PACKING)
+    {
+        SDL_UnlockMutex(mutex);
+        return nullptr;
+    }
+
+    if (entry->state == ENTRY_PACKED)
+    {
+        entry->state = ENTRY_UNPACKING;
+        if (!unpackEntry(path, *entry))
+        {
+            SDL_UnlockMutex(mutex);
+            return nullptr;
+        }
+    }
+    entry->users++;
+    entry->lastUse = ++useCounter;
+    hitCount++;
+    Track *track = entry->track;
+    trim();
+    SDL_UnlockMutex(mutex);
+    return track;
+}
+
+void TrackCache::insert(Track *track, Sint64 size, Sint64 modified)
+{
+    // Streamed tracks never hold their whole PCM, there is nothing to keep
+    if (mutex == nullptr || track == nullptr || track->chunk == nullptr)
+    {
+        return;
+    }
+
+    SDL_LockMutex(mutex);
+    missCount++;
+    auto it = entries.find(track->path);
+    if (it != entries.end() && it->second.users == 0 && (it->second.state == ENTRY_DECODED || it->second.state == ENTRY_PACKED))
+    {
+        evict(track->path); // An older copy, e.g. decoded at another rate
+        it = entries.end();
+    }
+    if (it == entries.end())
+    {
+        Entry entry = {};
+        entry.track = track;
+        entry.state = ENTRY_DECODED;
+        entry.users = 1;
+        entry.lastUse = ++useCounter;
+        entry.bytes = track->chunk->alen;
+        entry.fileSize = size;
+        entry.fileModified = modified;
+        entries[track->path] = std::move(entry);
+        decodedBytes += track->chunk->alen;
+        track->cache = this;
+        trim();
+    }
+    // Otherwise the cached copy is busy and this one stays an ordinary track
+    SDL_UnlockMutex(mutex);
+}
+
+void TrackCache::unpackAhead(const std::string &path)
+{
+    if (mutex == nullptr)
+    {
+        return;
+    }
+
+    SDL_LockMutex(mutex);
+    aheadPath = path;
+    auto it = entries.find(path);
+    aheadWanted = thread != nullptr && it != entries.end() && it->second.state == ENTRY_PACKED;
+    if (aheadWanted)
+    {
+        SDL_CondSignal(cond);
+    }
+    trim(); // The track kept before may be packed now
+    SDL_UnlockMutex(mutex);
+}
+
+void TrackCache::release(Track *track)
+{
+    SDL_LockMutex(mutex);
+    auto it = entries.find(track->path);
+    if (it != entries.end() && it->second.track == track && it->second.users > 0)
+    {
+        it->second.users--;
+        it->second.lastUse = ++useCounter;
+        trim();
+    }
+    SDL_UnlockMutex(mutex);
+}
+
+TrackCacheStats TrackCache::stats()
+{
+    TrackCacheStats stats = {};
+    if (mutex == nullptr)
+    {
+        return stats;
+    }
+
+    SDL_LockMutex(mutex);
+    stats.hits = hitCount;
+    stats.misses = missCount;
+    stats.decodedBytes = decodedBytes;
+    stats.packedBytes = packedBytes;
+    for (const auto &entry : entries)
+    {
+        if (entry.second.state == ENTRY_PACKED)
+        {
+            stats.packedTracks++;
+            stats.unpackedBytes += entry.second.bytes;
+        }
+        else
+        {
+            stats.decodedTracks++;
+        }
+    }
+    SDL_UnlockMutex(mutex);
+    return stats;
+}
+
+// The entry for path if it was decoded at this rate from the file as it is
+// now. One left from an older version of the file is dropped once unused.
+TrackCache::Entry *TrackCache::find(const std::string &path, int frequency, Sint64 size, Sint64 modified)
+{
+    auto it = entries.find(path);
+    if (it == entries.end())
+    {
+        return nullptr;
+    }
+    Entry &entry = it->second;
+    if (entry.fileSize != size || entry.fileModified != modified)
+    {
+        if (entry.users == 0 && (entry.state == ENTRY_DECODED || entry.state == ENTRY_PACKED))
+        {
+            evict(path);
+        }
+        return nullptr;
+    }
+    return entry.track->frequency == frequency ? &entry : nullptr;
+}
+
+// Drops or packs unused entries, least recently used first, until the
+// cache fits its budget again. Packing happens on the worker, which trims
+// again when it is done; until then the tracks it packs count as gone. The
+// track kept for unpackAhead() stays, like one in use.
+void TrackCache::trim()
+{
+    while (decodedBytes + packedBytes - packingBytes > budget)
+    {
+        const std::string *victim = nullptr;
+        Uint64 oldest = 0;
+        for (const auto &entry : entries)
+        {
+            EntryState state = entry.second.state;
+            if (entry.second.users == 0 && (state == ENTRY_DECODED || state == ENTRY_PACKED) && entry.first != aheadPath &&
+                (victim == nullptr || entry.second.lastUse < oldest))
+            {
+                victim = &entry.first;
+                oldest = entry.second.lastUse;
+            }
+        }
+        if (victim == nullptr)
+        {
+            return; // Everything left is in use or busy
+        }
+
+        Entry &entry = entries[*victim];
+        if (packing && entry.state == ENTRY_DECODED && !entry.incompressible)
+        {
+            entry.state = ENTRY_PACKING;
+            packingBytes += entry.bytes;
+            packQueue.push_back(*victim);
+            SDL_CondSignal(cond);
+            continue;
+        }
+        evict(*victim);
+    }
+}
+
+void TrackCache::evict(const std::string &path)
+{
+    auto it = entries.find(path);
+    Entry &entry = it->second;
+    if (entry.state == ENTRY_PACKED)
+    {
+        packedBytes -= entry.packed.size();
+    }
+    else
+    {
+        decodedBytes -= entry.bytes;
+    }
+    entry.track->cache = nullptr;
+    freeTrack(entry.track);
+    entries.erase(it);
+}
+
+bool TrackCache::unpackEntry(const std::string &path, Entry &entry)
+{
+    // Nobody else touches an entry while it is being unpacked
+    SDL_UnlockMutex(mutex);
+    Mix_Chunk *chunk = allocateChunk(entry.bytes);
+    bool done = chunk != nullptr && unpackPcm(entry.packed, chunk->abuf, entry.bytes, format, channels);
+    SDL_LockMutex(mutex);
+
+    if (done)
+    {
+        packedBytes -= entry.packed.size();
+        decodedBytes += entry.bytes;
+        std::vector<Uint8>().swap(entry.packed);
+        entry.track->chunk = chunk;
+        entry.state = ENTRY_DECODED;
+    }
+    else
+    {
+        if (chunk != nullptr)
+        {
+            Mix_FreeChunk(chunk);
+        }
+        entry.state = ENTRY_PACKED;
+        evict(path);
+    }
+    SDL_CondBroadcast(unpacked);
+    return done;
+}
+
+int SDLCALL TrackCache::run(void *data)
+{
+    TrackCache *cache = static_cast<TrackCache *>(data);
+
+    SDL_LockMutex(cache->mutex);
+    while (!cache->stopping)
+    {
+        if (cache->aheadWanted)
+        {
+            cache->aheadWanted = false;
+            std::string path = cache->aheadPath;
+            auto it = cache->entries.find(path);
+            if (it != cache->entries.end() && it->second.state == ENTRY_PACKED)
+            {
+                it->second.state = ENTRY_UNPACKING;
+                if (cache->unpackEntry(path, it->second))
+                {
+                    it->second.lastUse = ++cache->useCounter;
+                    cache->trim();
+                }
+            }
+            continue;
+        }
+        if (cache->packQueue.empty())
+        {
+            SDL_CondWait(cache->cond, cache->mutex);
+            continue;
+        }
+
+        std::string path = cache->packQueue.front();
+        cache->packQueue.pop_front();
+        auto it = cache->entries.find(path);
+        if (it == cache->entries.end() || it->second.state != ENTRY_PACKING)
+        {
+            continue;
+        }
+
+        // Packing entries are never evicted, and their PCM never changes
+        Entry &entry = it->second;
+        Track *track = entry.track;
+        SDL_UnlockMutex(cache->mutex);
+        std::vector<Uint8> packed;
+        bool packedWell = packPcm(track->chunk->abuf, track->chunk->alen, cache->format, cache->channels, packed);
+        SDL_LockMutex(cache->mutex);
+
+        entry.state = ENTRY_DECODED;
+        cache->packingBytes -= entry.bytes;
+        if (!packedWell)
+        {
+            entry.incompressible = true;
+        }
+        else if (entry.users == 0 && path != cache->aheadPath)
+        {
+            // Still unused and not wanted soon, so the decoded copy can go
+            cache->decodedBytes -= entry.bytes;
+            cache->packedBytes += packed.size();
+            Mix_FreeChunk(track->chunk);
+            track->chunk = nullptr;
+            entry.packed.swap(packed);
+            entry.state = ENTRY_PACKED;
+        }
+        cache->trim();
+    }
+    SDL_UnlockMutex(cache->mutex);
+
+    return 0;
+}
@@ -0,0 +1,116 @@
+#ifndef TRACKCACHE_H
+#define TRACKCACHE_H
+
+#include <SDL2/SDL.h>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "track.h"
+
+struct TrackCacheStats
+{
+    Uint64 hits;
+    Uint64 misses;
+    Uint32 decodedTracks;
+    Uint32 packedTracks;
+    size_t decodedBytes;
+    size_t packedBytes;
+    size_t unpackedBytes; // What the packed tracks take when decoded
+};
+
+// Keeps decoded tracks in memory after the engine is done with them, so
+// replaying a song, going back to the previous one or seeking around in
+// them needs no disk I/O. Cached tracks are shared: acquire() and insert()
+// count a use and freeTrack() hands it back. Every entry remembers the
+// size and modification time its file had when it was decoded, and only a
+// request with the same ones gets it, so an edited file is decoded again.
+// Unused tracks beyond the memory budget are dropped, least recently used
+// first. With packing enabled a worker thread first compresses them
+// losslessly (see pcmcodec.h) and the loader unpacks them again on the next
+// request, which takes around 150 ms for a four minute song. Tracks in use,
+// like the playing and the preloaded one, are never packed, and
+// unpackAhead() has the worker unpack one more before it is asked for.
+class TrackCache
+{
+public:
+    // budgetBytes 0 disables the cache. format and channels are the device's.
+    bool start(size_t budgetBytes, bool pack, Uint16 format, int channels);
+    void stop();
+
+    // Any thread. The decoded track for path, or nullptr if it is not cached
+    // decoded at this rate from the file with this size and time (see
+    // fileStamp()).
+    Track *acquire(const std::string &path, int frequency, Sint64 size, Sint64 modified);
+    // Loader thread. Unpacks a packed track, nullptr if there is none. Waits
+    // if the worker is already unpacking it.
+    Track *unpack(const std::string &path, int frequency, Sint64 size, Sint64 modified);
+    // Loader thread. Takes over a freshly loaded track, in use once. size and
+    // modified are the file's from before it was loaded.
+    void insert(Track *track, Sint64 size, Sint64 modified);
+    // Any thread. Keeps path decoded, unpacking it on the worker if it is
+    // packed, until another path is passed. For the song the user is most
+    // likely to go back to.
+    void unpackAhead(const std::string &path);
+    // Called by freeTrack() for tracks that belong to the cache
+    void release(Track *track);
+
+    TrackCacheStats stats();
+
+private:
+    enum EntryState
+    {
+        ENTRY_DECODED,
+        ENTRY_PACKING, // Still decoded and usable while the worker packs it
+        ENTRY_PACKED,
+        ENTRY_UNPACKING
+    };
+
+    struct Entry
+    {
+        Track *track;
+        EntryState state;
+        int users;
+        Uint64 lastUse;
+        Uint32 bytes; // Decoded size
+        Sint64 fileSize;
+        Sint64 fileModified;
+        std::vector<Uint8> packed;
+        bool incompressible;
+    };
+
+    // Require the mutex
+    Entry *find(const std::string &path, int frequency, Sint64 size, Sint64 modified);
+    void trim();
+    void evict(const std::string &path);
+    // Unlocks the mutex while it works. Fills in the decoded copy of an
+    // entry in ENTRY_UNPACKING, leaving it unused, or drops it.
+    bool unpackEntry(const std::string &path, Entry &entry);
+
+    static int SDLCALL run(void *data);
+
+    size_t budget = 0;
+    bool packing = false;
+    Uint16 format = 0;
+    int channels = 0;
+
+    SDL_Thread *thread = nullptr;
+    SDL_mutex *mutex = nullptr;
+    SDL_cond *cond = nullptr;
+    SDL_cond *unpacked = nullptr; // Broadcast whenever an entry leaves ENTRY_UNPACKING
+    bool stopping = false;
+
+    // Guarded by the mutex
+    std::unordered_map<std::string, Entry> entries;
+    std::deque<std::string> packQueue;
+    std::string aheadPath; // Kept decoded, see unpackAhead()
+    bool aheadWanted = false; // The worker should unpack aheadPath
+    Uint64 useCounter = 0;
+    size_t decodedBytes = 0;
+    size_t packedBytes = 0;
+    size_t packingBytes = 0; // Decoded bytes the worker is about to pack away
+    Uint64 hitCount = 0;
+    Uint64 missCount = 0;
+};
+
+#endif
@@ -0,0 +1,152 @@
+#include "trackloader.h"
+
+#include <iostream>
+
+// Rate the device runs at, tracks decoded for another one are of no use
+static int deviceFrequency()
+{
+    int frequency;
+    Uint16 format;
+    int channels;
+    return Mix_QuerySpec(&frequency, &format, &channels) != 0 ? frequency : 0;
+}
+
+bool TrackLoader::start(void (*onComplete)(), TrackCache *cache)
+{
+    this->onComplete = onComplete;
+    this->cache = cache;
+    stopping = false;
+    mutex = SDL_CreateMutex();
+    cond = SDL_CreateCond();
+    if (mutex == nullptr || cond == nullptr)
+    {
+        std::cout << "Failed to create loader lock: " << SDL_GetError() << std::endl;
+        stop();
+        return false;
+    }
+
+    thread = SDL_CreateThread(run, "TrackLoader", this);
+    if (thread == nullptr)
+    {
+        std::cout << "Failed to create loader thread: " << SDL_GetError() << std::endl;
+        stop();
+        return false;
+    }
+    return true;
+}
+
+void TrackLoader::stop()
+{
+    if (thread != nullptr)
+    {
+        SDL_LockMutex(mutex);
+        stopping = true;
+        SDL_CondSignal(cond);
+        SDL_UnlockMutex(mutex);
+        SDL_WaitThread(thread, nullptr);
+        thread = nullptr;
+    }
+
+    // Anything that was loaded but never collected is owned by the loader
+    for (LoadResult &result : completed)
+    {
+        freeTrack(result.track);
+    }
+    completed.clear();
+    pending.clear();
+
+    if (cond != nullptr)
+    {
+        SDL_DestroyCond(cond);
+        cond = nullptr;
+    }
+    if (mutex != nullptr)
+    {
+        SDL_DestroyMutex(mutex);
+        mutex = nullptr;
+    }
+}
+
+Uint32 TrackLoader::request(const std::string &path, bool urgent)
+{
+    SDL_LockMutex(mutex);
+    Uint32 id = nextId++;
+    if (urgent)
+    {
+        pending.push_front({id, path});
+    }
+    else
+    {
+        pending.push_back({id, path});
+    }
+    SDL_CondSignal(cond);
+    SDL_UnlockMutex(mutex);
+    return id;
+}
+
+bool TrackLoader::poll(LoadResult &result)
+{
+    SDL_LockMutex(mutex);
+    bool found = !completed.empty();
+    if (found)
+    {
+        result = completed.front();
+        completed.pop_front();
+    }
+    SDL_UnlockMutex(mutex);
+    return found;
+}
+
+int SDLCALL TrackLoader::run(void *data)
+{
+    TrackLoader *loader = static_cast<TrackLoader *>(data);
+
+    SDL_LockMutex(loader->mutex);
+    while (!loader->stopping)
+    {
+        if (loader->pending.empty())
+        {
+            SDL_CondWait(loader->cond, loader->mutex);
+            continue;
+        }
+
+        Request request = loader->pending.front();
+        loader->pending.pop_front();
+
+        // Decoding can take seconds, so do it without holding the lock
+        SDL_UnlockMutex(loader->mutex);
+        Track *track = nullptr;
+        TrackCache *cache = loader->cache;
+        // Cached tracks are only handed out for the file as it is now. The
+        // stamp is taken here rather than in request(), which the UI thread
+        // calls, and before loading, so a file written meanwhile is not
+        // cached as the new version.
+        Sint64 size = 0;
+        Sint64 modified = 0;
+        bool stamped = cache != nullptr && fileStamp(request.path, size, modified);
+        if (stamped)
+        {
+            int frequency = deviceFrequency();
+            track = cache->acquire(request.path, frequency, size, modified);
+            track = track != nullptr ? track : cache->unpack(request.path, frequency, size, modified);
+        }
+        if (track == nullptr)
+        {
+            track = loadTrack(request.path);
+            if (stamped)
+            {
+                cache->insert(track, size, modified);
+            }
+        }
+        SDL_LockMutex(loader->mutex);
+
+        loader->completed.push_back({request.id, request.path, track});
+        if (loader->onComplete != nullptr)
+        {
+            loader->onComplete();
+        }
+    }
+    SDL_UnlockMutex(loader->mutex);
+
+    return 0;
+}
@@ -0,0 +1,54 @@
+#ifndef TRACKLOADER_H
+#define TRACKLOADER_H
+
+#include <SDL2/SDL.h>
+#include <deque>
+#include <string>
+#include "track.h"
+#include "trackcache.h"
+
+struct LoadResult
+{
+    Uint32 id;
+    std::string path;
+    Track *track; // nullptr if loading failed
+};
+
+// Worker thread that opens, probes and decodes tracks in the background, so
+// slow disks or network shares never block the UI. Finished loads are
+// collected with poll() on the UI thread; the completion callback is invoked
+// from the worker so the main loop can be woken up. With a track cache, the
+// worker hands back cached tracks after one stat that tells the file has not
+// changed, and unpacks packed ones instead of decoding them from disk.
+class TrackLoader
+{
+public:
+    bool start(void (*onComplete)(), TrackCache *cache = nullptr);
+    void stop();
+
+    // Returns an id that identifies the matching LoadResult. Urgent requests
+    // (the user wants to hear the file now) skip ahead of pending preloads.
+    Uint32 request(const std::string &path, bool urgent = false);
+    bool poll(LoadResult &result);
+
+private:
+    struct Request
+    {
+        Uint32 id;
+        std::string path;
+    };
+
+    static int SDLCALL run(void *data);
+
+    SDL_Thread *thread = nullptr;
+    SDL_mutex *mutex = nullptr;
+    SDL_cond *cond = nullptr;
+    void (*onComplete)() = nullptr;
+    TrackCache *cache = nullptr;
+    bool stopping = false;
+    Uint32 nextId = 1;
+    std::deque<Request> pending;
+    std::deque<LoadResult> completed;
+};
+
+#endif
@@ -0,0 +1,457 @@
+#include "trackstream.h"
+#include "track.h"
+
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+
+// Files of an older layout are dropped and built up again
+const char *SEEK_INDEX_HEADER = "AudioFlow seek index 2";
+
+struct StoredSeekTable
+{
+    Sint64 size;
+    Sint64 modified;
+    SeekTable table;
+};
+
+// Only the loader and the stream threads use the index once it is loaded
+static std::mutex seekIndexMutex;
+static std::string seekIndexFile;
+static std::unordered_map<std::string, StoredSeekTable> seekIndex;
+
+// After a header line, one file per line: size, mtime, length in frames
+// and the number of points, then frame and byte offset of each, then the
+// path, separated by tabs
+void setSeekIndexFile(const std::string &file)
+{
+    std::lock_guard<std::mutex> lock(seekIndexMutex);
+    seekIndexFile = file;
+    seekIndex.clear();
+
+    std::ifstream in(file);
+    std::string line;
+    if (!std::getline(in, line) || line != SEEK_INDEX_HEADER)
+    {
+        return;
+    }
+    while (std::getline(in, line))
+    {
+        std::istringstream fields(line);
+        StoredSeekTable stored;
+        size_t count = 0;
+        fields >> stored.size >> stored.modified >> stored.table.frames >> count;
+        for (size_t i = 0; i < count && fields; i++)
+        {
+            SeekPoint point;
+            fields >> point.frame >> point.offset;
+            stored.table.points.push_back(point);
+        }
+        std::string path;
+        fields.ignore(1);
+        if (!fields || !std::getline(fields, path) || path.empty())
+        {
+            continue;
+        }
+        seekIndex[path] = std::move(stored);
+    }
+}
+
+static bool findSeekTable(const std::string &path, Sint64 size, Sint64 modified, SeekTable &table)
+{
+    std::lock_guard<std::mutex> lock(seekIndexMutex);
+    auto it = seekIndex.find(path);
+    if (it == seekIndex.end() || it->second.size != size || it->second.modified != modified)
+    {
+        return false;
+    }
+    table = it->second.table;
+    return true;
+}
+
+// Rewrites the whole file; it only holds files that were streamed
+static void storeSeekTable(const std::string &path, Sint64 size, Sint64 modified, const SeekTable &table)
+{
+    std::lock_guard<std::mutex> lock(seekIndexMutex);
+    seekIndex[path] = {size, modified, table};
+    if (seekIndexFile.empty())
+    {
+        return;
+    }
+
+    std::ofstream out(seekIndexFile, std::ios::trunc);
+    out << SEEK_INDEX_HEADER << '\n';
+    for (const auto &entry : seekIndex)
+    {
+        const SeekTable &stored = entry.second.table;
+        out << entry.second.size << '\t' << entry.second.modified << '\t' << stored.frames << '\t' << stored.points.size();
+        for (const SeekPoint &point : stored.points)
+        {
+            out << '\t' << point.frame << ' ' << point.offset;
+        }
+        out << '\t' << entry.first << '\n';
+    }
+    if (!out)
+    {
+        std::cout << "Failed to write seek index " << seekIndexFile << std::endl;
+    }
+}
+
+bool TrackStream::open(const std::string &path, int frequency, Uint16 format, int channels, ResamplerQuality quality)
+{
+    close();
+    SeekTable stored;
+    bool stamped = fileStamp(path, fileSize, fileModified);
+    bool known = stamped && findSeekTable(path, fileSize, fileModified, stored);
+    if (!reader.open(path, known ? &stored : nullptr) || reader.length() == 0)
+    {
+        reader.close();
+        return false;
+    }
+    this->path = path;
+    this->frequency = frequency;
+    this->format = format;
+    this->channels = channels;
+    frameSize = SDL_AUDIO_BITSIZE(format) / 8 * channels;
+
+    if (SDL_BuildAudioCVT(&channelCvt, AUDIO_F32SYS, reader.channelCount(), reader.frequency(), AUDIO_F32SYS, channels,
+                          reader.frequency()) < 0 ||
+        SDL_BuildAudioCVT(&formatCvt, AUDIO_F32SYS, channels, frequency, format, channels, frequency) < 0)
+    {
+        reader.close();
+        return false;
+    }
+    resampling = reader.frequency() != frequency;
+    if (resampling && !resampler.init(reader.frequency(), frequency, quality == RESAMPLER_SDL ? RESAMPLER_MEDIUM : quality))
+    {
+        reader.close();
+        return false;
+    }
+    totalFrames = resampling ? resampler.outputFrames(reader.length()) : reader.length();
+
+    // An MP3 was just read through for its frames, keep them right away
+    keepsSeekTable = stamped && reader.hasSeekTable();
+    storedPoints = known ? stored.points.size() : 0;
+    storeGrownSeekTable();
+
+    // Half a second or more per block, a power of two
+    blockFrames = 16384;
+    while (blockFrames < (Uint32)frequency / 2)
+    {
+        blockFrames *= 2;
+    }
+    apronFrames = blockFrames / 2;
+    blockCount = (totalFrames + blockFrames - 1) / blockFrames;
+    slotCount = (int)SDL_min((Uint64)STREAM_AHEAD_SECONDS * frequency / blockFrames + 3, blockCount + 1);
+    slots.reset(new Slot[slotCount]);
+    for (int i = 0; i < slotCount; i++)
+    {
+        slots[i].pcm.resize((size_t)(blockFrames + apronFrames) * frameSize);
+    }
+    sourceStart = 0;
+    sourceFrames = 0;
+
+    stopping = false;
+    readBlock = 0;
+    missCount = 0;
+    wakeup = SDL_CreateSemaphore(0);
+    filled = SDL_CreateSemaphore(0);
+    thread = wakeup != nullptr && filled != nullptr ? SDL_CreateThread(run, "TrackStream", this) : nullptr;
+    if (thread == nullptr)
+    {
+        std::cout << "Failed to create track stream thread: " << SDL_GetError() << std::endl;
+        close();
+        return false;
+    }
+
+    // The start is needed right away, for the first play as for a gapless one
+    while (!hasBlock(0))
+    {
+        SDL_SemWaitTimeout(filled, 10);
+    }
+    return true;
+}
+
+void TrackStream::close()
+{
+    if (thread != nullptr)
+    {
+        stopping = true;
+        SDL_SemPost(wakeup);
+        SDL_WaitThread(thread, nullptr);
+        thread = nullptr;
+    }
+    if (wakeup != nullptr)
+    {
+        SDL_DestroySemaphore(wakeup);
+        wakeup = nullptr;
+    }
+    if (filled != nullptr)
+    {
+        SDL_DestroySemaphore(filled);
+        filled = nullptr;
+    }
+    slots.reset();
+    slotCount = 0;
+    reader.close();
+    keepsSeekTable = false;
+    storedPoints = 0;
+}
+
+const Uint8 *TrackStream::read(Uint64 frame, Uint32 &count)
+{
+    if (frame >= totalFrames)
+    {
+        count = 0;
+        return nullptr;
+    }
+
+    Uint64 block = frame / blockFrames;
+    if (block != readBlock.load(std::memory_order_relaxed))
+    {
+        readBlock.store(block, std::memory_order_release);
+        sweep(block);
+        SDL_SemPost(wakeup);
+    }
+
+    for (;;)
+    {
+        for (int i = 0; i < slotCount; i++)
+        {
+            if (slots[i].tag.load(std::memory_order_acquire) == block + 1)
+            {
+                Uint32 offset = (Uint32)(frame - block * blockFrames);
+                Uint64 available = SDL_min((Uint64)(blockFrames + apronFrames - offset), totalFrames - frame);
+                count = (Uint32)SDL_min((Uint64)count, available);
+                return slots[i].pcm.data() + (size_t)offset * frameSize;
+            }
+        }
+        if (!blocking)
+        {
+            break;
+        }
+        SDL_SemWaitTimeout(filled, 10);
+    }
+    missCount.fetch_add(1, std::memory_order_relaxed);
+    count = 0;
+    return nullptr;
+}
+
+// Frees the blocks that are neither the reader's, the one behind it nor
+// among those the thread decodes ahead
+void TrackStream::sweep(Uint64 block)
+{
+    for (int i = 0; i < slotCount; i++)
+    {
+        Uint64 tag = slots[i].tag.load(std::memory_order_acquire);
+        if (tag == 0 || tag == FILLING)
+        {
+            continue;
+        }
+        Uint64 held = tag - 1;
+        if (held + 1 < block || held >= block + slotCount - 1)
+        {
+            slots[i].tag.store(0, std::memory_order_release);
+        }
+    }
+}
+
+int SDLCALL TrackStream::run(void *data)
+{
+    TrackStream *stream = static_cast<TrackStream *>(data);
+    stream->decodeAhead();
+    stream->storeGrownSeekTable();
+    return 0;
+}
+
+bool openWithSeekTable(AudioFileReader &reader, const std::string &path)
+{
+    Sint64 size;
+    Sint64 modified;
+    SeekTable stored;
+    bool known = fileStamp(path, size, modified) && findSeekTable(path, size, modified, stored);
+    return reader.open(path, known ? &stored : nullptr);
+}
+
+void keepSeekTable(const AudioFileReader &reader, const std::string &path)
+{
+    Sint64 size;
+    Sint64 modified;
+    SeekTable stored;
+    if (!reader.hasSeekTable() || !fileStamp(path, size, modified))
+    {
+        return;
+    }
+    SeekTable table = reader.seekTable();
+    if (!findSeekTable(path, size, modified, stored) || table.points.size() > stored.points.size())
+    {
+        storeSeekTable(path, size, modified, table);
+    }
+}
+
+// Once the stream knows more points than the index has for the file
+void TrackStream::storeGrownSeekTable()
+{
+    SeekTable table = keepsSeekTable ? reader.seekTable() : SeekTable();
+    if (table.points.size() > storedPoints)
+    {
+        storeSeekTable(path, fileSize, fileModified, table);
+        storedPoints = table.points.size();
+    }
+}
+
+bool TrackStream::hasBlock(Uint64 block) const
+{
+    for (int i = 0; i < slotCount; i++)
+    {
+        if (slots[i].tag.load(std::memory_order_acquire) == block + 1)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void TrackStream::decodeAhead()
+{
+    while (!stopping.load())
+    {
+        // The nearest missing block from the reader's on, and a free slot for it
+        Uint64 first = readBlock.load(std::memory_order_acquire);
+        Uint64 wanted = first;
+        Uint64 last = SDL_min(first + slotCount - 1, blockCount);
+        while (wanted < last && hasBlock(wanted))
+        {
+            wanted++;
+        }
+        Slot *slot = nullptr;
+        for (int i = 0; i < slotCount && slot == nullptr; i++)
+        {
+            slot = slots[i].tag.load(std::memory_order_acquire) == 0 ? &slots[i] : nullptr;
+        }
+        if (wanted >= last || slot == nullptr)
+        {
+            SDL_SemWaitTimeout(wakeup, 100);
+            continue;
+        }
+
+        slot->tag.store(FILLING, std::memory_order_relaxed);
+        decodeBlock(wanted, slot->pcm.data());
+        slot->tag.store(wanted + 1, std::memory_order_release);
+        SDL_SemPost(filled);
+    }
+}
+
+// Decodes output frames [block * blockFrames, + blockFrames + apronFrames)
+// into pcm. Whatever the file does not have plays as silence.
+void TrackStream::decodeBlock(Uint64 block, Uint8 *pcm)
+{
+    Uint64 first = block * blockFrames;
+    Uint32 count = (Uint32)SDL_min((Uint64)(blockFrames + apronFrames), totalFrames - first);
+    Sint64 begin = (Sint64)first;
+    Sint64 end = (Sint64)(first + count);
+    if (resampling)
+    {
+        resampler.inputSpan(first, count, begin, end);
+    }
+    begin = SDL_max(begin, (Sint64)0);
+    end = SDL_min(end, (Sint64)reader.length());
+
+    const float *samples;
+    if (!loadSource(begin, end))
+    {
+        resampled.assign((size_t)count * channels, 0.0f);
+        samples = resampled.data();
+    }
+    else if (resampling)
+    {
+        resampled.resize((size_t)count * channels);
+        for (int channel = 0; channel < channels; channel++)
+        {
+            resampler.process(source.data() + channel, sourceStart, sourceFrames, channels, first, count, resampled.data() + channel);
+        }
+        samples = resampled.data();
+    }
+    else
+    {
+        samples = source.data() + (size_t)(first - sourceStart) * channels;
+    }
+
+    // SDL saturates where the filter overshoots
+    size_t floatBytes = (size_t)count * channels * sizeof(float);
+    if (!formatCvt.needed)
+    {
+        SDL_memcpy(pcm, samples, floatBytes);
+        return;
+    }
+    converting.resize(floatBytes * formatCvt.len_mult);
+    SDL_memcpy(converting.data(), samples, floatBytes);
+    formatCvt.buf = converting.data();
+    formatCvt.len = (int)floatBytes;
+    if (SDL_ConvertAudio(&formatCvt) < 0)
+    {
+        SDL_memset(pcm, format == AUDIO_U8 ? 0x80 : 0, (size_t)count * frameSize);
+        return;
+    }
+    SDL_memcpy(pcm, converting.data(), (size_t)count * frameSize);
+}
+
+// Brings source frames [begin, end) into source, in the device's channel
+// layout. Blocks follow each other, so usually only the new part is read.
+bool TrackStream::loadSource(Sint64 begin, Sint64 end)
+{
+    if (begin < sourceStart || begin > sourceStart + (Sint64)sourceFrames)
+    {
+        if (!reader.seek((Uint64)begin))
+        {
+            return false;
+        }
+        sourceStart = begin;
+        sourceFrames = 0;
+    }
+    else
+    {
+        Uint32 drop = (Uint32)(begin - sourceStart);
+        SDL_memmove(source.data(), source.data() + (size_t)drop * channels, (size_t)(sourceFrames - drop) * channels * sizeof(float));
+        sourceStart = begin;
+        sourceFrames -= drop;
+    }
+
+    int sourceChannels = reader.channelCount();
+    source.resize((size_t)SDL_max(end - begin, (Sint64)sourceFrames) * channels);
+    while (sourceStart + (Sint64)sourceFrames < end)
+    {
+        Uint32 wanted = (Uint32)SDL_min(end - sourceStart - (Sint64)sourceFrames, (Sint64)8192);
+        raw.resize((size_t)wanted * sourceChannels);
+        Uint32 got = reader.read(raw.data(), wanted);
+        if (got == 0)
+        {
+            // The file is shorter than it claims
+            std::fill(raw.begin(), raw.end(), 0.0f);
+            got = wanted;
+        }
+
+        float *target = source.data() + (size_t)sourceFrames * channels;
+        size_t rawBytes = (size_t)got * sourceChannels * sizeof(float);
+        if (!channelCvt.needed)
+        {
+            SDL_memcpy(target, raw.data(), rawBytes);
+        }
+        else
+        {
+            converting.resize(rawBytes * channelCvt.len_mult);
+            SDL_memcpy(converting.data(), raw.data(), rawBytes);
+            channelCvt.buf = converting.data();
+            channelCvt.len = (int)rawBytes;
+            if (SDL_ConvertAudio(&channelCvt) < 0)
+            {
+                return false;
+            }
+            SDL_memcpy(target, converting.data(), (size_t)got * channels * sizeof(float));
+        }
+        sourceFrames += got;
+    }
+    return true;
+}
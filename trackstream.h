@@ -0,0 +1,115 @@
+#ifndef TRACKSTREAM_H
+#define TRACKSTREAM_H
+
+#include <SDL2/SDL.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include "audiofile.h"
+#include "resampler.h"
+
+// Plays a file that is too long to decode whole. A thread decodes it with
+// an AudioFileReader a block at a time into the device format, up to
+// STREAM_AHEAD_SECONDS ahead of the reader, and keeps the block behind the
+// reader for short steps back. Every block also holds a copy of the first
+// half of the next one, so a read of up to half a block is contiguous.
+//
+// The rendering thread reads without locks and never waits: only the
+// thread fills a free block and only the reader frees one it has moved away
+// from, so neither ever touches a block the other is using. A block that is
+// not decoded yet, like right after a seek, reads as nothing.
+class TrackStream
+{
+public:
+    static const int STREAM_AHEAD_SECONDS = 10;
+
+    ~TrackStream() { close(); }
+
+    // Quiet on failure, like AudioFileReader::open(). Returns once the first
+    // block is decoded. Rates are converted with the given quality, medium
+    // for RESAMPLER_SDL, whose converter can not start in the middle.
+    bool open(const std::string &path, int frequency, Uint16 format, int channels, ResamplerQuality quality);
+    void close();
+
+    Uint64 frames() const { return totalFrames; }
+    int sourceRate() const { return reader.frequency(); }
+    // Frames every read() hands out at once unless the track ends first
+    Uint32 contiguousFrames() const { return apronFrames; }
+
+    // Rendering thread. Points at up to count frames from frame on and sets
+    // count to how many there are, 0 if that part is not decoded yet.
+    const Uint8 *read(Uint64 frame, Uint32 &count);
+    // For offline rendering: read() waits for a missing block instead
+    void setBlocking(bool blocking) { this->blocking = blocking; }
+    // Reads that found their block missing
+    Uint64 misses() const { return missCount.load(std::memory_order_relaxed); }
+
+private:
+    static const Uint64 FILLING = ~(Uint64)0;
+
+    struct Slot
+    {
+        std::atomic<Uint64> tag{0}; // 0 when free, FILLING, or block number + 1 when ready
+        std::vector<Uint8> pcm;
+    };
+
+    static int SDLCALL run(void *data);
+    void decodeAhead();
+    bool hasBlock(Uint64 block) const;
+    void decodeBlock(Uint64 block, Uint8 *pcm);
+    bool loadSource(Sint64 begin, Sint64 end);
+    void sweep(Uint64 block);
+    void storeGrownSeekTable();
+
+    std::string path;
+    Sint64 fileSize = 0;
+    Sint64 fileModified = 0;
+    bool keepsSeekTable = false;
+    size_t storedPoints = 0; // Seek points the index already has for the file
+
+    int frequency = 0;
+    Uint16 format = 0;
+    int channels = 0;
+    int frameSize = 0;
+    Uint64 totalFrames = 0;
+    Uint32 blockFrames = 0;
+    Uint32 apronFrames = 0; // Copied from the next block
+    Uint64 blockCount = 0;
+    std::unique_ptr<Slot[]> slots;
+    int slotCount = 0;
+
+    SDL_Thread *thread = nullptr;
+    SDL_sem *wakeup = nullptr; // Posted by the reader when it moves to another block
+    SDL_sem *filled = nullptr; // Posted by the thread after every block
+    std::atomic<bool> stopping{false};
+    std::atomic<Uint64> readBlock{0};
+    std::atomic<Uint64> missCount{0};
+    bool blocking = false;
+
+    // Decoding thread only
+    AudioFileReader reader;
+    Resampler resampler;
+    bool resampling = false;
+    SDL_AudioCVT channelCvt; // Source channels to the device's, as float
+    SDL_AudioCVT formatCvt;  // Float to the device format
+    std::vector<float> source; // Source frames [sourceStart, sourceStart + sourceFrames), device channels
+    Sint64 sourceStart = 0;
+    Uint32 sourceFrames = 0;
+    std::vector<float> raw;
+    std::vector<Uint8> converting;
+    std::vector<float> resampled;
+};
+
+// File the seek tables of streamed FLAC, MP3 and Ogg Vorbis files are kept
+// in between runs, next to the library index. Call once before tracks are
+// loaded; without it they are only kept until the program ends.
+void setSeekIndexFile(const std::string &file);
+// Opens reader with the seek table kept for the file, if there is one, so
+// an MP3 is not read through again
+bool openWithSeekTable(AudioFileReader &reader, const std::string &path);
+// Keeps the seek table of an open reader, for a stream about to open the
+// file again
+void keepSeekTable(const AudioFileReader &reader, const std::string &path);
+
+#endif